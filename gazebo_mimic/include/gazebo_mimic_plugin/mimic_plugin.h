@@ -34,6 +34,9 @@
 #ifndef GAZEBO_ROS_CREATE_H
 #define GAZEBO_ROS_CREATE_H
 
+#include <string>
+#include <vector>
+
 #include "gazebo/physics/physics.hh"
 #include "gazebo/physics/PhysicsTypes.hh"
 #include "gazebo/sensors/SensorTypes.hh"
@@ -44,6 +47,10 @@
 
 namespace gazebo
 {
+  /// Makes joints follow other joints of the model: mimic = multiplier*joint + offset.
+  /// The pairs are listed as <mimic> elements (or given as a single pair directly in the
+  /// plugin element) and all are updated by one callback every physics step, either by
+  /// setting the mimic joint position or, with pdControl, by a PD effort on the mimic joint.
   class MimicPlugin : public ModelPlugin
   {
     public:
@@ -56,19 +63,34 @@ namespace gazebo
 
     private:
 
+      struct MimicJoint
+      {
+        std::string joint_name;
+        std::string mimic_joint_name;
+        double multiplier;
+        double offset;
+
+        /// PD effort law instead of setting the position, maxEffort <= 0 takes the joint limit
+        bool pd_control;
+        double p_gain;
+        double d_gain;
+        double max_effort;
+
+        physics::JointPtr joint;
+        physics::JointPtr mimic_joint;
+      };
+
+      /// Reads a pair from _sdf, unset values are taken from defaults
+      void LoadMimic(sdf::ElementPtr _sdf, const MimicJoint &defaults, MimicJoint &mimic);
+
       /// Parameters
       std::string node_namespace_;
-      std::string joint_name_;
-      std::string mimic_joint_name_;
 
-      double multiplier_;
+      std::vector<MimicJoint> mimics_;
 
       physics::WorldPtr world_;
       physics::ModelPtr model_;
 
-      physics::JointPtr joint_;
-      physics::JointPtr mimic_joint_;
-
       // Pointer to the update event connection
       event::ConnectionPtr updateConnection;
 
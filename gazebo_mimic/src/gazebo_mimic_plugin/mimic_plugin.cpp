@@ -31,6 +31,8 @@
  * the <mimic> joint tag limitations in Gazebo
  */
 
+#include <algorithm>
+
 #include <gazebo_mimic_plugin/mimic_plugin.h>
 
 using namespace gazebo;
@@ -38,57 +40,136 @@ using namespace gazebo;
 MimicPlugin::MimicPlugin()
 {
   kill_sim = false;
-
-  joint_.reset();
-  mimic_joint_.reset();
 }
 
 MimicPlugin::~MimicPlugin()
 {
-  event::Events::DisconnectWorldUpdateBegin(this->updateConnection);
+  if (this->updateConnection)
+    event::Events::DisconnectWorldUpdateBegin(this->updateConnection);
 
   kill_sim = true;
 }
 
-void MimicPlugin::Load(physics::ModelPtr _parent, sdf::ElementPtr _sdf )
+void MimicPlugin::LoadMimic(sdf::ElementPtr _sdf, const MimicJoint &defaults, MimicJoint &mimic)
 {
-  this->model_ = _parent;
-  this->world_ = this->model_->GetWorld();
+  mimic = defaults;
 
-
-  joint_name_ = "joint";
   if (_sdf->HasElement("joint"))
-    joint_name_ = _sdf->GetElement("joint")->Get<std::string>();
+    mimic.joint_name = _sdf->GetElement("joint")->Get<std::string>();
 
-  mimic_joint_name_ = "mimicJoint";
   if (_sdf->HasElement("mimicJoint"))
-    mimic_joint_name_ = _sdf->GetElement("mimicJoint")->Get<std::string>();
+    mimic.mimic_joint_name = _sdf->GetElement("mimicJoint")->Get<std::string>();
 
-  multiplier_ = 1.0;
   if (_sdf->HasElement("multiplier"))
-    multiplier_ = _sdf->GetElement("multiplier")->Get<double>();
+    mimic.multiplier = _sdf->GetElement("multiplier")->Get<double>();
+
+  if (_sdf->HasElement("offset"))
+    mimic.offset = _sdf->GetElement("offset")->Get<double>();
+
+  if (_sdf->HasElement("pdControl"))
+    mimic.pd_control = _sdf->GetElement("pdControl")->Get<bool>();
 
+  if (_sdf->HasElement("pGain"))
+    mimic.p_gain = _sdf->GetElement("pGain")->Get<double>();
+
+  if (_sdf->HasElement("dGain"))
+    mimic.d_gain = _sdf->GetElement("dGain")->Get<double>();
+
+  if (_sdf->HasElement("maxEffort"))
+    mimic.max_effort = _sdf->GetElement("maxEffort")->Get<double>();
+}
+
+void MimicPlugin::Load(physics::ModelPtr _parent, sdf::ElementPtr _sdf )
+{
+  this->model_ = _parent;
+  this->world_ = this->model_->GetWorld();
 
   // Get the name of the parent model
   std::string modelName = _sdf->GetParent()->Get<std::string>("name");
 
+  // The plugin element holds the defaults of all pairs, and the pair itself without <mimic>
+  MimicJoint defaults;
+  defaults.joint_name = "joint";
+  defaults.mimic_joint_name = "mimicJoint";
+  defaults.multiplier = 1.0;
+  defaults.offset = 0.0;
+  defaults.pd_control = false;
+  defaults.p_gain = 100.0;
+  defaults.d_gain = 1.0;
+  defaults.max_effort = 0.0;
+  LoadMimic(_sdf, defaults, defaults);
+
+  std::vector<MimicJoint> mimics;
+  if (_sdf->HasElement("mimic"))
+  {
+    for (sdf::ElementPtr element = _sdf->GetElement("mimic"); element; element = element->GetNextElement("mimic"))
+    {
+      MimicJoint mimic;
+      LoadMimic(element, defaults, mimic);
+      mimics.push_back(mimic);
+    }
+  }
+  else
+  {
+    mimics.push_back(defaults);
+  }
+
+  // The joints are looked up once, pairs with a missing joint are left out
+  mimics_.clear();
+  for (size_t i = 0; i < mimics.size(); i++)
+  {
+    MimicJoint &mimic = mimics[i];
+    mimic.joint = model_->GetJoint(mimic.joint_name);
+    mimic.mimic_joint = model_->GetJoint(mimic.mimic_joint_name);
+    if (!mimic.joint || !mimic.mimic_joint)
+    {
+      gzerr << "Mimic plugin of " << modelName << ": no joint "
+            << (mimic.joint ? mimic.mimic_joint_name : mimic.joint_name) << "\n";
+      continue;
+    }
+    if (mimic.pd_control && mimic.max_effort <= 0.0)
+      mimic.max_effort = mimic.mimic_joint->GetEffortLimit(0);
+    mimics_.push_back(mimic);
+  }
+
+  if (mimics_.empty())
+  {
+    gzerr << "Mimic plugin of " << modelName << " has no joints to mimic\n";
+    return;
+  }
+
   // Listen to the update event. This event is broadcast every
   // simulation iteration.
   this->updateConnection = event::Events::ConnectWorldUpdateBegin(
       boost::bind(&MimicPlugin::UpdateChild, this));
-  gzdbg << "Plugin model name: " << modelName << "\n";
-
-  joint_ = model_->GetJoint(joint_name_);
-  mimic_joint_ = model_->GetJoint(mimic_joint_name_);
+  gzdbg << "Plugin model name: " << modelName << ", " << mimics_.size() << " mimic joints\n";
 }
 
 void MimicPlugin::UpdateChild()
 {
+  for (size_t i = 0; i < mimics_.size(); i++)
+  {
+    const MimicJoint &mimic = mimics_[i];
+    double position = mimic.joint->GetAngle(0).Radian()*mimic.multiplier + mimic.offset;
+
+    if (mimic.pd_control)
+    {
+      // The mimic joint is pulled to the position, it stays in the dynamics and its contacts
+      double error = position - mimic.mimic_joint->GetAngle(0).Radian();
+      double error_dot = mimic.joint->GetVelocity(0)*mimic.multiplier - mimic.mimic_joint->GetVelocity(0);
+      double effort = mimic.p_gain*error + mimic.d_gain*error_dot;
+      if (mimic.max_effort > 0.0)
+        effort = std::max(-mimic.max_effort, std::min(mimic.max_effort, effort));
+      mimic.mimic_joint->SetForce(0, effort);
+      continue;
+    }
+
 #if GAZEBO_MAJOR_VERSION >= 4
-    mimic_joint_->SetPosition(0, joint_->GetAngle(0).Radian()*multiplier_);
+    mimic.mimic_joint->SetPosition(0, position);
 #else
-    mimic_joint_->SetAngle(0, joint_->GetAngle(0).Radian()*multiplier_);
+    mimic.mimic_joint->SetAngle(0, position);
 #endif
+  }
 }
 
 GZ_REGISTER_MODEL_PLUGIN(MimicPlugin);
@@ -0,0 +1,80 @@
+#ifndef __YUMI_ALLOC_CHECK_H
+#define __YUMI_ALLOC_CHECK_H
+
+#include <boost/atomic.hpp>
+
+/**
+  * Heap allocation check of the control loop. Executables that link src/yumi_alloc_check.cpp
+  * wrap malloc, calloc, realloc, memalign and free of glibc: every call made by a thread
+  * while it has the check armed is counted. Without that file the functions below are not
+  * defined, so the check can not be left out by accident.
+  */
+
+///arms or disarms the check on the calling thread
+void yumiAllocCheckArm(bool armed);
+
+///allocator calls made by the calling thread while armed
+unsigned long yumiAllocCheckCount();
+
+/**
+  * Counts the allocator calls of every phase of a cycle after a warm-up. The first cycle
+  * that allocates is kept for report(), which runs outside the control loop.
+  */
+class YumiAllocCheck {
+    private:
+	unsigned long warmup_cycles_, cycles_;
+	unsigned long phase_start_;
+	bool armed_;
+	boost::atomic<unsigned long> failed_cycle_, failed_phase_, failed_count_;
+
+    public:
+	enum Phase { READ = 0, UPDATE = 1, WRITE = 2, STATS = 3, N_PHASES = 4 };
+
+	YumiAllocCheck() : warmup_cycles_(0), cycles_(0), phase_start_(0), armed_(false),
+		failed_cycle_(0), failed_phase_(0), failed_count_(0) {}
+
+	///cycles <= 0 leaves the check off
+	void setup(long warmup_cycles) {
+	    warmup_cycles_ = warmup_cycles > 0 ? warmup_cycles : 0;
+	    armed_ = warmup_cycles > 0;
+	}
+
+	bool isEnabled() const { return armed_; }
+
+	///control thread: start of a cycle
+	void beginCycle() {
+	    if(!armed_) return;
+	    cycles_++;
+	    if(cycles_ == warmup_cycles_) yumiAllocCheckArm(true);
+	    phase_start_ = yumiAllocCheckCount();
+	}
+
+	///control thread: end of a phase, the next one starts right away
+	void endPhase(Phase phase) {
+	    if(!armed_ || cycles_ < warmup_cycles_) return;
+	    unsigned long count = yumiAllocCheckCount();
+	    if(count != phase_start_ && failed_count_ == 0) {
+		failed_cycle_ = cycles_ - warmup_cycles_ + 1;
+		failed_phase_ = phase;
+		failed_count_ = count - phase_start_;
+	    }
+	    phase_start_ = count;
+	}
+
+	///true once a checked cycle allocated
+	bool failed() const { return failed_count_ > 0; }
+
+	///cycles checked after the warm-up, read once the control thread is stopped
+	unsigned long checkedCycles() const { return !armed_ || cycles_ < warmup_cycles_ ? 0 : cycles_ - warmup_cycles_ + 1; }
+
+	static const char *phaseName(unsigned long phase) {
+	    static const char *names[N_PHASES] = {"read", "update", "write", "stats"};
+	    return phase < N_PHASES ? names[phase] : "?";
+	}
+
+	unsigned long failedCycle() const { return failed_cycle_; }
+	const char *failedPhase() const { return phaseName(failed_phase_); }
+	unsigned long failedCount() const { return failed_count_; }
+};
+
+#endif
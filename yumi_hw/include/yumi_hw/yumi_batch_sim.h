@@ -0,0 +1,431 @@
+#ifndef __YUMI_BATCH_SIM_H
+#define __YUMI_BATCH_SIM_H
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include <ros/ros.h>
+#include <urdf/model.h>
+#include <joint_limits_interface/joint_limits.h>
+#include <joint_limits_interface/joint_limits_rosparam.h>
+#include <joint_limits_interface/joint_limits_urdf.h>
+
+#include "yumi_hw/yumi_hw_sim.h"
+#include "yumi_hw/yumi_work_stealing.h"
+#include "yumi_hw/yumi_latency_stats.h"
+
+///robots per block of the scheduler, and the alignment of the robot arrays (doubles)
+#define YUMI_BATCH_GRAIN 64
+#define YUMI_BATCH_ALIGN 8
+
+/**
+  * Steps many YuMi models in lockstep, for rollouts where a Gazebo or a YumiHWSim per robot
+  * does not scale. The joints follow their commands through the joint models of YumiHWSim,
+  * then the poses of the links of the arm chains are computed from the URDF.
+  *
+  * Everything is stored robot-minor: a joint or a pose component is an array over the
+  * robots, so the loops of a step run over contiguous robots and vectorize at -O3 (the joint
+  * laws, the link rotations from the sines and cosines of a block and the pose products;
+  * the sines and cosines themselves are scalar libm calls). A step runs on blocks of robots spread over the threads of a YumiWorkStealingPool.
+  *
+  * The commands are written through positionCommand(joint)[robot] (or velocityCommand())
+  * between steps, the state is read through position(joint) and velocity(joint), the poses
+  * through getLinkPose() or linkPose().
+  */
+class YumiBatchSim {
+    public:
+	///a link of the chains, posed by its joint from its parent (-1 for the base)
+	struct Link {
+	    std::string name;
+	    int parent;
+	    ///index in the joint arrays, -1 for a fixed joint
+	    int joint;
+	    ///origin of the joint in the parent link
+	    double origin_position[3];
+	    ///the rotation of the link in its parent is C + cos(q) (A - C) + sin(q) B, with A
+	    ///the origin, B the origin times [axis]x and C the origin times axis axis^T
+	    double a[9], b[9], c[9];
+	};
+
+    private:
+	int n_joints_, robots_, stride_, grain_;
+	std::vector<std::string> joint_names_;
+	std::vector<Link> links_;
+
+	///joint model and limits, as in YumiHWSim
+	YumiHWSim::JointModel model_;
+	double time_constant_, natural_frequency_, damping_ratio_;
+	std::vector<double> lower_, upper_, max_velocity_, max_acceleration_;
+	bool velocity_mode_;
+
+	///joints x stride arrays, and links x 12 x stride for the poses (rotation row-major, then position)
+	double *position_, *velocity_, *position_command_, *velocity_command_;
+	double *poses_;
+
+	YumiWorkStealingPool pool_;
+	YumiWorkStealingPool::Task step_task_;
+	double step_dt_;
+
+	unsigned long long robot_steps_;
+	long long step_ns_;
+
+	static double *allocate(size_t n) {
+	    void *p = NULL;
+	    if(posix_memalign(&p, YUMI_BATCH_ALIGN*sizeof(double), n*sizeof(double)) != 0) return NULL;
+	    std::fill((double *)p, (double *)p + n, 0.0);
+	    return (double *)p;
+	}
+
+	void release() {
+	    free(position_);
+	    free(velocity_);
+	    free(position_command_);
+	    free(velocity_command_);
+	    free(poses_);
+	    position_ = velocity_ = position_command_ = velocity_command_ = poses_ = NULL;
+	}
+
+	double *pose(int link, int component) { return poses_ + ((size_t)link*12 + component)*stride_; }
+
+	///rotation of the joint origin, from the quaternion of the URDF
+	static void quaternionToMatrix(double x, double y, double z, double w, double *r) {
+	    r[0] = 1 - 2*(y*y + z*z); r[1] = 2*(x*y - z*w);     r[2] = 2*(x*z + y*w);
+	    r[3] = 2*(x*y + z*w);     r[4] = 1 - 2*(x*x + z*z); r[5] = 2*(y*z - x*w);
+	    r[6] = 2*(x*z - y*w);     r[7] = 2*(y*z + x*w);     r[8] = 1 - 2*(x*x + y*y);
+	}
+
+	///the joints of robots [begin, end) over dt
+	void stepJoints(int begin, int end, double dt) {
+	    double response = model_ == YumiHWSim::FIRST_ORDER ? time_constant_ : 1.0/natural_frequency_;
+	    int steps = 1;
+	    if(response > 0.0) steps = std::min(YUMI_SIM_MAX_SUBSTEPS, (int)std::ceil(dt/(0.1*response)));
+	    const double h = dt/steps;
+	    const double inf = std::numeric_limits<double>::infinity();
+
+	    // the laws of YumiHWSim::stepJoint as one, v_des = cv v + kv rv + kp (r - q)
+	    double cv = 0.0, kv = 0.0, kp = 0.0;
+	    if(velocity_mode_) {
+		double tau = model_ == YumiHWSim::FIRST_ORDER ? time_constant_ : 1.0/(2.0*damping_ratio_*natural_frequency_);
+		kv = tau > h ? h/tau : 1.0;
+		cv = 1.0 - kv;
+	    }
+	    else if(model_ == YumiHWSim::FIRST_ORDER) {
+		kp = time_constant_ > h ? 1.0/time_constant_ : 1.0/h;
+	    }
+	    else {
+		kp = natural_frequency_*natural_frequency_*h;
+		cv = 1.0 - 2.0*damping_ratio_*natural_frequency_*h;
+	    }
+
+	    for(int j = 0; j < n_joints_; j++) {
+		double *q = position_ + (size_t)j*stride_;
+		double *v = velocity_ + (size_t)j*stride_;
+		const double *r = position_command_ + (size_t)j*stride_;
+		const double *rv = velocity_command_ + (size_t)j*stride_;
+		const double dv = max_acceleration_[j] > 0.0 ? max_acceleration_[j]*h : inf;
+		const double vmax = max_velocity_[j] > 0.0 ? max_velocity_[j] : inf;
+		const double lower = lower_[j], upper = upper_[j];
+
+		for(int s = 0; s < steps; s++) {
+		    for(int i = begin; i < end; i++) {
+			double v_des = cv*v[i] + kv*rv[i] + kp*(r[i] - q[i]);
+			v_des = std::min(std::max(v_des, v[i] - dv), v[i] + dv);
+			v_des = std::min(std::max(v_des, -vmax), vmax);
+			double next = q[i] + v_des*h;
+			// the joint stops at its position limits
+			v[i] = next <= lower || next >= upper ? 0.0 : v_des;
+			q[i] = std::min(std::max(next, lower), upper);
+		    }
+		}
+	    }
+	}
+
+	///the link poses of robots [begin, end)
+	void computePoses(int begin, int end) {
+	    for(size_t l = 0; l < links_.size(); l++) {
+		const Link &link = links_[l];
+		double m[9][YUMI_BATCH_GRAIN], cos_q[YUMI_BATCH_GRAIN], sin_q[YUMI_BATCH_GRAIN];
+		double *out[12];
+		for(int k = 0; k < 12; k++) out[k] = pose(l, k);
+
+		for(int first = begin; first < end; first += YUMI_BATCH_GRAIN) {
+		    int n = std::min(end - first, YUMI_BATCH_GRAIN);
+
+		    // rotation of the link in its parent
+		    if(link.joint < 0) {
+			for(int k = 0; k < 9; k++) {
+			    for(int i = 0; i < n; i++) m[k][i] = link.a[k];
+			}
+		    }
+		    else {
+			// the libm calls stay scalar, the combination over the robots is vectorized
+			const double *q = position_ + (size_t)link.joint*stride_ + first;
+			for(int i = 0; i < n; i++) {
+			    cos_q[i] = std::cos(q[i]);
+			    sin_q[i] = std::sin(q[i]);
+			}
+			for(int k = 0; k < 9; k++) {
+			    const double c = link.c[k], a = link.a[k] - link.c[k], b = link.b[k];
+			    for(int i = 0; i < n; i++) m[k][i] = c + cos_q[i]*a + sin_q[i]*b;
+			}
+		    }
+
+		    if(link.parent < 0) {
+			for(int k = 0; k < 9; k++) {
+			    for(int i = 0; i < n; i++) out[k][first + i] = m[k][i];
+			}
+			for(int k = 0; k < 3; k++) {
+			    for(int i = 0; i < n; i++) out[9 + k][first + i] = link.origin_position[k];
+			}
+			continue;
+		    }
+
+		    // the pose of the parent times the pose in the parent
+		    const double *p[12];
+		    for(int k = 0; k < 12; k++) p[k] = pose(link.parent, k) + first;
+		    for(int row = 0; row < 3; row++) {
+			for(int col = 0; col < 3; col++) {
+			    double *o = out[3*row + col] + first;
+			    for(int i = 0; i < n; i++) {
+				o[i] = p[3*row][i]*m[col][i] + p[3*row + 1][i]*m[3 + col][i] + p[3*row + 2][i]*m[6 + col][i];
+			    }
+			}
+			double *o = out[9 + row] + first;
+			for(int i = 0; i < n; i++) {
+			    o[i] = p[3*row][i]*link.origin_position[0] + p[3*row + 1][i]*link.origin_position[1] +
+				p[3*row + 2][i]*link.origin_position[2] + p[9 + row][i];
+			}
+		    }
+		}
+	    }
+	}
+
+	void stepBlock(int begin, int end) {
+	    stepJoints(begin, end, step_dt_);
+	    computePoses(begin, end);
+	}
+
+    public:
+	YumiBatchSim() : n_joints_(0), robots_(0), stride_(0), grain_(YUMI_BATCH_GRAIN), model_(YumiHWSim::FIRST_ORDER),
+		time_constant_(0.02), natural_frequency_(30.0), damping_ratio_(1.0), velocity_mode_(false),
+		position_(NULL), velocity_(NULL), position_command_(NULL), velocity_command_(NULL), poses_(NULL),
+		step_dt_(0.0), robot_steps_(0), step_ns_(0) {
+	    step_task_ = boost::bind(&YumiBatchSim::stepBlock, this, _1, _2);
+	}
+	~YumiBatchSim() {
+	    pool_.shutdown();
+	    release();
+	}
+
+	///robots copies of the chains from base_link to the tips in model, driven by joint_names
+	///(the joint arrays are in that order) on threads threads (0 for one per core). The
+	///position and velocity limits come from the URDF.
+	bool setup(const urdf::Model &model, const std::string &base_link, const std::vector<std::string> &tips,
+		const std::vector<std::string> &joint_names, int robots, int threads) {
+	    if(robots <= 0 || joint_names.empty()) {
+		ROS_ERROR("Batch simulation: no robots or joints to simulate");
+		return false;
+	    }
+	    links_.clear();
+	    for(size_t t = 0; t < tips.size(); t++) {
+		// the chain from the tip down to the base or to a link of an earlier chain
+		std::vector<boost::shared_ptr<const urdf::Link> > chain;
+		boost::shared_ptr<const urdf::Link> link = model.getLink(tips[t]);
+		while(link && link->name != base_link && getLinkIndex(link->name) < 0) {
+		    chain.push_back(link);
+		    link = link->getParent();
+		}
+		if(!link) {
+		    ROS_ERROR("Batch simulation: no chain from %s to %s in the URDF", base_link.c_str(), tips[t].c_str());
+		    return false;
+		}
+		int parent = link->name == base_link ? -1 : getLinkIndex(link->name);
+
+		for(int c = chain.size() - 1; c >= 0; c--) {
+		    const urdf::Joint &joint = *chain[c]->parent_joint;
+		    Link l;
+		    l.name = chain[c]->name;
+		    l.parent = parent;
+		    l.joint = -1;
+		    const urdf::Pose &origin = joint.parent_to_joint_origin_transform;
+		    l.origin_position[0] = origin.position.x;
+		    l.origin_position[1] = origin.position.y;
+		    l.origin_position[2] = origin.position.z;
+		    quaternionToMatrix(origin.rotation.x, origin.rotation.y, origin.rotation.z, origin.rotation.w, l.a);
+		    std::fill(l.b, l.b + 9, 0.0);
+		    std::fill(l.c, l.c + 9, 0.0);
+
+		    if(joint.type == urdf::Joint::REVOLUTE || joint.type == urdf::Joint::CONTINUOUS) {
+			l.joint = std::find(joint_names.begin(), joint_names.end(), joint.name) - joint_names.begin();
+			if(l.joint >= (int)joint_names.size()) {
+			    ROS_ERROR("Batch simulation: joint %s of the chain to %s is not simulated", joint.name.c_str(), tips[t].c_str());
+			    return false;
+			}
+			double n = std::sqrt(joint.axis.x*joint.axis.x + joint.axis.y*joint.axis.y + joint.axis.z*joint.axis.z);
+			if(n <= 0.0) n = 1.0;
+			double u[3] = {joint.axis.x/n, joint.axis.y/n, joint.axis.z/n};
+			double cross[9] = {0, -u[2], u[1], u[2], 0, -u[0], -u[1], u[0], 0};
+			for(int row = 0; row < 3; row++) {
+			    for(int col = 0; col < 3; col++) {
+				for(int k = 0; k < 3; k++) {
+				    l.b[3*row + col] += l.a[3*row + k]*cross[3*k + col];
+				    l.c[3*row + col] += l.a[3*row + k]*u[k]*u[col];
+				}
+			    }
+			}
+		    }
+		    else if(joint.type != urdf::Joint::FIXED) {
+			ROS_ERROR("Batch simulation: joint %s of the chain to %s is neither revolute nor fixed", joint.name.c_str(), tips[t].c_str());
+			return false;
+		    }
+		    links_.push_back(l);
+		    parent = links_.size() - 1;
+		}
+	    }
+
+	    n_joints_ = joint_names.size();
+	    joint_names_ = joint_names;
+	    lower_.assign(n_joints_, -std::numeric_limits<double>::infinity());
+	    upper_.assign(n_joints_, std::numeric_limits<double>::infinity());
+	    max_velocity_.assign(n_joints_, 0.0);
+	    max_acceleration_.assign(n_joints_, 0.0);
+	    for(int j = 0; j < n_joints_; j++) {
+		joint_limits_interface::JointLimits limits;
+		limits.has_position_limits = false;
+		limits.has_velocity_limits = false;
+		const boost::shared_ptr<const urdf::Joint> urdf_joint = model.getJoint(joint_names[j]);
+		if(urdf_joint != NULL && joint_limits_interface::getJointLimits(urdf_joint, limits)) {
+		    if(limits.has_position_limits) setPositionLimits(j, limits.min_position, limits.max_position);
+		    if(limits.has_velocity_limits) max_velocity_[j] = limits.max_velocity;
+		}
+	    }
+
+	    release();
+	    robots_ = robots;
+	    stride_ = (robots + YUMI_BATCH_ALIGN - 1)/YUMI_BATCH_ALIGN*YUMI_BATCH_ALIGN;
+	    position_ = allocate((size_t)n_joints_*stride_);
+	    velocity_ = allocate((size_t)n_joints_*stride_);
+	    position_command_ = allocate((size_t)n_joints_*stride_);
+	    velocity_command_ = allocate((size_t)n_joints_*stride_);
+	    poses_ = allocate(links_.size()*12*(size_t)stride_);
+	    if(position_ == NULL || velocity_ == NULL || position_command_ == NULL || velocity_command_ == NULL || poses_ == NULL) {
+		ROS_ERROR("Batch simulation: could not allocate %d robots", robots);
+		release();
+		return false;
+	    }
+	    pool_.setup(threads);
+	    std::vector<double> zero(n_joints_, 0.0);
+	    reset(&zero[0]);
+	    return true;
+	}
+
+	///the joint model of YumiHWSim for all robots
+	void setJointModel(YumiHWSim::JointModel model, double time_constant, double natural_frequency, double damping_ratio) {
+	    model_ = model;
+	    time_constant_ = std::max(0.0, time_constant);
+	    natural_frequency_ = natural_frequency > 0.0 ? natural_frequency : 30.0;
+	    damping_ratio_ = damping_ratio > 0.0 ? damping_ratio : 1.0;
+	}
+
+	void setPositionLimits(int joint, double lower, double upper) {
+	    lower_[joint] = lower;
+	    upper_[joint] = upper;
+	}
+
+	///velocity and acceleration limits of a joint, 0 for none
+	void setDynamicLimits(int joint, double max_velocity, double max_acceleration) {
+	    max_velocity_[joint] = max_velocity;
+	    max_acceleration_[joint] = max_acceleration;
+	}
+
+	///overrides the limits with joint_limits.yaml loaded under limits_nh, as YumiHWSim does
+	void loadLimits(const ros::NodeHandle &limits_nh) {
+	    for(int j = 0; j < n_joints_; j++) {
+		joint_limits_interface::JointLimits limits;
+		limits.has_velocity_limits = max_velocity_[j] > 0.0;
+		limits.max_velocity = max_velocity_[j];
+		limits.has_acceleration_limits = max_acceleration_[j] > 0.0;
+		limits.max_acceleration = max_acceleration_[j];
+		if(!joint_limits_interface::getJointLimits(joint_names_[j], limits_nh, limits)) continue;
+		max_velocity_[j] = limits.has_velocity_limits ? limits.max_velocity : 0.0;
+		max_acceleration_[j] = limits.has_acceleration_limits ? limits.max_acceleration : 0.0;
+	    }
+	}
+
+	///velocity commands instead of position commands, for all robots
+	void setVelocityMode(bool velocity) { velocity_mode_ = velocity; }
+
+	///puts robot at rest at positions (one per joint, clamped to the limits), commanded to stay
+	void reset(int robot, const double *positions) {
+	    for(int j = 0; j < n_joints_; j++) {
+		size_t i = (size_t)j*stride_ + robot;
+		position_[i] = std::min(std::max(positions[j], lower_[j]), upper_[j]);
+		velocity_[i] = 0.0;
+		position_command_[i] = position_[i];
+		velocity_command_[i] = 0.0;
+	    }
+	    computePoses(robot, robot + 1);
+	}
+
+	///all robots
+	void reset(const double *positions) {
+	    for(int r = 0; r < robots_; r++) reset(r, positions);
+	}
+
+	///steps all robots over dt and computes their link poses
+	void step(double dt) {
+	    long long start = yumiMonotonicNs();
+	    step_dt_ = dt;
+	    pool_.run(robots_, grain_, step_task_);
+	    step_ns_ += yumiMonotonicNs() - start;
+	    robot_steps_ += robots_;
+	}
+
+	///the arrays over the robots of a joint
+	double *positionCommand(int joint) { return position_command_ + (size_t)joint*stride_; }
+	double *velocityCommand(int joint) { return velocity_command_ + (size_t)joint*stride_; }
+	const double *position(int joint) const { return position_ + (size_t)joint*stride_; }
+	const double *velocity(int joint) const { return velocity_ + (size_t)joint*stride_; }
+
+	///pose of link of robot in the base link: rotation row-major, position
+	void getLinkPose(int robot, int link, double rotation[9], double position[3]) const {
+	    for(int k = 0; k < 9; k++) rotation[k] = poses_[((size_t)link*12 + k)*stride_ + robot];
+	    for(int k = 0; k < 3; k++) position[k] = poses_[((size_t)link*12 + 9 + k)*stride_ + robot];
+	}
+
+	///a component of the poses of link over the robots, 0-8 the rotation, 9-11 the position
+	const double *linkPose(int link, int component) const { return poses_ + ((size_t)link*12 + component)*stride_; }
+
+	int getLinkIndex(const std::string &name) const {
+	    for(size_t l = 0; l < links_.size(); l++) {
+		if(links_[l].name == name) return l;
+	    }
+	    return -1;
+	}
+	const std::vector<Link> &getLinks() const { return links_; }
+
+	///robots per block handed to the threads
+	void setGrain(int grain) { grain_ = grain < 1 ? 1 : grain; }
+
+	int getRobots() const { return robots_; }
+	int getJoints() const { return n_joints_; }
+	int getThreads() const { return pool_.getThreads(); }
+	unsigned long getStolenBlocks() const { return pool_.getStolen(); }
+
+	///robots stepped, the time spent stepping and the throughput in robot-steps per second
+	unsigned long long getRobotSteps() const { return robot_steps_; }
+	double getStepTime() const { return step_ns_*1e-9; }
+	double getThroughput() const { return step_ns_ > 0 ? robot_steps_/(step_ns_*1e-9) : 0.0; }
+	void resetStatistics() {
+	    robot_steps_ = 0;
+	    step_ns_ = 0;
+	}
+};
+
+#endif
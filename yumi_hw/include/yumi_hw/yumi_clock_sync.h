@@ -0,0 +1,165 @@
+#ifndef __YUMI_CLOCK_SYNC_H
+#define __YUMI_CLOCK_SYNC_H
+
+#include <cmath>
+
+#include <ros/ros.h>
+#include "yumi_hw/yumi_rapid_protocol.h"
+#include "yumi_hw/yumi_latency_stats.h"
+
+///window minima the drift is fitted to
+#define YUMI_CLOCK_WINDOWS 32
+
+/**
+  * Maps the controller clock (the ClkRead timestamps of the joint states) to the monotonic
+  * clock of the PC. Every state is received some transport delay after it was sampled, so
+  * the difference of the receive time and the timestamp is the clock offset plus a delay
+  * that is never below the shortest one. The smallest difference of every window is kept,
+  * and a line through the last YUMI_CLOCK_WINDOWS of them gives offset and drift. Until a
+  * window is complete the offset follows the smallest difference seen.
+  *
+  * Sample times are late by the shortest transport delay, which one-way timestamps cannot
+  * tell apart from the offset. Fixed memory, meant for the communication thread only.
+  */
+class YumiClockSync {
+    private:
+	///controller seconds per window, and a jump of the offset taken for a new clock
+	double window_, max_jump_;
+
+	///unwrapping: last raw timestamp and the wraps before it
+	bool has_time_;
+	double last_raw_, base_;
+
+	///smallest offset of the current window and the controller time it was seen at
+	double window_start_, window_offset_, window_time_;
+
+	///window minima, a ring
+	double times_[YUMI_CLOCK_WINDOWS], offsets_[YUMI_CLOCK_WINDOWS];
+	int count_, next_;
+
+	///offset(t) = intercept_ + drift_*(t - reference_), in s
+	double intercept_, drift_, reference_;
+
+	///controller time of the last sample (unwrapped, s) and its time on the PC (ns)
+	double time_;
+	long long sample_time_;
+	unsigned long restarts_;
+
+	void fit() {
+	    double mean_t = 0.0, mean_o = 0.0;
+	    for(int i = 0; i < count_; i++) {
+		mean_t += times_[i];
+		mean_o += offsets_[i];
+	    }
+	    mean_t /= count_;
+	    mean_o /= count_;
+	    double stt = 0.0, sto = 0.0;
+	    for(int i = 0; i < count_; i++) {
+		stt += (times_[i] - mean_t)*(times_[i] - mean_t);
+		sto += (times_[i] - mean_t)*(offsets_[i] - mean_o);
+	    }
+	    reference_ = mean_t;
+	    intercept_ = mean_o;
+	    drift_ = count_ > 1 && stt > 0 ? sto/stt : 0.0;
+	    // quartz clocks are off by some ppm, anything beyond is a bad fit
+	    if(std::fabs(drift_) > 1e-3) drift_ = 0.0;
+	}
+
+	void startWindow(double t, double offset) {
+	    window_start_ = t;
+	    window_offset_ = offset;
+	    window_time_ = t;
+	}
+
+    public:
+	YumiClockSync() : window_(1.0), max_jump_(5.0), restarts_(0) {
+	    reset();
+	}
+
+	///window length and largest offset jump in s, set before the first update()
+	void setup(double window, double max_jump) {
+	    window_ = window;
+	    max_jump_ = max_jump;
+	}
+
+	///forgets the controller clock, e.g. after a reconnection restarted it
+	void reset() {
+	    has_time_ = false;
+	    last_raw_ = base_ = 0.0;
+	    count_ = next_ = 0;
+	    intercept_ = drift_ = reference_ = 0.0;
+	    time_ = 0.0;
+	    sample_time_ = 0;
+	}
+
+	///takes the timestamp of a sample received at rx_time (monotonic, ns). Returns false if the
+	///controller clock started over (a restarted server), the estimate then starts over too.
+	bool update(double timestamp, long long rx_time) {
+	    bool continued = true;
+	    bool wrapped = has_time_ && timestamp < last_raw_ - 0.5*YUMI_CLOCK_WRAP;
+	    if(wrapped) base_ += YUMI_CLOCK_WRAP;
+	    double t = base_ + timestamp;
+	    double offset = rx_time*1e-9 - t;
+	    // a clock started over either went back, or looks wrapped but does not fit the offset
+	    if(has_time_ && ((timestamp < last_raw_ && !wrapped) ||
+			std::fabs(offset - (intercept_ + drift_*(t - reference_))) > max_jump_)) {
+		restarts_++;
+		reset();
+		t = timestamp;
+		offset = rx_time*1e-9 - t;
+		continued = false;
+	    }
+	    last_raw_ = timestamp;
+
+	    if(!has_time_) {
+		has_time_ = true;
+		intercept_ = offset;
+		reference_ = t;
+		startWindow(t, offset);
+	    }
+	    else {
+		// the shortest delay so far moves the line down at once
+		double predicted = intercept_ + drift_*(t - reference_);
+		if(offset < predicted) intercept_ += offset - predicted;
+
+		if(offset < window_offset_) {
+		    window_offset_ = offset;
+		    window_time_ = t;
+		}
+		if(t - window_start_ >= window_) {
+		    times_[next_] = window_time_;
+		    offsets_[next_] = window_offset_;
+		    next_ = (next_ + 1) % YUMI_CLOCK_WINDOWS;
+		    if(count_ < YUMI_CLOCK_WINDOWS) count_++;
+		    fit();
+		    startWindow(t, offset);
+		}
+	    }
+
+	    time_ = t;
+	    sample_time_ = (long long)((t + intercept_ + drift_*(t - reference_))*1e9);
+	    // sampled before it was received, whatever the fit says
+	    if(sample_time_ > rx_time) sample_time_ = rx_time;
+	    return continued;
+	}
+
+	///controller time of the last sample, unwrapped, in s
+	double getTime() const { return time_; }
+	///monotonic time on the PC the last sample was taken at, in ns
+	long long getSampleTime() const { return sample_time_; }
+	///PC minus controller clock at the last sample, in s
+	double getOffset() const { return intercept_ + drift_*(time_ - reference_); }
+	///rate error of the controller clock against the PC clock, in s/s
+	double getDrift() const { return drift_; }
+	///times the controller clock started over
+	unsigned long getRestarts() const { return restarts_; }
+};
+
+///ROS time of a sample, from the ROS time now and the monotonic time it was taken at
+inline ros::Time yumiSampleStamp(const ros::Time &now, long long sample_time) {
+    if(sample_time <= 0) return now;
+    long long age = yumiMonotonicNs() - sample_time;
+    return age > 0 ? now - ros::Duration(age*1e-9) : now;
+}
+
+#endif
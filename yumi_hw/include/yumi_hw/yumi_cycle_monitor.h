@@ -0,0 +1,98 @@
+#ifndef __YUMI_CYCLE_MONITOR_H
+#define __YUMI_CYCLE_MONITOR_H
+
+#include <boost/scoped_ptr.hpp>
+
+#include <ros/ros.h>
+#include <realtime_tools/realtime_publisher.h>
+
+#include <yumi_hw/YumiCycleStats.h>
+#include <yumi_hw/yumi_latency_stats.h>
+#include <yumi_hw/yumi_realtime_loop.h>
+
+/**
+  * Per-cycle instrumentation of the control loop. The durations of read(), update() and
+  * write() and the measured period are recorded into fixed-memory histograms, which are
+  * summarized and published from the control thread through a RealtimePublisher once per
+  * statistics window. Nothing on the cycle path allocates or blocks.
+  */
+class YumiCycleMonitor {
+    private:
+	typedef realtime_tools::RealtimePublisher<yumi_hw::YumiCycleStats> StatsPublisher;
+
+	boost::scoped_ptr<StatsPublisher> publisher_;
+	const YumiRealtimeLoop *loop_;
+	long long window_ns_;
+	double control_period_;
+
+	YumiLatencyHistogram read_, update_, write_, period_;
+	long long window_start_;
+	unsigned long cycles_, overruns_start_;
+
+	static void summarize(const YumiLatencyHistogram &h, yumi_hw::YumiLatencySummary &s) {
+	    s.count = h.count();
+	    s.min = h.min()*1e-9;
+	    s.mean = h.mean()*1e-9;
+	    s.p50 = h.quantile(0.5)*1e-9;
+	    s.p90 = h.quantile(0.9)*1e-9;
+	    s.p99 = h.quantile(0.99)*1e-9;
+	    s.p999 = h.quantile(0.999)*1e-9;
+	    s.max = h.max()*1e-9;
+	}
+
+	void resetWindow(long long now) {
+	    read_.reset();
+	    update_.reset();
+	    write_.reset();
+	    period_.reset();
+	    cycles_ = 0;
+	    overruns_start_ = loop_ != NULL ? loop_->getOverruns() : 0;
+	    window_start_ = now;
+	}
+
+    public:
+	YumiCycleMonitor() : loop_(NULL), window_ns_(0), control_period_(0.0),
+		window_start_(0), cycles_(0), overruns_start_(0) {}
+
+	///publishes on nh/cycle_stats every window seconds, missed deadlines are taken from loop
+	void init(ros::NodeHandle &nh, double window, double control_period, const YumiRealtimeLoop *loop = NULL) {
+	    window_ns_ = (long long)(window*1e9);
+	    control_period_ = control_period;
+	    loop_ = loop;
+	    publisher_.reset(new StatsPublisher(nh, "cycle_stats", 1));
+	    resetWindow(yumiMonotonicNs());
+	}
+
+	bool isEnabled() const { return publisher_ && window_ns_ > 0; }
+
+	///called from the control thread once per cycle, durations in nanoseconds
+	void record(long long read_ns, long long update_ns, long long write_ns, long long period_ns, const ros::Time &now) {
+	    if(!isEnabled()) return;
+	    read_.record(read_ns);
+	    update_.record(update_ns);
+	    write_.record(write_ns);
+	    period_.record(period_ns);
+	    cycles_++;
+
+	    long long t = yumiMonotonicNs();
+	    if(t - window_start_ < window_ns_) return;
+	    // the publisher is still busy with the last window: keep accumulating and retry next cycle
+	    if(!publisher_->trylock()) return;
+
+	    yumi_hw::YumiCycleStats &msg = publisher_->msg_;
+	    msg.stamp = now;
+	    msg.window = (t - window_start_)*1e-9;
+	    msg.control_period = control_period_;
+	    msg.cycles = cycles_;
+	    msg.missed_deadlines = loop_ != NULL ? loop_->getOverruns() - overruns_start_ : 0;
+	    summarize(read_, msg.read);
+	    summarize(update_, msg.update);
+	    summarize(write_, msg.write);
+	    summarize(period_, msg.period);
+	    publisher_->unlockAndPublish();
+
+	    resetWindow(t);
+	}
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __YUMI_EFFORT_PUBLISHER_H
+#define __YUMI_EFFORT_PUBLISHER_H
+
+#include <boost/scoped_ptr.hpp>
+
+#include <ros/ros.h>
+#include <realtime_tools/realtime_publisher.h>
+#include <yumi_hw/YumiJointEffort.h>
+
+#include <yumi_hw/yumi_hw.h>
+
+/**
+  * Publishes the external effort estimate of the arm joints (YumiHW::updateExternalEffort)
+  * from the control thread, with the measured and model effort it came from. The message is
+  * sized once, publishing never allocates.
+  */
+class YumiEffortPublisher {
+    private:
+	typedef realtime_tools::RealtimePublisher<yumi_hw::YumiJointEffort> EffortPublisher;
+
+	boost::scoped_ptr<EffortPublisher> publisher_;
+	int n_joints_, decimation_, count_;
+
+    public:
+	YumiEffortPublisher() : n_joints_(0), decimation_(1), count_(0) {}
+
+	///publishes on nh/external_effort every decimation-th cycle, robot created already
+	void init(ros::NodeHandle &nh, const YumiHW &robot, int decimation) {
+	    n_joints_ = robot.n_joints_;
+	    decimation_ = decimation < 1 ? 1 : decimation;
+	    publisher_.reset(new EffortPublisher(nh, "external_effort", 1));
+	    yumi_hw::YumiJointEffort &msg = publisher_->msg_;
+	    msg.name.assign(robot.joint_names_.begin(), robot.joint_names_.begin() + n_joints_);
+	    msg.measured.resize(n_joints_);
+	    msg.model.resize(n_joints_);
+	    msg.external.resize(n_joints_);
+	}
+
+	bool isEnabled() const { return publisher_.get() != NULL; }
+
+	///called from the control thread once per cycle, after updateExternalEffort()
+	void publish(const YumiHW &robot, const ros::Time &stamp) {
+	    if(!isEnabled() || ++count_ < decimation_) return;
+	    // the publisher is still busy with the last estimate: try again next cycle
+	    if(!publisher_->trylock()) return;
+	    count_ = 0;
+
+	    yumi_hw::YumiJointEffort &msg = publisher_->msg_;
+	    msg.header.stamp = stamp;
+	    for(int j = 0; j < n_joints_; j++) {
+		msg.measured[j] = robot.joint_effort_[j];
+		msg.model[j] = robot.joint_model_effort_[j];
+		msg.external[j] = robot.joint_external_effort_[j];
+	    }
+	    publisher_->unlockAndPublish();
+	}
+};
+
+#endif
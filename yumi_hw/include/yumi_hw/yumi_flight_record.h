@@ -0,0 +1,63 @@
+#ifndef __YUMI_FLIGHT_RECORD_H
+#define __YUMI_FLIGHT_RECORD_H
+
+#include <stdint.h>
+
+///joints a record has room for, the arms and the grippers
+#define YUMI_FLIGHT_JOINTS 16
+///state channels whose sequence numbers are recorded
+#define YUMI_FLIGHT_CHANNELS 2
+#define YUMI_FLIGHT_NAME_LENGTH 48
+#define YUMI_FLIGHT_REASON_LENGTH 16
+
+#define YUMI_FLIGHT_MAGIC "YUMIFLT"
+#define YUMI_FLIGHT_VERSION 1
+
+///record flags
+#define YUMI_FLIGHT_LIMIT 0x1
+#define YUMI_FLIGHT_RECONNECT 0x2
+#define YUMI_FLIGHT_STALE 0x4
+
+/**
+  * One control cycle as the flight recorder keeps it: the state read, the command written,
+  * the control strategy and the timing of the cycle. Plain data of fixed size, written to
+  * the dump files as it is (native byte order).
+  */
+struct YumiFlightRecord {
+    ///cycle count of the control loop, from 1
+    uint64_t cycle;
+    ///monotonic time at the start of the cycle, and the time the controllers were updated at (ns)
+    int64_t time, stamp;
+    ///sequence numbers of the joint states of the last read(), per channel
+    uint32_t state_sequence[YUMI_FLIGHT_CHANNELS];
+    ///link interruptions read so far
+    uint32_t reconnects;
+    ///YumiHW::ControlStrategy
+    int32_t strategy;
+    ///measured period, and the durations of read, update and write (ns)
+    int32_t period, read_time, update_time, write_time;
+    uint32_t flags;
+    uint32_t reserved;
+    float position[YUMI_FLIGHT_JOINTS], velocity[YUMI_FLIGHT_JOINTS], effort[YUMI_FLIGHT_JOINTS];
+    float position_command[YUMI_FLIGHT_JOINTS], velocity_command[YUMI_FLIGHT_JOINTS];
+};
+
+/**
+  * Start of a dump file, followed by records oldest first.
+  */
+struct YumiFlightHeader {
+    char magic[8];
+    uint32_t version, header_size, record_size;
+    ///joints used in the records
+    uint32_t joints;
+    ///records following the header
+    uint64_t records;
+    ///monotonic and wall clock time of the dump (ns)
+    int64_t dump_time, wall_time;
+    ///control period the recorder was sized for (ns)
+    int64_t control_period;
+    char reason[YUMI_FLIGHT_REASON_LENGTH];
+    char names[YUMI_FLIGHT_JOINTS][YUMI_FLIGHT_NAME_LENGTH];
+};
+
+#endif
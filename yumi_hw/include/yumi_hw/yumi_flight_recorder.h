@@ -0,0 +1,419 @@
+#ifndef __YUMI_FLIGHT_RECORDER_H
+#define __YUMI_FLIGHT_RECORDER_H
+
+#include <vector>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+
+#include "yumi_hw/yumi_hw.h"
+#include "yumi_hw/yumi_flight_record.h"
+
+///longest path of a dump file
+#define YUMI_FLIGHT_PATH_LENGTH 512
+
+/**
+  * Keeps the last seconds of the control loop, every cycle, in a ring of YumiFlightRecord
+  * allocated up front, and dumps them to a memory-mapped file when something went wrong:
+  * trigger() from any thread or a signal handler, a joint beyond its limits, or a state
+  * channel that stopped delivering joint states. Recording is a copy into the ring, the
+  * dumps are written by a thread of their own, or by dumpFromSignal() from a handler of a
+  * fatal signal. yumi_flight_to_csv reads the files.
+  *
+  * The control thread is the only writer. A dump copies the ring while it is written and
+  * drops the records that were overwritten during the copy, the oldest ones.
+  */
+class YumiFlightRecorder {
+    public:
+	enum Reason {NONE = 0, REQUEST, FAULT, DISCONNECT, LIMIT, SIGNAL};
+
+    private:
+	std::vector<YumiFlightRecord> ring_;
+	uint64_t capacity_;
+	///records being written and written, the writer claims one before it writes it
+	boost::atomic<uint64_t> claimed_, written_;
+
+	YumiFlightHeader header_;
+	int joints_;
+	char directory_[YUMI_FLIGHT_PATH_LENGTH];
+
+	///triggers
+	long long stale_ns_;
+	double limit_margin_;
+	bool in_limit_;
+	uint32_t last_sequence_[YUMI_FLIGHT_CHANNELS];
+	long long last_fresh_[YUMI_FLIGHT_CHANNELS];
+	bool stale_[YUMI_FLIGHT_CHANNELS];
+	uint32_t reconnects_;
+
+	///dumps: the first pending reason, the thread writing them and how many there were
+	boost::atomic<int> pending_;
+	boost::atomic<bool> stop_;
+	mutable boost::atomic<unsigned long> dumps_;
+	unsigned long max_dumps_;
+	int event_fd_;
+	boost::thread thread_;
+
+	static const char *reasonName(int reason) {
+	    switch(reason) {
+		case REQUEST: return "request";
+		case FAULT: return "fault";
+		case DISCONNECT: return "disconnect";
+		case LIMIT: return "limit";
+		case SIGNAL: return "signal";
+		default: return "none";
+	    }
+	}
+
+	///string formatting that is safe in a signal handler
+	static void append(char *buffer, int &length, int size, const char *text) {
+	    while(*text != 0 && length < size - 1) buffer[length++] = *text++;
+	    buffer[length] = 0;
+	}
+	static void append(char *buffer, int &length, int size, uint64_t number) {
+	    char digits[24];
+	    int n = 0;
+	    do {
+		digits[n++] = '0' + number % 10;
+		number /= 10;
+	    } while(number > 0);
+	    while(n > 0 && length < size - 1) buffer[length++] = digits[--n];
+	    buffer[length] = 0;
+	}
+
+	static long long clockNs(clockid_t clock) {
+	    struct timespec ts;
+	    clock_gettime(clock, &ts);
+	    return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+	}
+
+	void run() {
+	    while(true) {
+		uint64_t events;
+		if(read(event_fd_, &events, sizeof(events)) < 0 && errno != EINTR) break;
+		int reason = pending_.exchange(NONE);
+		if(reason != NONE) {
+		    char path[YUMI_FLIGHT_PATH_LENGTH];
+		    unsigned long records = 0;
+		    if(dump((Reason)reason, path, &records)) {
+			ROS_WARN("Flight recorder: dumped the last %lu cycles (%s) to %s", records, reasonName(reason), path);
+		    }
+		    else if(dumps_ <= max_dumps_) {
+			ROS_ERROR("Flight recorder: could not dump to %s: %s", path, strerror(errno));
+		    }
+		}
+		if(stop_) break;
+	    }
+	}
+
+    public:
+	YumiFlightRecorder() : capacity_(0), claimed_(0), written_(0), joints_(0), stale_ns_(500000000LL),
+		limit_margin_(0.01), in_limit_(false), reconnects_(0), pending_(NONE), stop_(true), dumps_(0),
+		max_dumps_(10), event_fd_(-1) {
+	    directory_[0] = 0;
+	    memset(&header_, 0, sizeof(header_));
+	    for(int c = 0; c < YUMI_FLIGHT_CHANNELS; c++) {
+		last_sequence_[c] = 0;
+		last_fresh_[c] = 0;
+		stale_[c] = false;
+	    }
+	}
+	~YumiFlightRecorder() { shutdown(); }
+
+	///set before init(): a channel without a new joint state for stale_time s is taken for
+	///disconnected, a joint limit_margin beyond its limits for a violation, and no more than
+	///max_dumps files are written
+	void setup(double stale_time, double limit_margin, unsigned long max_dumps) {
+	    stale_ns_ = (long long)(stale_time*1e9);
+	    limit_margin_ = limit_margin;
+	    max_dumps_ = max_dumps;
+	}
+
+	///keeps seconds of cycles of control_period, dumps into directory; robot created already
+	bool init(const YumiHW &robot, double seconds, double control_period, const std::string &directory) {
+	    if(directory.size() > YUMI_FLIGHT_PATH_LENGTH - 64) {
+		ROS_ERROR("Flight recorder: the directory %s is too long", directory.c_str());
+		return false;
+	    }
+	    joints_ = robot.n_joints_ + robot.n_grippers_;
+	    if(joints_ > YUMI_FLIGHT_JOINTS) joints_ = YUMI_FLIGHT_JOINTS;
+	    strcpy(directory_, directory.c_str());
+
+	    memcpy(header_.magic, YUMI_FLIGHT_MAGIC, sizeof(YUMI_FLIGHT_MAGIC));
+	    header_.version = YUMI_FLIGHT_VERSION;
+	    header_.header_size = sizeof(YumiFlightHeader);
+	    header_.record_size = sizeof(YumiFlightRecord);
+	    header_.joints = joints_;
+	    header_.control_period = (int64_t)(control_period*1e9);
+	    for(int j = 0; j < joints_; j++) {
+		strncpy(header_.names[j], robot.joint_names_[j].c_str(), YUMI_FLIGHT_NAME_LENGTH - 1);
+	    }
+
+	    // zeroed, so the pages are there before the control loop writes them
+	    capacity_ = (uint64_t)(seconds/control_period) + 1;
+	    YumiFlightRecord empty;
+	    memset(&empty, 0, sizeof(empty));
+	    ring_.assign(capacity_, empty);
+
+	    event_fd_ = eventfd(0, EFD_CLOEXEC);
+	    if(event_fd_ < 0) {
+		ROS_ERROR("Flight recorder: eventfd failed: %s", strerror(errno));
+		return false;
+	    }
+	    stop_ = false;
+	    thread_ = boost::thread(boost::bind(&YumiFlightRecorder::run, this));
+	    return true;
+	}
+
+	bool isEnabled() const { return capacity_ > 0; }
+
+	///writes the pending dump and stops the thread
+	void shutdown() {
+	    if(event_fd_ < 0) return;
+	    stop_ = true;
+	    uint64_t one = 1;
+	    if(write(event_fd_, &one, sizeof(one)) < 0) {}
+	    thread_.join();
+	    close(event_fd_);
+	    event_fd_ = -1;
+	}
+
+	///called from the control thread once per cycle after write(): time is the monotonic time
+	///the cycle started at, stamp the time the controllers were updated at, durations in ns
+	void record(const YumiHW &robot, long long time, const ros::Time &stamp, long long period,
+		long long read_ns, long long update_ns, long long write_ns) {
+	    if(!isEnabled()) return;
+	    uint64_t cycle = written_.load(boost::memory_order_relaxed);
+	    claimed_.store(cycle + 1, boost::memory_order_relaxed);
+	    boost::atomic_thread_fence(boost::memory_order_release);
+
+	    YumiFlightRecord &r = ring_[cycle % capacity_];
+	    r.cycle = cycle + 1;
+	    r.time = time;
+	    r.stamp = stamp.toNSec();
+	    r.reconnects = robot.getReconnects();
+	    r.strategy = robot.current_strategy_;
+	    r.period = period;
+	    r.read_time = read_ns;
+	    r.update_time = update_ns;
+	    r.write_time = write_ns;
+	    r.flags = 0;
+
+	    bool limit = false;
+	    for(int j = 0; j < joints_; j++) {
+		double position = robot.joint_position_[j];
+		r.position[j] = position;
+		r.velocity[j] = robot.joint_velocity_[j];
+		r.effort[j] = robot.joint_effort_[j];
+		r.position_command[j] = robot.joint_position_command_[j];
+		r.velocity_command[j] = robot.joint_velocity_command_[j];
+		if(position < robot.joint_lower_limits_[j] - limit_margin_ ||
+			position > robot.joint_upper_limits_[j] + limit_margin_) limit = true;
+	    }
+	    if(limit) r.flags |= YUMI_FLIGHT_LIMIT;
+	    if(r.reconnects != reconnects_) r.flags |= YUMI_FLIGHT_RECONNECT;
+
+	    // a channel is stale once it delivered states and then stopped for stale_ns_
+	    bool stale = false;
+	    for(int c = 0; c < YUMI_FLIGHT_CHANNELS; c++) {
+		uint32_t sequence = robot.getStateSequence(c);
+		r.state_sequence[c] = sequence;
+		if(sequence != last_sequence_[c]) {
+		    last_sequence_[c] = sequence;
+		    last_fresh_[c] = time;
+		    stale_[c] = false;
+		}
+		else if(sequence != 0 && !stale_[c] && time - last_fresh_[c] > stale_ns_) {
+		    stale_[c] = true;
+		    stale = true;
+		}
+		if(stale_[c]) r.flags |= YUMI_FLIGHT_STALE;
+	    }
+	    written_.store(cycle + 1, boost::memory_order_release);
+
+	    // dump on the first cycle of a violation or an interruption
+	    if(limit && !in_limit_) trigger(LIMIT);
+	    if(stale) trigger(DISCONNECT);
+	    in_limit_ = limit;
+	    reconnects_ = r.reconnects;
+	}
+
+	///asks the thread for a dump, a no-op while one is pending. Lock-free and safe in a
+	///signal handler.
+	void trigger(Reason reason) {
+	    if(event_fd_ < 0) return;
+	    int none = NONE;
+	    if(!pending_.compare_exchange_strong(none, reason)) return;
+	    uint64_t one = 1;
+	    if(write(event_fd_, &one, sizeof(one)) < 0) {}
+	}
+
+    private:
+	///counts the dump and sets path to directory/yumi_flight_<wall time>_<dump>_<reason>.bin,
+	///false once max_dumps_ were written. Safe in a signal handler.
+	bool startDump(Reason reason, long long wall, char *path) const {
+	    path[0] = 0;
+	    if(!isEnabled()) return false;
+	    unsigned long number = dumps_.fetch_add(1);
+	    if(number >= max_dumps_) return false;
+
+	    int length = 0;
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, directory_);
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, "/yumi_flight_");
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, (uint64_t)(wall/1000000000LL));
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, "_");
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, (uint64_t)number);
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, "_");
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, reasonName(reason));
+	    append(path, length, YUMI_FLIGHT_PATH_LENGTH, ".bin");
+	    return true;
+	}
+
+	///records of [begin, end) copied before claimed_ was read that may have been overwritten
+	///during the copy, the oldest ones
+	uint64_t tornRecords(uint64_t begin, uint64_t end) const {
+	    boost::atomic_thread_fence(boost::memory_order_acquire);
+	    uint64_t claimed = claimed_.load(boost::memory_order_relaxed);
+	    uint64_t valid = claimed > capacity_ ? claimed - capacity_ : 0;
+	    if(valid <= begin) return 0;
+	    return valid - begin < end - begin ? valid - begin : end - begin;
+	}
+
+	void fillHeader(YumiFlightHeader &header, Reason reason, uint64_t records, long long wall) const {
+	    memcpy(&header, &header_, sizeof(YumiFlightHeader));
+	    header.records = records;
+	    header.dump_time = clockNs(CLOCK_MONOTONIC);
+	    header.wall_time = wall;
+	    int reason_length = 0;
+	    append(header.reason, reason_length, YUMI_FLIGHT_REASON_LENGTH, reasonName(reason));
+	}
+
+	static bool writeAll(int fd, const void *data, size_t size) {
+	    const char *p = (const char *)data;
+	    while(size > 0) {
+		ssize_t n = write(fd, p, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		p += n;
+		size -= n;
+	    }
+	    return true;
+	}
+
+	static bool readAll(int fd, void *data, size_t size) {
+	    char *p = (char *)data;
+	    while(size > 0) {
+		ssize_t n = read(fd, p, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		p += n;
+		size -= n;
+	    }
+	    return true;
+	}
+
+    public:
+	/**
+	  * Writes the ring to a file in the dump directory through a memory map, path is set to
+	  * the file name and records to the cycles in it. Called by the dump thread.
+	  */
+	bool dump(Reason reason, char *path = NULL, unsigned long *records = NULL) const {
+	    char local[YUMI_FLIGHT_PATH_LENGTH];
+	    if(path == NULL) path = local;
+	    long long wall = clockNs(CLOCK_REALTIME);
+	    if(!startDump(reason, wall, path)) return false;
+
+	    uint64_t end = written_.load(boost::memory_order_acquire);
+	    uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+	    size_t size = sizeof(YumiFlightHeader) + (end - begin)*sizeof(YumiFlightRecord);
+
+	    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	    if(fd < 0) return false;
+	    if(ftruncate(fd, size) != 0) {
+		close(fd);
+		return false;
+	    }
+	    char *map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	    if(map == MAP_FAILED) {
+		close(fd);
+		return false;
+	    }
+
+	    YumiFlightRecord *out = (YumiFlightRecord *)(map + sizeof(YumiFlightHeader));
+	    for(uint64_t i = begin; i < end; i++) {
+		memcpy(&out[i - begin], &ring_[i % capacity_], sizeof(YumiFlightRecord));
+	    }
+	    uint64_t drop = tornRecords(begin, end);
+	    if(drop > 0) {
+		memmove(out, out + drop, (end - begin - drop)*sizeof(YumiFlightRecord));
+		begin += drop;
+	    }
+	    fillHeader(*(YumiFlightHeader *)map, reason, end - begin, wall);
+
+	    size_t used = sizeof(YumiFlightHeader) + (end - begin)*sizeof(YumiFlightRecord);
+	    msync(map, size, MS_SYNC);
+	    munmap(map, size);
+	    bool ok = used == size || ftruncate(fd, used) == 0;
+	    close(fd);
+	    if(records != NULL) *records = end - begin;
+	    return ok;
+	}
+
+	/**
+	  * The same dump for a handler of a fatal signal: only async-signal-safe calls (open,
+	  * lseek, read, write, ftruncate, close, clock_gettime), the ring is written straight
+	  * from memory and torn records are moved out one at a time.
+	  */
+	bool dumpFromSignal(Reason reason) const {
+	    char path[YUMI_FLIGHT_PATH_LENGTH];
+	    long long wall = clockNs(CLOCK_REALTIME);
+	    if(!startDump(reason, wall, path)) return false;
+
+	    uint64_t end = written_.load(boost::memory_order_acquire);
+	    uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+
+	    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	    if(fd < 0) return false;
+	    const off_t records_offset = sizeof(YumiFlightHeader);
+	    bool ok = lseek(fd, records_offset, SEEK_SET) == records_offset;
+
+	    // at most two runs of the ring, up to its end and from its start
+	    uint64_t first = begin % capacity_, count = end - begin;
+	    uint64_t run = capacity_ - first < count ? capacity_ - first : count;
+	    ok = ok && writeAll(fd, &ring_[first], run*sizeof(YumiFlightRecord));
+	    if(count > run) ok = ok && writeAll(fd, &ring_[0], (count - run)*sizeof(YumiFlightRecord));
+
+	    uint64_t drop = tornRecords(begin, end);
+	    for(uint64_t i = drop; ok && drop > 0 && i < count; i++) {
+		YumiFlightRecord record;
+		ok = lseek(fd, records_offset + i*sizeof(YumiFlightRecord), SEEK_SET) >= 0 && readAll(fd, &record, sizeof(record)) &&
+		    lseek(fd, records_offset + (i - drop)*sizeof(YumiFlightRecord), SEEK_SET) >= 0 && writeAll(fd, &record, sizeof(record));
+	    }
+	    begin += drop;
+
+	    YumiFlightHeader header;
+	    fillHeader(header, reason, end - begin, wall);
+	    ok = ok && lseek(fd, 0, SEEK_SET) == 0 && writeAll(fd, &header, sizeof(header)) &&
+		ftruncate(fd, records_offset + (end - begin)*sizeof(YumiFlightRecord)) == 0;
+	    close(fd);
+	    return ok;
+	}
+
+	///cycles kept, and dumps written or attempted
+	unsigned long getCapacity() const { return capacity_; }
+	unsigned long getDumps() const { return dumps_; }
+};
+
+#endif
@@ -0,0 +1,587 @@
+#ifndef __YUMI_GRIPPER_INTERFACE_H
+#define __YUMI_GRIPPER_INTERFACE_H
+
+#include <cmath>
+#include <boost/function.hpp>
+
+#include <ros/ros.h>
+#include "simple_message/message_handler.h"
+#include "simple_message/messages/joint_message.h"
+#include "simple_message/smpl_msg_connection.h"
+#include "simple_message/socket/tcp_socket.h"
+#include "simple_message/socket/tcp_client.h"
+
+#include <yumi_hw/yumi_rapid_protocol.h>
+#include <yumi_hw/yumi_tcp_client.h>
+#include <yumi_hw/yumi_reactor.h>
+#include <yumi_hw/yumi_triple_buffer.h>
+#include <yumi_hw/yumi_latency_stats.h>
+
+///how often the gripper connections are checked and retried, in ms
+#define YUMI_GRIPPER_POLL_MS 100
+
+///finger opening of both grippers as received, left first
+struct YumiGripperState {
+    float position[N_YUMI_GRIPPERS];
+    ///monotonic time the message was received, in ns
+    long long rx_time;
+};
+
+///target of one gripper: a YUMI_GRIPPER_* mode, the finger opening in mm, the speed in mm/s
+///and the force limit in N
+struct YumiGripperTarget {
+    int mode;
+    float position;
+    float speed;
+    float force;
+};
+
+/**
+  * Overrides message handler: hands the gripper states to the reader through a triple buffer.
+  */
+class YumiGripperStateHandler : public industrial::message_handler::MessageHandler {
+    using industrial::message_handler::MessageHandler::init;
+
+    private:
+	YumiTripleBuffer<YumiGripperState> state_buffer_;
+	///communication thread: when the last gripper state arrived, and the state itself
+	long long last_rx_time_;
+	YumiGripperState last_state_;
+
+    public:
+	YumiGripperStateHandler() : last_rx_time_(0) {}
+
+	long long getLastRxTime() const { return last_rx_time_; }
+	void resetRxTime() { last_rx_time_ = yumiMonotonicNs(); }
+
+	///latest gripper state, returns false if none arrived since the last call. The state
+	///stays valid until the next call, and is NULL until the first one arrived.
+	bool getGripperStates(const YumiGripperState *&state) {
+	    bool fresh = state_buffer_.update();
+	    state = state_buffer_.frontSequence() > 0 ? &state_buffer_.front() : NULL;
+	    return fresh;
+	}
+
+	///communication thread: the state received last, NULL until the first one arrived
+	const YumiGripperState *getLastState() const {
+	    return state_buffer_.writeSequence() > 0 ? &last_state_ : NULL;
+	}
+
+	bool init(industrial::smpl_msg_connection::SmplMsgConnection* connection)
+	{
+	    return init((int)MSG_TYPE_GRIPPER_STATE, connection);
+	}
+
+    protected:
+
+	bool internalCB(industrial::simple_message::SimpleMessage& in)
+	{
+	    last_rx_time_ = yumiMonotonicNs();
+
+	    bool ret = true;
+	    if(in.getMessageType() != MSG_TYPE_GRIPPER_STATE) {
+		ret = false;
+	    }
+	    else
+	    {
+		industrial::byte_array::ByteArray data = in.getData();
+		industrial::shared_types::shared_real value_from_msg;
+
+		// unloaded from the back: right, then left
+		data.unload(value_from_msg);
+		last_state_.position[1] = value_from_msg;
+		data.unload(value_from_msg);
+		last_state_.position[0] = value_from_msg;
+		last_state_.rx_time = last_rx_time_;
+		state_buffer_.write(last_state_);
+	    }
+	    // Reply back to the controller if the sender requested it.
+	    if (industrial::simple_message::CommTypes::SERVICE_REQUEST == in.getCommType())
+	    {
+		ROS_INFO("Reply requested, sending");
+		industrial::simple_message::SimpleMessage reply;
+		reply.init(MSG_TYPE_GRIPPER_STATE, industrial::simple_message::CommTypes::SERVICE_REPLY,
+			ret ? industrial::simple_message::ReplyTypes::SUCCESS: industrial::simple_message::ReplyTypes::FAILURE) ;
+		this->getConnection()->sendMsg(reply);
+	    }
+
+	    return ret;
+	}
+
+};
+
+/**
+  * Keep a connection to the robot and send and receive gripper states. Both connections are
+  * served by a reactor thread, which also re-establishes them and sends the commands. The
+  * reactor is the interface's own, or one shared with other connections.
+  */
+class YumiGripperStateInterface {
+    private:
+	YumiReactor own_reactor_;
+	YumiReactor *reactor_;
+
+	///industrial connection
+	YumiTcpClient default_tcp_connection_;
+	industrial::smpl_msg_connection::SmplMsgConnection* connection_;
+	///descriptors registered with the reactor, -1 while disconnected
+	int state_socket_;
+	///the gripper state being received: its length, the bytes of the length (or of the message
+	///once the length is complete) read so far and the message. Resumed whenever the socket
+	///is readable, the reactor thread never waits for the rest.
+	industrial::shared_types::shared_int state_length_;
+	int state_received_;
+	bool state_has_length_;
+	char state_frame_[YUMI_SCRATCH_SIZE];
+
+	YumiTcpClient default_tcp_connection_command;
+	industrial::smpl_msg_connection::SmplMsgConnection* connection_command;
+	int command_socket_;
+
+	YumiGripperStateHandler gripper_handler;
+
+	///targets are handed to the reactor thread, which is woken by command_event_ to send them.
+	///Each gripper has a buffer of its own, so that a target for one never overrides the other.
+	YumiTripleBuffer<YumiGripperTarget> command_buffer_[N_YUMI_GRIPPERS];
+	int command_event_;
+	int command_sequence_;
+
+	///called on the reactor thread with every gripper state
+	boost::function<void(const YumiGripperState&)> state_callback_;
+
+	///checks the state timeout and retries lost connections
+	int watchdog_;
+	long long next_state_attempt_, next_command_attempt_;
+
+	///reconnection: a connection without gripper states for state_timeout_ seconds is dropped
+	double state_timeout_;
+	YumiBackoff backoff_, command_backoff_;
+
+	///reads what arrived of the next gripper state without blocking, and hands it on once complete
+	void onStateReadable()
+	{
+	    int status;
+	    if(!state_has_length_) {
+		status = default_tcp_connection_.receiveSome(&state_length_, sizeof(state_length_), state_received_);
+		if(status == YUMI_RECEIVE_PENDING) return;
+		if(status == YUMI_RECEIVE_DONE && (state_length_ < YUMI_HEADER_SIZE || state_length_ > (int)sizeof(state_frame_))) {
+		    ROS_ERROR("Message of %d bytes from the gripper state server, reconnecting", (int)state_length_);
+		    status = YUMI_RECEIVE_LOST;
+		}
+		if(status == YUMI_RECEIVE_LOST) {
+		    ROS_WARN("Connection to the gripper state server lost");
+		    lostState();
+		    return;
+		}
+		state_has_length_ = true;
+		state_received_ = 0;
+	    }
+
+	    status = default_tcp_connection_.receiveSome(state_frame_, state_length_, state_received_);
+	    if(status == YUMI_RECEIVE_PENDING) return;
+	    if(status == YUMI_RECEIVE_LOST) {
+		ROS_WARN("Connection to the gripper state server lost");
+		lostState();
+		return;
+	    }
+	    state_has_length_ = false;
+	    state_received_ = 0;
+
+	    industrial::byte_array::ByteArray data;
+	    industrial::simple_message::SimpleMessage msg;
+	    if(!data.init(state_frame_, state_length_) || !msg.init(data)) {
+		ROS_WARN_THROTTLE(1.0, "Dropped a malformed message from the gripper state server");
+		return;
+	    }
+	    gripper_handler.callback(msg);
+	    const YumiGripperState *state = gripper_handler.getLastState();
+	    if(state_callback_ && state != NULL && state->rx_time == gripper_handler.getLastRxTime()) {
+		state_callback_(*state);
+	    }
+	}
+
+	///the command server sends nothing, the socket becomes readable when it goes away
+	void onCommandReadable()
+	{
+	    if(!default_tcp_connection_command.discardPending()) {
+		ROS_WARN("Connection to the gripper command server lost");
+		lostCommand();
+	    }
+	}
+
+	///sends the new targets, grippers without one are left alone
+	void onCommand()
+	{
+	    bool fresh[N_YUMI_GRIPPERS], any = false;
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) {
+		fresh[g] = command_buffer_[g].update();
+		any = any || fresh[g];
+	    }
+	    if(!any) return;
+
+	    industrial::simple_message::SimpleMessage grasp_msg;
+	    industrial::byte_array::ByteArray data;
+	    industrial::shared_types::shared_int int_to_msg;
+	    industrial::shared_types::shared_real value_to_msg;
+
+	    int_to_msg = command_sequence_++;
+	    data.load(int_to_msg);
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) {
+		const YumiGripperTarget &target = command_buffer_[g].front();
+		int_to_msg = fresh[g] ? target.mode : YUMI_GRIPPER_KEEP;
+		data.load(int_to_msg);
+		value_to_msg = target.position;
+		data.load(value_to_msg);
+		value_to_msg = target.speed;
+		data.load(value_to_msg);
+		value_to_msg = target.force;
+		data.load(value_to_msg);
+	    }
+
+	    grasp_msg.init(YUMI_MSG_TYPE_GRIPPER_TARGET, industrial::simple_message::CommTypes::TOPIC,
+		    industrial::simple_message::ReplyTypes::INVALID, data) ;
+	    // the command server restarts when its client goes away, the watchdog connects again
+	    if(command_socket_ < 0) {
+		ROS_ERROR("Not connected to the gripper command server, command dropped");
+		return;
+	    }
+	    if(!connection_command->sendMsg(grasp_msg)) {
+		ROS_ERROR("Failed to send the gripper command");
+		lostCommand();
+	    }
+	}
+
+	void onWatchdog()
+	{
+	    long long now = yumiMonotonicNs();
+	    if(state_socket_ < 0) {
+		if(now >= next_state_attempt_) {
+		    if(!default_tcp_connection_.reconnect() || !watchState()) {
+			ROS_WARN_THROTTLE(5.0, "Gripper state server at %s:%d is not reachable, retrying",
+				default_tcp_connection_.getIp().c_str(), default_tcp_connection_.getPort());
+			lostState();
+		    }
+		    else {
+			ROS_INFO("Reconnected to the gripper state server");
+			gripper_handler.resetRxTime();
+			backoff_.reset();
+		    }
+		}
+	    }
+	    else if(state_timeout_ > 0 && now - gripper_handler.getLastRxTime() > (long long)(state_timeout_*1e9)) {
+		ROS_WARN("No gripper state for %.2f s, reconnecting", state_timeout_);
+		lostState();
+	    }
+
+	    if(command_socket_ < 0 && now >= next_command_attempt_) {
+		if(!default_tcp_connection_command.reconnect() || !watchCommand()) {
+		    ROS_WARN_THROTTLE(5.0, "Gripper command server at %s:%d is not reachable, retrying",
+			    default_tcp_connection_command.getIp().c_str(), default_tcp_connection_command.getPort());
+		    lostCommand();
+		}
+		else {
+		    ROS_INFO("Reconnected to the gripper command server");
+		    command_backoff_.reset();
+		}
+	    }
+	}
+
+	///a new connection starts with a new message
+	bool watchState() {
+	    state_length_ = 0;
+	    state_received_ = 0;
+	    state_has_length_ = false;
+	    state_socket_ = default_tcp_connection_.getSocket();
+	    default_tcp_connection_.setSendTimeout(YUMI_SEND_TIMEOUT_MS);
+	    if(!reactor_->add(state_socket_, boost::bind(&YumiGripperStateInterface::onStateReadable, this))) {
+		state_socket_ = -1;
+		return false;
+	    }
+	    return true;
+	}
+
+	bool watchCommand() {
+	    command_socket_ = default_tcp_connection_command.getSocket();
+	    default_tcp_connection_command.setSendTimeout(YUMI_SEND_TIMEOUT_MS);
+	    if(!reactor_->add(command_socket_, boost::bind(&YumiGripperStateInterface::onCommandReadable, this))) {
+		command_socket_ = -1;
+		return false;
+	    }
+	    return true;
+	}
+
+	///stops watching the connection, the next attempt is made after the backoff delay
+	void lostState() {
+	    reactor_->remove(state_socket_);
+	    state_socket_ = -1;
+	    default_tcp_connection_.disconnect();
+	    next_state_attempt_ = yumiMonotonicNs() + (long long)(backoff_.next()*1e9);
+	}
+
+	void lostCommand() {
+	    reactor_->remove(command_socket_);
+	    command_socket_ = -1;
+	    default_tcp_connection_command.disconnect();
+	    next_command_attempt_ = yumiMonotonicNs() + (long long)(command_backoff_.next()*1e9);
+	}
+
+    public:
+	YumiGripperStateInterface() {
+	    this->reactor_ = &own_reactor_;
+	    this->connection_ = NULL;
+	    this->connection_command = NULL;
+	    state_socket_ = -1;
+	    state_length_ = 0;
+	    state_received_ = 0;
+	    state_has_length_ = false;
+	    command_socket_ = -1;
+	    command_event_ = -1;
+	    command_sequence_ = 0;
+	    watchdog_ = -1;
+	    next_state_attempt_ = 0;
+	    next_command_attempt_ = 0;
+	    state_timeout_ = 1.0;
+	}
+
+	~YumiGripperStateInterface() {
+	    stopThreads();
+	}
+
+	///stops the interface's own reactor, a shared one is stopped by its owner
+	void stopThreads() {
+	    own_reactor_.stop();
+	}
+
+	void startThreads() {
+	    if(reactor_ == &own_reactor_ && watchdog_ >= 0) {
+		own_reactor_.start();
+	    }
+	}
+
+	///set before startThreads(): state_timeout <= 0 only reconnects when the server closes the connection
+	void setReconnect(double state_timeout, double min_backoff, double max_backoff) {
+	    state_timeout_ = state_timeout;
+	    backoff_.setup(min_backoff, max_backoff);
+	    command_backoff_.setup(min_backoff, max_backoff);
+	}
+
+	///latest state in mm, see YumiGripperStateHandler::getGripperStates()
+	bool getGripperStates(const YumiGripperState *&state) {
+	    return gripper_handler.getGripperStates(state);
+	}
+
+	///in mm, 0 until the first state arrived
+	void getCurrentJointStates(float &left, float &right) {
+	    const YumiGripperState *state;
+	    gripper_handler.getGripperStates(state);
+	    left = state != NULL ? state->position[0] : 0.0f;
+	    right = state != NULL ? state->position[1] : 0.0f;
+	}
+
+	///set before init(): called on the reactor thread with every gripper state as it arrives.
+	///It must not block for long, the connections wait meanwhile.
+	void setStateCallback(const boost::function<void(const YumiGripperState&)> &callback) {
+	    state_callback_ = callback;
+	}
+
+	///target of gripper (0 left, 1 right), sent by the reactor thread together with the latest
+	///target of the other gripper if it has a new one. Calls for the same gripper must not
+	///overlap, neither blocks nor allocates.
+	void setGripperTarget(int gripper, const YumiGripperTarget &target) {
+	    if(gripper < 0 || gripper >= N_YUMI_GRIPPERS) return;
+	    command_buffer_[gripper].back() = target;
+	    command_buffer_[gripper].publish();
+	    if(command_event_ >= 0) reactor_->signal(command_event_);
+	}
+
+	///grip force in N per gripper: > 0 grips inwards, < 0 outwards, a gripper with 0 is left alone
+	void setGripperEfforts(float left, float right) {
+	    float force[N_YUMI_GRIPPERS] = { left, right };
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) {
+		if(force[g] == 0.0f) continue;
+		YumiGripperTarget target;
+		target.mode = YUMI_GRIPPER_GRIP;
+		target.position = force[g] > 0 ? 0.0f : (float)(YUMI_GRIPPER_MAX_OPENING*1e3);
+		target.speed = 0.0f;
+		target.force = std::fabs(force[g]);
+		setGripperTarget(g, target);
+	    }
+	}
+
+	///with a reactor, the connections are served by it and it must not be running yet.
+	///Otherwise startThreads() starts a reactor of the interface's own.
+	bool init(std::string ip = "", int port = DEFAULT_STATE_PORT, int port_command = DEFAULT_COMMAND_PORT,
+		YumiReactor *reactor = NULL) {
+	    if(reactor != NULL) reactor_ = reactor;
+	    //initialize connection
+	    ROS_INFO("Robot state connecting to IP address: '%s:%d'", ip.c_str(), port);
+	    default_tcp_connection_.init(ip, port);
+	    default_tcp_connection_command.init(ip, port_command);
+
+	    // servers that are not up yet are connected to later
+	    connection_ = &default_tcp_connection_;
+	    if(connection_->makeConnect()) {
+		watchState();
+	    }
+
+	    connection_command = &default_tcp_connection_command;
+	    if(connection_command->makeConnect()) {
+		watchCommand();
+	    }
+
+	    //initialize message handler
+	    gripper_handler.init(connection_);
+	    gripper_handler.resetRxTime();
+
+	    command_event_ = reactor_->addEvent(boost::bind(&YumiGripperStateInterface::onCommand, this));
+	    watchdog_ = reactor_->addTimer(boost::bind(&YumiGripperStateInterface::onWatchdog, this));
+	    if(command_event_ < 0 || watchdog_ < 0) {
+		return false;
+	    }
+	    reactor_->setTimer(watchdog_, YUMI_GRIPPER_POLL_MS*1e-3, YUMI_GRIPPER_POLL_MS*1e-3);
+	    return true;
+	}
+
+};
+
+/**
+  * Tells from the gripper state stream when a grip is over: the fingers reached the target
+  * opening, or came to rest short of it, on an object as wide as the opening. Positions are
+  * in mm, times in s.
+  */
+class YumiGripDetector {
+    private:
+	double tolerance_, rest_speed_, settle_time_, start_time_;
+	double target_, start_position_, position_;
+	long long start_rx_time_, last_rx_time_;
+	///time the fingers have been at rest, and whether they have moved at all
+	double rest_time_;
+	bool has_state_, moved_, done_;
+
+    public:
+	YumiGripDetector() : target_(0.0), start_position_(0.0), position_(0.0), start_rx_time_(0), last_rx_time_(0),
+	    rest_time_(0.0), has_state_(false), moved_(false), done_(false) {
+	    setup(0.5, 1.0, 0.1, 1.0);
+	}
+
+	///tolerance of the target, speed below which the fingers are at rest, for how long they
+	///must rest to be done, and how long fingers that never started moving are waited for
+	void setup(double tolerance, double rest_speed, double settle_time, double start_time) {
+	    tolerance_ = tolerance;
+	    rest_speed_ = rest_speed;
+	    settle_time_ = settle_time;
+	    start_time_ = start_time;
+	}
+
+	void start(double target) {
+	    target_ = target;
+	    rest_time_ = 0.0;
+	    has_state_ = false;
+	    moved_ = false;
+	    done_ = false;
+	}
+
+	///feeds one state of the gripper, returns true once the grip is over
+	bool update(double position, long long rx_time) {
+	    if(done_) return true;
+	    if(!has_state_) {
+		start_position_ = position_ = position;
+		start_rx_time_ = last_rx_time_ = rx_time;
+		has_state_ = true;
+		return false;
+	    }
+	    double dt = (rx_time - last_rx_time_)*1e-9;
+	    if(dt <= 0) return false;
+	    double speed = std::fabs(position - position_)/dt;
+	    position_ = position;
+	    last_rx_time_ = rx_time;
+
+	    moved_ = moved_ || std::fabs(position - start_position_) > tolerance_;
+	    rest_time_ = speed < rest_speed_ ? rest_time_ + dt : 0.0;
+	    bool started = moved_ || reachedGoal() || (rx_time - start_rx_time_)*1e-9 >= start_time_;
+	    done_ = started && rest_time_ >= settle_time_;
+	    return done_;
+	}
+
+	bool done() const { return done_; }
+	bool reachedGoal() const { return has_state_ && std::fabs(position_ - target_) <= tolerance_; }
+	///at rest short of the target, the fingers are on an object
+	bool stalled() const { return done_ && !reachedGoal(); }
+	///opening at the last state, the width of the object when stalled
+	double position() const { return position_; }
+};
+
+/**
+  * The grippers as joints of the hardware interface: the finger opening in m is the joint
+  * position. The command is streamed to the RAPID gripper tasks as a grip target: the fingers
+  * move towards it at the set speed and stop there, or on an object with the force limit.
+  * A new target is only sent when the command moved by more than the deadband.
+  */
+class YumiGripperJoints {
+    private:
+	YumiGripperStateInterface interface_;
+	float force_, speed_;
+	double deadband_;
+	bool has_state_;
+	double time_since_state_;
+	///last target sent, in m
+	double sent_[N_YUMI_GRIPPERS];
+
+    public:
+	YumiGripperJoints() : force_(5.0f), speed_(20.0f), deadband_(0.002), has_state_(false), time_since_state_(0.0) {
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) sent_[g] = 0.0;
+	}
+
+	///force limit in N, speed in m/s (<= 0 keeps the speed of the gripper), deadband in m
+	void setup(double force, double speed, double deadband) {
+	    force_ = force;
+	    speed_ = speed*1e3;
+	    deadband_ = deadband;
+	}
+
+	///set before init(), see YumiGripperStateInterface::setReconnect()
+	void setReconnect(double state_timeout, double min_backoff, double max_backoff) {
+	    interface_.setReconnect(state_timeout, min_backoff, max_backoff);
+	}
+
+	///the connections are served by reactor, which must not be running yet
+	bool init(YumiReactor *reactor, const std::string &ip, int state_port, int command_port) {
+	    return interface_.init(ip, state_port, command_port, reactor);
+	}
+
+	///updates position and velocity of both gripper joints (left first) from the latest
+	///state. The command starts out at the first measured position.
+	void read(double *position, double *velocity, double *command, double dt) {
+	    time_since_state_ += dt;
+	    const YumiGripperState *state;
+	    if(!interface_.getGripperStates(state)) return;
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) {
+		double previous = position[g];
+		position[g] = state->position[g]*1e-3;
+		if(has_state_) {
+		    velocity[g] = (position[g] - previous)/time_since_state_;
+		}
+		else {
+		    command[g] = sent_[g] = position[g];
+		}
+	    }
+	    has_state_ = true;
+	    time_since_state_ = 0.0;
+	}
+
+	///streams the commanded positions of both gripper joints, each gripper on its own
+	void write(const double *command) {
+	    if(!has_state_) return;
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) {
+		if(std::fabs(command[g] - sent_[g]) <= deadband_) continue;
+		YumiGripperTarget target;
+		target.mode = YUMI_GRIPPER_GRIP;
+		target.position = command[g]*1e3;
+		target.speed = speed_;
+		target.force = force_;
+		interface_.setGripperTarget(g, target);
+		sent_[g] = command[g];
+	    }
+	}
+};
+
+#endif
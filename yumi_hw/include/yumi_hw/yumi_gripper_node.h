@@ -1,187 +1,33 @@
 #ifndef YUMI_GRIPPER_NODE_H
 #define YUMI_GRIPPER_NODE_H
 
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread.hpp>
 
 #include <ros/ros.h>
-#include "simple_message/message_handler.h"
-#include "simple_message/message_manager.h"
-#include "simple_message/messages/joint_message.h"
-#include "simple_message/smpl_msg_connection.h"
-#include "simple_message/socket/tcp_socket.h"
-#include "simple_message/socket/tcp_client.h"
+#include <actionlib/server/simple_action_server.h>
+#include <control_msgs/GripperCommandAction.h>
+#include <realtime_tools/realtime_publisher.h>
 #include <sensor_msgs/JointState.h>
 
 #include <yumi_hw/YumiGrasp.h>
-
-#define MSG_TYPE_GRIPPER_COMMAND 8008
-#define MSG_TYPE_GRIPPER_STATE 8009
-
-#define DEFAULT_STATE_PORT 12002
-#define DEFAULT_COMMAND_PORT 12000
-
-#define LEFT_GRIPPER 1
-#define RIGHT_GRIPPER 2
+#include <yumi_hw/YumiGripperSetpoint.h>
+#include <yumi_hw/yumi_rapid_protocol.h>
+#include <yumi_hw/yumi_gripper_interface.h>
 
 /**
-  * Overrides message handler: keeps joint states thread-safe.
+  * Serves the grippers on their own: blocking grasp/release services with a fixed force,
+  * a setpoint topic that streams targets to either gripper, and a GripperCommand action per
+  * gripper that ends when the fingers reached the goal or stopped on an object. The joint
+  * states are published as the gripper states arrive, every publish_decimation-th one.
   */
-class YumiGripperStateHandler : public industrial::message_handler::MessageHandler {
-    using industrial::message_handler::MessageHandler::init;
-    
-    private:
-	float gripper_positions[2];
-	boost::mutex data_buffer_mutex;
-
-    public:
-	bool getGripperStates(float &left, float &right) { 
-	    boost::mutex::scoped_lock lock(data_buffer_mutex);
-	    left = gripper_positions[0];
-	    right = gripper_positions[1];
-	}
-
-	bool init(industrial::smpl_msg_connection::SmplMsgConnection* connection)
-	{
-	    return init((int)MSG_TYPE_GRIPPER_STATE, connection);
-	}
-
-    protected:
-
-	bool internalCB(industrial::simple_message::SimpleMessage& in)
-	{
-	    boost::mutex::scoped_lock lock(data_buffer_mutex);
-
-	    bool ret;	    
-	    if(in.getMessageType() != MSG_TYPE_GRIPPER_STATE) {
-		ret = false;
-	    }
-	    else 
-	    {		
-		industrial::byte_array::ByteArray data = in.getData();
-		industrial::shared_types::shared_real value_from_msg;
-
-		data.unload(value_from_msg);
-		gripper_positions[0] = value_from_msg; 
-		data.unload(value_from_msg);
-		gripper_positions[1] = value_from_msg;
-
-	    }
-	    // Reply back to the controller if the sender requested it.
-	    if (industrial::simple_message::CommTypes::SERVICE_REQUEST == in.getCommType())
-	    {
-		ROS_INFO("Reply requested, sending");
-		industrial::simple_message::SimpleMessage reply;
-		reply.init(MSG_TYPE_GRIPPER_STATE, industrial::simple_message::CommTypes::SERVICE_REPLY, 
-			ret ? industrial::simple_message::ReplyTypes::SUCCESS: industrial::simple_message::ReplyTypes::FAILURE) ;
-		this->getConnection()->sendMsg(reply);
-	    }
-
-	    return ret;
-	}
-
-};
-
-/**
-  * Keep a connection to the robot and send and receive joint states
-  */
-class YumiGripperStateInterface {
-    private:
-	boost::thread RapidCommThread_;
-	
-	///industrial connection
-	industrial::tcp_client::TcpClient default_tcp_connection_; 
-	industrial::smpl_msg_connection::SmplMsgConnection* connection_;
-	
-	industrial::tcp_client::TcpClient default_tcp_connection_command; 
-	industrial::smpl_msg_connection::SmplMsgConnection* connection_command;
-
-	industrial::message_manager::MessageManager manager_;
-	YumiGripperStateHandler gripper_handler;
-
-	bool stopComm_;
-
-	virtual void RapidCommThreadCallback()
-	{
-	    while(!stopComm_) {
-		manager_.spinOnce();
-	    }
-	    return;
-	}
-
-    public:
-	YumiGripperStateInterface() { 
-	    this->connection_ = NULL;
-	    stopComm_ = true;
-	}
-
-	~YumiGripperStateInterface() { 
-	    stopThreads();
-	}
-	
-	void stopThreads() {
-	    stopComm_ = true;
-	    RapidCommThread_.join();
-	}
-
-	void startThreads() {
-	    if(!stopComm_) {
-		boost::thread(boost::bind(&YumiGripperStateInterface::RapidCommThreadCallback,this ));
-	    }
-	}
-
-	void getCurrentJointStates(float &left, float &right) {
-	    gripper_handler.getGripperStates(right,left);	    
-	}
-
-	void setGripperEfforts(float left, float right) {
-
-	    industrial::simple_message::SimpleMessage grasp_msg;
-	    industrial::byte_array::ByteArray data;
-	    industrial::shared_types::shared_real value_to_msg;
-	   
-	    value_to_msg = left;
-	    data.load(value_to_msg);
-	   
-	    value_to_msg = right;
-	    data.load(value_to_msg);
-	   
-	    grasp_msg.init(MSG_TYPE_GRIPPER_COMMAND, industrial::simple_message::CommTypes::TOPIC, 
-		    industrial::simple_message::ReplyTypes::INVALID, data) ;
-	    connection_command->sendMsg(grasp_msg);
-
-	}
-
-	bool init(std::string ip = "", int port = DEFAULT_STATE_PORT, int port_command = DEFAULT_COMMAND_PORT) {
-	    //initialize connection 
-	    char* ip_addr = strdup(ip.c_str());  // connection.init() requires "char*", not "const char*"
-	    ROS_INFO("Robot state connecting to IP address: '%s:%d'", ip_addr, port);
-	    default_tcp_connection_.init(ip_addr, port);
-	    default_tcp_connection_command.init(ip_addr, port_command);
-	    free(ip_addr);
-
-	    connection_ = &default_tcp_connection_;
-	    connection_->makeConnect();
-
-	    connection_command = &default_tcp_connection_command;
-	    connection_command->makeConnect();
-
-	    //initialize message manager
-	    manager_.init(connection_);
-
-	    //initialize message handler
-	    gripper_handler.init(connection_);
-
-	    //register handler to manager
-	    manager_.add(&gripper_handler,false);
-
-	    stopComm_ = false;
-	}
-	
-};
-
 class YumiGripperNode
 {
+    typedef actionlib::SimpleActionServer<control_msgs::GripperCommandAction> GripperActionServer;
+    typedef realtime_tools::RealtimePublisher<sensor_msgs::JointState> StatePublisher;
+
     public:
 	YumiGripperNode() {
 
@@ -192,41 +38,87 @@ class YumiGripperNode
 	    nh_.param<std::string>("joint_state_topic", gripper_state_topic,"joint_states");
 	    nh_.param<std::string>("grasp_request_topic", grasp_request_topic,"do_grasp");
 	    nh_.param<std::string>("grasp_release_topic", grasp_release_topic,"release_grasp");
-	    nh_.param<double>("publish_period", js_rate, 0.1);
+	    nh_.param("publish_decimation", publish_decimation, 1);
 	    nh_.param("port_stream", port_s, DEFAULT_STATE_PORT);
 	    nh_.param("port_command", port_c,DEFAULT_COMMAND_PORT);
 	    nh_.param("grasp_force", default_force, 5);
 	    nh_.param("ip", ip, std::string("192.168.125.1") );
+	    nh_.param("state_timeout", state_timeout, 1.0);
+	    nh_.param("reconnect_backoff_min", backoff_min, 0.1);
+	    nh_.param("reconnect_backoff_max", backoff_max, 5.0);
+	    nh_.param<std::string>("setpoint_topic", setpoint_topic, "gripper_setpoint");
+	    nh_.param<std::string>("left_action", action_names[0], "left_gripper/gripper_command");
+	    nh_.param<std::string>("right_action", action_names[1], "right_gripper/gripper_command");
+	    nh_.param("grasp_speed", grasp_speed, 0.02);
+	    nh_.param("goal_tolerance", goal_tolerance, 0.0005);
+	    nh_.param("goal_timeout", goal_timeout, 5.0);
+	    nh_.param("rest_speed", rest_speed, 0.001);
+	    nh_.param("settle_time", settle_time, 0.1);
+	    nh_.param("start_time", start_time, 1.0);
 
-	    heartbeat_ = nh_.createTimer(ros::Duration(js_rate), &YumiGripperNode::publishState, this);
 	    request_grasp_ = nh_.advertiseService(grasp_request_topic, &YumiGripperNode::request_grasp, this);;
 	    request_release_ = nh_.advertiseService(grasp_release_topic, &YumiGripperNode::request_release, this);;
-	    gripper_status_publisher_ = ros::NodeHandle().advertise<sensor_msgs::JointState>(gripper_state_topic, 10); 
+	    // the message is laid out once, publishing only fills in the values
+	    gripper_status_publisher_.reset(new StatePublisher(ros::NodeHandle(), gripper_state_topic, 10));
+	    sensor_msgs::JointState &js = gripper_status_publisher_->msg_;
+	    js.name.push_back("gripper_l_joint");
+	    js.name.push_back("gripper_r_joint");
+	    js.position.resize(N_YUMI_GRIPPERS, 0.0);
+	    js.velocity.resize(N_YUMI_GRIPPERS, 0.0);
+	    if(publish_decimation < 1) publish_decimation = 1;
+	    states_ = 0;
 
-	    gripper_interface.init(ip,port_s);
+	    state_.rx_time = 0;
+	    setpoint_subscriber_ = nh_.subscribe(setpoint_topic, 10, &YumiGripperNode::setpointCallback, this);
+
+	    gripper_interface.setReconnect(state_timeout, backoff_min, backoff_max);
+	    gripper_interface.setStateCallback(boost::bind(&YumiGripperNode::stateCallback, this, _1));
+	    gripper_interface.init(ip,port_s,port_c);
 	    gripper_interface.startThreads();
 
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) {
+		action_servers_[g].reset(new GripperActionServer(nh_, action_names[g],
+			    boost::bind(&YumiGripperNode::executeGrip, this, _1, g), false));
+		action_servers_[g]->start();
+	    }
+
 
 	}
 
 	virtual ~YumiGripperNode() {
-
+	    for(int g = 0; g < N_YUMI_GRIPPERS; g++) action_servers_[g]->shutdown();
+	    gripper_interface.stopThreads();
 	}
 
     private:
 	ros::NodeHandle nh_;
 
-	ros::Publisher gripper_status_publisher_;
+	boost::scoped_ptr<StatePublisher> gripper_status_publisher_;
 	ros::ServiceServer request_grasp_;
 	ros::ServiceServer request_release_;
+	ros::Subscriber setpoint_subscriber_;
+	boost::scoped_ptr<GripperActionServer> action_servers_[N_YUMI_GRIPPERS];
 	YumiGripperStateInterface gripper_interface;
+	///the callbacks run on several spinner threads, commands are handed over one at a time
+	boost::mutex command_mutex_;
+
+	///latest gripper state, set by the reactor thread for the running actions
+	boost::mutex state_mutex_;
+	boost::condition_variable state_changed_;
+	YumiGripperState state_;
+	///reactor thread: states received, and the last one for the velocities
+	unsigned long states_;
+	YumiGripperState previous_state_;
 
 	std::string gripper_state_topic, grasp_request_topic, grasp_release_topic, ip;
+	std::string setpoint_topic, action_names[N_YUMI_GRIPPERS];
 	int port_s, port_c;
-	double js_rate;
+	int publish_decimation;
+	double state_timeout, backoff_min, backoff_max;
 	int default_force;
+	///actions: speed in m/s, when the goal is reached (m) and when the fingers are at rest (m/s, s)
+	double grasp_speed, goal_tolerance, goal_timeout, rest_speed, settle_time, start_time;
 
-	ros::Timer heartbeat_;
 
 	bool request_grasp(yumi_hw::YumiGrasp::Request  &req,
 		yumi_hw::YumiGrasp::Response &res ) {
@@ -238,6 +130,7 @@ class YumiGripperNode
 	    if(req.gripper_id == RIGHT_GRIPPER) {
 		right = default_force;
 	    }
+	    boost::mutex::scoped_lock lock(command_mutex_);
 	    gripper_interface.setGripperEfforts(left,right);
 	    return true;
 	}
@@ -252,30 +145,119 @@ class YumiGripperNode
 	    if(req.gripper_id == RIGHT_GRIPPER) {
 		right = -default_force;
 	    }
+	    boost::mutex::scoped_lock lock(command_mutex_);
 	    gripper_interface.setGripperEfforts(left,right);
 	    return true;
 	}
 
-	//callbacks
-	void publishState(const ros::TimerEvent& event) {
-
-	    float left, right;
-	    gripper_interface.getCurrentJointStates(left,right);
+	void setTarget(int gripper, int mode, double position, double speed, double max_effort) {
+	    YumiGripperTarget target;
+	    target.mode = mode;
+	    target.position = position*1e3;
+	    target.speed = speed*1e3;
+	    target.force = max_effort > 0 ? max_effort : default_force;
+	    boost::mutex::scoped_lock lock(command_mutex_);
+	    gripper_interface.setGripperTarget(gripper, target);
+	}
 
-	    //to mm
-	    left *= 1e-3;
-	    right *= 1e-3;
+	void setpointCallback(const yumi_hw::YumiGripperSetpoint::ConstPtr &setpoint) {
+	    if(setpoint->gripper_id != LEFT_GRIPPER && setpoint->gripper_id != RIGHT_GRIPPER) {
+		ROS_WARN("YumiGrippers: setpoint for unknown gripper %d", setpoint->gripper_id);
+		return;
+	    }
+	    if(setpoint->mode < YUMI_GRIPPER_MOVE || setpoint->mode > YUMI_GRIPPER_STOP) {
+		ROS_WARN("YumiGrippers: setpoint with unknown mode %d", setpoint->mode);
+		return;
+	    }
+	    setTarget(setpoint->gripper_id == LEFT_GRIPPER ? 0 : 1, setpoint->mode, setpoint->position,
+		    setpoint->speed, setpoint->max_effort);
+	}
 
-	    sensor_msgs::JointState js;
-	    js.header.stamp = ros::Time::now();
-	    js.name.push_back("gripper_l_joint");
-	    js.position.push_back(left);
+	///reactor thread, with every gripper state as it arrives
+	void stateCallback(const YumiGripperState &state) {
+	    {
+		boost::mutex::scoped_lock lock(state_mutex_);
+		state_ = state;
+	    }
+	    state_changed_.notify_all();
+	    publishState(state);
+	}
 
-	    js.name.push_back("gripper_r_joint");
-	    js.position.push_back(right);
-	    
-	    gripper_status_publisher_.publish(js);
+	///stamped with the time the state was received. Neither blocks nor allocates, a state
+	///that comes while the last one is still being published is skipped.
+	void publishState(const YumiGripperState &state) {
+	    bool first = states_++ == 0;
+	    double dt = (state.rx_time - previous_state_.rx_time)*1e-9;
+	    sensor_msgs::JointState &js = gripper_status_publisher_->msg_;
+	    if(states_ % publish_decimation == 0 && gripper_status_publisher_->trylock()) {
+		js.header.stamp = ros::Time::now() - ros::Duration((yumiMonotonicNs() - state.rx_time)*1e-9);
+		for(int g = 0; g < N_YUMI_GRIPPERS; g++) {
+		    js.position[g] = state.position[g]*1e-3;
+		    js.velocity[g] = !first && dt > 0 ? (state.position[g] - previous_state_.position[g])*1e-3/dt : 0.0;
+		}
+		gripper_status_publisher_->unlockAndPublish();
+	    }
+	    previous_state_ = state;
+	}
 
+	///grips towards the goal opening and follows the fingers in the state stream until they
+	///are at rest, at the goal or on an object. A cancelled goal stops the gripper.
+	void executeGrip(const control_msgs::GripperCommandGoalConstPtr &goal, int gripper) {
+	    GripperActionServer &server = *action_servers_[gripper];
+	    double force = goal->command.max_effort > 0 ? goal->command.max_effort : default_force;
+	    setTarget(gripper, YUMI_GRIPPER_GRIP, goal->command.position, grasp_speed, force);
+
+	    YumiGripDetector detector;
+	    detector.setup(goal_tolerance*1e3, rest_speed*1e3, settle_time, start_time);
+	    detector.start(goal->command.position*1e3);
+
+	    control_msgs::GripperCommandFeedback feedback;
+	    control_msgs::GripperCommandResult result;
+	    ros::Time deadline = ros::Time::now() + ros::Duration(goal_timeout);
+	    long long last_rx_time;
+	    {
+		boost::mutex::scoped_lock lock(state_mutex_);
+		last_rx_time = state_.rx_time;
+	    }
+	    while(ros::ok()) {
+		if(server.isPreemptRequested()) {
+		    if(!server.isNewGoalAvailable()) setTarget(gripper, YUMI_GRIPPER_STOP, 0.0, 0.0, 0.0);
+		    result.position = detector.position()*1e-3;
+		    server.setPreempted(result);
+		    return;
+		}
+		if(ros::Time::now() > deadline) {
+		    result.position = detector.position()*1e-3;
+		    server.setAborted(result, "The gripper did not come to rest in time");
+		    return;
+		}
+
+		YumiGripperState state;
+		{
+		    boost::mutex::scoped_lock lock(state_mutex_);
+		    if(state_.rx_time == last_rx_time) {
+			state_changed_.timed_wait(lock, boost::posix_time::milliseconds(YUMI_GRIPPER_POLL_MS));
+			if(state_.rx_time == last_rx_time) continue;
+		    }
+		    state = state_;
+		    last_rx_time = state.rx_time;
+		}
+
+		bool done = detector.update(state.position[gripper], state.rx_time);
+		feedback.position = detector.position()*1e-3;
+		feedback.effort = detector.stalled() ? force : 0.0;
+		feedback.stalled = detector.stalled();
+		feedback.reached_goal = detector.reachedGoal();
+		server.publishFeedback(feedback);
+		if(done) {
+		    result.position = feedback.position;
+		    result.effort = feedback.effort;
+		    result.stalled = feedback.stalled;
+		    result.reached_goal = feedback.reached_goal;
+		    server.setSucceeded(result);
+		    return;
+		}
+	    }
 	}
 };
 
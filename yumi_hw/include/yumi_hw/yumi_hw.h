@@ -19,6 +19,7 @@
 #include <joint_limits_interface/joint_limits_rosparam.h>
 #include <joint_limits_interface/joint_limits_urdf.h>
 #include <control_toolbox/filters.h>
+#include "yumi_hw/yumi_state_estimator.h"
 
 // KDL
 #include <kdl/kdl.hpp>
@@ -38,11 +39,25 @@ class YumiHW : public hardware_interface::RobotHW
 	YumiHW() 
 	{
 	    n_joints_=14;
+	    n_grippers_=0;
+	    default_smoothing_=0.04;
+	    gravity_=KDL::Vector(0.0, 0.0, -9.81);
+	    dynamics_ready_=false;
+	    dynamics_inertial_=false;
 	}
 	virtual ~YumiHW() {}
 
 	void create(std::string name, std::string urdf_string);
 
+	// Call before create(): gripper_l_joint and gripper_r_joint (finger opening in m) follow the
+	// arm joints, with state and position handles, so one controller can move arms and grippers
+	void setGrippers(bool grippers) { n_grippers_ = grippers ? 2 : 0; }
+
+	// Velocity and acceleration estimator of the arm joints, owned from here on. Without one
+	// create() sets up the exponential smoothing of the backend.
+	void setStateEstimator(YumiStateEstimator *estimator);
+	const YumiStateEstimator *getStateEstimator() const { return estimator_.get(); }
+
 	// Strings
 	std::string robot_namespace_;
 
@@ -63,6 +78,19 @@ class YumiHW : public hardware_interface::RobotHW
 	virtual void read(ros::Time time, ros::Duration period) = 0;
 	virtual void write(ros::Time time, ros::Duration period) = 0;
 
+	// Interruptions of the link to the controller: the number seen by the control loop, and
+	// releasing the commands held back after them once the controllers were restarted
+	virtual unsigned long getReconnects() const { return 0; }
+	virtual void releaseHold(unsigned long reconnects) {}
+
+	// When the state of the last read() was sampled, for stamping what is computed from it.
+	// Backends without timestamps from the controller return now.
+	virtual ros::Time getStateStamp(const ros::Time &now) const { return now; }
+
+	// Sequence number of the joint state of the last read() on a state channel, 0 for backends
+	// without sequenced states
+	virtual unsigned long getStateSequence(int channel) const { return 0; }
+
 	// get/set control method
 	void setControlStrategy( ControlStrategy strategy){current_strategy_ = strategy;};
 	ControlStrategy getControlStrategy(){ return current_strategy_;};
@@ -88,6 +116,7 @@ class YumiHW : public hardware_interface::RobotHW
 
 	// configuration
 	int n_joints_; // all joints of yumi
+	int n_grippers_; // gripper joints, stored after the arm joints
 	std::vector<std::string> joint_names_;
 
 	// limits
@@ -100,24 +129,66 @@ class YumiHW : public hardware_interface::RobotHW
 	    joint_position_,
 	    joint_position_prev_,
 	    joint_velocity_,
+	    joint_acceleration_,
 	    joint_effort_,
 	    joint_position_command_,
 	    joint_velocity_command_;
 
 	// Set all members to default values
 	void reset();
+
+	// Position sample of joint j taken at time (s), velocity and acceleration follow. The
+	// measured position is kept as it is.
+	void estimateState(int j, double position, double time)
+	{
+	    joint_position_[j] = position;
+	    estimator_->update(j, position, time);
+	    joint_velocity_[j] = estimator_->getVelocity(j);
+	    joint_acceleration_[j] = estimator_->getAcceleration(j);
+	}
+
+	// alpha of the smoothing estimator set up by create()
+	double default_smoothing_;
+	boost::scoped_ptr<YumiStateEstimator> estimator_;
 	
 	// Transmissions in this plugin's scope
 	std::vector<transmission_interface::TransmissionInfo> transmissions_;
 
-	//TODO: KDL stuff is not implemented yet
-	// KDL stuff to compute ik, gravity term, etc.
-	/*
-	KDL::Chain yumi_chain_;
-	boost::scoped_ptr<KDL::ChainDynParam> f_dyn_solver_;
-	KDL::JntArray joint_position_kdl_, gravity_effort_;
+	// Dynamics model of the arms from the URDF, the chains from base_link to the tips of the
+	// left and right arm. With inertial the model effort includes inertia (from the estimated
+	// accelerations) and coriolis terms, else it is the gravity alone.
+	bool initDynamics(const std::string &base_link, const std::string &left_tip, const std::string &right_tip, bool inertial);
+	bool hasDynamics() const { return dynamics_ready_; }
+
+	// After read(): the effort the model needs for the measured motion, and the difference of
+	// the measured effort to it, the effort of external forces (and friction)
+	void updateExternalEffort();
+
+	// The gravity effort of the arm joints at position (indexed as joint_position_), into
+	// effort; nothing without a dynamics model. Does not allocate.
+	void computeGravity(const std::vector<double> &position, std::vector<double> &effort);
+
+	// Scale from the efforts the controller reports to joint efforts, one per arm joint
+	void setEffortScale(const std::vector<double> &scale) { effort_scale_ = scale; }
+	std::vector<double> effort_scale_;
+
+	std::vector<double>
+	    joint_model_effort_,
+	    joint_external_effort_;
+
+	// KDL stuff to compute the gravity term etc.
+	struct ArmDynamics
+	{
+	    KDL::Chain chain;
+	    boost::scoped_ptr<KDL::ChainDynParam> solver;
+	    // index in the joint vectors of every joint of the chain
+	    std::vector<int> joints;
+	    KDL::JntArray q, qd, qdd, gravity, coriolis;
+	    KDL::JntSpaceInertiaMatrix mass;
+	};
+	ArmDynamics arm_dynamics_[2];
 	KDL::Vector gravity_;
-	*/
+	bool dynamics_ready_, dynamics_inertial_;
 
     private:
 
@@ -131,6 +202,9 @@ class YumiHW : public hardware_interface::RobotHW
 	// Initialize all KDL members
 	// bool initKDLdescription(const urdf::Model *const urdf_model);
 
+	// Grippers have no transmission, their handles and limits are registered on their own
+	void registerGripperJoints(const urdf::Model *const urdf_model);
+
 	// Helper function to register limit interfaces
 	void registerJointLimits(const std::string& joint_name,
 		const hardware_interface::JointHandle& joint_handle_position,
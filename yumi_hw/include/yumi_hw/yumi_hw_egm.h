@@ -0,0 +1,397 @@
+#ifndef __YUMI_HW_EGM_H
+#define __YUMI_HW_EGM_H
+
+#include "yumi_hw/yumi_hw.h"
+#include "yumi_hw/yumi_rapid_protocol.h"
+#include "yumi_hw/yumi_triple_buffer.h"
+#include "yumi_hw/yumi_latency_stats.h"
+#include "yumi_hw/yumi_joint_packet.h"
+#include "yumi_hw/yumi_udp_socket.h"
+#include "yumi_hw/yumi_gripper_interface.h"
+#include "yumi_hw/yumi_clock_sync.h"
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include <ros/ros.h>
+
+///how long the streaming thread waits for a datagram before checking the stream, in ms
+#define YUMI_EGM_POLL_MS 20
+
+/**
+  * UDP end of the joint streaming, in the style of Externally Guided Motion: the controller
+  * sends its joint states every cycle and every datagram is answered right away with the
+  * latest command of the control thread. Nothing is ever waited for or resent: late
+  * datagrams are dropped and lost ones counted, the next cycle carries newer data anyway.
+  */
+class YumiEgmInterface {
+    private:
+	YumiUdpSocket socket_;
+	boost::thread thread_;
+	bool stop_;
+
+	YumiTripleBuffer<YumiJointState> state_buffer_;
+	YumiTripleBuffer<YumiJointCommand> command_buffer_;
+
+	///owned by the streaming thread
+	bool streaming_, has_sequence_;
+	int last_sequence_;
+	unsigned long last_command_sequence_;
+	long long last_rx_time_;
+	double state_timeout_;
+	YumiClockSync clock_;
+
+	///times the stream resumed after state_timeout_ without datagrams
+	boost::atomic<unsigned long> restarts_;
+	///datagrams received, missing in the sequence, arrived after a newer one, malformed
+	boost::atomic<unsigned long> received_, lost_, late_, malformed_;
+	///replies sent with a command the control thread had already seen
+	boost::atomic<unsigned long> stale_commands_;
+
+	///optional, time from receiving a state to sending the command computed from it
+	YumiLatencyHistogram *command_latency_;
+
+	void streamThread() {
+	    YumiJointFrame in;
+	    struct sockaddr_in from;
+	    while(!stop_) {
+		int n = socket_.receive(&in, sizeof(in), YUMI_EGM_POLL_MS, from);
+		long long rx_time = yumiMonotonicNs();
+		if(n == 0) {
+		    if(streaming_ && state_timeout_ > 0 && rx_time - last_rx_time_ > (long long)(state_timeout_*1e9)) {
+			ROS_WARN("No joint state datagram for %.2f s, waiting for the stream to resume", state_timeout_);
+			streaming_ = false;
+		    }
+		    continue;
+		}
+		if(n < 0) {
+		    ROS_ERROR_THROTTLE(1.0, "Failed to receive joint state datagrams: %s", strerror(errno));
+		    usleep(YUMI_EGM_POLL_MS*1000);
+		    continue;
+		}
+		if(n != (int)sizeof(in) || in.msg_type != YUMI_MSG_TYPE_YUMI_JOINTS) {
+		    malformed_++;
+		    continue;
+		}
+		received_++;
+
+		if(has_sequence_) {
+		    int gap = in.data.sequence - last_sequence_;
+		    if(gap <= 0 && gap > -YUMI_EGM_REORDER_WINDOW) {
+			late_++;
+			continue;
+		    }
+		    if(gap > 1 && streaming_) lost_ += gap - 1;
+		}
+		has_sequence_ = true;
+		last_sequence_ = in.data.sequence;
+		last_rx_time_ = rx_time;
+		if(!streaming_) {
+		    ROS_INFO("Joint state stream from %s:%d %s", inet_ntoa(from.sin_addr), ntohs(from.sin_port),
+			    received_ > 1 ? "resumed" : "started");
+		    if(received_ > 1) restarts_++;
+		    streaming_ = true;
+		}
+
+		answer(in.data, rx_time, from);
+	    }
+	}
+
+	///publishes the state and sends the latest command back to the sender
+	void answer(const YumiJointPacket &packet, long long rx_time, const struct sockaddr_in &to) {
+	    YumiJointState &state = state_buffer_.back();
+	    state.packet = packet;
+	    state.rx_time = rx_time;
+	    clock_.update(packet.timestamp, rx_time);
+	    state.sample_time = clock_.getSampleTime();
+
+	    command_buffer_.update();
+	    YumiJointCommand &command = command_buffer_.front();
+	    unsigned long command_sequence = command_buffer_.frontSequence();
+	    bool fresh_command = command_sequence != last_command_sequence_;
+
+	    //until the control thread sent its first command, and after the stream resumed until
+	    //it caught up and resynced its controllers, mirror state to command
+	    if(command_sequence == 0 || command.hold || command.reconnects != restarts_) {
+		memcpy(&command.frame.data.position,&state.packet.position,sizeof(state.packet.position));
+		memset(&command.frame.data.velocity,0,sizeof(command.frame.data.velocity));
+		command.frame.data.mode = YumiHW::JOINT_POSITION;
+	    }
+	    else if(!fresh_command) {
+		stale_commands_++;
+	    }
+	    last_command_sequence_ = command_sequence;
+	    command.frame.data.sequence = state.packet.sequence;
+	    command.frame.data.timestamp = state.packet.timestamp;
+	    state_buffer_.publish();
+
+	    command.frame.setHeader(YUMI_COMM_TYPE_TOPIC, YUMI_REPLY_TYPE_INVALID);
+	    if(!socket_.sendTo(&command.frame, sizeof(command.frame), to)) {
+		ROS_WARN_THROTTLE(1.0, "Failed to send a joint command datagram: %s", strerror(errno));
+		return;
+	    }
+	    if(command_latency_ != NULL && fresh_command && command_sequence > 0) {
+		command_latency_->record(yumiMonotonicNs() - command.state_rx_time);
+	    }
+	}
+
+    public:
+	YumiEgmInterface() : stop_(true), streaming_(false), has_sequence_(false), last_sequence_(0),
+		last_command_sequence_(0), last_rx_time_(0), state_timeout_(0.1), restarts_(0),
+		received_(0), lost_(0), late_(0), malformed_(0), stale_commands_(0), command_latency_(NULL) {}
+
+	~YumiEgmInterface() {
+	    stopThreads();
+	}
+
+	///binds the port the controller streams to
+	bool init(int port = YUMI_EGM_PORT) {
+	    if(!socket_.open(port)) {
+		return false;
+	    }
+	    ROS_INFO("Waiting for joint state datagrams on UDP port %d", port);
+	    stop_ = false;
+	    return true;
+	}
+
+	void startThreads() {
+	    if(!stop_) {
+		thread_ = boost::thread(boost::bind(&YumiEgmInterface::streamThread, this));
+	    }
+	}
+
+	void stopThreads() {
+	    stop_ = true;
+	    thread_.join();
+	    socket_.close();
+	}
+
+	///set before startThreads(): the stream counts as interrupted after state_timeout seconds without datagrams
+	void setStateTimeout(double state_timeout) { state_timeout_ = state_timeout; }
+
+	///set before startThreads()
+	void setCommandLatencyHistogram(YumiLatencyHistogram *histogram) { command_latency_ = histogram; }
+
+	///latest joint state, returns false if no new state arrived since the last call. The
+	///state stays valid until the next call.
+	bool getCurrentJointStates(const YumiJointState *&state, unsigned long &sequence) {
+	    bool fresh = state_buffer_.update();
+	    state = &state_buffer_.front();
+	    sequence = state_buffer_.frontSequence();
+	    return fresh;
+	}
+
+	///fill in the command in place, then publish it with setJointTargets()
+	YumiJointCommand &getJointTargets() { return command_buffer_.back(); }
+	unsigned long setJointTargets() { return command_buffer_.publish(); }
+
+	unsigned long getRestarts() const { return restarts_; }
+	unsigned long getReceived() const { return received_; }
+	unsigned long getLost() const { return lost_; }
+	unsigned long getLate() const { return late_; }
+	unsigned long getMalformed() const { return malformed_; }
+	unsigned long getStaleCommands() const { return stale_commands_; }
+};
+
+class YumiHWEgm : public YumiHW
+{
+
+public:
+  YumiHWEgm() : YumiHW() {
+      isInited = false;
+      port = YUMI_EGM_PORT;
+      hasState = false;
+      firstRunInPositionMode = true;
+      lastStateSequence = 0;
+      lastStateRxTime = 0;
+      lastSampleTime = 0;
+      restarts = 0;
+      skippedStates = 0;
+      staleStates = 0;
+      resyncHold = false;
+      handledRestarts = 0;
+      releasedRestarts = 0;
+      gripperStatePort = DEFAULT_STATE_PORT;
+      gripperCommandPort = DEFAULT_COMMAND_PORT;
+  }
+
+  ~YumiHWEgm() {
+      robot_interface.stopThreads();
+      gripperReactor.stop();
+  }
+
+  ///port the controller streams its joint states to, state_timeout without datagrams interrupts the stream
+  void setup(int port_ = YUMI_EGM_PORT, double state_timeout = 0.1) {
+      port = port_;
+      robot_interface.setStateTimeout(state_timeout);
+  }
+
+  ///set before init(), with setGrippers(true) before create(): the grippers are served over
+  ///TCP by the RAPID gripper servers at ip, see YumiGripperJoints for force, speed and deadband
+  void setupGrippers(const std::string &ip, int state_port, int command_port, double force, double speed, double deadband) {
+      gripperIp = ip;
+      gripperStatePort = state_port;
+      gripperCommandPort = command_port;
+      grippers.setup(force, speed, deadband);
+  }
+
+  bool init()
+  {
+    if (isInited) return false;
+    if(!robot_interface.init(port)) {
+      return false;
+    }
+    if(n_grippers_ > 0)
+    {
+      if(!grippers.init(&gripperReactor, gripperIp, gripperStatePort, gripperCommandPort)) {
+	return false;
+      }
+      gripperReactor.start();
+    }
+    robot_interface.startThreads();
+    isInited = true;
+    return true;
+  }
+
+  ///copies the last received joint states out to the controller manager, never waits for a new one
+  void read(ros::Time time, ros::Duration period)
+  {
+    if(!isInited) return;
+    if(n_grippers_ > 0)
+    {
+      grippers.read(&joint_position_[n_joints_], &joint_velocity_[n_joints_], &joint_position_command_[n_joints_], period.toSec());
+    }
+
+    unsigned long sequence;
+    const YumiJointState *state;
+    bool fresh = robot_interface.getCurrentJointStates(state, sequence);
+
+    if(!fresh)
+    {
+      if(hasState) staleStates++;
+      return;
+    }
+    if(hasState && sequence > lastStateSequence + 1)
+    {
+      skippedStates += sequence - lastStateSequence - 1;
+    }
+    // an interrupted stream starts over like a new connection: no velocity across the gap
+    unsigned long current_restarts = robot_interface.getRestarts();
+    if(current_restarts != restarts)
+    {
+      handledRestarts += current_restarts - restarts;
+      restarts = current_restarts;
+      hasState = false;
+      firstRunInPositionMode = true;
+    }
+    lastStateSequence = sequence;
+    lastStateRxTime = state->rx_time;
+    lastSampleTime = state->sample_time;
+
+    for (int j = 0; j < n_joints_; j++)
+    {
+      joint_position_prev_[j] = joint_position_[j];
+      if(!hasState) estimator_->reset(j);
+      estimateState(j, state->packet.position[j], state->sample_time*1e-9);
+      joint_effort_[j] = effort_scale_[j]*state->packet.effort[j];
+      if(firstRunInPositionMode) {
+	  joint_position_command_[j] = state->packet.position[j];
+      }
+    }
+    firstRunInPositionMode = false;
+    hasState = true;
+  }
+
+  ///serializes the most recent joint commands straight into the command buffer, the streaming
+  ///thread sends them with the answer to the next joint state datagram
+  void write(ros::Time time, ros::Duration period)
+  {
+    if(!isInited || !hasState) return;
+    enforceLimits(period);
+    if(n_grippers_ > 0)
+    {
+      grippers.write(&joint_position_command_[n_joints_]);
+    }
+
+    YumiJointCommand &command = robot_interface.getJointTargets();
+    YumiJointPacket &packet = command.frame.data;
+    packet.mode = getControlStrategy();
+    switch (getControlStrategy())
+    {
+      case JOINT_POSITION:
+        for (int j = 0; j < n_joints_; j++)
+        {
+          packet.position[j] = joint_position_command_[j];
+          packet.velocity[j] = joint_velocity_command_[j];
+        }
+        break;
+
+      case JOINT_VELOCITY:
+	for (int j = 0; j < n_joints_; j++)
+	{
+	  packet.position[j] = joint_position_[j];
+	  packet.velocity[j] = joint_velocity_command_[j];
+	}
+	firstRunInPositionMode = true;
+	break;
+      default:
+	break;
+    }
+    command.window.length = 0;
+    command.state_rx_time = lastStateRxTime;
+    command.reconnects = restarts;
+    command.hold = resyncHold && handledRestarts > releasedRestarts;
+    robot_interface.setJointTargets();
+  }
+
+  ///when the controller sampled the joint states of the last read()
+  ros::Time getStateStamp(const ros::Time &now) const { return yumiSampleStamp(now, lastSampleTime); }
+
+  ///sequence number of the joint states of the last read(), one channel
+  unsigned long getStateSequence(int channel) const { return channel == 0 ? lastStateSequence : 0; }
+
+  ///stream interruptions whose first joint state the control loop has read
+  unsigned long getReconnects() const { return handledRestarts; }
+
+  ///after an interruption the controller is only sent the measured state, until releaseHold()
+  ///is called with the interruptions the controllers were restarted for
+  void setResyncHold(bool hold) { resyncHold = hold; }
+  void releaseHold(unsigned long reconnects) { releasedRestarts = reconnects; }
+
+  ///cycles in which no new joint state had arrived
+  unsigned long getStaleStates() const { return staleStates; }
+  ///joint states overwritten by the streaming thread before read() picked them up
+  unsigned long getSkippedStates() const { return skippedStates; }
+  ///datagrams that never arrived, or arrived after a newer one and were dropped
+  unsigned long getLostStates() const { return robot_interface.getLost(); }
+  unsigned long getLateStates() const { return robot_interface.getLate(); }
+  unsigned long getStaleCommands() const { return robot_interface.getStaleCommands(); }
+
+  ///optional latency probe of the streaming thread: state received -> command sent, set before init()
+  void setLatencyHistogram(YumiLatencyHistogram *sent) {
+    robot_interface.setCommandLatencyHistogram(sent);
+  }
+
+private:
+  YumiEgmInterface robot_interface;
+  int port;
+
+  ///the grippers have TCP servers of their own, served by a thread of their own
+  YumiReactor gripperReactor;
+  YumiGripperJoints grippers;
+  std::string gripperIp;
+  int gripperStatePort, gripperCommandPort;
+  ///
+  bool isInited;
+  ///sequence tracking of the received joint states
+  bool hasState, firstRunInPositionMode;
+  unsigned long lastStateSequence;
+  long long lastStateRxTime, lastSampleTime;
+  unsigned long restarts;
+  unsigned long skippedStates, staleStates;
+  ///resync after interruptions: the control loop counts them, the node releases them
+  bool resyncHold;
+  boost::atomic<unsigned long> handledRestarts, releasedRestarts;
+};
+
+#endif
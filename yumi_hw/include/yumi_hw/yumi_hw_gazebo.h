@@ -5,6 +5,7 @@
 
 // ROS
 #include <angles/angles.h>
+#include <control_toolbox/pid.h>
 // #include <pluginlib/class_list_macros.h>
 
 // Gazebo hook
@@ -19,6 +20,10 @@ class YumiHWGazebo : public YumiHW
 	YumiHWGazebo() : YumiHW() 
 	{
 	    parent_set_=false;
+	    default_smoothing_=0.2;
+	    effort_control_=false;
+	    gravity_compensation_=false;
+	    effort_strategy_=JOINT_POSITION;
 	}
 	~YumiHWGazebo() {}
 
@@ -28,6 +33,20 @@ class YumiHWGazebo : public YumiHW
 	    parent_set_ = true;
 	};
 
+	// Call before init(): the joints are driven by efforts instead of being set to their
+	// commands, a PID per joint with the gains under gains_nh/<joint> (p, i, d, i_clamp)
+	// plus the gravity of the arm chains from base_link to the tips, if gravity_compensation
+	void setEffortControl(const ros::NodeHandle &gains_nh, bool gravity_compensation,
+		const std::string &base_link, const std::string &left_tip, const std::string &right_tip)
+	{
+	    effort_control_ = true;
+	    gains_nh_ = gains_nh;
+	    gravity_compensation_ = gravity_compensation;
+	    dynamics_base_link_ = base_link;
+	    dynamics_left_tip_ = left_tip;
+	    dynamics_right_tip_ = right_tip;
+	}
+
 	// Init, read, and write, with Gazebo hooks
 	bool init()
 	{
@@ -49,6 +68,11 @@ class YumiHWGazebo : public YumiHW
 		sim_joints_.push_back(joint);
 	    }
 
+	    if (effort_control_ && !initEffortControl())
+	    {
+		return false;
+	    }
+
 	    return true;
 	}
 
@@ -57,11 +81,10 @@ class YumiHWGazebo : public YumiHW
 	    for(int j=0; j < n_joints_; ++j)
 	    {
 		joint_position_prev_[j] = joint_position_[j];
-		joint_position_[j] += angles::shortest_angular_distance(joint_position_[j],
-			sim_joints_[j]->GetAngle(0).Radian());
 		//joint_position_kdl_(j) = joint_position_[j];
-		// derivate velocity as in the real hardware instead of reading it from simulation
-		joint_velocity_[j] = filters::exponentialSmoothing((joint_position_[j] - joint_position_prev_[j])/period.toSec(), joint_velocity_[j], 0.2);
+		// estimate velocity as in the real hardware instead of reading it from simulation
+		estimateState(j, joint_position_[j] + angles::shortest_angular_distance(joint_position_[j],
+			sim_joints_[j]->GetAngle(0).Radian()), time.toSec());
 		joint_effort_[j] = sim_joints_[j]->GetForce((int)(0));
 		//joint_stiffness_[j] = joint_stiffness_command_[j];
 	    }
@@ -71,6 +94,12 @@ class YumiHWGazebo : public YumiHW
 	{
 	    enforceLimits(period);
 
+	    if (effort_control_)
+	    {
+		writeEffort(period);
+		return;
+	    }
+
 	    switch (getControlStrategy())
 	    {
 
@@ -101,34 +130,107 @@ class YumiHWGazebo : public YumiHW
 		    }
 		    break;
 
-#if 0
-		case JOINT_IMPEDANCE:
-		    // compute the gracity term
-		    f_dyn_solver_->JntToGravity(joint_position_kdl_, gravity_effort_);
-
-		    for(int j=0; j < n_joints_; j++)
-		    {
-			// replicate the joint impedance control strategy
-			// tau = k (q_FRI - q_msr) + tau_FRI + D(q_msr) + f_dyn(q_msr)
-			const double stiffness_effort = 0.0;//10.0*( joint_position_command_[j] - joint_position_[j] ); // joint_stiffness_command_[j]*( joint_position_command_[j] - joint_position_[j] );
-			//double damping_effort = joint_damping_command_[j]*( joint_velocity_[j] );
-			const double effort = stiffness_effort + joint_effort_command_[j] + gravity_effort_(j);
-			sim_joints_[j]->SetForce(0, effort);
-		    }
-		    break;
-#endif
 		default:
-		    ROS_WARN("UNSUPPORTED CONTROL MODE");
+		    ROS_WARN_ONCE("UNSUPPORTED CONTROL MODE");
 		    break;
 	    }
 	}
+
     private:
 
+	// Gains of the joints and the dynamics model, the gravity is computed at the simulated positions
+	bool initEffortControl()
+	{
+	    pids_.resize(n_joints_);
+	    for(int j=0; j < n_joints_; j++)
+	    {
+		if (!pids_[j].init(ros::NodeHandle(gains_nh_, joint_names_[j])))
+		{
+		    ROS_ERROR("No PID gains for %s under %s/%s", joint_names_[j].c_str(),
+			    gains_nh_.getNamespace().c_str(), joint_names_[j].c_str());
+		    return false;
+		}
+	    }
+
+	    effort_limits_.assign(n_joints_, std::numeric_limits<double>::max());
+	    for(int j=0; j < n_joints_; j++)
+	    {
+		const boost::shared_ptr<const urdf::Joint> urdf_joint = urdf_model_.getJoint(joint_names_[j]);
+		if (urdf_joint && urdf_joint->limits && urdf_joint->limits->effort > 0.0)
+		{
+		    effort_limits_[j] = urdf_joint->limits->effort;
+		}
+	    }
+
+	    if (gravity_compensation_ && !initDynamics(dynamics_base_link_, dynamics_left_tip_, dynamics_right_tip_, false))
+	    {
+		return false;
+	    }
+	    sim_position_.assign(n_joints_, 0.0);
+	    gravity_effort_.assign(n_joints_, 0.0);
+	    position_reference_.assign(n_joints_, 0.0);
+	    return true;
+	}
+
+	// Runs every physics step: Gazebo clears the forces after each one
+	void writeEffort(ros::Duration period)
+	{
+	    for(int j=0; j < n_joints_; j++)
+	    {
+		sim_position_[j] = joint_position_[j] + angles::shortest_angular_distance(joint_position_[j],
+			sim_joints_[j]->GetAngle(0).Radian());
+	    }
+	    if (gravity_compensation_)
+	    {
+		computeGravity(sim_position_, gravity_effort_);
+	    }
+
+	    // velocity commands move a position reference, tracked with the same gains
+	    ControlStrategy strategy = getControlStrategy();
+	    if (strategy != effort_strategy_)
+	    {
+		for(int j=0; j < n_joints_; j++)
+		{
+		    position_reference_[j] = sim_position_[j];
+		    pids_[j].reset();
+		}
+		effort_strategy_ = strategy;
+	    }
+
+	    for(int j=0; j < n_joints_; j++)
+	    {
+		double velocity = sim_joints_[j]->GetVelocity(0);
+		double error, error_dot;
+		if (strategy == JOINT_VELOCITY)
+		{
+		    position_reference_[j] += joint_velocity_command_[j]*period.toSec();
+		    error = position_reference_[j] - sim_position_[j];
+		    error_dot = joint_velocity_command_[j] - velocity;
+		}
+		else
+		{
+		    error = joint_position_command_[j] - sim_position_[j];
+		    error_dot = -velocity;
+		}
+		double effort = pids_[j].computeCommand(error, error_dot, period) + gravity_effort_[j];
+		effort = std::min(std::max(effort, -effort_limits_[j]), effort_limits_[j]);
+		sim_joints_[j]->SetForce(0, effort);
+	    }
+	}
+
 	// Gazebo stuff
 	std::vector<gazebo::physics::JointPtr> sim_joints_;
 	gazebo::physics::ModelPtr parent_model_;
 	bool parent_set_;
 
+	// Effort control
+	bool effort_control_, gravity_compensation_;
+	ros::NodeHandle gains_nh_;
+	std::string dynamics_base_link_, dynamics_left_tip_, dynamics_right_tip_;
+	std::vector<control_toolbox::Pid> pids_;
+	std::vector<double> effort_limits_, sim_position_, gravity_effort_, position_reference_;
+	ControlStrategy effort_strategy_;
+
 };
 
 
@@ -2,229 +2,376 @@
 #define __YUMI_HW_RAPID_H
 
 #include "yumi_hw/yumi_hw.h"
+#include "yumi_hw/yumi_rapid_protocol.h"
+#include "yumi_hw/yumi_triple_buffer.h"
+#include "yumi_hw/yumi_latency_stats.h"
+#include "yumi_hw/yumi_lookahead.h"
+#include "yumi_hw/yumi_joint_packet.h"
+#include "yumi_hw/yumi_tcp_client.h"
+#include "yumi_hw/yumi_reactor.h"
+#include "yumi_hw/yumi_clock_sync.h"
+#include "yumi_hw/yumi_gripper_interface.h"
+#include "yumi_hw/yumi_session_recorder.h"
+
+#include <algorithm>
 
-#include <boost/thread/mutex.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 
 #include <ros/ros.h>
-#include "simple_message/message_handler.h"
-#include "simple_message/message_manager.h"
-#include "simple_message/messages/joint_message.h"
 #include "simple_message/smpl_msg_connection.h"
 #include "simple_message/socket/tcp_socket.h"
 #include "simple_message/socket/tcp_client.h"
 
-#ifndef N_YUMI_JOINTS
-#define N_YUMI_JOINTS 14
-#endif
+///how often the communication thread checks a connection for the state timeout and retries a lost one, in ms
+#define YUMI_COMM_POLL_MS 100
 
 /**
-  * Overrides message handler: keeps joint states thread-safe.
+  * Exchanges joint states and commands with the control thread through lock-free triple
+  * buffers, so neither thread ever waits for the other. States are received straight
+  * into the state buffer and commands are sent straight out of the command buffer, every
+  * other message goes through buffers allocated up front: nothing is allocated per cycle.
   */
-class YumiJointStateHandler : public industrial::message_handler::MessageHandler {
-    using industrial::message_handler::MessageHandler::init;
-    
+class YumiJointStateHandler {
     private:
-	float joint_positions[N_YUMI_JOINTS];
-	float joint_command[N_YUMI_JOINTS];
-	bool first_iteration;
-	boost::mutex data_buffer_mutex, t_m;
-	boost::condition_variable joint_state_received, joint_commands_set;
-	bool b_joint_state_received, b_joint_commands_set;
-	int mode;
+	YumiTripleBuffer<YumiJointState> state_buffer_;
+	YumiTripleBuffer<YumiJointCommand> command_buffer_;
+	YumiTcpClient *client_;
+
+	///owned by the communication thread, messages other than joint states are read into
+	///scratch_ and dropped
+	YumiJointFrame in_;
+	char scratch_[YUMI_SCRATCH_SIZE];
+	///the message being received: bytes of the length, then of the message read so far, and
+	///where the message goes (NULL until the length is complete). It is resumed by the next
+	///receive(), the reactor thread never waits for the rest.
+	int received_;
+	char *body_;
+	YumiJointFrame reply_;
+	YumiJointStreamFrame stream_;
+
+	///owned by the communication thread
+	unsigned long last_command_sequence_;
+	long long last_rx_time_;
+	///controller clock, started over with every connection
+	YumiClockSync clock_;
+
+	///times the connection was re-established
+	boost::atomic<unsigned long> reconnects_;
+
+	///replies sent with a command the control thread had already seen
+	boost::atomic<unsigned long> stale_commands_;
+
+	///optional, time from receiving a state to sending the command computed from it
+	YumiLatencyHistogram *command_latency_;
 
     public:
-	bool getJointStates(float (&jnts)[N_YUMI_JOINTS]) {
-	    boost::mutex::scoped_lock lock(data_buffer_mutex);
-	    while(!b_joint_state_received) {
-		joint_state_received.wait(lock);
-	    }
-	    b_joint_state_received = false;
-	    memcpy(&jnts,&joint_positions,sizeof(jnts));
+	YumiJointStateHandler() : client_(NULL), received_(0), body_(NULL), last_command_sequence_(0), last_rx_time_(0), reconnects_(0),
+		stale_commands_(0), command_latency_(NULL) {}
+
+	///latest joint state, returns false if no new state arrived since the last call. The
+	///state stays valid until the next call.
+	bool getJointStates(const YumiJointState *&state, unsigned long &sequence) {
+	    bool fresh = state_buffer_.update();
+	    state = &state_buffer_.front();
+	    sequence = state_buffer_.frontSequence();
+	    return fresh;
 	}
 
-	bool setJointCommands(float (&jnts)[N_YUMI_JOINTS], int mode_) {
-	    boost::mutex::scoped_lock lock(data_buffer_mutex);
-	    memcpy(&joint_command,&jnts,sizeof(jnts));
-	    b_joint_commands_set=true;
-	    mode = mode_;
-	    joint_commands_set.notify_all();
+	///command to fill in before publishJointCommands()
+	YumiJointCommand &getJointCommands() {
+	    return command_buffer_.back();
 	}
 
-	bool init(industrial::smpl_msg_connection::SmplMsgConnection* connection)
-	{
-	    first_iteration = true;
-	    b_joint_state_received = false;
-	    b_joint_commands_set = false;
+	///publishes the filled in command, it goes out with the reply to the next joint state
+	unsigned long publishJointCommands() {
+	    return command_buffer_.publish();
+	}
 
-	    return init((int)industrial::simple_message::StandardMsgTypes::JOINT, connection);
+	unsigned long getStaleCommands() const { return stale_commands_; }
+
+	unsigned long getReconnects() const { return reconnects_; }
+
+	///communication thread: the state timeout starts over with a new connection, and so
+	///does the message being received
+	void connected() {
+	    received_ = 0;
+	    body_ = NULL;
+	    last_rx_time_ = yumiMonotonicNs();
+	    clock_.reset();
 	}
 
-    protected:
+	///communication thread: the connection is back, commands computed before are not sent
+	void reconnected() {
+	    connected();
+	    reconnects_++;
+	}
 
-	
-	bool internalCB(industrial::simple_message::SimpleMessage& in)
-	{
-	    boost::mutex::scoped_lock lock(data_buffer_mutex);
-	    
-	    //ROS_INFO("Received a message");
-	    industrial::joint_message::JointMessage joint_msg;
-	    bool rtn = true;
+	///communication thread: when the last joint state arrived
+	long long getLastRxTime() const { return last_rx_time_; }
 
-	    if (!joint_msg.init(in))
-	    {
-		ROS_ERROR("Failed to initialize joint message");
-		return false;
-	    }
+	///must be set before the communication thread starts, written by that thread only
+	void setCommandLatencyHistogram(YumiLatencyHistogram *histogram) { command_latency_ = histogram; }
 
-	    //ROS_INFO("Message parsed");
-	    industrial::shared_types::shared_real joint_value_from_msg;
+	void init(YumiTcpClient* connection)
+	{
+	    client_ = connection;
+	    reply_.setHeader(YUMI_COMM_TYPE_SRV_REPLY, YUMI_REPLY_TYPE_SUCCESS);
+	    reply_.length = sizeof(reply_.msg_type) + sizeof(reply_.comm_type) + sizeof(reply_.reply_code);
+	}
 
-	    for(int i=0; i<N_YUMI_JOINTS; i++) {
-		//std::cerr<<i<<":";
-		if (joint_msg.getJoints().getJoint(i, joint_value_from_msg))
-		{
-		    joint_positions[i] = joint_value_from_msg;
-		    //std::cerr<<joint_positions[i]<<" ";
+	///communication thread: reads what arrived of the next message without blocking, and
+	///answers it if it is a complete joint state. Returns false once the connection is lost.
+	///A message stuck halfway leaves the joint states out, so the state timeout reconnects.
+	bool receive()
+	{
+	    int status;
+	    if(body_ == NULL) {
+		status = client_->receiveSome(&in_.length, sizeof(in_.length), received_);
+		if(status != YUMI_RECEIVE_DONE) {
+		    return status == YUMI_RECEIVE_PENDING;
+		}
+		int length = in_.length;
+		if(length == (int)sizeof(in_) - (int)sizeof(in_.length)) {
+		    body_ = (char*)&in_.msg_type;
 		}
-		else
-		{
-		    //std::cerr<<"X";
-		    rtn = false;
+		else if(length < YUMI_HEADER_SIZE || length > (int)sizeof(scratch_)) {
+		    ROS_ERROR("Message of %d bytes from the state server, reconnecting", length);
+		    client_->disconnect();
+		    return false;
 		}
+		else {
+		    body_ = scratch_;
+		}
+		received_ = 0;
 	    }
-	    //std::cerr<<"\n";
 
-	    // Reply back to the controller if the sender requested it.
-	    if (industrial::simple_message::CommTypes::SERVICE_REQUEST == joint_msg.getMessageType())
-	    {
-		//ROS_INFO("Reply requested, sending");
-		industrial::simple_message::SimpleMessage reply;
-		joint_msg.toReply(reply, rtn ? industrial::simple_message::ReplyTypes::SUCCESS : industrial::simple_message::ReplyTypes::FAILURE);
-		this->getConnection()->sendMsg(reply);
+	    status = client_->receiveSome(body_, in_.length, received_);
+	    if(status != YUMI_RECEIVE_DONE) {
+		return status == YUMI_RECEIVE_PENDING;
+	    }
+	    bool joint_state = body_ != scratch_ && in_.msg_type == YUMI_MSG_TYPE_YUMI_JOINTS;
+	    received_ = 0;
+	    body_ = NULL;
+	    if(joint_state) {
+		return handleJointState();
 	    }
+	    ROS_WARN_THROTTLE(1.0, "Dropped a message of %d bytes from the state server, expected joint states", (int)in_.length);
+	    return true;
+	}
 
-	    b_joint_state_received=true;
-	    joint_state_received.notify_all();
+    protected:
 
-	    while(!b_joint_commands_set) {
-		joint_commands_set.wait(lock);
+	///packs a lookahead command, see ROS_receive_msg_joint_command in ROS_messages.sys
+	bool sendJointStream(const YumiJointCommand &command, industrial::shared_types::shared_int sequence) {
+	    stream_.sequence = sequence;
+	    stream_.mode = command.frame.data.mode;
+	    stream_.points = command.window.length;
+	    for(int k=0; k<command.window.length; k++) {
+		stream_.point[k][0] = command.window.time[k];
+		memcpy(&stream_.point[k][1], &command.window.joints[k], sizeof(command.window.joints[k]));
 	    }
-	    b_joint_commands_set = false;
+	    int size = stream_.setHeader(YUMI_COMM_TYPE_SRV_REQ, YUMI_REPLY_TYPE_INVALID);
+	    return client_->sendRaw(&stream_, size);
+	}
 
-	    //if first call back, then mirror state to command
-	    if(first_iteration) {
-		ROS_INFO("Mirroring to command");
-		memcpy(&joint_command,&joint_positions,sizeof(joint_command));
-		first_iteration = false;	
+	bool handleJointState()
+	{
+	    long long rx_time = yumiMonotonicNs();
+	    last_rx_time_ = rx_time;
+
+	    YumiJointState &state = state_buffer_.back();
+	    state.packet = in_.data;
+	    state.rx_time = rx_time;
+	    clock_.update(state.packet.timestamp, rx_time);
+	    state.sample_time = clock_.getSampleTime();
+
+	    // answer with the latest command, whatever the control thread is doing right now
+	    command_buffer_.update();
+	    YumiJointCommand &joint_command = command_buffer_.front();
+	    unsigned long command_sequence = command_buffer_.frontSequence();
+	    bool fresh_command = command_sequence != last_command_sequence_;
+
+	    //until the control thread sent its first command, and after a reconnection until it
+	    //caught up and resynced its controllers, mirror state to command
+	    if(command_sequence == 0 || joint_command.hold || joint_command.reconnects != reconnects_) {
+		memcpy(&joint_command.frame.data.position,&state.packet.position,sizeof(state.packet.position));
+		memset(&joint_command.frame.data.velocity,0,sizeof(joint_command.frame.data.velocity));
+		joint_command.frame.data.mode = YumiHW::JOINT_POSITION;
+		joint_command.window.length = 0;
 	    }
-	    
-	    //TODO: format trajectory request message
-	    industrial::shared_types::shared_real joint_value_to_msg;
-
-	    for(int i=0; i<N_YUMI_JOINTS; i++) {
-		joint_value_to_msg = joint_command[i];
-//		std::cerr<<joint_command[i]<<" ";
-		if (!joint_msg.getJoints().setJoint(i, joint_value_to_msg))
-		{
-		    rtn = false;
-		}
+	    else if(!fresh_command) {
+		stale_commands_++;
 	    }
-	    if (!joint_msg.getJoints().setJoint(N_YUMI_JOINTS, mode))
+	    last_command_sequence_ = command_sequence;
+	    joint_command.frame.data.sequence = state.packet.sequence;
+	    joint_command.frame.data.timestamp = state.packet.timestamp;
+	    state_buffer_.publish();
+
+	    // Reply back to the controller if the sender requested it, with the header only.
+	    if (in_.comm_type == YUMI_COMM_TYPE_SRV_REQ)
 	    {
-		rtn = false;
+		client_->sendRaw(&reply_, sizeof(reply_.length) + reply_.length);
 	    }
-//	    std::cerr<<"\n";
 
-	    //TODO: send back on conncetion 
-	    industrial::simple_message::SimpleMessage next_point;
-	    joint_msg.toRequest(next_point);
-	    this->getConnection()->sendMsg(next_point);
+	    bool rtn;
+	    if(joint_command.window.length > 0) {
+		rtn = sendJointStream(joint_command, joint_command.frame.data.sequence);
+	    }
+	    else {
+		joint_command.frame.setHeader(YUMI_COMM_TYPE_SRV_REQ, YUMI_REPLY_TYPE_INVALID);
+		rtn = client_->sendRaw(&joint_command.frame, sizeof(joint_command.frame));
+	    }
 
-	    //ROS_INFO("Done processing");
-	    
+	    if(command_latency_ != NULL && fresh_command && command_sequence > 0) {
+		command_latency_->record(yumiMonotonicNs() - joint_command.state_rx_time);
+	    }
 	    return rtn;
 	}
 
 };
 
 /**
-  * Keep a connection to the robot and send and receive joint states
+  * Keep a connection to the robot and send and receive joint states, on the thread of a
+  * reactor that may serve other connections too
   */
 class YumiRapidInterface {
     private:
-	boost::thread RapidCommThread_;
-	
+	YumiReactor *reactor_;
+
 	///industrial connection
-	industrial::tcp_client::TcpClient default_tcp_connection_; //?
-	//industrial::tcp_client::RobotStatusRelayHandler default_robot_status_handler_; //?
+	YumiTcpClient default_tcp_connection_;
+	///the descriptor registered with the reactor, -1 while disconnected
+	int socket_;
+	///checks the state timeout, and reconnects once the backoff delay ran out
+	int watchdog_;
+	long long next_attempt_;
 
-	industrial::smpl_msg_connection::SmplMsgConnection* connection_;
-	industrial::message_manager::MessageManager manager_;
 	YumiJointStateHandler js_handler;
 
-	bool stopComm_;
+	///reconnection: a connection without joint states for state_timeout_ seconds is dropped
+	double state_timeout_;
+	YumiBackoff backoff_;
+
+	void onReadable()
+	{
+	    js_handler.receive();
+	    if(!default_tcp_connection_.isConnected()) {
+		lost();
+	    }
+	}
 
-	virtual void RapidCommThreadCallback()
+	void onWatchdog()
 	{
-	    while(!stopComm_) {
-		manager_.spinOnce();
+	    if(socket_ < 0) {
+		if(yumiMonotonicNs() >= next_attempt_) reconnect();
+		return;
 	    }
-	    return;
+	    if(state_timeout_ > 0 && yumiMonotonicNs() - js_handler.getLastRxTime() > (long long)(state_timeout_*1e9)) {
+		ROS_WARN("No joint state from %s:%d for %.2f s, reconnecting", default_tcp_connection_.getIp().c_str(),
+			default_tcp_connection_.getPort(), state_timeout_);
+		lost();
+	    }
+	}
+
+	///stops watching the connection, the next attempt is made after the backoff delay
+	void lost() {
+	    reactor_->remove(socket_);
+	    socket_ = -1;
+	    default_tcp_connection_.disconnect();
+	    next_attempt_ = yumiMonotonicNs() + (long long)(backoff_.next()*1e9);
+	}
+
+	///a single attempt, the RAPID server accepts a new client after ExitCycle
+	void reconnect() {
+	    if(!default_tcp_connection_.reconnect() || !watch()) {
+		ROS_WARN_THROTTLE(5.0, "Robot state server at %s:%d is not reachable, retrying", default_tcp_connection_.getIp().c_str(),
+			default_tcp_connection_.getPort());
+		default_tcp_connection_.disconnect();
+		next_attempt_ = yumiMonotonicNs() + (long long)(backoff_.next()*1e9);
+		return;
+	    }
+	    ROS_INFO("Reconnected to the robot state server at %s:%d", default_tcp_connection_.getIp().c_str(), default_tcp_connection_.getPort());
+	    js_handler.reconnected();
+	    backoff_.reset();
+	}
+
+	bool watch() {
+	    socket_ = default_tcp_connection_.getSocket();
+	    default_tcp_connection_.setSendTimeout(YUMI_SEND_TIMEOUT_MS);
+	    if(!reactor_->add(socket_, boost::bind(&YumiRapidInterface::onReadable, this))) {
+		socket_ = -1;
+		return false;
+	    }
+	    return true;
 	}
 
     public:
 	YumiRapidInterface() { 
-	    this->connection_ = NULL;
-	    stopComm_ = true;
+	    reactor_ = NULL;
+	    socket_ = -1;
+	    watchdog_ = -1;
+	    next_attempt_ = 0;
+	    state_timeout_ = 1.0;
 	}
 
-	~YumiRapidInterface() { 
-	    stopThreads();
+	bool getCurrentJointStates(const YumiJointState *&state, unsigned long &sequence) {
+	    return js_handler.getJointStates(state, sequence);
 	}
-	
-	void stopThreads() {
-	    stopComm_ = true;
-	    RapidCommThread_.join();
+
+	///fill in the command in place, then publish it with setJointTargets()
+	YumiJointCommand &getJointTargets() {
+	    return js_handler.getJointCommands();
 	}
 
-	void startThreads() {
-	    if(!stopComm_) {
-		boost::thread(boost::bind(&YumiRapidInterface::RapidCommThreadCallback,this ));
-	    }
+	unsigned long setJointTargets() {
+	    return js_handler.publishJointCommands();
 	}
 
-	void getCurrentJointStates(float (&joints)[N_YUMI_JOINTS]) {
-	    js_handler.getJointStates(joints);	    
+	void setCommandLatencyHistogram(YumiLatencyHistogram *histogram) {
+	    js_handler.setCommandLatencyHistogram(histogram);
 	}
 
-	void setJointTargets(float (&joints)[N_YUMI_JOINTS], int mode) {
-	    js_handler.setJointCommands(joints, mode);
+	unsigned long getStaleCommands() const {
+	    return js_handler.getStaleCommands();
 	}
 
+	unsigned long getReconnects() const {
+	    return js_handler.getReconnects();
+	}
 
-	bool init(std::string ip = "", int port = industrial::simple_socket::StandardSocketPorts::STATE) {
+	///set before init(): state_timeout <= 0 only reconnects when the server closes the connection
+	void setReconnect(double state_timeout, double min_backoff, double max_backoff) {
+	    state_timeout_ = state_timeout;
+	    backoff_.setup(min_backoff, max_backoff);
+	}
+
+	///connects and registers with the reactor, which must not be running yet
+	bool init(YumiReactor *reactor, std::string ip = "", int port = industrial::simple_socket::StandardSocketPorts::STATE) {
+	    reactor_ = reactor;
 	    //initialize connection 
-	    char* ip_addr = strdup(ip.c_str());  // connection.init() requires "char*", not "const char*"
-	    ROS_INFO("Robot state connecting to IP address: '%s:%d'", ip_addr, port);
-	    default_tcp_connection_.init(ip_addr, port);
-	    free(ip_addr);
+	    ROS_INFO("Robot state connecting to IP address: '%s:%d'", ip.c_str(), port);
+	    default_tcp_connection_.init(ip, port);
 
-	    connection_ = &default_tcp_connection_;
-	    connection_->makeConnect();
+	    if(!default_tcp_connection_.makeConnect()) {
+		ROS_ERROR("Could not connect to the robot state server");
+		return false;
+	    }
 
 	    ROS_INFO("Connection established");
-	    //initialize message manager
-	    manager_.init(connection_);
-
 	    //initialize message handler
-	    js_handler.init(connection_);
+	    js_handler.init(&default_tcp_connection_);
+	    js_handler.connected();
 
-	    //register handler to manager
-	    manager_.add(&js_handler,false);
+	    watchdog_ = reactor_->addTimer(boost::bind(&YumiRapidInterface::onWatchdog, this));
+	    if(!watch() || watchdog_ < 0) {
+		ROS_ERROR("Could not register the robot state connection");
+		return false;
+	    }
+	    reactor_->setTimer(watchdog_, YUMI_COMM_POLL_MS*1e-3, YUMI_COMM_POLL_MS*1e-3);
 
 	    ROS_INFO("Callbacks and handlers set up");
-	    stopComm_ = false;
+	    return true;
 	}
 	
 };
@@ -236,19 +383,35 @@ public:
   YumiHWRapid() : YumiHW() {
       isInited = false;
       isSetup = false;
-      firstRunInPositionMode = true;
       sampling_rate_ = 0.1;
+      n_channels = 1;
+      skippedStates = 0;
+      staleStates = 0;
+      readyLatency = NULL;
+      sessionRecorder = NULL;
+      resyncHold = false;
+      handledReconnects = 0;
+      releasedReconnects = 0;
+      armOffloaded[0] = false;
+      armOffloaded[1] = false;
+      gripperStatePort = DEFAULT_STATE_PORT;
+      gripperCommandPort = DEFAULT_COMMAND_PORT;
   }
   
   ~YumiHWRapid() { 
-      robot_interface.stopThreads();
+      reactor.stop();
   }
 
   float getSampleTime(){return sampling_rate_;};
 	
-  void setup(std::string ip_ = "", int port_ = industrial::simple_socket::StandardSocketPorts::STATE) {
+  ///with a right_port, port serves the left arm and right_port the right arm, each on its own
+  ///connection (ROS_stateServer_left/right.mod), otherwise port serves both arms. One thread
+  ///serves all connections.
+  void setup(std::string ip_ = "", int port_ = industrial::simple_socket::StandardSocketPorts::STATE, int right_port_ = 0) {
       ip = ip_;
-      port = port_;
+      channels[0].port = port_;
+      channels[1].port = right_port_;
+      n_channels = right_port_ > 0 ? 2 : 1;
       isSetup = true;
   }
 
@@ -261,65 +424,256 @@ public:
 	return false;
     }
 
-    robot_interface.init(ip,port);
-    robot_interface.startThreads();
+    for (int c = 0; c < n_channels; c++)
+    {
+      Channel &channel = channels[c];
+      channel.first_joint = c == 0 ? 0 : N_YUMI_ARM_JOINTS;
+      channel.end_joint = n_channels == 1 || c == 1 ? n_joints_ : std::min(n_joints_, N_YUMI_ARM_JOINTS);
+      if(!channel.robot_interface.init(&reactor,ip,channel.port)) {
+	return false;
+      }
+    }
+    if(n_grippers_ > 0 && !grippers.init(&reactor, ip, gripperStatePort, gripperCommandPort)) {
+      return false;
+    }
+    // both connections are up before either arm starts exchanging
+    reactor.start();
     isInited = true;
 
     return true;
   }
 
-  ///copies the last received joint state out to the controller manager
+  ///copies the last received joint states out to the controller manager, never waits for a new one
   void read(ros::Time time, ros::Duration period)
   {
     if(!isInited) return;  
+    if(sessionRecorder != NULL) sessionRecorder->beginCycle(time, period);
+
+    for (int c = 0; c < n_channels; c++)
+    {
+      readChannel(channels[c], period);
+    }
+    if(n_grippers_ > 0)
+    {
+      grippers.read(&joint_position_[n_joints_], &joint_velocity_[n_joints_], &joint_position_command_[n_joints_], period.toSec());
+    }
+    if(sessionRecorder != NULL) sessionRecorder->endRead(*this);
+  }
 
+  ///serializes the most recent joint commands straight into the command buffers of the robot interfaces
+  void write(ros::Time time, ros::Duration period)
+  {
+    if(!isInited) return;  
+    enforceLimits(period);
+    if(n_grippers_ > 0)
+    {
+      grippers.write(&joint_position_command_[n_joints_]);
+    }
+
+    YumiJointCommand *filled = NULL;
+    for (int c = 0; c < n_channels; c++)
+    {
+      Channel &channel = channels[c];
+      // nothing to command before the first state arrived, the interface mirrors the state until then
+      if(!channel.hasState) continue;
+
+      YumiJointCommand &command = channel.robot_interface.getJointTargets();
+      fillCommand(command, period, filled);
+      filled = &command;
+
+      command.state_rx_time = channel.lastStateRxTime;
+      command.reconnects = channel.reconnects;
+      command.hold = resyncHold && handledReconnects > releasedReconnects;
+      channel.robot_interface.setJointTargets();
+      if(readyLatency != NULL) readyLatency->record(yumiMonotonicNs() - channel.lastStateRxTime);
+    }
+    if(sessionRecorder != NULL) sessionRecorder->endCycle(*this);
+    //ROS_INFO("wrote joints");
+
+    return;
+  }
+
+  ///cycles in which no new joint state had arrived, summed over the channels
+  unsigned long getStaleStates() const { return staleStates; }
+  ///joint states overwritten by the communication threads before read() picked them up
+  unsigned long getSkippedStates() const { return skippedStates; }
+  ///replies to the controller that repeated an already sent command
+  unsigned long getStaleCommands() const {
+    unsigned long stale = 0;
+    for (int c = 0; c < n_channels; c++) stale += channels[c].robot_interface.getStaleCommands();
+    return stale;
+  }
+
+  ///when the controller sampled the joint states of the last read(), the latest channel counts
+  ros::Time getStateStamp(const ros::Time &now) const {
+    long long sample_time = 0;
+    for (int c = 0; c < n_channels; c++) sample_time = std::max(sample_time, channels[c].lastSampleTime);
+    return yumiSampleStamp(now, sample_time);
+  }
+
+  ///runs in the control loop, see YumiHW::doSwitch
+  void doSwitch(const std::list<hardware_interface::ControllerInfo> &start_list, const std::list<hardware_interface::ControllerInfo> &stop_list)
+  {
+    YumiHW::doSwitch(start_list, stop_list);
+    if(sessionRecorder != NULL) sessionRecorder->switched();
+  }
+
+  ///sequence number of the joint states of the last read() on a channel
+  unsigned long getStateSequence(int channel) const {
+    return channel < n_channels ? channels[channel].lastStateSequence : 0;
+  }
+
+  ///reconnections whose first joint state the control loop has read, summed over the channels
+  unsigned long getReconnects() const { return handledReconnects; }
+
+  ///set before init(): state_timeout without joint states drops a connection, it is re-established
+  ///with a delay growing from min_backoff to max_backoff seconds
+  void setReconnect(double state_timeout, double min_backoff, double max_backoff) {
+    for (int c = 0; c < 2; c++) channels[c].robot_interface.setReconnect(state_timeout, min_backoff, max_backoff);
+    grippers.setReconnect(state_timeout, min_backoff, max_backoff);
+  }
+
+  ///set before init(), with setGrippers(true) before create(): the gripper servers are served
+  ///by the same thread as the arms, see YumiGripperJoints for force, speed and deadband
+  void setupGrippers(int state_port, int command_port, double force, double speed, double deadband) {
+    gripperStatePort = state_port;
+    gripperCommandPort = command_port;
+    grippers.setup(force, speed, deadband);
+  }
+
+  ///after a reconnection the controller is only sent the measured state, until releaseHold() is
+  ///called with the reconnections the controllers were restarted for
+  void setResyncHold(bool hold) {
+    resyncHold = hold;
+  }
+
+  void releaseHold(unsigned long reconnects) {
+    releasedReconnects = reconnects;
+  }
+
+  ///arm 0 (left) or 1 (right) runs a trajectory downloaded to the controller
+  void setArmOffloaded(int arm, bool offloaded) {
+    armOffloaded[arm] = offloaded;
+  }
+
+  ///streams points setpoints spaced period seconds apart in position mode, 0 sends single setpoints
+  void setLookahead(int points, double period) {
+    lookahead.setup(points, period);
+  }
+
+  ///records the session of the control loop for YumiHWReplay, set before the loop starts
+  void setSessionRecorder(YumiSessionRecorder *recorder) {
+    sessionRecorder = recorder;
+  }
+
+  ///state channels: one for both arms, or one per arm
+  int getChannels() const { return n_channels; }
+
+  ///optional latency probes, set before init(): state received -> command written / command sent.
+  ///The sent probe is filled by the communication thread of the first channel only.
+  void setLatencyHistograms(YumiLatencyHistogram *ready, YumiLatencyHistogram *sent) {
+    readyLatency = ready;
+    channels[0].robot_interface.setCommandLatencyHistogram(sent);
+  }
+
+private:
+
+  ///serves the connections of all channels and the grippers, stopped before they are destroyed
+  YumiReactor reactor;
+
+  YumiGripperJoints grippers;
+  int gripperStatePort, gripperCommandPort;
+
+  ///one connection to a RAPID state server and the joints it serves
+  struct Channel {
+    YumiRapidInterface robot_interface;
+    int port;
+    int first_joint, end_joint;
+    ///sequence tracking of the received joint states
+    bool hasState, firstRunInPositionMode;
+    unsigned long lastStateSequence;
+    long long lastStateRxTime, lastSampleTime;
+    ///reconnections of the interface as of the last joint state read
+    unsigned long reconnects;
+
+    Channel() : port(0), first_joint(0), end_joint(0), hasState(false), firstRunInPositionMode(true),
+	lastStateSequence(0), lastStateRxTime(0), lastSampleTime(0), reconnects(0) {}
+  };
+
+  void readChannel(Channel &channel, const ros::Duration &period)
+  {
     //ROS_INFO("reading joints");
-    data_buffer_mutex.lock();
-    robot_interface.getCurrentJointStates(readJntPosition);
+    unsigned long sequence;
+    const YumiJointState *state;
+    bool fresh = channel.robot_interface.getCurrentJointStates(state, sequence);
+
+    if(!fresh)
+    {
+      // no new sample from the controller, keep the last state
+      if(channel.hasState) staleStates++;
+      return;
+    }
+    if(channel.hasState && sequence > channel.lastStateSequence + 1)
+    {
+      skippedStates += sequence - channel.lastStateSequence - 1;
+    }
+    // counted before the state was published, so a state from a new connection is never
+    // taken for one of the old: no velocity across the gap, and the command restarts from it
+    unsigned long reconnects = channel.robot_interface.getReconnects();
+    if(reconnects != channel.reconnects)
+    {
+      handledReconnects += reconnects - channel.reconnects;
+      channel.reconnects = reconnects;
+      channel.hasState = false;
+      channel.firstRunInPositionMode = true;
+      lookahead.reset();
+    }
+    if(sessionRecorder != NULL) sessionRecorder->state(&channel - channels, reconnects, sequence, *state);
+    channel.lastStateSequence = sequence;
+    channel.lastStateRxTime = state->rx_time;
+    channel.lastSampleTime = state->sample_time;
 
-    for (int j = 0; j < n_joints_; j++)
+    for (int j = channel.first_joint; j < channel.end_joint; j++)
     {
       joint_position_prev_[j] = joint_position_[j];
-      joint_position_[j] = readJntPosition[j];
-      //joint_effort_[j] = readJntEffort[j]; //TODO: read effort 
-      joint_velocity_[j] = filters::exponentialSmoothing((joint_position_[j]-joint_position_prev_[j])/period.toSec(), joint_velocity_[j], 0.04); //exponential smoothing
-      if(firstRunInPositionMode) {
-	  joint_position_command_[j] = readJntPosition[j];
+      joint_effort_[j] = effort_scale_[j]*state->packet.effort[j];
+      // estimated over the time between the samples, not the loop period
+      if(!channel.hasState) estimator_->reset(j);
+      estimateState(j, state->packet.position[j], state->sample_time*1e-9);
+      if(channel.firstRunInPositionMode) {
+	  joint_position_command_[j] = state->packet.position[j];
       }
     }
-    firstRunInPositionMode = false;
-    data_buffer_mutex.unlock();
+    channel.firstRunInPositionMode = false;
+    channel.hasState = true;
     //ROS_INFO("read joints");
-
-    return;
   }
 
-  ///caches the most recent joint commands into the robot interface
-  void write(ros::Time time, ros::Duration period)
+  ///every channel gets the command of all joints, the state servers pick their own arm. The
+  ///lookahead window is computed once per cycle and copied from the first filled command.
+  void fillCommand(YumiJointCommand &command, const ros::Duration &period, const YumiJointCommand *filled)
   {
-    if(!isInited) return;  
-    enforceLimits(period);
-
+    YumiJointPacket &packet = command.frame.data;
+    packet.mode = getControlStrategy();
     //ROS_INFO("writing joints");
-    data_buffer_mutex.lock();
     switch (getControlStrategy())
     {
       case JOINT_POSITION:
         for (int j = 0; j < n_joints_; j++)
         {
-          newJntPosition[j] = joint_position_command_[j];
+          packet.position[j] = joint_position_command_[j];
+          packet.velocity[j] = joint_velocity_command_[j];
         }
         break;
       
       case JOINT_VELOCITY:
-	//std::cerr<<"ASS = ";
 	for (int j = 0; j < n_joints_; j++)
 	{
-	  //std::cerr<<joint_velocity_command_[j]<<"*"<<period.toSec()<<" + "<<joint_position_[j]<<" ::: ";  
-	  newJntPosition[j] = joint_velocity_command_[j]; //*period.toSec() + joint_position_[j]; 
+	  packet.position[j] = joint_position_[j];
+	  packet.velocity[j] = joint_velocity_command_[j];
 	}
-	//std::cerr<<std::endl;
-	firstRunInPositionMode = true;
+	for (int c = 0; c < n_channels; c++) channels[c].firstRunInPositionMode = true;
+	lookahead.reset();
 	break;
       //case JOINT_EFFORT:
       //break;
@@ -327,34 +681,61 @@ public:
 	break;
     }
 
-    robot_interface.setJointTargets(newJntPosition, getControlStrategy());
-    data_buffer_mutex.unlock();
-    //ROS_INFO("wrote joints");
-
-    return;
+    command.window.length = 0;
+    if(getControlStrategy() == JOINT_POSITION && lookahead.isEnabled())
+    {
+      if(filled != NULL)
+      {
+	command.window = filled->window;
+      }
+      else
+      {
+	lookahead.fill(packet.position, period.toSec(), command.window);
+      }
+    }
+    holdOffloadedArms(command);
   }
 
-private:
+  ///an offloaded arm is commanded to where it is, so streaming picks up without a jump afterwards
+  void holdOffloadedArms(YumiJointCommand &command)
+  {
+    for (int a = 0; a < 2; a++)
+    {
+      if(!armOffloaded[a]) continue;
+      for (int j = a*N_YUMI_ARM_JOINTS; j < (a+1)*N_YUMI_ARM_JOINTS; j++)
+      {
+	command.frame.data.position[j] = joint_position_[j];
+	command.frame.data.velocity[j] = 0.0;
+	for (int k = 0; k < command.window.length; k++)
+	{
+	  command.window.joints[k][j] = joint_position_[j];
+	}
+      }
+    }
+  }
 
-  ///
-  YumiRapidInterface robot_interface; 
-  ///
-  float last_comm[N_YUMI_JOINTS];
+  ///one channel for both arms, or one per arm
+  Channel channels[2];
+  int n_channels;
   ///
   std::string hintToRemoteHost_;
   ///
-  bool isInited, isSetup, firstRunInPositionMode;
+  bool isInited, isSetup;
   ///
   float sampling_rate_;
-  ///
-  boost::mutex data_buffer_mutex;
-  ///command buffers
-  float newJntPosition[N_YUMI_JOINTS];
-  ///data buffers
-  float readJntPosition[N_YUMI_JOINTS];
+  ///received joint state statistics, over all channels
+  unsigned long skippedStates, staleStates;
+  YumiLatencyHistogram *readyLatency;
+  YumiSessionRecorder *sessionRecorder;
+  ///lookahead streaming of position commands
+  YumiLookahead lookahead;
+  ///arms running a downloaded trajectory, see YumiTrajectoryOffload
+  boost::atomic<bool> armOffloaded[2];
+  ///resync after reconnections: the control loop counts them, the node releases them
+  bool resyncHold;
+  boost::atomic<unsigned long> handledReconnects, releasedReconnects;
 
   std::string ip;
-  int port;
     
 
 };
@@ -0,0 +1,259 @@
+#ifndef __YUMI_HW_REPLAY_H
+#define __YUMI_HW_REPLAY_H
+
+#include "yumi_hw/yumi_hw.h"
+#include "yumi_hw/yumi_session.h"
+#include "yumi_hw/yumi_session_recorder.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <ros/ros.h>
+
+/**
+  * Backend replaying a session recorded from YumiHWRapid (see YumiSessionRecorder): read()
+  * applies the joint states of the current cycle the way YumiHWRapid read them, write()
+  * compares the commands with the recorded ones and can record them into a new session. The
+  * driver steps the cycles with nextCycle() and calls read(), update and write() with the
+  * recorded time and period, so a controller stack computes what it computed on the robot.
+  */
+class YumiHWReplay : public YumiHW
+{
+
+public:
+  YumiHWReplay() : YumiHW() {
+      isInited = false;
+      n_channels = 1;
+      cycle = NULL;
+      states = NULL;
+      capture = NULL;
+      lastCycle = 0;
+      droppedCycles = 0;
+      skippedStates = 0;
+      handledReconnects = 0;
+      mismatchedCycles = 0;
+      firstMismatch = 0;
+      maxMismatch = 0.0;
+  }
+
+  ///the session to replay, set before init()
+  void setup(const std::string &session_) {
+      session = session_;
+  }
+
+  ///records the replayed session, with the commands computed in the replay, set before init()
+  void setCapture(YumiSessionRecorder *capture_) {
+      capture = capture_;
+  }
+
+  bool init()
+  {
+    if (isInited) return false;
+    if(!reader.open(session.c_str()))
+    {
+      ROS_ERROR("Could not open the session %s", session.c_str());
+      return false;
+    }
+    const YumiSessionHeader &header = reader.header();
+    if((int)header.joints != n_joints_ || (int)header.grippers != n_grippers_)
+    {
+      ROS_ERROR("The session has %u arm and %u gripper joints, the robot %d and %d",
+	header.joints, header.grippers, n_joints_, n_grippers_);
+      return false;
+    }
+    for (int j = 0; j < n_joints_ + n_grippers_; j++)
+    {
+      if(strncmp(header.names[j], joint_names_[j].c_str(), YUMI_SESSION_NAME_LENGTH) != 0)
+      {
+	ROS_ERROR("Joint %d of the session is %.*s, of the robot %s", j, YUMI_SESSION_NAME_LENGTH,
+	  header.names[j], joint_names_[j].c_str());
+	return false;
+      }
+    }
+    // the states are scaled as they were on the robot
+    effort_scale_.assign(header.effort_scale, header.effort_scale + n_joints_ + n_grippers_);
+
+    n_channels = header.channels < 1 ? 1 : header.channels;
+    for (int c = 0; c < n_channels; c++)
+    {
+      Channel &channel = channels[c];
+      channel.first_joint = c == 0 ? 0 : N_YUMI_ARM_JOINTS;
+      channel.end_joint = n_channels == 1 || c == 1 ? n_joints_ : std::min(n_joints_, N_YUMI_ARM_JOINTS);
+    }
+    isInited = true;
+    return true;
+  }
+
+  ///moves to the next recorded cycle, false at the end of the session
+  bool nextCycle()
+  {
+    if(!isInited || !reader.next(cycle, states))
+    {
+      cycle = NULL;
+      return false;
+    }
+    if(lastCycle > 0 && cycle->cycle > lastCycle + 1) droppedCycles += cycle->cycle - lastCycle - 1;
+    lastCycle = cycle->cycle;
+    return true;
+  }
+
+  ///time and period the current cycle ran at on the robot
+  ros::Time getCycleTime() const { ros::Time t; t.fromNSec(cycle->time); return t; }
+  ros::Duration getCyclePeriod() const { ros::Duration d; d.fromNSec(cycle->period); return d; }
+  ///the controllers were stamped with the sample time in the current cycle
+  bool hasCycleStamp() const { return cycle->stamp != 0; }
+  ///the controllers were switched in the update of the current cycle
+  bool hasCycleSwitch() const { return (cycle->flags & YUMI_SESSION_SWITCH) != 0; }
+
+  ///applies the joint states of the current cycle
+  void read(ros::Time time, ros::Duration period)
+  {
+    if(!isInited || cycle == NULL) return;
+    if(capture != NULL) capture->beginCycle(time, period);
+
+    for (unsigned int s = 0; s < cycle->states; s++)
+    {
+      readState(states[s]);
+    }
+    for (int g = 0; g < n_grippers_; g++)
+    {
+      joint_position_[n_joints_ + g] = cycle->gripper_position[g];
+      joint_velocity_[n_joints_ + g] = cycle->gripper_velocity[g];
+      joint_position_command_[n_joints_ + g] = cycle->gripper_command[g];
+    }
+    if(capture != NULL) capture->endRead(*this);
+  }
+
+  ///limits the commands as on the robot and compares them with the recorded ones
+  void write(ros::Time time, ros::Duration period)
+  {
+    if(!isInited || cycle == NULL) return;
+    enforceLimits(period);
+
+    // velocity mode starts position mode over from the measured state, as the robot did
+    bool hasState = false;
+    for (int c = 0; c < n_channels; c++) hasState = hasState || channels[c].hasState;
+    if(hasState && getControlStrategy() == JOINT_VELOCITY)
+    {
+      for (int c = 0; c < n_channels; c++) channels[c].firstRunInPositionMode = true;
+    }
+
+    bool mismatch = false;
+    for (int j = 0; j < n_joints_ + n_grippers_; j++)
+    {
+      double position = std::fabs(joint_position_command_[j] - cycle->position_command[j]);
+      double velocity = std::fabs(joint_velocity_command_[j] - cycle->velocity_command[j]);
+      if(joint_position_command_[j] != cycle->position_command[j] || joint_velocity_command_[j] != cycle->velocity_command[j])
+      {
+	mismatch = true;
+	maxMismatch = std::max(maxMismatch, std::max(position, velocity));
+      }
+    }
+    if(mismatch)
+    {
+      if(mismatchedCycles == 0) firstMismatch = cycle->cycle;
+      mismatchedCycles++;
+    }
+    if(capture != NULL) capture->endCycle(*this);
+  }
+
+  ///the stamp the controllers were updated with on the robot
+  ros::Time getStateStamp(const ros::Time &now) const
+  {
+    ros::Time stamp = now;
+    if(cycle != NULL && cycle->stamp != 0) stamp.fromNSec(cycle->stamp);
+    return stamp;
+  }
+
+  unsigned long getReconnects() const { return handledReconnects; }
+
+  unsigned long getStateSequence(int channel) const {
+    return channel < n_channels ? channels[channel].lastStateSequence : 0;
+  }
+
+  ///the replay performs the recorded switches itself, at the end of the update of their cycle
+  void doSwitch(const std::list<hardware_interface::ControllerInfo> &start_list, const std::list<hardware_interface::ControllerInfo> &stop_list)
+  {
+    YumiHW::doSwitch(start_list, stop_list);
+    if(capture != NULL) capture->switched();
+  }
+
+  const YumiSessionHeader &getSessionHeader() const { return reader.header(); }
+  ///recorded cycle number of the current cycle, cycles the recorder dropped
+  unsigned long getCycle() const { return lastCycle; }
+  unsigned long getDroppedCycles() const { return droppedCycles; }
+  unsigned long getSkippedStates() const { return skippedStates; }
+  ///cycles whose commands differ from the recorded ones, the first of them and the largest difference
+  unsigned long getMismatchedCycles() const { return mismatchedCycles; }
+  unsigned long getFirstMismatch() const { return firstMismatch; }
+  double getMaxMismatch() const { return maxMismatch; }
+
+private:
+
+  ///the channels of the recording, tracked as YumiHWRapid tracks its channels
+  struct Channel {
+    int first_joint, end_joint;
+    bool hasState, firstRunInPositionMode;
+    unsigned long lastStateSequence;
+    unsigned long reconnects;
+
+    Channel() : first_joint(0), end_joint(0), hasState(false), firstRunInPositionMode(true),
+	lastStateSequence(0), reconnects(0) {}
+  };
+
+  ///YumiHWRapid::readChannel for a recorded state
+  void readState(const YumiSessionState &state)
+  {
+    if((int)state.channel >= n_channels) return;
+    Channel &channel = channels[state.channel];
+    if(channel.hasState && state.sequence > channel.lastStateSequence + 1)
+    {
+      skippedStates += state.sequence - channel.lastStateSequence - 1;
+    }
+    if(state.reconnects != channel.reconnects)
+    {
+      handledReconnects += state.reconnects - channel.reconnects;
+      channel.reconnects = state.reconnects;
+      channel.hasState = false;
+      channel.firstRunInPositionMode = true;
+    }
+    if(capture != NULL)
+    {
+      YumiJointState joint_state;
+      joint_state.packet = state.packet;
+      joint_state.rx_time = state.rx_time;
+      joint_state.sample_time = state.sample_time;
+      capture->state(state.channel, state.reconnects, state.sequence, joint_state);
+    }
+    channel.lastStateSequence = state.sequence;
+
+    for (int j = channel.first_joint; j < channel.end_joint; j++)
+    {
+      joint_position_prev_[j] = joint_position_[j];
+      joint_effort_[j] = effort_scale_[j]*state.packet.effort[j];
+      if(!channel.hasState) estimator_->reset(j);
+      estimateState(j, state.packet.position[j], state.sample_time*1e-9);
+      if(channel.firstRunInPositionMode) {
+	  joint_position_command_[j] = state.packet.position[j];
+      }
+    }
+    channel.firstRunInPositionMode = false;
+    channel.hasState = true;
+  }
+
+  std::string session;
+  YumiSessionReader reader;
+  YumiSessionRecorder *capture;
+  bool isInited;
+
+  Channel channels[YUMI_SESSION_CHANNELS];
+  int n_channels;
+  ///the current cycle and its states
+  const YumiSessionCycle *cycle;
+  const YumiSessionState *states;
+  unsigned long lastCycle, droppedCycles, skippedStates, handledReconnects;
+  unsigned long mismatchedCycles, firstMismatch;
+  double maxMismatch;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef __YUMI_HW_SIM_H
+#define __YUMI_HW_SIM_H
+
+#include "yumi_hw/yumi_hw.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include <ros/ros.h>
+
+///integration steps of a joint per write() at most
+#define YUMI_SIM_MAX_SUBSTEPS 100
+
+/**
+  * Kinematic simulation of the joints, without Gazebo: write() steps every joint towards its
+  * command through a first order lag (time constant) or a second order one (natural frequency
+  * and damping ratio), with the velocity, acceleration and position limits of the joint.
+  * read() samples the simulated positions the way a backend samples the robot, the velocities
+  * are estimated from them. Nothing paces the backend, the driver steps it with the simulated
+  * time, as fast as it likes.
+  */
+class YumiHWSim : public YumiHW
+{
+
+public:
+  enum JointModel {FIRST_ORDER, SECOND_ORDER};
+
+  YumiHWSim() : YumiHW() {
+      isInited = false;
+      model = FIRST_ORDER;
+      timeConstant = 0.02;
+      naturalFrequency = 30.0;
+      dampingRatio = 1.0;
+      default_smoothing_ = 0.2;
+  }
+
+  ///the joint model: time_constant for FIRST_ORDER (s, 0 follows the command at once),
+  ///natural_frequency (rad/s) and damping_ratio for SECOND_ORDER; set before init()
+  void setup(JointModel model_, double time_constant, double natural_frequency, double damping_ratio) {
+      model = model_;
+      timeConstant = std::max(0.0, time_constant);
+      naturalFrequency = natural_frequency;
+      dampingRatio = damping_ratio;
+  }
+
+  ///velocity and acceleration limits from the URDF, overridden by the joint_limits.yaml
+  ///loaded under limits_nh (joint_limits/<joint>/max_velocity, ...); after create()
+  void loadLimits(const ros::NodeHandle &limits_nh)
+  {
+    int n_all = n_joints_ + n_grippers_;
+    maxVelocity.assign(n_all, 0.0);
+    maxAcceleration.assign(n_all, 0.0);
+    for (int j = 0; j < n_all; j++)
+    {
+      joint_limits_interface::JointLimits limits;
+      limits.has_velocity_limits = false;
+      limits.has_acceleration_limits = false;
+      const boost::shared_ptr<const urdf::Joint> urdf_joint = urdf_model_.getJoint(joint_names_[j]);
+      if (urdf_joint != NULL) joint_limits_interface::getJointLimits(urdf_joint, limits);
+      joint_limits_interface::getJointLimits(joint_names_[j], limits_nh, limits);
+      if (limits.has_velocity_limits) maxVelocity[j] = limits.max_velocity;
+      if (limits.has_acceleration_limits) maxAcceleration[j] = limits.max_acceleration;
+    }
+  }
+
+  ///where the joints start, clamped to their limits; before init()
+  void setInitialPositions(const std::vector<double> &positions) {
+      initialPositions = positions;
+  }
+
+  bool init()
+  {
+    if (isInited) return false;
+    if (model == SECOND_ORDER && (naturalFrequency <= 0.0 || dampingRatio <= 0.0))
+    {
+      ROS_ERROR("The second order joint model needs a positive natural frequency and damping ratio");
+      return false;
+    }
+    int n_all = n_joints_ + n_grippers_;
+    if (!initialPositions.empty() && initialPositions.size() != (size_t)n_all)
+    {
+      ROS_ERROR("%lu initial positions for %d joints", initialPositions.size(), n_all);
+      return false;
+    }
+    maxVelocity.resize(n_all, 0.0);
+    maxAcceleration.resize(n_all, 0.0);
+    simPosition.assign(n_all, 0.0);
+    simVelocity.assign(n_all, 0.0);
+    for (int j = 0; j < n_all; j++)
+    {
+      if (!initialPositions.empty()) simPosition[j] = initialPositions[j];
+      simPosition[j] = std::min(std::max(simPosition[j], joint_lower_limits_[j]), joint_upper_limits_[j]);
+      joint_position_[j] = simPosition[j];
+      joint_position_prev_[j] = simPosition[j];
+      joint_position_command_[j] = simPosition[j];
+    }
+    isInited = true;
+    return true;
+  }
+
+  ///samples the simulated joints
+  void read(ros::Time time, ros::Duration period)
+  {
+    if (!isInited) return;
+    for (int j = 0; j < n_joints_ + n_grippers_; j++)
+    {
+      joint_position_prev_[j] = joint_position_[j];
+      estimateState(j, simPosition[j], time.toSec());
+      joint_effort_[j] = 0.0;
+    }
+  }
+
+  ///steps the joints over period towards the commands
+  void write(ros::Time time, ros::Duration period)
+  {
+    if (!isInited) return;
+    enforceLimits(period);
+
+    double dt = period.toSec();
+    if (dt <= 0.0) return;
+    // substeps short against the joint model keep the integration stable for any period
+    double response = model == FIRST_ORDER ? timeConstant : 1.0/naturalFrequency;
+    int steps = 1;
+    if (response > 0.0) steps = std::min(YUMI_SIM_MAX_SUBSTEPS, (int)std::ceil(dt/(0.1*response)));
+    double h = dt/steps;
+
+    bool velocityMode = getControlStrategy() == JOINT_VELOCITY;
+    for (int j = 0; j < n_joints_ + n_grippers_; j++)
+    {
+      // the grippers only have position handles
+      bool velocity = velocityMode && j < n_joints_;
+      for (int s = 0; s < steps; s++)
+      {
+        stepJoint(j, velocity, h);
+      }
+    }
+  }
+
+  ///the simulated state, not the estimated one
+  double getSimPosition(int j) const { return simPosition[j]; }
+  double getSimVelocity(int j) const { return simVelocity[j]; }
+
+private:
+
+  ///one integration step of joint j over h (semi-implicit Euler)
+  void stepJoint(int j, bool velocity, double h)
+  {
+    double q = simPosition[j], v = simVelocity[j];
+    double v_des;
+    if (velocity)
+    {
+      // velocity commands go through a first order lag, of 1/(2 zeta wn) for the second order model
+      v_des = joint_velocity_command_[j];
+      double tau = model == FIRST_ORDER ? timeConstant : 1.0/(2.0*dampingRatio*naturalFrequency);
+      if (tau > h) v_des = v + (v_des - v)*h/tau;
+    }
+    else if (model == FIRST_ORDER)
+    {
+      double error = joint_position_command_[j] - q;
+      v_des = timeConstant > h ? error/timeConstant : error/h;
+    }
+    else
+    {
+      double a = naturalFrequency*naturalFrequency*(joint_position_command_[j] - q) - 2.0*dampingRatio*naturalFrequency*v;
+      v_des = v + a*h;
+    }
+
+    if (maxAcceleration[j] > 0.0)
+    {
+      double dv = maxAcceleration[j]*h;
+      v_des = std::min(std::max(v_des, v - dv), v + dv);
+    }
+    if (maxVelocity[j] > 0.0)
+    {
+      v_des = std::min(std::max(v_des, -maxVelocity[j]), maxVelocity[j]);
+    }
+
+    q += v_des*h;
+    // the joint stops at its position limits
+    if (q <= joint_lower_limits_[j] || q >= joint_upper_limits_[j])
+    {
+      q = std::min(std::max(q, joint_lower_limits_[j]), joint_upper_limits_[j]);
+      v_des = 0.0;
+    }
+    simPosition[j] = q;
+    simVelocity[j] = v_des;
+  }
+
+  bool isInited;
+  JointModel model;
+  double timeConstant, naturalFrequency, dampingRatio;
+  std::vector<double> initialPositions;
+  ///0 where the joint has no limit
+  std::vector<double> maxVelocity, maxAcceleration;
+  std::vector<double> simPosition, simVelocity;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __YUMI_JOINT_PACKET_H
+#define __YUMI_JOINT_PACKET_H
+
+#include <boost/static_assert.hpp>
+
+#include "simple_message/shared_types.h"
+
+#include "yumi_hw/yumi_rapid_protocol.h"
+#include "yumi_hw/yumi_lookahead.h"
+
+/**
+  * Payload of a YuMi joint message (YUMI_MSG_TYPE_YUMI_JOINTS), matching ROS_msg_yumi_joints
+  * in ROS_messages.sys. The controller sends its joint states in it, the PC answers with
+  * the command for both arms. Positions are in rad, velocities in rad/s, the timestamp is
+  * the controller clock in seconds: sent with the state, echoed back with the command.
+  * Efforts are the motor torques (GetMotorTorque, Nm) in the state, unused in the command.
+  */
+struct YumiJointPacket {
+    industrial::shared_types::shared_int sequence;
+    industrial::shared_types::shared_int mode;
+    industrial::shared_types::shared_real timestamp;
+    industrial::shared_types::shared_real position[N_YUMI_JOINTS];
+    industrial::shared_types::shared_real velocity[N_YUMI_JOINTS];
+    industrial::shared_types::shared_real effort[N_YUMI_JOINTS];
+};
+
+///a complete simple_message on the wire: length prefix, header and payload
+struct YumiJointFrame {
+    industrial::shared_types::shared_int length;
+    industrial::shared_types::shared_int msg_type;
+    industrial::shared_types::shared_int comm_type;
+    industrial::shared_types::shared_int reply_code;
+    YumiJointPacket data;
+
+    void setHeader(int comm, int reply) {
+	length = sizeof(YumiJointFrame) - sizeof(length);
+	msg_type = YUMI_MSG_TYPE_YUMI_JOINTS;
+	comm_type = comm;
+	reply_code = reply;
+    }
+};
+
+///a lookahead command on the wire (YUMI_MSG_TYPE_JOINT_STREAM), only the used points are sent
+struct YumiJointStreamFrame {
+    industrial::shared_types::shared_int length;
+    industrial::shared_types::shared_int msg_type;
+    industrial::shared_types::shared_int comm_type;
+    industrial::shared_types::shared_int reply_code;
+    industrial::shared_types::shared_int sequence;
+    industrial::shared_types::shared_int mode;
+    industrial::shared_types::shared_int points;
+    ///time from now, then the joints
+    industrial::shared_types::shared_real point[YUMI_STREAM_MAX_POINTS][1 + N_YUMI_JOINTS];
+
+    ///returns the number of bytes to send
+    int setHeader(int comm, int reply) {
+	int size = sizeof(YumiJointStreamFrame) - (YUMI_STREAM_MAX_POINTS - points)*sizeof(point[0]);
+	length = size - sizeof(length);
+	msg_type = YUMI_MSG_TYPE_JOINT_STREAM;
+	comm_type = comm;
+	reply_code = reply;
+	return size;
+    }
+};
+
+// the layout is the wire format, no padding allowed
+BOOST_STATIC_ASSERT(sizeof(YumiJointPacket) == YUMI_JOINT_PACKET_SIZE);
+BOOST_STATIC_ASSERT(sizeof(YumiJointFrame) == YUMI_JOINT_PACKET_SIZE + 16);
+BOOST_STATIC_ASSERT(sizeof(YumiJointStreamFrame) == 28 + YUMI_STREAM_MAX_POINTS*(1 + N_YUMI_JOINTS)*4);
+
+///joint state sample as received from the controller
+struct YumiJointState {
+    YumiJointPacket packet;
+    ///monotonic time the message was received, in ns
+    long long rx_time;
+    ///monotonic time the controller took the sample, from its timestamp, in ns
+    long long sample_time;
+};
+
+///joint command, laid out as the frame that goes on the wire
+struct YumiJointCommand {
+    YumiJointFrame frame;
+    ///receive time of the joint state the command was computed from
+    long long state_rx_time;
+    ///future setpoints, sent as a lookahead command when not empty
+    YumiSetpointWindow window;
+    ///reconnections the control thread had seen, the state is mirrored until it caught up
+    unsigned long reconnects;
+    ///mirror the state instead of sending the command, while the controllers are resynced
+    bool hold;
+};
+
+#endif
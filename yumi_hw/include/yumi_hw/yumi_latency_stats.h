@@ -0,0 +1,112 @@
+#ifndef __YUMI_LATENCY_STATS_H
+#define __YUMI_LATENCY_STATS_H
+
+#include <time.h>
+#include <string.h>
+
+#include <boost/atomic.hpp>
+
+///CLOCK_MONOTONIC in nanoseconds
+inline long long yumiMonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/**
+  * Fixed-memory log-linear histogram of durations in nanoseconds. Every power of two
+  * is split into 16 buckets, so quantiles are exact to about 6%. Recording is O(1)
+  * and never allocates; it is meant to be written from a single thread. A paused histogram
+  * drops the samples, so a warm-up can be left out without touching it from another thread.
+  */
+class YumiLatencyHistogram {
+    public:
+	static const int SUB_BUCKETS = 16;
+	static const int SUB_BITS = 4;
+	///covers durations up to 2^40 ns, about 18 minutes
+	static const int MAX_EXPONENT = 40;
+	static const int N_BUCKETS = (MAX_EXPONENT - SUB_BITS + 2)*SUB_BUCKETS;
+
+    private:
+	unsigned long counts_[N_BUCKETS];
+	unsigned long total_;
+	long long min_, max_;
+	double sum_;
+	boost::atomic<bool> recording_;
+
+	static int bucketOf(long long ns) {
+	    if(ns < SUB_BUCKETS) return ns < 0 ? 0 : (int)ns;
+	    int e = 63 - __builtin_clzll((unsigned long long)ns);
+	    if(e > MAX_EXPONENT) return N_BUCKETS - 1;
+	    int sub = (int)(ns >> (e - SUB_BITS)) & (SUB_BUCKETS - 1);
+	    return (e - SUB_BITS + 1)*SUB_BUCKETS + sub;
+	}
+
+    public:
+	///lower bound of bucket b in nanoseconds
+	static long long bucketLowerBound(int b) {
+	    if(b < SUB_BUCKETS) return b;
+	    int e = b/SUB_BUCKETS + SUB_BITS - 1;
+	    return (long long)(SUB_BUCKETS + b%SUB_BUCKETS) << (e - SUB_BITS);
+	}
+
+	YumiLatencyHistogram() : recording_(true) { reset(); }
+
+	void reset() {
+	    memset(counts_, 0, sizeof(counts_));
+	    total_ = 0;
+	    min_ = 0;
+	    max_ = 0;
+	    sum_ = 0.0;
+	}
+
+	///pause before the writer starts, resume from any thread
+	void pause() { recording_.store(false, boost::memory_order_release); }
+	void resume() { recording_.store(true, boost::memory_order_release); }
+
+	void record(long long ns) {
+	    if(!recording_.load(boost::memory_order_acquire)) return;
+	    counts_[bucketOf(ns)]++;
+	    if(total_ == 0 || ns < min_) min_ = ns;
+	    if(total_ == 0 || ns > max_) max_ = ns;
+	    sum_ += ns;
+	    total_++;
+	}
+
+	///adds the counts of another histogram to this one
+	void merge(const YumiLatencyHistogram &other) {
+	    if(other.total_ == 0) return;
+	    for(int b=0; b<N_BUCKETS; b++) {
+		counts_[b] += other.counts_[b];
+	    }
+	    if(total_ == 0 || other.min_ < min_) min_ = other.min_;
+	    if(total_ == 0 || other.max_ > max_) max_ = other.max_;
+	    sum_ += other.sum_;
+	    total_ += other.total_;
+	}
+
+	///value below which a fraction q of the samples lie, in nanoseconds
+	long long quantile(double q) const {
+	    if(total_ == 0) return 0;
+	    if(q >= 1.0) return max_;
+	    unsigned long rank = (unsigned long)(q*total_) + 1;
+	    unsigned long seen = 0;
+	    for(int b=0; b<N_BUCKETS; b++) {
+		seen += counts_[b];
+		if(seen >= rank) {
+		    // middle of the bucket, clamped to the observed range
+		    long long v = (bucketLowerBound(b) + bucketLowerBound(b+1))/2;
+		    return v < min_ ? min_ : (v > max_ ? max_ : v);
+		}
+	    }
+	    return max_;
+	}
+
+	unsigned long count() const { return total_; }
+	unsigned long bucketCount(int b) const { return counts_[b]; }
+	long long min() const { return min_; }
+	long long max() const { return max_; }
+	double mean() const { return total_ > 0 ? sum_/total_ : 0.0; }
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __YUMI_LOOKAHEAD_H
+#define __YUMI_LOOKAHEAD_H
+
+#include <string.h>
+
+#include "yumi_hw/yumi_rapid_protocol.h"
+
+///short run of future joint setpoints, time is measured from the moment the command is sent
+struct YumiSetpointWindow {
+    int length;
+    float time[YUMI_STREAM_MAX_POINTS];
+    float joints[YUMI_STREAM_MAX_POINTS][N_YUMI_JOINTS];
+};
+
+/**
+  * Extends the current position command into a window of setpoints for the RAPID motion
+  * tasks, so they can keep a zone-blended motion going when a PC cycle is late. The points
+  * follow the commanded velocity, ramped down to zero at the end of the window: if the PC
+  * stops answering, the arm comes to rest instead of running on.
+  */
+class YumiLookahead {
+    private:
+	int points_;
+	double period_;
+	///smoothing of the commanded velocity
+	double alpha_;
+
+	float previous_[N_YUMI_JOINTS];
+	float velocity_[N_YUMI_JOINTS];
+	bool hasPrevious_;
+
+    public:
+	YumiLookahead() : points_(0), period_(0.02), alpha_(0.3), hasPrevious_(false) {
+	    memset(velocity_, 0, sizeof(velocity_));
+	}
+
+	///points <= 0 disables the lookahead, period is the spacing of the points in seconds
+	void setup(int points, double period) {
+	    points_ = points < 0 ? 0 : (points > YUMI_STREAM_MAX_POINTS ? YUMI_STREAM_MAX_POINTS : points);
+	    period_ = period;
+	    reset();
+	}
+
+	bool isEnabled() const { return points_ > 0 && period_ > 0; }
+	int getPoints() const { return points_; }
+
+	///forgets the command history, e.g. after a switch of the control mode
+	void reset() {
+	    hasPrevious_ = false;
+	    memset(velocity_, 0, sizeof(velocity_));
+	}
+
+	///command is the position for one period from now, dt the time since the last call
+	void fill(const float (&command)[N_YUMI_JOINTS], double dt, YumiSetpointWindow &window) {
+	    if(!isEnabled()) {
+		window.length = 0;
+		return;
+	    }
+	    for(int j=0; j<N_YUMI_JOINTS; j++) {
+		if(hasPrevious_ && dt > 0) {
+		    velocity_[j] += alpha_*((command[j] - previous_[j])/dt - velocity_[j]);
+		}
+		previous_[j] = command[j];
+	    }
+	    hasPrevious_ = true;
+
+	    window.length = points_;
+	    for(int k=0; k<points_; k++) {
+		window.time[k] = (k+1)*period_;
+		double scale = (double)(points_ - k)/points_;
+		for(int j=0; j<N_YUMI_JOINTS; j++) {
+		    window.joints[k][j] = k == 0 ? command[j] :
+			window.joints[k-1][j] + velocity_[j]*period_*scale;
+		}
+	    }
+	}
+};
+
+#endif
@@ -0,0 +1,714 @@
+#ifndef __YUMI_MOCK_CONTROLLER_H
+#define __YUMI_MOCK_CONTROLLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include <ros/ros.h>
+
+#include "yumi_hw/yumi_hw.h"
+#include "yumi_hw/yumi_rapid_protocol.h"
+#include "yumi_hw/yumi_joint_packet.h"
+#include "yumi_hw/yumi_udp_socket.h"
+
+#define YUMI_MOCK_MAX_MSG 1024
+
+/**
+  * Server side of a simple_message connection, framed by hand the same way ROS_socket.sys
+  * does it. Accept and receive take a timeout so the mock can always be shut down.
+  */
+class YumiMockServerSocket {
+    private:
+	int listen_fd_, client_fd_;
+	bool no_delay_;
+
+	bool readAll(char *buffer, int n) {
+	    while(n > 0) {
+		int rc = recv(client_fd_, buffer, n, 0);
+		if(rc <= 0) {
+		    disconnect();
+		    return false;
+		}
+		buffer += rc;
+		n -= rc;
+	    }
+	    return true;
+	}
+
+    public:
+	YumiMockServerSocket() : listen_fd_(-1), client_fd_(-1), no_delay_(true) {}
+	~YumiMockServerSocket() { close(); }
+
+	bool listen(int port, bool no_delay) {
+	    no_delay_ = no_delay;
+	    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+	    if(listen_fd_ < 0) return false;
+	    int on = 1;
+	    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	    struct sockaddr_in addr;
+	    memset(&addr, 0, sizeof(addr));
+	    addr.sin_family = AF_INET;
+	    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	    addr.sin_port = htons(port);
+	    if(bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listen_fd_, 1) != 0) {
+		ROS_ERROR("Mock controller: could not listen on port %d: %s", port, strerror(errno));
+		close();
+		return false;
+	    }
+	    return true;
+	}
+
+	///waits up to timeout_ms for a client, returns true once one is connected
+	bool accept(int timeout_ms) {
+	    if(isConnected()) return true;
+	    struct pollfd pfd = {listen_fd_, POLLIN, 0};
+	    if(poll(&pfd, 1, timeout_ms) <= 0) return false;
+	    client_fd_ = ::accept(listen_fd_, NULL, NULL);
+	    if(client_fd_ < 0) return false;
+	    int on = no_delay_ ? 1 : 0;
+	    setsockopt(client_fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	    return true;
+	}
+
+	bool isConnected() const { return client_fd_ >= 0; }
+
+	void disconnect() {
+	    if(client_fd_ >= 0) ::close(client_fd_);
+	    client_fd_ = -1;
+	}
+
+	void close() {
+	    disconnect();
+	    if(listen_fd_ >= 0) ::close(listen_fd_);
+	    listen_fd_ = -1;
+	}
+
+	bool sendMsg(int msg_type, int comm_type, int reply_code, const char *data, int data_len) {
+	    if(!isConnected()) return false;
+	    char buffer[YUMI_MOCK_MAX_MSG];
+	    if(data_len + 16 > YUMI_MOCK_MAX_MSG) return false;
+	    int header[4] = {12 + data_len, msg_type, comm_type, reply_code};
+	    memcpy(buffer, header, sizeof(header));
+	    memcpy(buffer + sizeof(header), data, data_len);
+	    if(send(client_fd_, buffer, data_len + 16, MSG_NOSIGNAL) != data_len + 16) {
+		disconnect();
+		return false;
+	    }
+	    return true;
+	}
+
+	///1 if a message was received, 0 on timeout, -1 if the client went away
+	int receiveMsg(int &msg_type, char *data, int max_len, int &data_len, int timeout_ms) {
+	    if(!isConnected()) return -1;
+	    struct pollfd pfd = {client_fd_, POLLIN, 0};
+	    if(poll(&pfd, 1, timeout_ms) <= 0) return 0;
+
+	    int header[4];
+	    if(!readAll((char*)header, sizeof(header))) return -1;
+	    msg_type = header[1];
+	    data_len = header[0] - 12;
+	    if(data_len < 0 || data_len > max_len) {
+		disconnect();
+		return -1;
+	    }
+	    return readAll(data, data_len) ? 1 : -1;
+	}
+};
+
+/**
+  * Settings of the mock controller. Times are in seconds, gripper values in mm and mm/s.
+  */
+struct YumiMockControllerConfig {
+    ///ports <= 0 disable the corresponding server, with a right_state_port the state_port
+    ///serves the left arm only (ROS_stateServer_left/right.mod)
+    int state_port;
+    int right_state_port;
+    int gripper_state_port;
+    int gripper_command_port;
+    ///disable Nagle's algorithm on the accepted connections
+    bool tcp_no_delay;
+    ///with an egm_port > 0 the joint states are streamed as UDP datagrams to egm_address:egm_port
+    ///instead of being served on the state ports, like the UDP backend (YumiHWEgm) expects
+    int egm_port;
+    std::string egm_address;
+    ///without a command datagram for this long, velocity commands are stopped
+    double egm_timeout;
+
+    ///period of the joint state exchange (the ROS_stateServer loop)
+    double cycle_time;
+    ///delay between receiving a command and the joints starting to follow it
+    double response_latency;
+    ///first-order time constants of the joint position and velocity response
+    double position_time_constant;
+    double velocity_time_constant;
+    ///the joints report the torque that accelerates this inertia (kg m^2) as their effort
+    double joint_inertia;
+    ///probability that a cycle's exchange is skipped, or that a received command is lost
+    double state_drop_rate;
+    double command_drop_rate;
+    ///rate error of the controller clock, e.g. 50e-6 runs it 50 ppm fast
+    double clock_drift;
+
+    double gripper_cycle_time;
+    ///speed of targets that do not set one
+    double gripper_speed;
+    double gripper_max_position;
+    ///width of an object between the fingers of both grippers, a grip stops on it. 0 for none.
+    double gripper_object_width;
+
+    unsigned int seed;
+    float initial_positions[N_YUMI_JOINTS];
+
+    YumiMockControllerConfig() {
+	state_port = YUMI_STATE_PORT;
+	right_state_port = -1;
+	gripper_state_port = DEFAULT_STATE_PORT;
+	gripper_command_port = DEFAULT_COMMAND_PORT;
+	tcp_no_delay = true;
+	egm_port = -1;
+	egm_address = "127.0.0.1";
+	egm_timeout = 0.1;
+	cycle_time = 0.004;
+	response_latency = 0.0;
+	position_time_constant = 0.02;
+	velocity_time_constant = 0.01;
+	joint_inertia = 0.05;
+	state_drop_rate = 0.0;
+	command_drop_rate = 0.0;
+	clock_drift = 0.0;
+	gripper_cycle_time = 0.02;
+	gripper_speed = 20.0;
+	gripper_max_position = 25.0;
+	gripper_object_width = 0.0;
+	seed = 1;
+	for(int i=0; i<N_YUMI_JOINTS; i++) {
+	    initial_positions[i] = 0.0;
+	}
+    }
+};
+
+/**
+  * Stands in for the IRC5: serves the lockstep joint protocol of ROS_stateServer.mod, or
+  * streams the joints over UDP, and the gripper state/command servers, and moves simulated
+  * joints and fingers according to the received targets.
+  */
+class YumiMockController {
+    private:
+	struct PendingCommand {
+	    double due;
+	    float targets[N_YUMI_JOINTS];
+	    int mode;
+	    ///later point of a lookahead window, superseded by the next command
+	    bool lookahead;
+	};
+
+	///one state server and the joints it moves, both arms or a single one
+	struct JointChannel {
+	    YumiMockServerSocket server;
+	    boost::thread thread;
+	    int port;
+	    int first_joint, end_joint;
+
+	    ///owned by the channel thread
+	    float targets[N_YUMI_JOINTS];
+	    int mode;
+	    int sequence;
+	    std::deque<PendingCommand> pending;
+	    unsigned int rand_state;
+	};
+
+	YumiMockControllerConfig config_;
+
+	JointChannel channels_[2];
+	int n_channels_;
+	YumiMockServerSocket gripper_state_server_;
+	YumiMockServerSocket gripper_command_server_;
+	YumiUdpSocket egm_socket_;
+	struct sockaddr_in egm_to_;
+
+	boost::thread gripper_state_thread_, gripper_command_thread_;
+	boost::atomic<bool> stop_;
+
+	///joint model, every channel thread owns the joints of its channel
+	float positions_[N_YUMI_JOINTS];
+	float velocities_[N_YUMI_JOINTS];
+	float efforts_[N_YUMI_JOINTS];
+	double start_time_;
+
+	///gripper model
+	boost::mutex gripper_mutex_;
+	float gripper_positions_[2];
+	float gripper_targets_[2];
+	float gripper_speeds_[2];
+
+	///published joint positions and statistics
+	boost::mutex state_mutex_;
+	float published_positions_[N_YUMI_JOINTS];
+	boost::atomic<unsigned long> cycles_, dropped_states_, dropped_commands_, gripper_commands_;
+
+	static double now() {
+	    struct timespec ts;
+	    clock_gettime(CLOCK_MONOTONIC, &ts);
+	    return ts.tv_sec + 1e-9*ts.tv_nsec;
+	}
+
+	///ClkRead time of the state servers at t, starting over every YUMI_CLOCK_WRAP seconds
+	double clockTime(double t) const {
+	    return fmod((t - start_time_)*(1.0 + config_.clock_drift), YUMI_CLOCK_WRAP);
+	}
+
+	static void sleepUntil(double t) {
+	    struct timespec ts;
+	    ts.tv_sec = (time_t)t;
+	    ts.tv_nsec = (long)((t - ts.tv_sec)*1e9);
+	    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+
+	static bool drop(JointChannel &channel, double rate) {
+	    return rate > 0 && rand_r(&channel.rand_state) < rate*((double)RAND_MAX + 1.0);
+	}
+
+	///first-order response of the joints of the channel to its active targets over dt
+	void stepJoints(JointChannel &channel, double dt) {
+	    if(dt <= 0) return;
+	    double ap = 1.0 - exp(-dt/config_.position_time_constant);
+	    double av = 1.0 - exp(-dt/config_.velocity_time_constant);
+	    for(int i=channel.first_joint; i<channel.end_joint; i++) {
+		float prev_velocity = velocities_[i];
+		if(channel.mode == YumiHW::JOINT_VELOCITY) {
+		    velocities_[i] += av*(channel.targets[i] - velocities_[i]);
+		    positions_[i] += velocities_[i]*dt;
+		}
+		else {
+		    float prev = positions_[i];
+		    positions_[i] += ap*(channel.targets[i] - positions_[i]);
+		    velocities_[i] = (positions_[i] - prev)/dt;
+		}
+		efforts_[i] = config_.joint_inertia*(velocities_[i] - prev_velocity)/dt;
+	    }
+	}
+
+	///applies the queued commands whose latency has elapsed
+	void applyPending(JointChannel &channel, double t) {
+	    while(!channel.pending.empty() && channel.pending.front().due <= t) {
+		const PendingCommand &cmd = channel.pending.front();
+		memcpy(&channel.targets,&cmd.targets,sizeof(channel.targets));
+		if(cmd.mode != channel.mode && cmd.mode == YumiHW::JOINT_VELOCITY) {
+		    for(int i=channel.first_joint; i<channel.end_joint; i++) velocities_[i] = 0.0;
+		}
+		channel.mode = cmd.mode;
+		channel.pending.pop_front();
+	    }
+	}
+
+	///queues the points of a lookahead command (ROS_receive_msg_joint_command), the motion
+	///tasks step through them one move time after the other until the next command arrives
+	void queueStream(JointChannel &channel, const char *data, int len, double t) {
+	    int header[3];
+	    if(len < (int)sizeof(header)) return;
+	    memcpy(header, data, sizeof(header));
+	    int points = header[2];
+	    const int point_size = (1 + N_YUMI_JOINTS)*sizeof(float);
+	    if(points < 1 || points > YUMI_STREAM_MAX_POINTS || len < (int)sizeof(header) + points*point_size) {
+		ROS_WARN("Mock controller: malformed joint stream with %d points in %d bytes", points, len);
+		return;
+	    }
+	    while(!channel.pending.empty() && channel.pending.back().lookahead) {
+		channel.pending.pop_back();
+	    }
+	    float first_time = 0.0;
+	    for(int k=0; k<points; k++) {
+		float point[1 + N_YUMI_JOINTS];
+		memcpy(point, data + sizeof(header) + k*point_size, point_size);
+		if(k == 0) first_time = point[0];
+		PendingCommand cmd;
+		memcpy(&cmd.targets, &point[1], sizeof(cmd.targets));
+		cmd.mode = header[1];
+		cmd.due = t + config_.response_latency + (point[0] - first_time);
+		cmd.lookahead = k > 0;
+		channel.pending.push_back(cmd);
+	    }
+	}
+
+	///sends the joints of the channel (ROS_send_msg_yumi_joints) and waits for the command,
+	///a single arm channel leaves the joints of the other arm at zero
+	bool exchangeJoints(JointChannel &channel, double t) {
+	    YumiJointPacket state;
+	    memset(&state, 0, sizeof(state));
+	    state.sequence = channel.sequence++;
+	    state.mode = channel.mode;
+	    state.timestamp = clockTime(t);
+	    for(int i=channel.first_joint; i<channel.end_joint; i++) {
+		state.position[i] = positions_[i];
+		state.velocity[i] = velocities_[i];
+		state.effort[i] = efforts_[i];
+	    }
+	    if(!channel.server.sendMsg(YUMI_MSG_TYPE_YUMI_JOINTS, YUMI_COMM_TYPE_TOPIC, YUMI_REPLY_TYPE_INVALID,
+			(const char*)&state, sizeof(state))) {
+		return false;
+	    }
+
+	    float data[YUMI_MOCK_MAX_MSG/sizeof(float)];
+	    int msg_type, len, rc;
+	    while((rc = channel.server.receiveMsg(msg_type, (char*)data, sizeof(data), len, 100)) == 0) {
+		if(stop_) return false;
+	    }
+	    if(rc < 0) return false;
+
+	    if(!(msg_type == YUMI_MSG_TYPE_YUMI_JOINTS && len >= (int)sizeof(YumiJointPacket)) &&
+		    msg_type != YUMI_MSG_TYPE_JOINT_STREAM) {
+		ROS_WARN("Mock controller: unexpected message type %d of %d bytes", msg_type, len);
+		return true;
+	    }
+	    if(drop(channel, config_.command_drop_rate)) {
+		dropped_commands_++;
+		return true;
+	    }
+	    if(msg_type == YUMI_MSG_TYPE_JOINT_STREAM) {
+		queueStream(channel, (const char*)data, len, t);
+		return true;
+	    }
+
+	    YumiJointPacket command;
+	    memcpy(&command, data, sizeof(command));
+	    queueCommand(channel, command, t);
+	    return true;
+	}
+
+	///queues a single setpoint, it replaces what is left of a lookahead window
+	void queueCommand(JointChannel &channel, const YumiJointPacket &command, double t) {
+	    PendingCommand cmd;
+	    cmd.mode = command.mode;
+	    if(cmd.mode == YumiHW::JOINT_VELOCITY) {
+		memcpy(&cmd.targets, &command.velocity, sizeof(cmd.targets));
+	    }
+	    else {
+		memcpy(&cmd.targets, &command.position, sizeof(cmd.targets));
+	    }
+	    cmd.due = t + config_.response_latency;
+	    cmd.lookahead = false;
+	    while(!channel.pending.empty() && channel.pending.back().lookahead) {
+		channel.pending.pop_back();
+	    }
+	    channel.pending.push_back(cmd);
+	}
+
+	///takes the command datagrams that arrived since the last cycle, without waiting for any.
+	///Only answers to a newer state than the last applied command count.
+	bool receiveEgmCommands(JointChannel &channel, double t, int &last_echo, bool &has_echo) {
+	    bool received = false;
+	    YumiJointFrame frame;
+	    struct sockaddr_in from;
+	    int n;
+	    while((n = egm_socket_.receive(&frame, sizeof(frame), 0, from)) > 0) {
+		if(n != (int)sizeof(frame) || frame.msg_type != YUMI_MSG_TYPE_YUMI_JOINTS) {
+		    ROS_WARN_THROTTLE(1.0, "Mock controller: unexpected datagram of %d bytes", n);
+		    continue;
+		}
+		if(drop(channel, config_.command_drop_rate)) {
+		    dropped_commands_++;
+		    continue;
+		}
+		if(has_echo && frame.data.sequence - last_echo <= 0) continue;
+		has_echo = true;
+		last_echo = frame.data.sequence;
+		queueCommand(channel, frame.data, t);
+		received = true;
+	    }
+	    return received;
+	}
+
+	///the controller end of the UDP streaming: a state datagram every cycle, whatever came back
+	void egmThread() {
+	    JointChannel &channel = channels_[0];
+	    double last = now(), next = last, last_command = last;
+	    int last_echo = 0;
+	    bool has_echo = false;
+	    while(!stop_) {
+		next += config_.cycle_time;
+		sleepUntil(next);
+		double t = now();
+
+		if(receiveEgmCommands(channel, t, last_echo, has_echo)) {
+		    last_command = t;
+		}
+		else if(t - last_command > config_.egm_timeout && channel.mode == YumiHW::JOINT_VELOCITY) {
+		    // the sensor went quiet, stop instead of running on
+		    for(int i=0; i<N_YUMI_JOINTS; i++) channel.targets[i] = 0.0;
+		    channel.pending.clear();
+		}
+		applyPending(channel, t);
+		stepJoints(channel, t - last);
+		last = t;
+
+		{
+		    boost::mutex::scoped_lock lock(state_mutex_);
+		    memcpy(&published_positions_,&positions_,sizeof(published_positions_));
+		}
+		cycles_++;
+
+		// a dropped datagram is lost on the way, its sequence number is used up
+		YumiJointFrame state;
+		state.data.sequence = channel.sequence++;
+		if(drop(channel, config_.state_drop_rate)) {
+		    dropped_states_++;
+		    continue;
+		}
+		state.setHeader(YUMI_COMM_TYPE_TOPIC, YUMI_REPLY_TYPE_INVALID);
+		state.data.mode = channel.mode;
+		state.data.timestamp = clockTime(t);
+		memcpy(&state.data.position,&positions_,sizeof(state.data.position));
+		memcpy(&state.data.velocity,&velocities_,sizeof(state.data.velocity));
+		memcpy(&state.data.effort,&efforts_,sizeof(state.data.effort));
+		egm_socket_.sendTo(&state, sizeof(state), egm_to_);
+
+		if(now() > next + config_.cycle_time) next = now();
+	    }
+	}
+
+	void stateThread(int c) {
+	    JointChannel &channel = channels_[c];
+	    double last = now(), next = last;
+	    while(!stop_) {
+		if(!channel.server.isConnected()) {
+		    if(!channel.server.accept(100)) {
+			continue;
+		    }
+		    ROS_INFO("Mock controller: state client connected on port %d", channel.port);
+		    // a new client starts from the current position, like the RAPID tasks after ExitCycle.
+		    // The joints of the other channel belong to its thread.
+		    for(int i=channel.first_joint; i<channel.end_joint; i++) {
+			channel.targets[i] = positions_[i];
+		    }
+		    channel.mode = YumiHW::JOINT_POSITION;
+		    channel.pending.clear();
+		    last = next = now();
+		}
+
+		next += config_.cycle_time;
+		sleepUntil(next);
+		double t = now();
+		applyPending(channel, t);
+		stepJoints(channel, t - last);
+		last = t;
+
+		{
+		    boost::mutex::scoped_lock lock(state_mutex_);
+		    for(int i=channel.first_joint; i<channel.end_joint; i++) {
+			published_positions_[i] = positions_[i];
+		    }
+		}
+		cycles_++;
+
+		if(drop(channel, config_.state_drop_rate)) {
+		    dropped_states_++;
+		    continue;
+		}
+		if(!exchangeJoints(channel, t)) {
+		    ROS_WARN("Mock controller: state client disconnected");
+		}
+		// do not try to catch up on cycles lost while the client was slow
+		if(now() > next + config_.cycle_time) next = now();
+	    }
+	}
+
+	void gripperStateThread() {
+	    double last = now(), next = last;
+	    unsigned int sequence = 0;
+	    while(!stop_) {
+		if(!gripper_state_server_.isConnected()) {
+		    if(!gripper_state_server_.accept(100)) {
+			continue;
+		    }
+		    last = next = now();
+		}
+		next += config_.gripper_cycle_time;
+		sleepUntil(next);
+		double t = now();
+
+		float data[3];
+		{
+		    boost::mutex::scoped_lock lock(gripper_mutex_);
+		    // fingers move at constant speed towards the target, closing fingers stop on the object
+		    for(int i=0; i<2; i++) {
+			float step = gripper_speeds_[i]*(t - last);
+			float target = gripper_targets_[i];
+			if(gripper_positions_[i] >= config_.gripper_object_width) {
+			    target = std::max(target, (float)config_.gripper_object_width);
+			}
+			if(target < gripper_positions_[i]) gripper_positions_[i] = std::max(target, gripper_positions_[i] - step);
+			else gripper_positions_[i] = std::min(target, gripper_positions_[i] + step);
+		    }
+		    int seq = sequence++;
+		    memcpy(&data[0], &seq, sizeof(seq));
+		    data[1] = gripper_positions_[0];
+		    data[2] = gripper_positions_[1];
+		}
+		last = t;
+
+		gripper_state_server_.sendMsg(MSG_TYPE_GRIPPER_STATE, YUMI_COMM_TYPE_TOPIC, YUMI_REPLY_TYPE_INVALID,
+			(const char*)data, sizeof(data));
+	    }
+	}
+
+	void gripperCommandThread() {
+	    while(!stop_) {
+		if(!gripper_command_server_.accept(100)) {
+		    continue;
+		}
+		int msg_type, len;
+		float data[YUMI_MOCK_MAX_MSG/sizeof(float)];
+		if(gripper_command_server_.receiveMsg(msg_type, (char*)data, sizeof(data), len, 100) != 1) continue;
+
+		boost::mutex::scoped_lock lock(gripper_mutex_);
+		if(msg_type == YUMI_MSG_TYPE_GRIPPER_TARGET && len >= YUMI_GRIPPER_TARGET_SIZE) {
+		    // sequence, then mode, position, speed and force per gripper
+		    for(int i=0; i<2; i++) {
+			const float *target = &data[1 + 4*i];
+			int mode;
+			memcpy(&mode, &target[0], sizeof(mode));
+			applyGripperTarget(i, mode, target[1], target[2]);
+		    }
+		}
+		else if(msg_type == MSG_TYPE_GRIPPER_COMMAND && len >= (int)(2*sizeof(float))) {
+		    // a grip force per gripper, towards closed or open
+		    for(int i=0; i<2; i++) {
+			if(data[i] != 0) applyGripperTarget(i, YUMI_GRIPPER_GRIP, data[i] > 0 ? 0.0 : config_.gripper_max_position, 0.0);
+		    }
+		}
+		else {
+		    continue;
+		}
+		gripper_commands_++;
+	    }
+	}
+
+	///with the gripper mutex held
+	void applyGripperTarget(int gripper, int mode, double position, double speed) {
+	    if(mode == YUMI_GRIPPER_KEEP) return;
+	    if(mode == YUMI_GRIPPER_STOP) {
+		gripper_targets_[gripper] = gripper_positions_[gripper];
+		return;
+	    }
+	    gripper_targets_[gripper] = std::min(std::max(position, 0.0), config_.gripper_max_position);
+	    if(speed > 0) gripper_speeds_[gripper] = speed;
+	}
+
+    public:
+	YumiMockController() {
+	    stop_ = true;
+	    n_channels_ = 1;
+	    cycles_ = 0;
+	    dropped_states_ = 0;
+	    dropped_commands_ = 0;
+	    gripper_commands_ = 0;
+	}
+
+	~YumiMockController() {
+	    stop();
+	}
+
+	bool init(const YumiMockControllerConfig &config) {
+	    config_ = config;
+	    start_time_ = now();
+	    for(int i=0; i<N_YUMI_JOINTS; i++) {
+		positions_[i] = published_positions_[i] = config_.initial_positions[i];
+		velocities_[i] = 0.0;
+		efforts_[i] = 0.0;
+	    }
+	    bool egm = config_.egm_port > 0;
+	    n_channels_ = config_.right_state_port > 0 && !egm ? 2 : 1;
+	    for(int c=0; c<n_channels_; c++) {
+		JointChannel &channel = channels_[c];
+		channel.port = c == 0 ? config_.state_port : config_.right_state_port;
+		channel.first_joint = c == 0 ? 0 : N_YUMI_ARM_JOINTS;
+		channel.end_joint = n_channels_ == 2 && c == 0 ? N_YUMI_ARM_JOINTS : N_YUMI_JOINTS;
+		channel.mode = YumiHW::JOINT_POSITION;
+		channel.sequence = 0;
+		channel.rand_state = config_.seed + c;
+		channel.pending.clear();
+		memcpy(&channel.targets,&positions_,sizeof(channel.targets));
+	    }
+	    for(int i=0; i<2; i++) {
+		gripper_positions_[i] = gripper_targets_[i] = config_.gripper_max_position;
+		gripper_speeds_[i] = config_.gripper_speed;
+	    }
+
+	    if(egm) {
+		if(!YumiUdpSocket::resolve(config_.egm_address, config_.egm_port, egm_to_) || !egm_socket_.open(0)) {
+		    ROS_ERROR("Mock controller: could not stream to %s:%d", config_.egm_address.c_str(), config_.egm_port);
+		    return false;
+		}
+		ROS_INFO("Mock controller: streaming joint states to %s:%d", config_.egm_address.c_str(), config_.egm_port);
+	    }
+	    if((config_.state_port > 0 && !egm && !channels_[0].server.listen(config_.state_port, config_.tcp_no_delay)) ||
+		    (n_channels_ == 2 && !channels_[1].server.listen(config_.right_state_port, config_.tcp_no_delay)) ||
+		    (config_.gripper_state_port > 0 && !gripper_state_server_.listen(config_.gripper_state_port, config_.tcp_no_delay)) ||
+		    (config_.gripper_command_port > 0 && !gripper_command_server_.listen(config_.gripper_command_port, config_.tcp_no_delay))) {
+		ROS_ERROR("Mock controller: could not open the server sockets");
+		return false;
+	    }
+	    ROS_INFO("Mock controller: serving joint states on %d (right arm on %d), gripper states on %d and gripper commands on %d",
+		    config_.state_port, config_.right_state_port, config_.gripper_state_port, config_.gripper_command_port);
+	    return true;
+	}
+
+	void start() {
+	    if(!stop_) return;
+	    stop_ = false;
+	    if(config_.egm_port > 0)
+		channels_[0].thread = boost::thread(boost::bind(&YumiMockController::egmThread, this));
+	    else if(config_.state_port > 0)
+		for(int c=0; c<n_channels_; c++)
+		    channels_[c].thread = boost::thread(boost::bind(&YumiMockController::stateThread, this, c));
+	    if(config_.gripper_state_port > 0)
+		gripper_state_thread_ = boost::thread(boost::bind(&YumiMockController::gripperStateThread, this));
+	    if(config_.gripper_command_port > 0)
+		gripper_command_thread_ = boost::thread(boost::bind(&YumiMockController::gripperCommandThread, this));
+	}
+
+	void stop() {
+	    if(stop_) return;
+	    stop_ = true;
+	    for(int c=0; c<2; c++) channels_[c].thread.join();
+	    gripper_state_thread_.join();
+	    gripper_command_thread_.join();
+	    for(int c=0; c<2; c++) channels_[c].server.close();
+	    gripper_state_server_.close();
+	    gripper_command_server_.close();
+	    egm_socket_.close();
+	}
+
+	void getJointPositions(float (&joints)[N_YUMI_JOINTS]) {
+	    boost::mutex::scoped_lock lock(state_mutex_);
+	    memcpy(&joints,&published_positions_,sizeof(joints));
+	}
+
+	void getGripperPositions(float &left, float &right) {
+	    boost::mutex::scoped_lock lock(gripper_mutex_);
+	    left = gripper_positions_[0];
+	    right = gripper_positions_[1];
+	}
+
+	///state cycles summed over the channels, each channel runs one per cycle_time
+	unsigned long getCycles() const { return cycles_; }
+	int getChannels() const { return n_channels_; }
+	unsigned long getDroppedStates() const { return dropped_states_; }
+	unsigned long getDroppedCommands() const { return dropped_commands_; }
+	unsigned long getGripperCommands() const { return gripper_commands_; }
+};
+
+#endif
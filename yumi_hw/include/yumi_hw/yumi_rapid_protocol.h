@@ -0,0 +1,112 @@
+#ifndef __YUMI_RAPID_PROTOCOL_H
+#define __YUMI_RAPID_PROTOCOL_H
+
+/**
+  * Constants shared with the RAPID servers in rapid/ (see ROS_messages.sys).
+  */
+
+#ifndef N_YUMI_JOINTS
+#define N_YUMI_JOINTS 14
+#endif
+
+// simple_message framing, see ROS_messages.sys
+#define YUMI_MSG_TYPE_JOINT 10
+#define YUMI_COMM_TYPE_TOPIC 1
+#define YUMI_COMM_TYPE_SRV_REQ 2
+#define YUMI_COMM_TYPE_SRV_REPLY 3
+#define YUMI_REPLY_TYPE_INVALID 0
+#define YUMI_REPLY_TYPE_SUCCESS 1
+#define YUMI_REPLY_TYPE_FAILURE 2
+// message type, comm type and reply code, after the length prefix
+#define YUMI_HEADER_SIZE 12
+// largest message the PC expects from the controller
+#define YUMI_SCRATCH_SIZE 1024
+
+// number of joint values in a joint message (ROS_MSG_MAX_JOINTS)
+#define YUMI_MSG_MAX_JOINTS 20
+
+// lookahead command: sequence, mode and number of points (int32), then per point the
+// time from now (float) and 14 joint values (ROS_MSG_TYPE_JOINT_STREAM)
+#define YUMI_MSG_TYPE_JOINT_STREAM 8010
+#define YUMI_STREAM_MAX_POINTS 4
+
+// YuMi joint message: sequence and mode (int32), controller timestamp (float, s), then 14
+// positions, 14 velocities and 14 efforts (float), see YumiJointPacket in yumi_joint_packet.h
+#define YUMI_MSG_TYPE_YUMI_JOINTS 8012
+#define YUMI_JOINT_PACKET_SIZE (3*4 + 3*N_YUMI_JOINTS*4)
+// the controller timestamp is ClkRead time of the sample, it starts over every
+// YUMI_CLOCK_WRAP seconds to keep the precision of a float (ROS_CLOCK_WRAP)
+#define YUMI_CLOCK_WRAP 1000.0
+
+// joint state server port, with one connection per arm it serves the left arm only and the
+// right arm has a server of its own (ROS_stateServer_left/right.mod)
+#define YUMI_STATE_PORT 11002
+#define YUMI_RIGHT_STATE_PORT 11004
+
+// UDP streaming in the style of Externally Guided Motion (YumiHWEgm): every cycle the
+// controller sends its joint states as a YuMi joint message, length prefix and header
+// included, in one datagram to the PC, which answers each with a command datagram of the
+// same layout. Datagrams may be lost or reordered, the sequence numbers tell.
+#define YUMI_EGM_PORT 6510
+// a sequence number further behind than this is a restarted sender, not a late datagram
+#define YUMI_EGM_REORDER_WINDOW 1000
+
+// arms, the left arm comes first in the joint messages
+#define N_YUMI_ARM_JOINTS 7
+#define YUMI_LEFT_ARM 1
+#define YUMI_RIGHT_ARM 2
+
+// trajectory download (ROS_trajectoryServer.mod): arm, flags, trajectory id and number of
+// points (int32), then per point the duration of the move to it (float) and the 7 joints
+// of the arm. Every request is answered with the status of the arm: arm, trajectory id,
+// state, point being executed and number of points (int32), then the 7 joints (float).
+#define YUMI_MSG_TYPE_TRAJECTORY 8011
+#define YUMI_TRAJECTORY_PORT 11000
+#define YUMI_TRAJ_CHUNK_POINTS 24
+#define YUMI_TRAJ_MAX_POINTS 200
+
+// request flags, a request without flags only asks for the status
+#define YUMI_TRAJ_START 1
+#define YUMI_TRAJ_END 2
+#define YUMI_TRAJ_STOP 4
+
+// trajectory states
+#define YUMI_TRAJ_IDLE 0
+#define YUMI_TRAJ_LOADING 1
+#define YUMI_TRAJ_RUNNING 2
+#define YUMI_TRAJ_DONE 3
+#define YUMI_TRAJ_ABORTED 4
+
+// gripper messages
+#define MSG_TYPE_GRIPPER_COMMAND 8008
+#define MSG_TYPE_GRIPPER_STATE 8009
+
+// gripper server ports
+#define DEFAULT_STATE_PORT 12002
+#define DEFAULT_COMMAND_PORT 12000
+
+#define LEFT_GRIPPER 1
+#define RIGHT_GRIPPER 2
+
+// gripper state: sequence (int32), then the left and right finger opening in mm (float),
+// see Gripper_stateServer.mod. The original command (MSG_TYPE_GRIPPER_COMMAND) is a grip
+// force per gripper in N: > 0 grips inwards, < 0 outwards, 0 leaves the gripper alone.
+#define N_YUMI_GRIPPERS 2
+
+// gripper target (GripperMotion_left/right.mod): sequence (int32), then per gripper, left
+// first, mode (int32), finger opening in mm, speed in mm/s and force limit in N (float).
+// Every gripper is commanded on its own, one in YUMI_GRIPPER_KEEP is left alone. A speed
+// <= 0 keeps the current speed.
+#define YUMI_MSG_TYPE_GRIPPER_TARGET 8013
+#define YUMI_GRIPPER_TARGET_SIZE (4 + N_YUMI_GRIPPERS*4*4)
+
+// gripper modes: move the fingers to the opening, grip towards it with the force limit
+// (stopping on an object), or stop them where they are
+#define YUMI_GRIPPER_KEEP 0
+#define YUMI_GRIPPER_MOVE 1
+#define YUMI_GRIPPER_GRIP 2
+#define YUMI_GRIPPER_STOP 3
+// full stroke of the fingers in m
+#define YUMI_GRIPPER_MAX_OPENING 0.025
+
+#endif
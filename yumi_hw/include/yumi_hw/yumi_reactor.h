@@ -0,0 +1,205 @@
+#ifndef __YUMI_REACTOR_H
+#define __YUMI_REACTOR_H
+
+#include <map>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+
+#define YUMI_REACTOR_MAX_EVENTS 16
+
+/**
+  * Event loop on a single thread: sleeps in epoll_wait until one of the registered sockets
+  * has data, one of its timers (timerfd) expires or one of its events (eventfd) is signaled,
+  * and calls the callback registered for it. Sockets, timers and events are added and removed
+  * before start() or from within a callback, that is on the reactor thread only. signal() may
+  * be called from any thread. The callbacks must not block, the others wait meanwhile: a
+  * socket is read with YumiTcpClient::receiveSome(), which resumes a partial message later.
+  */
+class YumiReactor {
+    public:
+	typedef boost::function<void()> Callback;
+
+    private:
+	struct Entry {
+	    Callback callback;
+	    ///tells a registration from an earlier one of the same, since reused, descriptor
+	    uint32_t generation;
+	    ///a timer or an event, owned by the reactor and read before the callback
+	    bool counter;
+	};
+
+	int epoll_fd_;
+	///written by stop() to wake the loop
+	int wake_fd_;
+	std::map<int, Entry> entries_;
+	uint32_t generation_;
+
+	boost::thread thread_;
+	boost::atomic<bool> stop_;
+
+	bool watch(int fd, const Callback &callback, bool counter) {
+	    Entry &entry = entries_[fd];
+	    entry.callback = callback;
+	    entry.generation = ++generation_;
+	    entry.counter = counter;
+
+	    struct epoll_event event;
+	    memset(&event, 0, sizeof(event));
+	    event.events = EPOLLIN;
+	    event.data.u64 = ((uint64_t)entry.generation << 32) | (uint32_t)fd;
+	    if(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+		ROS_ERROR("Could not watch descriptor %d: %s", fd, strerror(errno));
+		entries_.erase(fd);
+		return false;
+	    }
+	    return true;
+	}
+
+	void run() {
+	    struct epoll_event events[YUMI_REACTOR_MAX_EVENTS];
+	    while(!stop_) {
+		int n = epoll_wait(epoll_fd_, events, YUMI_REACTOR_MAX_EVENTS, -1);
+		if(n < 0) {
+		    if(errno == EINTR) continue;
+		    ROS_ERROR("epoll_wait failed: %s", strerror(errno));
+		    break;
+		}
+		for(int i = 0; i < n && !stop_; i++) {
+		    int fd = (int)(uint32_t)events[i].data.u64;
+		    std::map<int, Entry>::iterator it = entries_.find(fd);
+		    // removed, or removed and added again, by an earlier callback of this round
+		    if(it == entries_.end() || it->second.generation != (uint32_t)(events[i].data.u64 >> 32)) {
+			continue;
+		    }
+		    if(it->second.counter) {
+			uint64_t count;
+			if(::read(fd, &count, sizeof(count)) != sizeof(count)) continue;
+		    }
+		    // the callback may remove its own entry
+		    Callback callback = it->second.callback;
+		    callback();
+		}
+	    }
+	}
+
+    public:
+	YumiReactor() : generation_(0), stop_(true) {
+	    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+	    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	    struct epoll_event event;
+	    memset(&event, 0, sizeof(event));
+	    event.events = EPOLLIN;
+	    event.data.u64 = (uint32_t)wake_fd_;
+	    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+	}
+
+	~YumiReactor() {
+	    stop();
+	    for(std::map<int, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+		if(it->second.counter) ::close(it->first);
+	    }
+	    ::close(wake_fd_);
+	    ::close(epoll_fd_);
+	}
+
+	///calls on_readable whenever fd has data, or has been closed by the peer
+	bool add(int fd, const Callback &on_readable) {
+	    return fd >= 0 && watch(fd, on_readable, false);
+	}
+
+	///a new disarmed timer, returns its descriptor or -1
+	int addTimer(const Callback &on_expired) {
+	    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	    if(fd < 0) {
+		ROS_ERROR("Could not create a timer: %s", strerror(errno));
+		return -1;
+	    }
+	    if(!watch(fd, on_expired, true)) {
+		::close(fd);
+		return -1;
+	    }
+	    return fd;
+	}
+
+	///a new event, returns its descriptor or -1. Signals that come in before the callback ran
+	///are merged into one call.
+	int addEvent(const Callback &on_signal) {
+	    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	    if(fd < 0) {
+		ROS_ERROR("Could not create an event: %s", strerror(errno));
+		return -1;
+	    }
+	    if(!watch(fd, on_signal, true)) {
+		::close(fd);
+		return -1;
+	    }
+	    return fd;
+	}
+
+	///wakes the reactor to call the callback of event, from any thread. Never blocks, never allocates.
+	void signal(int event) {
+	    uint64_t one = 1;
+	    if(::write(event, &one, sizeof(one)) != sizeof(one)) {
+		// the counter is saturated, the callback is pending anyway
+	    }
+	}
+
+	///expires after delay seconds, then every period seconds if period > 0. A delay <= 0 disarms.
+	bool setTimer(int timer, double delay, double period = 0.0) {
+	    struct itimerspec spec;
+	    memset(&spec, 0, sizeof(spec));
+	    if(delay > 0) {
+		spec.it_value.tv_sec = (time_t)delay;
+		spec.it_value.tv_nsec = (long)((delay - (time_t)delay)*1e9);
+		if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1;
+		if(period > 0) {
+		    spec.it_interval.tv_sec = (time_t)period;
+		    spec.it_interval.tv_nsec = (long)((period - (time_t)period)*1e9);
+		}
+	    }
+	    return timerfd_settime(timer, 0, &spec, NULL) == 0;
+	}
+
+	///stops watching fd, a timer or event is closed as well. Sockets stay open, they belong to the caller.
+	void remove(int fd) {
+	    std::map<int, Entry>::iterator it = entries_.find(fd);
+	    if(it == entries_.end()) return;
+	    // fails harmlessly for a socket the caller already closed, which leaves the epoll set by itself
+	    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+	    if(it->second.counter) ::close(fd);
+	    entries_.erase(it);
+	}
+
+	void start() {
+	    if(!stop_ || epoll_fd_ < 0 || wake_fd_ < 0) return;
+	    stop_ = false;
+	    thread_ = boost::thread(boost::bind(&YumiReactor::run, this));
+	}
+
+	///wakes the loop and waits for the callback in progress to return
+	void stop() {
+	    if(stop_) return;
+	    stop_ = true;
+	    uint64_t one = 1;
+	    if(::write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+		ROS_ERROR("Could not wake the reactor thread");
+	    }
+	    thread_.join();
+	}
+
+	bool isRunning() const { return !stop_; }
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef __YUMI_REALTIME_LOOP_H
+#define __YUMI_REALTIME_LOOP_H
+
+// SYS
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
+
+#include <ros/ros.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+/**
+  * Runs a read/update/write cycle at a fixed period, paced by absolute deadlines on
+  * CLOCK_MONOTONIC. In realtime mode the memory of the process is locked and the cycle
+  * runs on a SCHED_FIFO thread, optionally pinned to a single CPU.
+  */
+class YumiRealtimeLoop {
+    public:
+	typedef boost::function<void (const ros::Time&, const ros::Duration&)> CycleCallback;
+
+    private:
+	CycleCallback cycle_;
+	long long period_ns_;
+	bool realtime_;
+	int priority_, cpu_;
+
+	pthread_t thread_;
+	bool thread_started_;
+	boost::atomic<bool> stop_;
+
+	///statistics, written by the loop thread only
+	boost::atomic<unsigned long> cycles_, overruns_;
+	boost::atomic<long long> max_jitter_ns_;
+
+	static void addNs(struct timespec &ts, long long ns) {
+	    ts.tv_nsec += ns % NSEC_PER_SEC;
+	    ts.tv_sec += ns / NSEC_PER_SEC;
+	    if(ts.tv_nsec >= NSEC_PER_SEC) {
+		ts.tv_nsec -= NSEC_PER_SEC;
+		ts.tv_sec++;
+	    }
+	}
+
+	static long long diffNs(const struct timespec &a, const struct timespec &b) {
+	    return (long long)(a.tv_sec - b.tv_sec)*NSEC_PER_SEC + (a.tv_nsec - b.tv_nsec);
+	}
+
+	static void* threadEntry(void *arg) {
+	    static_cast<YumiRealtimeLoop*>(arg)->run();
+	    return NULL;
+	}
+
+	///pins the calling thread to cpu_, if one is configured
+	bool setAffinity() {
+	    if(cpu_ < 0) return true;
+	    cpu_set_t cpuset;
+	    CPU_ZERO(&cpuset);
+	    CPU_SET(cpu_, &cpuset);
+	    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	    if(rc != 0) {
+		ROS_ERROR("Could not pin control thread to CPU %d: %s", cpu_, strerror(rc));
+		return false;
+	    }
+	    return true;
+	}
+
+    public:
+	YumiRealtimeLoop() {
+	    period_ns_ = 0;
+	    realtime_ = false;
+	    priority_ = 80;
+	    cpu_ = -1;
+	    thread_started_ = false;
+	    stop_ = false;
+	    cycles_ = 0;
+	    overruns_ = 0;
+	    max_jitter_ns_ = 0;
+	}
+
+	~YumiRealtimeLoop() {
+	    stop();
+	}
+
+	///period <= 0 runs the cycle as fast as possible
+	void setup(CycleCallback cycle, double period, bool realtime = false, int priority = 80, int cpu = -1) {
+	    cycle_ = cycle;
+	    period_ns_ = period > 0 ? (long long)(period*NSEC_PER_SEC) : 0;
+	    realtime_ = realtime;
+	    priority_ = priority;
+	    cpu_ = cpu;
+	}
+
+	///locks all current and future pages of the process in RAM
+	static bool lockMemory() {
+	    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		ROS_ERROR("mlockall failed: %s. Is the memlock limit high enough?", strerror(errno));
+		return false;
+	    }
+	    return true;
+	}
+
+	///starts the cycle on its own thread. In realtime mode the thread is created SCHED_FIFO.
+	bool start() {
+	    if(thread_started_ || !cycle_) return false;
+	    stop_ = false;
+
+	    pthread_attr_t attr;
+	    pthread_attr_init(&attr);
+	    if(realtime_) {
+		if(!lockMemory()) {
+		    pthread_attr_destroy(&attr);
+		    return false;
+		}
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority_;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	    }
+
+	    int rc = pthread_create(&thread_, &attr, &YumiRealtimeLoop::threadEntry, this);
+	    pthread_attr_destroy(&attr);
+	    if(rc != 0) {
+		ROS_ERROR("Could not create control thread: %s%s", strerror(rc),
+			realtime_ ? " (SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit)" : "");
+		return false;
+	    }
+	    thread_started_ = true;
+	    return true;
+	}
+
+	void stop() {
+	    stop_ = true;
+	    if(thread_started_) {
+		pthread_join(thread_, NULL);
+		thread_started_ = false;
+	    }
+	}
+
+	///runs the cycle on the calling thread until stop() is called
+	void run() {
+	    if(realtime_) setAffinity();
+
+	    struct timespec next, now, last;
+	    clock_gettime(CLOCK_MONOTONIC, &next);
+	    last = next;
+
+	    while(!stop_) {
+		if(period_ns_ > 0) {
+		    addNs(next, period_ns_);
+		    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR && !stop_);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		// the period comes from the monotonic clock, the time stamp stays in ROS time
+		// since the controllers compare it against message stamps
+		ros::Duration period;
+		period.fromNSec(diffNs(now, last));
+		last = now;
+
+		if(period_ns_ > 0) {
+		    long long jitter = diffNs(now, next);
+		    if(jitter > max_jitter_ns_) max_jitter_ns_ = jitter;
+		}
+
+		cycle_(ros::Time::now(), period);
+		cycles_++;
+
+		if(period_ns_ > 0) {
+		    // the next deadline has already passed: count it and skip the missed cycles
+		    clock_gettime(CLOCK_MONOTONIC, &now);
+		    long long late = diffNs(now, next) - period_ns_;
+		    if(late > 0) {
+			long long missed = late / period_ns_ + 1;
+			overruns_ += missed;
+			addNs(next, missed*period_ns_);
+		    }
+		}
+	    }
+	}
+
+	unsigned long getCycles() const { return cycles_; }
+	unsigned long getOverruns() const { return overruns_; }
+	double getMaxJitter() const { return max_jitter_ns_*1e-9; }
+	bool isRealtime() const { return realtime_; }
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef __YUMI_SESSION_H
+#define __YUMI_SESSION_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "yumi_hw/yumi_joint_packet.h"
+
+///joints and state channels a session has room for, the arms and the grippers
+#define YUMI_SESSION_JOINTS 16
+#define YUMI_SESSION_CHANNELS 2
+#define YUMI_SESSION_GRIPPERS 2
+#define YUMI_SESSION_NAME_LENGTH 48
+
+#define YUMI_SESSION_MAGIC "YUMISES"
+#define YUMI_SESSION_VERSION 1
+
+///cycle flags: the controller manager switched controllers in the update of the cycle
+#define YUMI_SESSION_SWITCH 0x1
+
+/**
+  * A session is the input of the controller stack over a run of the node, recorded by
+  * YumiSessionRecorder from YumiHWRapid and replayed by YumiHWReplay: the joint states as they
+  * were received, and the times every cycle was run at. The commands written are kept to tell
+  * whether a replay computes the same.
+  *
+  * The file is the header followed by chunks of chunk_size bytes (the header is at the start
+  * of the first). A chunk holds cycles, each a YumiSessionCycle followed by the states read in
+  * it; a cycle never crosses a chunk and a zero cycle number ends a chunk. Native byte order.
+  */
+struct YumiSessionHeader {
+    char magic[8];
+    uint32_t version, header_size, cycle_size, state_size;
+    ///arm joints, gripper joints and state channels of the recorded backend
+    uint32_t joints, grippers, channels, reserved;
+    uint64_t chunk_size;
+    ///cycles recorded, 0 when the recording did not end cleanly
+    uint64_t cycles;
+    ///control period of the node (ns)
+    int64_t control_period;
+    double effort_scale[YUMI_SESSION_JOINTS];
+    char names[YUMI_SESSION_JOINTS][YUMI_SESSION_NAME_LENGTH];
+};
+
+struct YumiSessionCycle {
+    ///cycle count of the recording, from 1
+    uint64_t cycle;
+    ///the time and period read() and write() were called with, and the stamp the controllers
+    ///were updated with, 0 when the node did not stamp with the sample time (ns)
+    int64_t time, period, stamp;
+    int32_t strategy;
+    ///states following the cycle
+    uint32_t states;
+    uint32_t flags;
+    uint32_t reserved;
+    ///gripper joints after read()
+    double gripper_position[YUMI_SESSION_GRIPPERS], gripper_velocity[YUMI_SESSION_GRIPPERS];
+    double gripper_command[YUMI_SESSION_GRIPPERS];
+    ///commands after enforceLimits(), as write() sent them
+    double position_command[YUMI_SESSION_JOINTS], velocity_command[YUMI_SESSION_JOINTS];
+};
+
+///a joint state read from a channel, see YumiJointState
+struct YumiSessionState {
+    uint32_t channel, reconnects;
+    uint64_t sequence;
+    int64_t rx_time, sample_time;
+    YumiJointPacket packet;
+};
+
+/**
+  * Reads a session file through a read-only mapping, cycle by cycle.
+  */
+class YumiSessionReader {
+    private:
+	const char *map_;
+	size_t size_, position_;
+	const YumiSessionHeader *header_;
+
+    public:
+	YumiSessionReader() : map_(NULL), size_(0), position_(0), header_(NULL) {}
+	~YumiSessionReader() { close(); }
+
+	///false if path is not a session of this version
+	bool open(const char *path) {
+	    close();
+	    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	    if(fd < 0) return false;
+	    struct stat st;
+	    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(YumiSessionHeader)) {
+		::close(fd);
+		return false;
+	    }
+	    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    ::close(fd);
+	    if(map == MAP_FAILED) return false;
+	    map_ = (const char *)map;
+	    size_ = st.st_size;
+	    header_ = (const YumiSessionHeader *)map_;
+	    if(memcmp(header_->magic, YUMI_SESSION_MAGIC, sizeof(YUMI_SESSION_MAGIC)) != 0 ||
+		    header_->version != YUMI_SESSION_VERSION || header_->header_size != sizeof(YumiSessionHeader) ||
+		    header_->cycle_size != sizeof(YumiSessionCycle) || header_->state_size != sizeof(YumiSessionState) ||
+		    header_->chunk_size < sizeof(YumiSessionHeader) + sizeof(YumiSessionCycle) ||
+		    header_->joints + header_->grippers > YUMI_SESSION_JOINTS || header_->channels > YUMI_SESSION_CHANNELS) {
+		close();
+		return false;
+	    }
+	    rewind();
+	    return true;
+	}
+
+	void close() {
+	    if(map_ != NULL) munmap((void *)map_, size_);
+	    map_ = NULL;
+	    header_ = NULL;
+	    size_ = 0;
+	}
+
+	const YumiSessionHeader &header() const { return *header_; }
+
+	///back to the first cycle
+	void rewind() { position_ = sizeof(YumiSessionHeader); }
+
+	///the next cycle and its states, false at the end of the session
+	bool next(const YumiSessionCycle *&cycle, const YumiSessionState *&states) {
+	    uint64_t chunk = header_->chunk_size;
+	    while(position_ + sizeof(YumiSessionCycle) <= size_) {
+		size_t chunk_end = (position_/chunk + 1)*chunk;
+		if(chunk_end > size_) chunk_end = size_;
+		if(position_ + sizeof(YumiSessionCycle) <= chunk_end) {
+		    const YumiSessionCycle *c = (const YumiSessionCycle *)(map_ + position_);
+		    size_t end = position_ + sizeof(YumiSessionCycle) + c->states*sizeof(YumiSessionState);
+		    if(c->cycle != 0 && c->states <= YUMI_SESSION_CHANNELS && end <= chunk_end) {
+			cycle = c;
+			states = (const YumiSessionState *)(c + 1);
+			position_ = end;
+			return true;
+		    }
+		    // an empty chunk is the end of the recording
+		    if(position_ % chunk == 0) return false;
+		}
+		position_ = chunk_end;
+	    }
+	    return false;
+	}
+};
+
+#endif
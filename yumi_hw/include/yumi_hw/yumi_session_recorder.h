@@ -0,0 +1,256 @@
+#ifndef __YUMI_SESSION_RECORDER_H
+#define __YUMI_SESSION_RECORDER_H
+
+#include <string>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+
+#include "yumi_hw/yumi_hw.h"
+#include "yumi_hw/yumi_session.h"
+
+///retired chunks waiting to be unmapped
+#define YUMI_SESSION_RETIRED 4
+
+/**
+  * Records a session (see YumiSessionHeader) from the control thread of a backend into a
+  * memory-mapped file. The control thread only writes to memory: a thread of the recorder
+  * grows the file, maps the next chunk ahead with its pages populated and unmaps the full
+  * ones. If the next chunk is not ready in time the cycles are dropped and counted, the
+  * control loop never waits.
+  *
+  * Per cycle: beginCycle() when read() starts, state() for every joint state read,
+  * endRead() when read() is done, setStamp() with the stamp of the controllers,
+  * switched() when the controllers were switched and endCycle() in write().
+  */
+class YumiSessionRecorder {
+    private:
+	int fd_;
+	uint64_t chunk_size_;
+	YumiSessionHeader header_;
+
+	///chunk being written, its index and the next write position in it
+	char *current_;
+	boost::atomic<uint64_t> chunk_;
+	uint64_t position_;
+	///the next chunk, mapped ahead by the thread, and the full ones it unmaps
+	boost::atomic<char *> next_;
+	boost::atomic<char *> retired_[YUMI_SESSION_RETIRED];
+
+	///cycle being recorded, NULL if it is dropped; cycles begun and recorded
+	YumiSessionCycle *cycle_;
+	uint64_t begun_, cycles_;
+	unsigned long dropped_;
+	bool blocking_;
+
+	boost::atomic<bool> stop_;
+	boost::thread thread_;
+
+	char *mapChunk(uint64_t index) {
+	    if(ftruncate(fd_, (index + 1)*chunk_size_) != 0) return NULL;
+	    void *map = mmap(NULL, chunk_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, index*chunk_size_);
+	    return map == MAP_FAILED ? NULL : (char *)map;
+	}
+
+	void unmapRetired() {
+	    for(int r = 0; r < YUMI_SESSION_RETIRED; r++) {
+		char *chunk = retired_[r].exchange(NULL);
+		if(chunk != NULL) munmap(chunk, chunk_size_);
+	    }
+	}
+
+	void run() {
+	    uint64_t mapped = 0;
+	    while(!stop_) {
+		unmapRetired();
+		uint64_t chunk = chunk_;
+		if(next_.load() == NULL && mapped <= chunk) {
+		    char *map = mapChunk(chunk + 1);
+		    if(map == NULL) {
+			ROS_ERROR_THROTTLE(10, "Session recorder: could not grow the session file: %s", strerror(errno));
+		    }
+		    else {
+			mapped = chunk + 1;
+			next_.store(map);
+		    }
+		}
+		usleep(5000);
+	    }
+	}
+
+	///room for bytes in the current chunk, switching to the next one if needed
+	char *reserve(size_t bytes) {
+	    if(position_ + bytes > chunk_size_) {
+		char *next = next_.exchange(NULL);
+		while(next == NULL && blocking_) {
+		    usleep(100);
+		    next = next_.exchange(NULL);
+		}
+		if(next == NULL) return NULL;
+		char *full = current_;
+		retired_[chunk_ % YUMI_SESSION_RETIRED].store(full);
+		current_ = next;
+		position_ = 0;
+		chunk_++;
+	    }
+	    return current_ + position_;
+	}
+
+    public:
+	YumiSessionRecorder() : fd_(-1), chunk_size_(0), current_(NULL), chunk_(0), position_(0), next_(NULL),
+		cycle_(NULL), begun_(0), cycles_(0), dropped_(0), blocking_(false), stop_(true) {
+	    for(int r = 0; r < YUMI_SESSION_RETIRED; r++) retired_[r] = NULL;
+	    memset(&header_, 0, sizeof(header_));
+	}
+	~YumiSessionRecorder() { close(); }
+
+	///records into path in chunks of chunk_size bytes (rounded to pages); robot created already,
+	///its joint states come from channels state channels
+	bool open(const std::string &path, const YumiHW &robot, int channels, double control_period, uint64_t chunk_size) {
+	    long page = sysconf(_SC_PAGESIZE);
+	    chunk_size_ = (chunk_size + page - 1)/page*page;
+	    uint64_t smallest = sizeof(YumiSessionHeader) + sizeof(YumiSessionCycle) + YUMI_SESSION_CHANNELS*sizeof(YumiSessionState);
+	    if(chunk_size_ < smallest) chunk_size_ = (smallest + page - 1)/page*page;
+	    if(robot.n_joints_ + robot.n_grippers_ > YUMI_SESSION_JOINTS || robot.n_grippers_ > YUMI_SESSION_GRIPPERS ||
+		    channels > YUMI_SESSION_CHANNELS) {
+		ROS_ERROR("Session recorder: %d joints on %d channels do not fit a session", robot.n_joints_ + robot.n_grippers_, channels);
+		return false;
+	    }
+
+	    memcpy(header_.magic, YUMI_SESSION_MAGIC, sizeof(YUMI_SESSION_MAGIC));
+	    header_.version = YUMI_SESSION_VERSION;
+	    header_.header_size = sizeof(YumiSessionHeader);
+	    header_.cycle_size = sizeof(YumiSessionCycle);
+	    header_.state_size = sizeof(YumiSessionState);
+	    header_.joints = robot.n_joints_;
+	    header_.grippers = robot.n_grippers_;
+	    header_.channels = channels;
+	    header_.chunk_size = chunk_size_;
+	    header_.control_period = (int64_t)(control_period*1e9);
+	    for(int j = 0; j < robot.n_joints_ + robot.n_grippers_; j++) {
+		if(j < (int)robot.effort_scale_.size()) header_.effort_scale[j] = robot.effort_scale_[j];
+		strncpy(header_.names[j], robot.joint_names_[j].c_str(), YUMI_SESSION_NAME_LENGTH - 1);
+	    }
+
+	    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	    if(fd_ < 0) {
+		ROS_ERROR("Session recorder: could not create %s: %s", path.c_str(), strerror(errno));
+		return false;
+	    }
+	    current_ = mapChunk(0);
+	    if(current_ == NULL) {
+		ROS_ERROR("Session recorder: could not map %s: %s", path.c_str(), strerror(errno));
+		::close(fd_);
+		fd_ = -1;
+		return false;
+	    }
+	    memcpy(current_, &header_, sizeof(header_));
+	    position_ = sizeof(header_);
+	    stop_ = false;
+	    thread_ = boost::thread(boost::bind(&YumiSessionRecorder::run, this));
+	    return true;
+	}
+
+	bool isOpen() const { return fd_ >= 0; }
+
+	///offline recording: wait for the next chunk instead of dropping cycles
+	void setBlocking(bool blocking) { blocking_ = blocking; }
+
+	///stops recording, the file ends with the last complete cycle
+	void close() {
+	    if(fd_ < 0) return;
+	    stop_ = true;
+	    thread_.join();
+	    unmapRetired();
+	    uint64_t used = chunk_*chunk_size_ + position_;
+	    char *next = next_.exchange(NULL);
+	    if(next != NULL) munmap(next, chunk_size_);
+	    munmap(current_, chunk_size_);
+	    current_ = NULL;
+	    cycle_ = NULL;
+
+	    header_.cycles = cycles_;
+	    if(pwrite(fd_, &header_, sizeof(header_), 0) != sizeof(header_) || ftruncate(fd_, used) != 0) {
+		ROS_ERROR("Session recorder: could not finish the session file: %s", strerror(errno));
+	    }
+	    ::close(fd_);
+	    fd_ = -1;
+	    if(dropped_ > 0) ROS_WARN("Session recorder: %lu cycles were dropped, the file could not grow in time", dropped_);
+	}
+
+	///read() started with time and period
+	void beginCycle(const ros::Time &time, const ros::Duration &period) {
+	    if(fd_ < 0) return;
+	    begun_++;
+	    cycle_ = (YumiSessionCycle *)reserve(sizeof(YumiSessionCycle) + YUMI_SESSION_CHANNELS*sizeof(YumiSessionState));
+	    if(cycle_ == NULL) {
+		dropped_++;
+		return;
+	    }
+	    cycle_->time = time.toNSec();
+	    cycle_->period = period.toNSec();
+	    cycle_->stamp = 0;
+	    cycle_->states = 0;
+	    cycle_->flags = 0;
+	}
+
+	///a joint state read from channel
+	void state(int channel, unsigned long reconnects, unsigned long sequence, const YumiJointState &state) {
+	    if(cycle_ == NULL || cycle_->states >= YUMI_SESSION_CHANNELS) return;
+	    YumiSessionState &s = ((YumiSessionState *)(cycle_ + 1))[cycle_->states++];
+	    s.channel = channel;
+	    s.reconnects = reconnects;
+	    s.sequence = sequence;
+	    s.rx_time = state.rx_time;
+	    s.sample_time = state.sample_time;
+	    s.packet = state.packet;
+	}
+
+	///read() is done, the gripper joints follow the arm joints of robot
+	void endRead(const YumiHW &robot) {
+	    if(cycle_ == NULL) return;
+	    for(int g = 0; g < robot.n_grippers_; g++) {
+		cycle_->gripper_position[g] = robot.joint_position_[robot.n_joints_ + g];
+		cycle_->gripper_velocity[g] = robot.joint_velocity_[robot.n_joints_ + g];
+		cycle_->gripper_command[g] = robot.joint_position_command_[robot.n_joints_ + g];
+	    }
+	}
+
+	///the stamp the controllers are updated with
+	void setStamp(const ros::Time &stamp) {
+	    if(cycle_ != NULL) cycle_->stamp = stamp.toNSec();
+	}
+
+	///the controller manager switched controllers in this cycle
+	void switched() {
+	    if(cycle_ != NULL) cycle_->flags |= YUMI_SESSION_SWITCH;
+	}
+
+	///write() computed the commands of robot, the cycle is complete
+	void endCycle(const YumiHW &robot) {
+	    if(cycle_ == NULL) return;
+	    cycle_->strategy = robot.current_strategy_;
+	    for(int j = 0; j < robot.n_joints_ + robot.n_grippers_; j++) {
+		cycle_->position_command[j] = robot.joint_position_command_[j];
+		cycle_->velocity_command[j] = robot.joint_velocity_command_[j];
+	    }
+	    position_ += sizeof(YumiSessionCycle) + cycle_->states*sizeof(YumiSessionState);
+	    // numbered last, a cycle cut short by a crash reads as the end of the chunk. Dropped
+	    // cycles leave a gap in the numbers.
+	    boost::atomic_thread_fence(boost::memory_order_release);
+	    cycle_->cycle = begun_;
+	    cycles_++;
+	    cycle_ = NULL;
+	}
+
+	uint64_t getCycles() const { return cycles_; }
+	unsigned long getDropped() const { return dropped_; }
+};
+
+#endif
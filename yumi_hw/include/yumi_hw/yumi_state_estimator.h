@@ -0,0 +1,302 @@
+#ifndef __YUMI_STATE_ESTIMATOR_H
+#define __YUMI_STATE_ESTIMATOR_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+
+///most samples the polynomial fit runs over
+#define YUMI_POLYFIT_MAX_SAMPLES 16
+
+/**
+  * Velocity and acceleration of the joints from timestamped position samples. Samples that
+  * are not newer than the last one of their joint (duplicated or reordered) are dropped. A
+  * joint starts over at rest when the time jumps by more than max_gap seconds either way, a
+  * pause or a clock that started over; dropped samples in between are covered by the actual
+  * time between the samples. Per-joint
+  * memory is sized by resize(), updates never allocate.
+  */
+class YumiStateEstimator {
+    private:
+	std::vector<double> last_time_;
+	std::vector<char> has_sample_;
+	double max_gap_;
+	unsigned long duplicates_, gaps_;
+
+    protected:
+	std::vector<double> position_, velocity_, acceleration_;
+
+	///the first sample of joint, or the first after a gap
+	virtual void start(int joint, double position, double time) = 0;
+	///a sample taken dt seconds after the last one
+	virtual void correct(int joint, double position, double time, double dt) = 0;
+	///per-joint state of the derived estimator
+	virtual void resizeState(int n) {}
+
+    public:
+	YumiStateEstimator() : max_gap_(0.5), duplicates_(0), gaps_(0) {}
+	virtual ~YumiStateEstimator() {}
+
+	///n joints, before the control loop starts. All joints start over.
+	void resize(int n) {
+	    last_time_.assign(n, 0.0);
+	    has_sample_.assign(n, 0);
+	    position_.assign(n, 0.0);
+	    velocity_.assign(n, 0.0);
+	    acceleration_.assign(n, 0.0);
+	    resizeState(n);
+	}
+
+	///seconds without a sample after which a joint starts over
+	void setMaxGap(double max_gap) { max_gap_ = max_gap; }
+
+	///the next sample of joint starts it over at rest, e.g. after a reconnection
+	void reset(int joint) { has_sample_[joint] = 0; }
+
+	///a position sample of joint taken at time (s), returns false if it was dropped
+	bool update(int joint, double position, double time) {
+	    if(has_sample_[joint]) {
+		double dt = time - last_time_[joint];
+		if(dt <= 0 && dt >= -max_gap_) {
+		    duplicates_++;
+		    return false;
+		}
+		if(dt > 0 && dt <= max_gap_) {
+		    last_time_[joint] = time;
+		    correct(joint, position, time, dt);
+		    return true;
+		}
+		gaps_++;
+	    }
+	    has_sample_[joint] = 1;
+	    last_time_[joint] = time;
+	    position_[joint] = position;
+	    velocity_[joint] = 0.0;
+	    acceleration_[joint] = 0.0;
+	    start(joint, position, time);
+	    return true;
+	}
+
+	double getPosition(int joint) const { return position_[joint]; }
+	double getVelocity(int joint) const { return velocity_[joint]; }
+	double getAcceleration(int joint) const { return acceleration_[joint]; }
+
+	///samples dropped for not being newer than the last one
+	unsigned long getDuplicates() const { return duplicates_; }
+	///times a joint started over after a jump in time
+	unsigned long getGaps() const { return gaps_; }
+};
+
+/**
+  * Finite differences through exponential smoothing, what the backends always did. A small
+  * alpha gives smooth but lagging estimates.
+  */
+class YumiSmoothingEstimator : public YumiStateEstimator {
+    private:
+	double alpha_;
+
+    protected:
+	void start(int joint, double position, double time) {}
+
+	void correct(int joint, double position, double time, double dt) {
+	    double velocity = alpha_*(position - position_[joint])/dt + (1.0 - alpha_)*velocity_[joint];
+	    acceleration_[joint] = alpha_*(velocity - velocity_[joint])/dt + (1.0 - alpha_)*acceleration_[joint];
+	    velocity_[joint] = velocity;
+	    position_[joint] = position;
+	}
+
+    public:
+	YumiSmoothingEstimator(double alpha) : alpha_(alpha) {}
+};
+
+/**
+  * Kalman filter per joint on a constant acceleration model driven by white jerk. The time
+  * between the samples enters the prediction, so irregular and dropped samples are weighed
+  * right. position_noise is the standard deviation of the measured positions (rad),
+  * jerk_noise the spectral density of the jerk (rad^2/s^5): larger follows faster.
+  */
+class YumiKalmanEstimator : public YumiStateEstimator {
+    private:
+	struct State {
+	    double p[3][3];
+	};
+	std::vector<State> state_;
+	double r_, q_;
+
+    protected:
+	void resizeState(int n) { state_.resize(n); }
+
+	void start(int joint, double position, double time) {
+	    double (*p)[3] = state_[joint].p;
+	    for(int i = 0; i < 3; i++) for(int k = 0; k < 3; k++) p[i][k] = 0.0;
+	    // unknown motion: any velocity and acceleration the arms can reach
+	    p[0][0] = r_;
+	    p[1][1] = 10.0;
+	    p[2][2] = 100.0;
+	}
+
+	void correct(int joint, double position, double time, double dt) {
+	    double (*p)[3] = state_[joint].p;
+	    double &x = position_[joint], &v = velocity_[joint], &a = acceleration_[joint];
+
+	    // predict: x' = F x, P' = F P F^T + Q
+	    x += v*dt + 0.5*a*dt*dt;
+	    v += a*dt;
+	    double f[3][3] = {{1.0, dt, 0.5*dt*dt}, {0.0, 1.0, dt}, {0.0, 0.0, 1.0}};
+	    double fp[3][3];
+	    for(int i = 0; i < 3; i++) for(int k = 0; k < 3; k++) {
+		fp[i][k] = f[i][0]*p[0][k] + f[i][1]*p[1][k] + f[i][2]*p[2][k];
+	    }
+	    double dt2 = dt*dt, dt3 = dt2*dt;
+	    double q[3][3] = {
+		{q_*dt3*dt2/20.0, q_*dt2*dt2/8.0, q_*dt3/6.0},
+		{q_*dt2*dt2/8.0, q_*dt3/3.0, q_*dt2/2.0},
+		{q_*dt3/6.0, q_*dt2/2.0, q_*dt}};
+	    for(int i = 0; i < 3; i++) for(int k = 0; k < 3; k++) {
+		p[i][k] = fp[i][0]*f[k][0] + fp[i][1]*f[k][1] + fp[i][2]*f[k][2] + q[i][k];
+	    }
+
+	    // correct with the measured position
+	    double s = p[0][0] + r_;
+	    double gain[3] = {p[0][0]/s, p[1][0]/s, p[2][0]/s};
+	    double innovation = position - x;
+	    x += gain[0]*innovation;
+	    v += gain[1]*innovation;
+	    a += gain[2]*innovation;
+	    double row[3] = {p[0][0], p[0][1], p[0][2]};
+	    for(int i = 0; i < 3; i++) for(int k = 0; k < 3; k++) {
+		p[i][k] -= gain[i]*row[k];
+	    }
+	}
+
+    public:
+	YumiKalmanEstimator(double position_noise, double jerk_noise) :
+	    r_(position_noise*position_noise), q_(jerk_noise) {}
+};
+
+/**
+  * Least squares polynomial (order 1 or 2) through the last samples of each joint, velocity
+  * and acceleration are its derivatives at the newest sample. No model to tune, the lag is
+  * set by the window alone.
+  */
+class YumiPolyfitEstimator : public YumiStateEstimator {
+    private:
+	struct Window {
+	    double time[YUMI_POLYFIT_MAX_SAMPLES], position[YUMI_POLYFIT_MAX_SAMPLES];
+	    int count, next;
+	};
+	std::vector<Window> windows_;
+	int samples_, order_;
+
+    protected:
+	void resizeState(int n) { windows_.resize(n); }
+
+	void start(int joint, double position, double time) {
+	    Window &w = windows_[joint];
+	    w.count = 0;
+	    w.next = 0;
+	    push(w, position, time);
+	}
+
+	void correct(int joint, double position, double time, double dt) {
+	    Window &w = windows_[joint];
+	    push(w, position, time);
+	    position_[joint] = position;
+	    int order = w.count > order_ ? order_ : w.count - 1;
+
+	    // normal equations in the time relative to the newest sample, relative to the first
+	    // position for precision
+	    double s[5] = {0, 0, 0, 0, 0}, b[3] = {0, 0, 0};
+	    double p0 = w.position[(w.next + samples_ - w.count) % samples_];
+	    for(int k = 0; k < w.count; k++) {
+		int i = (w.next + samples_ - 1 - k) % samples_;
+		double t = w.time[i] - time, y = w.position[i] - p0, tk = 1.0;
+		for(int e = 0; e < 5; e++) {
+		    s[e] += tk;
+		    if(e < 3) b[e] += tk*y;
+		    tk *= t;
+		}
+	    }
+	    if(order == 1) {
+		double det = s[0]*s[2] - s[1]*s[1];
+		if(det <= 0) return;
+		velocity_[joint] = (s[0]*b[1] - s[1]*b[0])/det;
+		acceleration_[joint] = 0.0;
+		return;
+	    }
+	    // order 2 by Cramer's rule, the coefficients of t and t^2
+	    double m[3][3] = {{s[0], s[1], s[2]}, {s[1], s[2], s[3]}, {s[2], s[3], s[4]}};
+	    double det = det3(m);
+	    if(std::fabs(det) < 1e-30) return;
+	    double m1[3][3], m2[3][3];
+	    for(int i = 0; i < 3; i++) {
+		for(int k = 0; k < 3; k++) m1[i][k] = m2[i][k] = m[i][k];
+		m1[i][1] = b[i];
+		m2[i][2] = b[i];
+	    }
+	    velocity_[joint] = det3(m1)/det;
+	    acceleration_[joint] = 2.0*det3(m2)/det;
+	}
+
+	///the window is a ring of samples_
+	void push(Window &w, double position, double time) {
+	    w.time[w.next] = time;
+	    w.position[w.next] = position;
+	    w.next = (w.next + 1) % samples_;
+	    if(w.count < samples_) w.count++;
+	}
+
+	static double det3(const double m[3][3]) {
+	    return m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+		- m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+		+ m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+	}
+
+    public:
+	///fits order (1 or 2) to the last samples (order + 1 to YUMI_POLYFIT_MAX_SAMPLES)
+	YumiPolyfitEstimator(int samples, int order) {
+	    order_ = order < 1 ? 1 : (order > 2 ? 2 : order);
+	    samples_ = samples < order_ + 1 ? order_ + 1 : (samples > YUMI_POLYFIT_MAX_SAMPLES ? YUMI_POLYFIT_MAX_SAMPLES : samples);
+	}
+};
+
+/**
+  * The estimator named by the state_estimator parameter of nh (smoothing, kalman or polyfit)
+  * with its parameters, NULL for an unknown name. default_smoothing is the alpha of smoothing
+  * when velocity_smoothing is not set.
+  */
+inline YumiStateEstimator *yumiStateEstimatorFromParams(const ros::NodeHandle &nh, double default_smoothing) {
+    std::string type;
+    double max_gap;
+    nh.param("state_estimator", type, std::string("smoothing"));
+    nh.param("estimator_max_gap", max_gap, 0.5);
+
+    YumiStateEstimator *estimator = NULL;
+    if(type == "smoothing") {
+	double alpha;
+	nh.param("velocity_smoothing", alpha, default_smoothing);
+	estimator = new YumiSmoothingEstimator(alpha);
+    }
+    else if(type == "kalman") {
+	double position_noise, jerk_noise;
+	nh.param("kalman_position_noise", position_noise, 1e-4);
+	nh.param("kalman_jerk_noise", jerk_noise, 1e4);
+	estimator = new YumiKalmanEstimator(position_noise, jerk_noise);
+    }
+    else if(type == "polyfit") {
+	int samples, order;
+	nh.param("polyfit_samples", samples, 8);
+	nh.param("polyfit_order", order, 2);
+	estimator = new YumiPolyfitEstimator(samples, order);
+    }
+    else {
+	ROS_ERROR("Unknown state estimator '%s', use smoothing, kalman or polyfit", type.c_str());
+	return NULL;
+    }
+    estimator->setMaxGap(max_gap);
+    return estimator;
+}
+
+#endif
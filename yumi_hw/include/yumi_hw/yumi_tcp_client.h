@@ -0,0 +1,147 @@
+#ifndef __YUMI_TCP_CLIENT_H
+#define __YUMI_TCP_CLIENT_H
+
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <ros/ros.h>
+#include "simple_message/socket/tcp_client.h"
+
+///results of YumiTcpClient::receiveSome()
+enum YumiReceiveStatus { YUMI_RECEIVE_PENDING, YUMI_RECEIVE_DONE, YUMI_RECEIVE_LOST };
+
+///a send to a stalled server gives up after this long and drops the connection, in ms
+#define YUMI_SEND_TIMEOUT_MS 100
+
+/**
+  * TCP client to one of the RAPID servers. On top of the simple_message client it can
+  * send a message that is already laid out in memory, and drop and re-establish the
+  * connection, since the servers restart (ExitCycle) whenever a client goes away.
+  */
+class YumiTcpClient : public industrial::tcp_client::TcpClient {
+    private:
+	std::string ip_;
+	int port_;
+
+    public:
+	YumiTcpClient() : port_(0) {}
+
+	bool init(const std::string &ip, int port) {
+	    ip_ = ip;
+	    port_ = port;
+	    char* ip_addr = strdup(ip.c_str());  // connection.init() requires "char*", not "const char*"
+	    bool rtn = industrial::tcp_client::TcpClient::init(ip_addr, port);
+	    free(ip_addr);
+	    return rtn;
+	}
+
+	const std::string &getIp() const { return ip_; }
+	int getPort() const { return port_; }
+	///descriptor to wait on, -1 when disconnected
+	int getSocket() { return this->isConnected() ? this->getSockHandle() : -1; }
+
+	///sends size bytes of a complete message (length prefix, header and data) as they are
+	bool sendRaw(const void *data, int size) {
+	    if(!this->isConnected()) {
+		return false;
+	    }
+	    int sent = this->rawSendBytes((char*)data, size);
+	    if(sent != size) {
+		ROS_ERROR("Failed to send to %s:%d (%d of %d bytes)", ip_.c_str(), port_, sent, size);
+		disconnect();
+		return false;
+	    }
+	    return true;
+	}
+
+	///reads what arrived of the size bytes at data after the received ones, without blocking.
+	///DONE once all of them are in, PENDING while the rest is still on its way, LOST (and
+	///disconnected) once the peer closed the connection or it failed. For the connections
+	///served by a reactor, which resume a partial message on the next call.
+	int receiveSome(void *data, int size, int &received) {
+	    char *buffer = (char*)data;
+	    while(received < size) {
+		int rc = this->isConnected() ? ::recv(this->getSockHandle(), buffer + received, size - received, MSG_DONTWAIT) : -1;
+		if(rc > 0) {
+		    received += rc;
+		    continue;
+		}
+		if(rc < 0 && errno == EINTR) continue;
+		if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return YUMI_RECEIVE_PENDING;
+		ROS_ERROR("Connection to %s:%d lost", ip_.c_str(), port_);
+		disconnect();
+		return YUMI_RECEIVE_LOST;
+	    }
+	    return YUMI_RECEIVE_DONE;
+	}
+
+	///bounds the sends, so that a stalled server cannot hold up the thread sending to it
+	bool setSendTimeout(int ms) {
+	    struct timeval timeout;
+	    timeout.tv_sec = ms/1000;
+	    timeout.tv_usec = (ms%1000)*1000;
+	    return ::setsockopt(this->getSockHandle(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+	}
+
+	///reads and drops whatever arrived without blocking, returns false once the peer closed
+	///the connection. For connections that only send, to notice the server going away.
+	bool discardPending() {
+	    char buffer[256];
+	    int rc;
+	    while((rc = ::recv(this->getSockHandle(), buffer, sizeof(buffer), MSG_DONTWAIT)) > 0);
+	    if(rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		disconnect();
+		return false;
+	    }
+	    return true;
+	}
+
+	void disconnect() {
+	    if(this->getSockHandle() >= 0) {
+		::close(this->getSockHandle());
+		this->setSockHandle(-1);
+	    }
+	    this->setConnected(false);
+	}
+
+	///closes the socket and connects with a new one, a single attempt
+	bool reconnect() {
+	    disconnect();
+	    return init(ip_, port_) && this->makeConnect();
+	}
+};
+
+/**
+  * Exponential backoff between reconnection attempts.
+  */
+class YumiBackoff {
+    private:
+	double min_delay_, max_delay_, delay_;
+
+    public:
+	YumiBackoff(double min_delay = 0.1, double max_delay = 5.0) {
+	    setup(min_delay, max_delay);
+	}
+
+	void setup(double min_delay, double max_delay) {
+	    min_delay_ = min_delay;
+	    max_delay_ = max_delay < min_delay ? min_delay : max_delay;
+	    reset();
+	}
+
+	void reset() { delay_ = min_delay_; }
+
+	///the delay before the next attempt, the one after is twice as long
+	double next() {
+	    double delay = delay_;
+	    delay_ = delay_*2 > max_delay_ ? max_delay_ : delay_*2;
+	    return delay;
+	}
+};
+
+#endif
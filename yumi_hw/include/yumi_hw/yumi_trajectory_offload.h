@@ -0,0 +1,354 @@
+#ifndef __YUMI_TRAJECTORY_OFFLOAD_H
+#define __YUMI_TRAJECTORY_OFFLOAD_H
+
+#include <algorithm>
+#include <sstream>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+
+#include <ros/ros.h>
+#include <actionlib/server/simple_action_server.h>
+#include <control_msgs/FollowJointTrajectoryAction.h>
+#include <controller_manager/controller_manager.h>
+
+#include "simple_message/simple_message.h"
+
+#include "yumi_hw/yumi_rapid_protocol.h"
+#include "yumi_hw/yumi_hw_rapid.h"
+#include "yumi_hw/yumi_tcp_client.h"
+
+///shortest move time sent to the controller, in seconds
+#define YUMI_TRAJ_MIN_MOVE_TIME 0.01
+///longest wait for the motion task to abort a stopped trajectory, in seconds
+#define YUMI_TRAJ_STOP_TIMEOUT 2.0
+
+///status of one arm as reported by ROS_trajectoryServer
+struct YumiTrajectoryStatus {
+    int arm, id, state, index, size;
+    float joints[N_YUMI_ARM_JOINTS];
+};
+
+/**
+  * Executes FollowJointTrajectory goals for left_arm and right_arm natively on the IRC5:
+  * the whole trajectory is downloaded in chunks to ROS_trajectoryServer.mod and run by the
+  * motion tasks as a zone-blended MoveAbsJ sequence. The PC side only polls the progress and
+  * handles preemption. While an arm executes a downloaded trajectory the streaming controllers
+  * are stopped and the streamed command of the arm follows its measured position.
+  */
+class YumiTrajectoryOffload {
+    private:
+	typedef actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction> TrajectoryServer;
+
+	YumiHWRapid *robot_;
+	controller_manager::ControllerManager *manager_;
+
+	///streaming controllers stopped while any arm executes a downloaded trajectory
+	std::vector<std::string> controllers_, stopped_;
+	int active_;
+	boost::mutex switch_mutex_;
+
+	YumiTcpClient connection_;
+	boost::mutex connection_mutex_;
+	int next_id_;
+
+	boost::scoped_ptr<TrajectoryServer> servers_[2];
+	double status_rate_, timeout_margin_;
+	boost::atomic<bool> shutdown_;
+
+	///sends one request and parses the status in the reply
+	bool exchange(int arm, int flags, int id, const std::vector<float> &durations,
+		const std::vector<float> &joints, int first, int count, YumiTrajectoryStatus &status) {
+	    industrial::byte_array::ByteArray data;
+	    data.init();
+	    data.load((industrial::shared_types::shared_int)(arm + 1));
+	    data.load((industrial::shared_types::shared_int)flags);
+	    data.load((industrial::shared_types::shared_int)id);
+	    data.load((industrial::shared_types::shared_int)count);
+	    for(int k=first; k<first+count; k++) {
+		data.load((industrial::shared_types::shared_real)durations[k]);
+		for(int j=0; j<N_YUMI_ARM_JOINTS; j++) {
+		    data.load((industrial::shared_types::shared_real)joints[k*N_YUMI_ARM_JOINTS + j]);
+		}
+	    }
+
+	    industrial::simple_message::SimpleMessage request, reply;
+	    request.init(YUMI_MSG_TYPE_TRAJECTORY, YUMI_COMM_TYPE_SRV_REQ, YUMI_REPLY_TYPE_INVALID, data);
+	    {
+		boost::mutex::scoped_lock lock(connection_mutex_);
+		// the server restarts when a connection fails, the next request connects anew
+		if(!connection_.isConnected() && !connection_.reconnect()) {
+		    ROS_ERROR("Could not connect to the trajectory server");
+		    return false;
+		}
+		if(!connection_.sendAndReceiveMsg(request, reply)) {
+		    ROS_ERROR("No reply from the trajectory server");
+		    connection_.disconnect();
+		    return false;
+		}
+	    }
+
+	    industrial::byte_array::ByteArray status_data = reply.getData();
+	    if(reply.getMessageType() != YUMI_MSG_TYPE_TRAJECTORY ||
+		    status_data.getBufferSize() < 5*sizeof(industrial::shared_types::shared_int) + N_YUMI_ARM_JOINTS*sizeof(industrial::shared_types::shared_real)) {
+		ROS_ERROR("Malformed reply from the trajectory server");
+		return false;
+	    }
+	    // the byte array unloads from the back
+	    industrial::shared_types::shared_real joint;
+	    for(int j=N_YUMI_ARM_JOINTS-1; j>=0; j--) {
+		status_data.unload(joint);
+		status.joints[j] = joint;
+	    }
+	    industrial::shared_types::shared_int value;
+	    status_data.unload(value); status.size = value;
+	    status_data.unload(value); status.index = value;
+	    status_data.unload(value); status.state = value;
+	    status_data.unload(value); status.id = value;
+	    status_data.unload(value); status.arm = value - 1;
+	    return reply.getReplyCode() == YUMI_REPLY_TYPE_SUCCESS;
+	}
+
+	bool requestStatus(int arm, YumiTrajectoryStatus &status) {
+	    std::vector<float> none;
+	    return exchange(arm, 0, 0, none, none, 0, 0, status);
+	}
+
+	bool requestStop(int arm, int id) {
+	    std::vector<float> none;
+	    YumiTrajectoryStatus status;
+	    return exchange(arm, YUMI_TRAJ_STOP, id, none, none, 0, 0, status);
+	}
+
+	///stops the trajectory and waits until the motion task has left it, so the next goal of
+	///the arm is not refused as long as the abort is pending on the controller
+	bool stop(int arm, int id) {
+	    if(!requestStop(arm, id)) return false;
+	    YumiTrajectoryStatus status;
+	    ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(YUMI_TRAJ_STOP_TIMEOUT);
+	    while(requestStatus(arm, status)) {
+		if(status.id != id || status.state != YUMI_TRAJ_RUNNING) return true;
+		if(ros::WallTime::now() > deadline) break;
+		ros::WallDuration(0.01).sleep();
+	    }
+	    ROS_ERROR("Trajectory %d of the %s arm did not stop", id, arm == 0 ? "left" : "right");
+	    return false;
+	}
+
+	///downloads the trajectory in chunks, the last one starts the motion
+	bool download(int arm, int id, const std::vector<float> &durations, const std::vector<float> &joints) {
+	    YumiTrajectoryStatus status;
+	    int n_points = durations.size();
+	    for(int first=0; first<n_points; first+=YUMI_TRAJ_CHUNK_POINTS) {
+		int count = std::min(YUMI_TRAJ_CHUNK_POINTS, n_points - first);
+		int flags = 0;
+		if(first == 0) flags |= YUMI_TRAJ_START;
+		if(first + count == n_points) flags |= YUMI_TRAJ_END;
+		if(!exchange(arm, flags, id, durations, joints, first, count, status)) {
+		    ROS_ERROR("The trajectory server rejected points %d to %d of trajectory %d", first, first+count-1, id);
+		    return false;
+		}
+	    }
+	    return true;
+	}
+
+	///stops the streaming controllers when the first arm starts a downloaded trajectory
+	void beginOffload(int arm) {
+	    boost::mutex::scoped_lock lock(switch_mutex_);
+	    robot_->setArmOffloaded(arm, true);
+	    if(active_++ > 0) return;
+
+	    stopped_.clear();
+	    for(size_t i=0; i<controllers_.size(); i++) {
+		controller_interface::ControllerBase *controller = manager_->getControllerByName(controllers_[i]);
+		if(controller != NULL && controller->isRunning()) {
+		    stopped_.push_back(controllers_[i]);
+		}
+	    }
+	    if(!stopped_.empty()) {
+		manager_->switchController(std::vector<std::string>(), stopped_,
+			controller_manager_msgs::SwitchController::Request::BEST_EFFORT);
+	    }
+	}
+
+	///restarts them when the last one is done, they pick up from the measured position
+	void endOffload(int arm) {
+	    boost::mutex::scoped_lock lock(switch_mutex_);
+	    if(--active_ == 0 && !stopped_.empty()) {
+		manager_->switchController(stopped_, std::vector<std::string>(),
+			controller_manager_msgs::SwitchController::Request::BEST_EFFORT);
+		stopped_.clear();
+	    }
+	    robot_->setArmOffloaded(arm, false);
+	}
+
+	void abort(int arm, int error_code, const std::string &text) {
+	    ROS_ERROR("Offloaded trajectory aborted: %s", text.c_str());
+	    control_msgs::FollowJointTrajectoryResult result;
+	    result.error_code = error_code;
+	    result.error_string = text;
+	    servers_[arm]->setAborted(result, text);
+	}
+
+	void execute(const control_msgs::FollowJointTrajectoryGoalConstPtr &goal, int arm) {
+	    const trajectory_msgs::JointTrajectory &trajectory = goal->trajectory;
+	    int offset = arm*N_YUMI_ARM_JOINTS;
+
+	    // position of every goal joint in the message order of the arm
+	    std::vector<int> index(trajectory.joint_names.size(), -1);
+	    bool valid = trajectory.joint_names.size() == N_YUMI_ARM_JOINTS;
+	    for(size_t i=0; valid && i<trajectory.joint_names.size(); i++) {
+		for(int j=0; j<N_YUMI_ARM_JOINTS; j++) {
+		    if(robot_->joint_names_[offset + j] == trajectory.joint_names[i]) index[i] = j;
+		}
+		valid = index[i] >= 0;
+	    }
+	    if(!valid) {
+		abort(arm, control_msgs::FollowJointTrajectoryResult::INVALID_JOINTS, "The goal does not name the 7 joints of the arm");
+		return;
+	    }
+	    if(trajectory.points.empty()) {
+		servers_[arm]->setSucceeded();
+		return;
+	    }
+	    if(trajectory.points.size() > YUMI_TRAJ_MAX_POINTS) {
+		std::stringstream text;
+		text << "The trajectory has " << trajectory.points.size() << " points, the controller takes at most " << YUMI_TRAJ_MAX_POINTS;
+		abort(arm, control_msgs::FollowJointTrajectoryResult::INVALID_GOAL, text.str());
+		return;
+	    }
+
+	    std::vector<float> durations(trajectory.points.size()), joints(trajectory.points.size()*N_YUMI_ARM_JOINTS);
+	    double last = 0.0;
+	    for(size_t k=0; k<trajectory.points.size(); k++) {
+		const trajectory_msgs::JointTrajectoryPoint &point = trajectory.points[k];
+		if(point.positions.size() != N_YUMI_ARM_JOINTS) {
+		    abort(arm, control_msgs::FollowJointTrajectoryResult::INVALID_GOAL, "Trajectory point without 7 positions");
+		    return;
+		}
+		for(int i=0; i<N_YUMI_ARM_JOINTS; i++) {
+		    joints[k*N_YUMI_ARM_JOINTS + index[i]] = point.positions[i];
+		}
+		durations[k] = std::max(YUMI_TRAJ_MIN_MOVE_TIME, point.time_from_start.toSec() - last);
+		last = point.time_from_start.toSec();
+	    }
+
+	    int id;
+	    {
+		boost::mutex::scoped_lock lock(connection_mutex_);
+		id = ++next_id_;
+	    }
+
+	    beginOffload(arm);
+	    if(!download(arm, id, durations, joints)) {
+		stop(arm, id);
+		endOffload(arm);
+		abort(arm, control_msgs::FollowJointTrajectoryResult::INVALID_GOAL, "Trajectory download failed");
+		return;
+	    }
+	    ROS_INFO("Offloaded trajectory %d with %lu points to the %s arm", id, trajectory.points.size(), arm == 0 ? "left" : "right");
+
+	    control_msgs::FollowJointTrajectoryFeedback feedback;
+	    feedback.joint_names = trajectory.joint_names;
+	    feedback.actual.positions.resize(N_YUMI_ARM_JOINTS);
+	    feedback.error.positions.resize(N_YUMI_ARM_JOINTS);
+
+	    ros::Time deadline = ros::Time::now() + ros::Duration(last + goal->goal_time_tolerance.toSec() + timeout_margin_);
+	    ros::Rate rate(status_rate_);
+	    YumiTrajectoryStatus status;
+	    while(true) {
+		if(servers_[arm]->isPreemptRequested() || shutdown_) {
+		    stop(arm, id);
+		    endOffload(arm);
+		    servers_[arm]->setPreempted();
+		    return;
+		}
+		if(!requestStatus(arm, status)) {
+		    requestStop(arm, id);
+		    endOffload(arm);
+		    abort(arm, control_msgs::FollowJointTrajectoryResult::PATH_TOLERANCE_VIOLATED, "Lost the trajectory server");
+		    return;
+		}
+		if(status.id == id) {
+		    if(status.state == YUMI_TRAJ_DONE) {
+			break;
+		    }
+		    if(status.state == YUMI_TRAJ_ABORTED) {
+			endOffload(arm);
+			abort(arm, control_msgs::FollowJointTrajectoryResult::PATH_TOLERANCE_VIOLATED, "Aborted on the controller");
+			return;
+		    }
+		    // the index is the point the arm moves to, from 0, and the size once it is done
+		    int last_point = (int)trajectory.points.size() - 1;
+		    const trajectory_msgs::JointTrajectoryPoint &desired = trajectory.points[std::max(0, std::min(status.index, last_point))];
+		    feedback.header.stamp = ros::Time::now();
+		    feedback.desired = desired;
+		    for(int i=0; i<N_YUMI_ARM_JOINTS; i++) {
+			feedback.actual.positions[i] = status.joints[index[i]];
+			feedback.error.positions[i] = desired.positions[i] - feedback.actual.positions[i];
+		    }
+		    servers_[arm]->publishFeedback(feedback);
+		}
+		if(ros::Time::now() > deadline) {
+		    stop(arm, id);
+		    endOffload(arm);
+		    abort(arm, control_msgs::FollowJointTrajectoryResult::GOAL_TOLERANCE_VIOLATED, "The trajectory did not finish in time");
+		    return;
+		}
+		rate.sleep();
+	    }
+
+	    endOffload(arm);
+	    control_msgs::FollowJointTrajectoryResult result;
+	    result.error_code = control_msgs::FollowJointTrajectoryResult::SUCCESSFUL;
+	    servers_[arm]->setSucceeded(result);
+	}
+
+    public:
+	YumiTrajectoryOffload() : robot_(NULL), manager_(NULL), active_(0), next_id_(0),
+		status_rate_(20.0), timeout_margin_(2.0) {
+	    shutdown_ = false;
+	}
+
+	~YumiTrajectoryOffload() {
+	    shutdown();
+	}
+
+	///action servers are started on nh/left_arm/joint_trajectory_action and nh/right_arm/joint_trajectory_action
+	bool init(ros::NodeHandle nh, std::string ip, int port, YumiHWRapid *robot,
+		controller_manager::ControllerManager *manager, const std::vector<std::string> &controllers) {
+	    robot_ = robot;
+	    manager_ = manager;
+	    controllers_ = controllers;
+
+	    ROS_INFO("Trajectory offload connecting to IP address: '%s:%d'", ip.c_str(), port);
+	    connection_.init(ip, port);
+	    if(!connection_.makeConnect()) {
+		ROS_ERROR("Could not connect to the trajectory server");
+		return false;
+	    }
+
+	    const char *names[2] = {"left_arm/joint_trajectory_action", "right_arm/joint_trajectory_action"};
+	    for(int arm=0; arm<2; arm++) {
+		servers_[arm].reset(new TrajectoryServer(nh, names[arm],
+			    boost::bind(&YumiTrajectoryOffload::execute, this, _1, arm), false));
+		servers_[arm]->start();
+	    }
+	    return true;
+	}
+
+	///stops running trajectories and the action servers
+	void shutdown() {
+	    shutdown_ = true;
+	    for(int arm=0; arm<2; arm++) {
+		if(servers_[arm]) {
+		    servers_[arm]->shutdown();
+		    servers_[arm].reset();
+		}
+	    }
+	}
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __YUMI_TRIPLE_BUFFER_H
+#define __YUMI_TRIPLE_BUFFER_H
+
+#include <boost/atomic.hpp>
+
+/**
+  * Lock-free single-producer/single-consumer exchange with latest-value semantics.
+  * The writer fills back() and publishes it, the reader picks up the most recently
+  * published value. Neither side ever waits for the other. Every published value
+  * carries a sequence number, so the reader can tell stale (no new value) and
+  * skipped (overwritten before being read) samples apart.
+  */
+template <class T>
+class YumiTripleBuffer {
+    private:
+	static const unsigned DIRTY = 4;
+	static const unsigned INDEX = 3;
+
+	T buffers_[3];
+	unsigned long sequence_[3];
+
+	///index of the slot in the middle, plus the DIRTY bit if it was not read yet
+	boost::atomic<unsigned> middle_;
+	///owned by the writer
+	unsigned back_;
+	unsigned long write_sequence_;
+	///owned by the reader
+	unsigned front_;
+
+    public:
+	YumiTripleBuffer() : middle_(1), back_(2), write_sequence_(0), front_(0) {
+	    for(int i=0; i<3; i++) {
+		sequence_[i] = 0;
+	    }
+	}
+
+	///writer: slot to fill before calling publish()
+	T& back() { return buffers_[back_]; }
+
+	///writer: makes back() the latest value, returns its sequence number
+	unsigned long publish() {
+	    sequence_[back_] = ++write_sequence_;
+	    back_ = middle_.exchange(back_ | DIRTY, boost::memory_order_acq_rel) & INDEX;
+	    return write_sequence_;
+	}
+
+	///writer: copies value into back() and publishes it
+	unsigned long write(const T &value) {
+	    back() = value;
+	    return publish();
+	}
+
+	///writer: sequence number of the last published value
+	unsigned long writeSequence() const { return write_sequence_; }
+
+	///reader: swaps in the latest value, returns false if nothing new was published
+	bool update() {
+	    if(!(middle_.load(boost::memory_order_relaxed) & DIRTY)) {
+		return false;
+	    }
+	    front_ = middle_.exchange(front_, boost::memory_order_acq_rel) & INDEX;
+	    return true;
+	}
+
+	///reader: latest value picked up by update()
+	const T& front() const { return buffers_[front_]; }
+	///reader: the front slot is the reader's until the next update(), it may be modified in place
+	T& front() { return buffers_[front_]; }
+
+	///reader: sequence number of front(), 0 if nothing was ever published
+	unsigned long frontSequence() const { return sequence_[front_]; }
+
+	///reader: copies the latest value out, returns false if it is not newer than the last read
+	bool read(T &value, unsigned long &sequence) {
+	    bool fresh = update();
+	    value = front();
+	    sequence = frontSequence();
+	    return fresh;
+	}
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __YUMI_UDP_SOCKET_H
+#define __YUMI_UDP_SOCKET_H
+
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ros/ros.h>
+
+/**
+  * Datagram socket for the UDP streaming: both the PC and the stand-in controller bind a
+  * port and answer whoever sent them the last datagram. Receiving takes a timeout so the
+  * owning thread can always be shut down.
+  */
+class YumiUdpSocket {
+    private:
+	int fd_;
+
+    public:
+	YumiUdpSocket() : fd_(-1) {}
+	~YumiUdpSocket() { close(); }
+
+	///port 0 binds an ephemeral port
+	bool open(int port) {
+	    close();
+	    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+	    if(fd_ < 0) {
+		ROS_ERROR("Could not create a UDP socket: %s", strerror(errno));
+		return false;
+	    }
+	    int on = 1;
+	    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	    struct sockaddr_in addr;
+	    memset(&addr, 0, sizeof(addr));
+	    addr.sin_family = AF_INET;
+	    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	    addr.sin_port = htons(port);
+	    if(bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		ROS_ERROR("Could not bind UDP port %d: %s", port, strerror(errno));
+		close();
+		return false;
+	    }
+	    return true;
+	}
+
+	bool isOpen() const { return fd_ >= 0; }
+
+	void close() {
+	    if(fd_ >= 0) ::close(fd_);
+	    fd_ = -1;
+	}
+
+	static bool resolve(const std::string &ip, int port, struct sockaddr_in &addr) {
+	    memset(&addr, 0, sizeof(addr));
+	    addr.sin_family = AF_INET;
+	    addr.sin_port = htons(port);
+	    return inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) == 1;
+	}
+
+	///size of the datagram, 0 on timeout, -1 on error. A datagram longer than max_len is truncated.
+	int receive(void *data, int max_len, int timeout_ms, struct sockaddr_in &from) {
+	    if(fd_ < 0) return -1;
+	    struct pollfd pfd = {fd_, POLLIN, 0};
+	    int rc = poll(&pfd, 1, timeout_ms);
+	    if(rc == 0 || (rc < 0 && errno == EINTR)) return 0;
+	    if(rc < 0) return -1;
+	    socklen_t from_len = sizeof(from);
+	    int n = recvfrom(fd_, data, max_len, 0, (struct sockaddr*)&from, &from_len);
+	    if(n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	    return n;
+	}
+
+	///a datagram is sent whole or not at all, there is nothing to retry
+	bool sendTo(const void *data, int len, const struct sockaddr_in &to) {
+	    if(fd_ < 0) return false;
+	    return sendto(fd_, data, len, 0, (const struct sockaddr*)&to, sizeof(to)) == len;
+	}
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef __YUMI_WORK_STEALING_H
+#define __YUMI_WORK_STEALING_H
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+///yields of an idle worker before it sleeps until the next run
+#define YUMI_WORK_STEALING_SPIN 2000
+///most blocks of a run, a range holds a run tag and the begin and end of its blocks
+#define YUMI_WORK_STEALING_MAX_BLOCKS 0xffffff
+
+/**
+  * Runs a task over blocks of items on a fixed set of threads, the calling thread being the
+  * first of them. Every run hands each thread a contiguous range of blocks; a thread takes
+  * blocks from the front of its range and, once it is empty, steals the back half of the
+  * range of another thread. A range is one atomic word (run tag, begin and end), taking and
+  * stealing are compare-and-swaps on it, so every block runs exactly once. A thread only
+  * takes from ranges of the run it works on: one still stealing when the next run hands out
+  * its ranges leaves them alone.
+  *
+  * The threads spin for a while between runs, stepping loops pay no wake-up; they sleep when
+  * no run comes.
+  */
+class YumiWorkStealingPool {
+    public:
+	///the task runs on the items [begin, end) of a block
+	typedef boost::function<void (int begin, int end)> Task;
+
+    private:
+	///the range of blocks of a thread, on its own cache line
+	struct Range {
+	    boost::atomic<uint64_t> blocks;
+	    char pad[64 - sizeof(boost::atomic<uint64_t>)];
+	    Range() : blocks(0) {}
+	};
+
+	static uint64_t pack(uint32_t tag, uint32_t begin, uint32_t end) {
+	    return ((uint64_t)(tag & 0xffff) << 48) | ((uint64_t)begin << 24) | end;
+	}
+	static uint32_t tag(uint64_t range) { return (uint32_t)(range >> 48); }
+	static uint32_t begin(uint64_t range) { return (uint32_t)(range >> 24) & YUMI_WORK_STEALING_MAX_BLOCKS; }
+	static uint32_t end(uint64_t range) { return (uint32_t)range & YUMI_WORK_STEALING_MAX_BLOCKS; }
+	///blocks of the run left in a range
+	static bool holds(uint64_t range, uint32_t run) { return tag(range) == (run & 0xffff) && begin(range) < end(range); }
+
+	int threads_;
+	boost::scoped_array<Range> ranges_;
+	boost::thread_group workers_;
+
+	///the run: its task, items, items per block and blocks not done yet
+	boost::atomic<const Task *> task_;
+	int items_, grain_;
+	boost::atomic<int> remaining_;
+	boost::atomic<unsigned long> stolen_;
+
+	boost::atomic<unsigned long> generation_;
+	boost::atomic<bool> stop_;
+	boost::mutex mutex_;
+	boost::condition_variable wake_;
+
+	///the next block of run for thread t, from its own range or stolen; false when none is left
+	bool take(int t, uint32_t run, uint32_t &block) {
+	    Range &own = ranges_[t];
+	    uint64_t range = own.blocks.load();
+	    while(holds(range, run)) {
+		if(own.blocks.compare_exchange_weak(range, pack(run, begin(range) + 1, end(range)))) {
+		    block = begin(range);
+		    return true;
+		}
+	    }
+	    for(int k = 1; k < threads_; k++) {
+		Range &victim = ranges_[(t + k) % threads_];
+		range = victim.blocks.load();
+		while(holds(range, run)) {
+		    uint32_t count = end(range) - begin(range);
+		    uint32_t split = end(range) - (count + 1)/2;
+		    if(victim.blocks.compare_exchange_weak(range, pack(run, begin(range), split))) {
+			// the first stolen block runs now, the rest becomes the own range. The run
+			// can not end before they ran, so the own range is not handed out anew meanwhile.
+			own.blocks.store(pack(run, split + 1, end(range)));
+			stolen_ += end(range) - split;
+			block = split;
+			return true;
+		    }
+		}
+	    }
+	    return false;
+	}
+
+	void work(int t, uint32_t run) {
+	    uint32_t block;
+	    while(take(t, run, block)) {
+		int first = block*grain_;
+		int last = first + grain_ < items_ ? first + grain_ : items_;
+		(*task_.load())(first, last);
+		remaining_.fetch_sub(1, boost::memory_order_release);
+	    }
+	}
+
+	void worker(int t) {
+	    unsigned long seen = generation_;
+	    while(true) {
+		for(int spin = 0; spin < YUMI_WORK_STEALING_SPIN && generation_ == seen && !stop_; spin++) {
+		    boost::this_thread::yield();
+		}
+		if(generation_ == seen && !stop_) {
+		    boost::unique_lock<boost::mutex> lock(mutex_);
+		    while(generation_ == seen && !stop_) wake_.wait(lock);
+		}
+		if(stop_) return;
+		seen = generation_;
+		work(t, (uint32_t)seen);
+	    }
+	}
+
+    public:
+	YumiWorkStealingPool() : threads_(1), ranges_(new Range[1]), task_(NULL), items_(0), grain_(1), remaining_(0),
+		stolen_(0), generation_(0), stop_(false) {}
+	~YumiWorkStealingPool() { shutdown(); }
+
+	///threads including the calling one, 0 for one per core
+	void setup(int threads) {
+	    shutdown();
+	    if(threads <= 0) threads = boost::thread::hardware_concurrency();
+	    threads_ = threads < 1 ? 1 : threads;
+	    ranges_.reset(new Range[threads_]);
+	    stop_ = false;
+	    for(int t = 1; t < threads_; t++) {
+		workers_.create_thread(boost::bind(&YumiWorkStealingPool::worker, this, t));
+	    }
+	}
+
+	void shutdown() {
+	    {
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		stop_ = true;
+	    }
+	    wake_.notify_all();
+	    workers_.join_all();
+	}
+
+	///runs task over items in blocks of grain items, returns when all blocks are done
+	void run(int items, int grain, const Task &task) {
+	    if(items <= 0) return;
+	    grain_ = grain < 1 ? 1 : grain;
+	    // larger blocks than asked for rather than more than a range holds
+	    if((items - 1)/grain_ + 1 > YUMI_WORK_STEALING_MAX_BLOCKS) grain_ = (items - 1)/YUMI_WORK_STEALING_MAX_BLOCKS + 1;
+	    items_ = items;
+	    uint32_t blocks = (items + grain_ - 1)/grain_;
+	    task_ = &task;
+	    remaining_ = blocks;
+	    uint32_t run = (uint32_t)(generation_ + 1);
+	    for(int t = 0; t < threads_; t++) {
+		ranges_[t].blocks.store(pack(run, (uint64_t)blocks*t/threads_, (uint64_t)blocks*(t + 1)/threads_));
+	    }
+	    {
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		generation_++;
+	    }
+	    wake_.notify_all();
+
+	    work(0, run);
+	    while(remaining_.load(boost::memory_order_acquire) > 0) {
+		boost::this_thread::yield();
+	    }
+	}
+
+	int getThreads() const { return threads_; }
+	///blocks that ran on another thread than the one they were handed to
+	unsigned long getStolen() const { return stolen_; }
+};
+
+#endif
@@ -30,7 +30,8 @@ MODULE GripperMotion_left
 
 
 PROC main()
-    VAR num grasp_force;
+    VAR ROS_gripper_cmd command;
+    VAR bool new_command;
     
     Hand_JogOutward;
     WaitTime 4;
@@ -43,27 +44,47 @@ PROC main()
     WHILE true DO
         ! Check for an updated setpoint. 
         WaitTestAndSet ROS_gripper_left_lock;
-        IF (ROS_new_gripper_left) THEN          ! a new setpoint is available
-            grasp_force := next_grasp_target.left;
+        new_command := ROS_new_gripper_left;
+        IF (new_command) THEN          ! a new setpoint is available
+            command := next_gripper_left;
         ENDIF
         current_gripper_left := Hand_GetActualPos();
         ROS_new_gripper_left := FALSE;
         ROS_gripper_left_lock := FALSE;        ! release data-lock
         
-        !gripper target received
-        IF(grasp_force > 0 ) THEN
-            TPWrite "Grasping with left";
-            Hand_GripInward \holdForce:=grasp_force;
-        ELSEIF (grasp_force < 0 ) THEN
-            Hand_GripOutward \holdForce:=-grasp_force;
-        ELSE
-            !do nothing
+        !gripper target received, started without waiting so that the position keeps being
+        !updated and a new target can take over at once
+        IF (new_command) THEN
+            apply_command command;
         ENDIF
-        WaitTime 0.1;
+        WaitTime ROS_GRIPPER_CYCLE;
     ENDWHILE
 ERROR
     ErrWrite \W, "Gripper Motion Error", "Error executing motion.  Aborting trajectory.";
 ENDPROC
 
+LOCAL PROC apply_command(ROS_gripper_cmd command)
+    IF (command.speed > 0) THEN
+        Hand_SetMaxSpeed command.speed;
+    ENDIF
+    TEST command.mode
+    CASE ROS_GRIPPER_MOVE:
+        Hand_MoveTo command.position \NoWait;
+    CASE ROS_GRIPPER_GRIP:
+        IF (command.position <= Hand_GetActualPos()) THEN
+            Hand_GripInward \holdForce:=command.force, \targetPos:=command.position, \NoWait;
+        ELSE
+            Hand_GripOutward \holdForce:=command.force, \targetPos:=command.position, \NoWait;
+        ENDIF
+    CASE ROS_GRIPPER_STOP:
+        Hand_Stop;
+    ENDTEST
+ERROR
+    ! a target the hand cannot take leaves it as it is, the next one is tried again
+    SkipWarn;
+    ErrWrite \W, "Gripper Command Error", "The left gripper rejected its target.";
+    RETURN;
+ENDPROC
+
 
 ENDMODULE
@@ -35,24 +35,28 @@ LOCAL VAR socketdev client_socket;
 
 
 PROC main()
-    VAR ROS_msg_gripper_target message;
+    VAR ROS_msg_gripper_command message;
 
     TPWrite "GripperMotionServer: Waiting for connection.";
 	ROS_init_socket server_socket, server_port;
     ROS_wait_for_client server_socket, client_socket;
 
     WHILE ( true ) DO
-		! Recieve Gripper Trajectory Pt Message
-        ROS_receive_msg_gripper_data client_socket, message;
-        WaitTestAndSet ROS_gripper_left_lock;
-        ROS_new_gripper_left := TRUE;
-        next_grasp_target.left := message.left;
-        ROS_gripper_left_lock := FALSE;
+		! Recieve Gripper Target Message, each gripper only takes a target of its own
+        ROS_receive_msg_gripper_command client_socket, message;
+        IF (message.left.mode <> ROS_GRIPPER_KEEP) THEN
+            WaitTestAndSet ROS_gripper_left_lock;
+            ROS_new_gripper_left := TRUE;
+            next_gripper_left := message.left;
+            ROS_gripper_left_lock := FALSE;
+        ENDIF
         
-        WaitTestAndSet ROS_gripper_right_lock;
-        ROS_new_gripper_right := TRUE;
-        next_grasp_target.right := message.right;
-        ROS_gripper_right_lock := FALSE;
+        IF (message.right.mode <> ROS_GRIPPER_KEEP) THEN
+            WaitTestAndSet ROS_gripper_right_lock;
+            ROS_new_gripper_right := TRUE;
+            next_gripper_right := message.right;
+            ROS_gripper_right_lock := FALSE;
+        ENDIF
         
 	ENDWHILE
 
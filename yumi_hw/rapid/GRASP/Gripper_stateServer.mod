@@ -29,7 +29,7 @@ MODULE Gripper_stateServer
 ! WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 LOCAL CONST num server_port := 12002;
-LOCAL CONST num update_rate := 0.10;  ! broadcast rate (sec)
+LOCAL CONST num update_rate := ROS_GRIPPER_CYCLE;  ! broadcast rate (sec)
 
 LOCAL VAR socketdev server_socket;
 LOCAL VAR socketdev client_socket;
@@ -31,6 +31,17 @@ MODULE ROS_motion_left
 LOCAL CONST zonedata DEFAULT_CORNER_DIST := z10;
 LOCAL VAR ROS_msg_joint_data local_target;
 LOCAL VAR intnum intr_new_target;
+LOCAL VAR intnum intr_stop_trajectory;
+
+! downloaded trajectory, see ROS_trajectoryServer
+LOCAL VAR ROS_trajectory_pt trajectory{ROS_TRAJ_MAX_POINTS};
+LOCAL VAR bool executing_trajectory := FALSE;
+
+! lookahead window of the last command, one point per move
+LOCAL VAR jointtarget stream_targets{ROS_STREAM_MAX_POINTS};
+LOCAL VAR num stream_times{ROS_STREAM_MAX_POINTS};
+LOCAL VAR num stream_length := 0;
+LOCAL VAR num stream_index := 1;
 
 PROC main()
     VAR jointtarget target;
@@ -44,6 +55,8 @@ PROC main()
     VAR num prev;
     VAR num local_cycle_time;
     VAR bool wasPosition := FALSE;
+    VAR num move_time;
+    VAR num i;
     
     ClkReset clk;
     ClkStart clk;
@@ -56,20 +69,45 @@ PROC main()
     !CONNECT intr_new_target WITH new_target_handler;
     !IPers ROS_joint_target_left_lock, intr_new_target;
 
+    ! Set up interrupt to abort a downloaded trajectory
+    IDelete intr_stop_trajectory;    ! clear interrupt handler, in case restarted with ExitCycle
+    CONNECT intr_stop_trajectory WITH stop_trajectory_handler;
+    IPers ROS_trajectory_left_stop, intr_stop_trajectory;
+
     prev_target :=CJointT();
     
     WHILE true DO
+        ! A downloaded trajectory takes over until it is done
+        IF (ROS_new_trajectory_left) THEN
+            run_trajectory;
+            prev_target := CJointT();
+        ENDIF
+
         ! Check for an updated setpoint. 
         IF (TestAndSet(ROS_joint_target_left_lock)) THEN ! mutex acquired, we can change the target
             IF (ROS_new_joint_target_left) THEN          ! a new setpoint is available
-                local_target := next_joint_target;            ! copy to local var
+                local_target := next_joint_target_left;            ! copy to local var
+                stream_length := ROS_stream_left_length;
+                FOR i FROM 1 TO stream_length DO
+                    stream_targets{i} := ROS_stream_left{i};
+                    stream_times{i} := ROS_stream_left_time{i};
+                ENDFOR
+                stream_index := 1;                           ! restart at the first point of the new window
             ENDIF
             ROS_new_joint_target_left := FALSE;
             ROS_joint_target_left_lock := FALSE;        ! release data-lock
         ENDIF
 
         !track setpoint position / velocity
-        IF (local_target.mode=JOINT_POSITION) THEN
+        move_time := cycle_time;
+        IF (local_target.mode=JOINT_POSITION) AND (stream_length > 0) THEN
+            !lookahead: keep stepping through the window until a new command arrives, then hold its last point
+            IF (stream_index > stream_length) stream_index := stream_length;
+            target := stream_targets{stream_index};
+            move_time := stream_times{stream_index};
+            IF (stream_index > 1) move_time := stream_times{stream_index} - stream_times{stream_index-1};
+            wasPosition:=TRUE;
+        ELSEIF (local_target.mode=JOINT_POSITION) THEN
             target.robax:=local_target.joints_left.robax;
             target.extax.eax_a:=local_target.joints_left.extax.eax_a;
             wasPosition:=TRUE;
@@ -86,7 +124,15 @@ PROC main()
         ENDIF
                 
         !check if we are too close to the target
-        IF (NOT is_near(target,0.0001)) THEN
+        IF (local_target.mode=JOINT_POSITION) AND (stream_length > 0) THEN
+            !blend through the lookahead window, stop exactly on its last point
+            IF (stream_index < stream_length) THEN
+                stop_mode:=DEFAULT_CORNER_DIST;
+            ELSE
+                stop_mode:=fine;
+            ENDIF
+            stream_index := stream_index + 1;
+        ELSEIF (NOT is_near(target,0.0001)) THEN
             !no, so we can move with a smoothing zone
             stop_mode:=DEFAULT_CORNER_DIST;                     
         ELSE
@@ -94,7 +140,7 @@ PROC main()
             stop_mode:=fine;        
         ENDIF
         prev := ClkRead(clk, \HighRes);
-        MoveAbsJ target,move_speed,\T:=cycle_time,stop_mode,tool0;    
+        MoveAbsJ target,move_speed,\T:=move_time,stop_mode,tool0;    
         
         
     ENDWHILE
@@ -139,6 +185,45 @@ LOCAL FUNC bool is_near(jointtarget target, num tol)
        AND ( ABS(curr_jnt.extax.eax_a - target.extax.eax_a) < tol );
 ENDFUNC
 
+! Runs the downloaded trajectory point by point, blending through all but the last one
+LOCAL PROC run_trajectory()
+    VAR num size;
+    VAR num i;
+    VAR zonedata stop_mode;
+
+    WaitTestAndSet ROS_trajectory_left_lock;
+    size := ROS_trajectory_left_size;
+    FOR i FROM 1 TO size DO
+        trajectory{i} := ROS_trajectory_left{i};
+    ENDFOR
+    ROS_new_trajectory_left := FALSE;
+    executing_trajectory := TRUE;
+    ROS_trajectory_left_lock := FALSE;
+
+    FOR i FROM 1 TO size DO
+        ROS_trajectory_left_index := i - 1;
+        stop_mode := DEFAULT_CORNER_DIST;
+        IF (i = size) stop_mode := fine;
+        MoveAbsJ trajectory{i}.joints, v100, \T:=trajectory{i}.duration, stop_mode, tool0;
+    ENDFOR
+
+    ROS_trajectory_left_index := size;
+    ROS_trajectory_left_state := ROS_TRAJ_DONE;
+    executing_trajectory := FALSE;
+    hold_position;
+ENDPROC
+
+! Drops the setpoints that were received before the trajectory, so the arm stays where it is
+LOCAL PROC hold_position()
+    IF (local_target.mode = JOINT_POSITION) THEN
+        local_target.joints_left := CJointT();
+    ELSE
+        local_target.joints_left.robax := [0, 0, 0, 0, 0, 0];
+        local_target.joints_left.extax.eax_a := 0;
+    ENDIF
+    stream_length := 0;
+ENDPROC
+
 LOCAL PROC abort_trajectory()
     clear_path;
     ExitCycle;  ! restart program
@@ -157,4 +242,15 @@ ENDPROC
 !    abort_trajectory;
 !ENDTRAP
 
+LOCAL TRAP stop_trajectory_handler
+    IF (NOT ROS_trajectory_left_stop) RETURN;
+    ROS_trajectory_left_stop := FALSE;
+    IF (NOT executing_trajectory) RETURN;
+
+    ROS_trajectory_left_state := ROS_TRAJ_ABORTED;
+    executing_trajectory := FALSE;
+    hold_position;
+    abort_trajectory;
+ENDTRAP
+
 ENDMODULE
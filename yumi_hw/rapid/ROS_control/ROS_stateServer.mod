@@ -29,16 +29,32 @@ MODULE ROS_stateServer
 ! WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 LOCAL CONST num server_port := 11002;
+! a client that sends no command for this long is dropped (sec)
+LOCAL CONST num command_timeout := 2.0;
 LOCAL CONST num update_rate := 0.010;  ! broadcast rate (sec)
 
 LOCAL VAR socketdev server_socket;
 LOCAL VAR socketdev client_socket;
 
+! previous sample, the joint velocities are differentiated from it
+LOCAL VAR clock state_clock;
+LOCAL VAR num sequence := 0;
+LOCAL VAR num prev_time := 0;
+LOCAL VAR num clock_carry := 0;
+LOCAL VAR jointtarget prev_left;
+LOCAL VAR jointtarget prev_right;
+
 PROC main()
 
     TPWrite "StateServer: Waiting for connection.";
 	ROS_init_socket server_socket, server_port;
     ROS_wait_for_client server_socket, client_socket;
+    ClkReset state_clock;
+    ClkStart state_clock;
+    clock_carry := 0;
+    prev_time := 0;
+    prev_left := CJointT(\TaskName:="T_ROB_L");
+    prev_right := CJointT(\TaskName:="T_ROB_R");
     
 	WHILE (TRUE) DO
 		send_joints;
@@ -49,6 +65,7 @@ ERROR (ERR_SOCK_TIMEOUT, ERR_SOCK_CLOSED)
 	IF (ERRNO=ERR_SOCK_TIMEOUT) OR (ERRNO=ERR_SOCK_CLOSED) THEN
         SkipWarn;  ! TBD: include this error data in the message logged below?
         ErrWrite \W, "ROS StateServer disconnect", "Connection lost.  Waiting for new connection.";
+        hold_arms;
         ExitCycle;  ! restart program
 	ELSE
 		TRYNEXT;
@@ -57,26 +74,58 @@ UNDO
 ENDPROC
 
 LOCAL PROC send_joints()
-	VAR ROS_msg_joint_data message;
+	VAR ROS_msg_yumi_joints message;
     VAR ROS_msg_joint_data target;
+    VAR jointtarget stream_left{ROS_STREAM_MAX_POINTS};
+    VAR jointtarget stream_right{ROS_STREAM_MAX_POINTS};
+    VAR num stream_time{ROS_STREAM_MAX_POINTS};
+    VAR num stream_length;
+    VAR num i;
 	! VAR jointtarget joints;
 	
-    ! get current joint position (degrees)
-	message.joints_left := CJointT(\TaskName:="T_ROB_L");
-    message.joints_right := CJointT(\TaskName:="T_ROB_R");
+    ! get current joint position (degrees) and the time it was sampled. The clock starts over
+    ! every ROS_CLOCK_WRAP seconds, before its time loses precision, the PC unwraps it.
+    message.timestamp := ClkRead(state_clock, \HighRes) + clock_carry;
+    IF (message.timestamp >= ROS_CLOCK_WRAP) THEN
+        ClkReset state_clock;
+        ClkStart state_clock;
+        message.timestamp := message.timestamp - ROS_CLOCK_WRAP;
+        clock_carry := message.timestamp;
+        prev_time := prev_time - ROS_CLOCK_WRAP;
+    ENDIF
+	message.position_left := CJointT(\TaskName:="T_ROB_L");
+    message.position_right := CJointT(\TaskName:="T_ROB_R");
+    message.velocity_left := joint_velocity(message.position_left, prev_left, message.timestamp - prev_time);
+    message.velocity_right := joint_velocity(message.position_right, prev_right, message.timestamp - prev_time);
+    message.effort_left := ROS_motor_torques(ROB_L);
+    message.effort_right := ROS_motor_torques(ROB_R);
+    prev_left := message.position_left;
+    prev_right := message.position_right;
+    prev_time := message.timestamp;
     
     ! create message
-    message.header := [ROS_MSG_TYPE_JOINT, ROS_COM_TYPE_TOPIC, ROS_REPLY_TYPE_INVALID];
-    message.sequence_id := 0;
+    message.header := [ROS_MSG_TYPE_YUMI_JOINTS, ROS_COM_TYPE_TOPIC, ROS_REPLY_TYPE_INVALID];
+    message.sequence_id := sequence;
+    message.mode := next_joint_target_left.mode;
+    sequence := (sequence + 1) MOD 1000000;
          
     ! send message to client
-    ROS_send_msg_joint_data client_socket, message;
+    ROS_send_msg_yumi_joints client_socket, message;
 
-    ! recv message from client
-    ROS_receive_msg_joint_data client_socket, target;
+    ! recv message from client, a single setpoint or a lookahead window
+    ROS_receive_msg_joint_command client_socket, target, stream_left, stream_right, stream_time, stream_length \wait_time:=command_timeout;
     WaitTestAndSet ROS_joint_target_left_lock;
     WaitTestAndSet ROS_joint_target_right_lock;
-    next_joint_target := target;
+    next_joint_target_left := target;
+    next_joint_target_right := target;
+    ROS_stream_left_length := stream_length;
+    ROS_stream_right_length := stream_length;
+    FOR i FROM 1 TO stream_length DO
+        ROS_stream_left_time{i} := stream_time{i};
+        ROS_stream_right_time{i} := stream_time{i};
+        ROS_stream_left{i} := stream_left{i};
+        ROS_stream_right{i} := stream_right{i};
+    ENDFOR
 
     ROS_new_joint_target_left := TRUE;
     ROS_new_joint_target_right := TRUE;
@@ -86,5 +135,39 @@ ERROR
     RAISE;  ! raise errors to calling code
 ENDPROC
 
+! without a client the motion tasks stop where they are, a velocity command would go on forever
+LOCAL PROC hold_arms()
+    WaitTestAndSet ROS_joint_target_left_lock;
+    next_joint_target_left.mode := JOINT_POSITION;
+    next_joint_target_left.joints_left := CJointT(\TaskName:="T_ROB_L");
+    ROS_stream_left_length := 0;
+    ROS_new_joint_target_left := TRUE;
+    ROS_joint_target_left_lock := FALSE;
+    WaitTestAndSet ROS_joint_target_right_lock;
+    next_joint_target_right.mode := JOINT_POSITION;
+    next_joint_target_right.joints_right := CJointT(\TaskName:="T_ROB_R");
+    ROS_stream_right_length := 0;
+    ROS_new_joint_target_right := TRUE;
+    ROS_joint_target_right_lock := FALSE;
+ENDPROC
+
+LOCAL FUNC jointtarget joint_velocity(jointtarget current, jointtarget previous, num dt)
+    VAR jointtarget ret;
+
+    ret := current;
+    IF (dt <= 0) THEN
+        ret.robax := [0, 0, 0, 0, 0, 0];
+        ret.extax.eax_a := 0;
+        RETURN ret;
+    ENDIF
+    ret.robax.rax_1 := (current.robax.rax_1 - previous.robax.rax_1)/dt;
+    ret.robax.rax_2 := (current.robax.rax_2 - previous.robax.rax_2)/dt;
+    ret.robax.rax_3 := (current.robax.rax_3 - previous.robax.rax_3)/dt;
+    ret.robax.rax_4 := (current.robax.rax_4 - previous.robax.rax_4)/dt;
+    ret.robax.rax_5 := (current.robax.rax_5 - previous.robax.rax_5)/dt;
+    ret.robax.rax_6 := (current.robax.rax_6 - previous.robax.rax_6)/dt;
+    ret.extax.eax_a := (current.extax.eax_a - previous.extax.eax_a)/dt;
+    RETURN ret;
+ENDFUNC
 
 ENDMODULE
@@ -0,0 +1,155 @@
+MODULE ROS_stateServer_right
+
+! Software License Agreement (BSD License)
+!
+! Copyright (c) 2012, Edward Venator, Case Western Reserve University
+! Copyright (c) 2012, Jeremy Zoss, Southwest Research Institute
+! All rights reserved.
+!
+! Redistribution and use in source and binary forms, with or without modification,
+! are permitted provided that the following conditions are met:
+!
+!   Redistributions of source code must retain the above copyright notice, this
+!       list of conditions and the following disclaimer.
+!   Redistributions in binary form must reproduce the above copyright notice, this
+!       list of conditions and the following disclaimer in the documentation
+!       and/or other materials provided with the distribution.
+!   Neither the name of the Case Western Reserve University nor the names of its contributors
+!       may be used to endorse or promote products derived from this software without
+!       specific prior written permission.
+!
+! THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+! EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+! OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+! SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+! INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+! TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+! BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+! CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+! WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+LOCAL CONST num server_port := 11004;
+! a client that sends no command for this long is dropped (sec)
+LOCAL CONST num command_timeout := 2.0;
+
+! Joint state server for the right arm alone, so that each arm has its own connection and
+! neither waits for the other. Run it instead of ROS_stateServer, together with ROS_stateServer_left.
+! The joints of the other arm are sent as zeros and ignored in the commands.
+
+LOCAL VAR socketdev server_socket;
+LOCAL VAR socketdev client_socket;
+
+! previous sample, the joint velocities are differentiated from it
+LOCAL VAR clock state_clock;
+LOCAL VAR num sequence := 0;
+LOCAL VAR num prev_time := 0;
+LOCAL VAR num clock_carry := 0;
+LOCAL VAR jointtarget prev_joints;
+
+PROC main()
+
+    TPWrite "StateServer right: Waiting for connection.";
+    ROS_init_socket server_socket, server_port;
+    ROS_wait_for_client server_socket, client_socket;
+    ClkReset state_clock;
+    ClkStart state_clock;
+    clock_carry := 0;
+    prev_time := 0;
+    prev_joints := CJointT(\TaskName:="T_ROB_R");
+
+    WHILE (TRUE) DO
+        send_joints;
+    ENDWHILE
+
+ERROR (ERR_SOCK_TIMEOUT, ERR_SOCK_CLOSED)
+    IF (ERRNO=ERR_SOCK_TIMEOUT) OR (ERRNO=ERR_SOCK_CLOSED) THEN
+        SkipWarn;
+        ErrWrite \W, "ROS StateServer right disconnect", "Connection lost.  Waiting for new connection.";
+        hold_arms;
+        ExitCycle;  ! restart program
+    ELSE
+        TRYNEXT;
+    ENDIF
+UNDO
+ENDPROC
+
+LOCAL PROC send_joints()
+    VAR ROS_msg_yumi_joints message;
+    VAR ROS_msg_joint_data target;
+    VAR jointtarget stream_left{ROS_STREAM_MAX_POINTS};
+    VAR jointtarget stream_right{ROS_STREAM_MAX_POINTS};
+    VAR num stream_time{ROS_STREAM_MAX_POINTS};
+    VAR num stream_length;
+    VAR num i;
+
+    ! get current joint position (degrees) and the time it was sampled. The clock starts over
+    ! every ROS_CLOCK_WRAP seconds, before its time loses precision, the PC unwraps it.
+    message.timestamp := ClkRead(state_clock, \HighRes) + clock_carry;
+    IF (message.timestamp >= ROS_CLOCK_WRAP) THEN
+        ClkReset state_clock;
+        ClkStart state_clock;
+        message.timestamp := message.timestamp - ROS_CLOCK_WRAP;
+        clock_carry := message.timestamp;
+        prev_time := prev_time - ROS_CLOCK_WRAP;
+    ENDIF
+    message.position_right := CJointT(\TaskName:="T_ROB_R");
+    message.velocity_right := joint_velocity(message.position_right, prev_joints, message.timestamp - prev_time);
+    message.effort_right := ROS_motor_torques(ROB_R);
+    prev_joints := message.position_right;
+    prev_time := message.timestamp;
+
+    ! create message
+    message.header := [ROS_MSG_TYPE_YUMI_JOINTS, ROS_COM_TYPE_TOPIC, ROS_REPLY_TYPE_INVALID];
+    message.sequence_id := sequence;
+    message.mode := next_joint_target_right.mode;
+    sequence := (sequence + 1) MOD 1000000;
+
+    ! send message to client
+    ROS_send_msg_yumi_joints client_socket, message;
+
+    ! recv message from client, only the right arm is taken from it
+    ROS_receive_msg_joint_command client_socket, target, stream_left, stream_right, stream_time, stream_length \wait_time:=command_timeout;
+    WaitTestAndSet ROS_joint_target_right_lock;
+    next_joint_target_right := target;
+    ROS_stream_right_length := stream_length;
+    FOR i FROM 1 TO stream_length DO
+        ROS_stream_right_time{i} := stream_time{i};
+        ROS_stream_right{i} := stream_right{i};
+    ENDFOR
+
+    ROS_new_joint_target_right := TRUE;
+    ROS_joint_target_right_lock := FALSE; !release lock
+ERROR
+    RAISE;  ! raise errors to calling code
+ENDPROC
+
+! without a client the motion tasks stop where they are, a velocity command would go on forever
+LOCAL PROC hold_arms()
+    WaitTestAndSet ROS_joint_target_right_lock;
+    next_joint_target_right.mode := JOINT_POSITION;
+    next_joint_target_right.joints_right := CJointT(\TaskName:="T_ROB_R");
+    ROS_stream_right_length := 0;
+    ROS_new_joint_target_right := TRUE;
+    ROS_joint_target_right_lock := FALSE;
+ENDPROC
+
+LOCAL FUNC jointtarget joint_velocity(jointtarget current, jointtarget previous, num dt)
+    VAR jointtarget ret;
+
+    ret := current;
+    IF (dt <= 0) THEN
+        ret.robax := [0, 0, 0, 0, 0, 0];
+        ret.extax.eax_a := 0;
+        RETURN ret;
+    ENDIF
+    ret.robax.rax_1 := (current.robax.rax_1 - previous.robax.rax_1)/dt;
+    ret.robax.rax_2 := (current.robax.rax_2 - previous.robax.rax_2)/dt;
+    ret.robax.rax_3 := (current.robax.rax_3 - previous.robax.rax_3)/dt;
+    ret.robax.rax_4 := (current.robax.rax_4 - previous.robax.rax_4)/dt;
+    ret.robax.rax_5 := (current.robax.rax_5 - previous.robax.rax_5)/dt;
+    ret.robax.rax_6 := (current.robax.rax_6 - previous.robax.rax_6)/dt;
+    ret.extax.eax_a := (current.extax.eax_a - previous.extax.eax_a)/dt;
+    RETURN ret;
+ENDFUNC
+
+ENDMODULE
@@ -0,0 +1,255 @@
+MODULE ROS_trajectoryServer
+
+! Software License Agreement (BSD License)
+!
+! Copyright (c) 2012, Edward Venator, Case Western Reserve University
+! Copyright (c) 2012, Jeremy Zoss, Southwest Research Institute
+! All rights reserved.
+!
+! Redistribution and use in source and binary forms, with or without modification,
+! are permitted provided that the following conditions are met:
+!
+!   Redistributions of source code must retain the above copyright notice, this
+!       list of conditions and the following disclaimer.
+!   Redistributions in binary form must reproduce the above copyright notice, this
+!       list of conditions and the following disclaimer in the documentation
+!       and/or other materials provided with the distribution.
+!   Neither the name of the Case Western Reserve University nor the names of its contributors
+!       may be used to endorse or promote products derived from this software without
+!       specific prior written permission.
+!
+! THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+! EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+! OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+! SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+! INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+! TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+! BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+! CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+! WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+LOCAL CONST num server_port := 11000;
+
+LOCAL VAR socketdev server_socket;
+LOCAL VAR socketdev client_socket;
+
+! trajectory being downloaded, handed to the motion task of its arm once complete
+LOCAL VAR ROS_trajectory_pt trajectory{ROS_TRAJ_MAX_POINTS};
+LOCAL VAR num trajectory_size := 0;
+LOCAL VAR num trajectory_id := 0;
+LOCAL VAR num trajectory_arm := 0;
+
+PROC main()
+
+    TPWrite "TrajectoryServer: Waiting for connection.";
+    ROS_init_socket server_socket, server_port;
+    ROS_wait_for_client server_socket, client_socket;
+
+    WHILE (TRUE) DO
+        trajectory_callback;
+    ENDWHILE
+
+ERROR (ERR_SOCK_TIMEOUT, ERR_SOCK_CLOSED)
+    IF (ERRNO=ERR_SOCK_TIMEOUT) OR (ERRNO=ERR_SOCK_CLOSED) THEN
+        SkipWarn;
+        ErrWrite \W, "ROS TrajectoryServer disconnect", "Connection lost.  Waiting for new connection.";
+        trajectory_arm := 0;  ! drop any partial download
+        ExitCycle;  ! restart program
+    ELSE
+        TRYNEXT;
+    ENDIF
+UNDO
+ENDPROC
+
+! Handles one request: arm, flags, id, number of points, then per point the move
+! duration and the 7 joints of the arm. A request without points and flags only
+! asks for the status of the arm.
+LOCAL PROC trajectory_callback()
+    VAR ROS_msg message;
+    VAR num arm;
+    VAR num flags;
+    VAR num id;
+    VAR num n;
+    VAR num i;
+    VAR bool ok := TRUE;
+
+    ROS_receive_msg client_socket, message;
+
+    IF (message.header.msg_type <> ROS_MSG_TYPE_TRAJECTORY) OR (RawBytesLen(message.data) < 16) THEN
+        ErrWrite \W, "ROS Socket Type Mismatch", "Unexpected trajectory request",
+                \RL2:="expected: " + ValToStr(ROS_MSG_TYPE_TRAJECTORY),
+                \RL3:="received: " + ValToStr(message.header.msg_type);
+        RAISE ERR_ARGVALERR;
+    ENDIF
+
+    UnpackRawBytes message.data, 1, arm, \IntX:=DINT;
+    UnpackRawBytes message.data, 5, flags, \IntX:=DINT;
+    UnpackRawBytes message.data, 9, id, \IntX:=DINT;
+    UnpackRawBytes message.data, 13, n, \IntX:=DINT;
+
+    IF (arm <> ROS_LEFT_ARM) AND (arm <> ROS_RIGHT_ARM) THEN
+        ErrWrite \W, "ROS TrajectoryServer", "Unknown arm", \RL2:="arm: " + ValToStr(arm);
+        RAISE ERR_ARGVALERR;
+    ENDIF
+
+    IF has_flag(flags, ROS_TRAJ_STOP) THEN
+        stop_trajectory arm;
+        IF (trajectory_arm = arm) trajectory_arm := 0;
+    ENDIF
+
+    IF has_flag(flags, ROS_TRAJ_START) THEN
+        IF (get_state(arm) = ROS_TRAJ_RUNNING) THEN
+            ! the arm is busy, the client has to stop it first
+            ok := FALSE;
+        ELSE
+            trajectory_arm := arm;
+            trajectory_id := id;
+            trajectory_size := 0;
+            set_state arm, ROS_TRAJ_LOADING, id, 0;
+        ENDIF
+    ENDIF
+
+    IF ok AND (n > 0) THEN
+        ! points only belong to the download that is open for this arm
+        IF (trajectory_arm <> arm) OR (trajectory_id <> id) OR (trajectory_size + n > ROS_TRAJ_MAX_POINTS) OR (RawBytesLen(message.data) < 16 + n*32) THEN
+            ok := FALSE;
+        ELSE
+            FOR i FROM 1 TO n DO
+                ROS_unpack_trajectory_pt message.data, 17 + (i-1)*32, trajectory{trajectory_size + i};
+            ENDFOR
+            trajectory_size := trajectory_size + n;
+        ENDIF
+    ENDIF
+
+    IF ok AND has_flag(flags, ROS_TRAJ_END) THEN
+        IF (trajectory_arm <> arm) OR (trajectory_id <> id) OR (trajectory_size < 1) THEN
+            ok := FALSE;
+        ELSE
+            start_trajectory arm;
+            trajectory_arm := 0;
+        ENDIF
+    ENDIF
+
+    send_status arm, ok;
+
+ERROR
+    RAISE;  ! raise errors to calling code
+ENDPROC
+
+LOCAL FUNC bool has_flag(num flags, num flag)
+    RETURN ((flags DIV flag) MOD 2) = 1;
+ENDFUNC
+
+LOCAL FUNC num get_state(num arm)
+    IF (arm = ROS_LEFT_ARM) RETURN ROS_trajectory_left_state;
+    RETURN ROS_trajectory_right_state;
+ENDFUNC
+
+LOCAL PROC set_state(num arm, num state, num id, num size)
+    IF (arm = ROS_LEFT_ARM) THEN
+        WaitTestAndSet ROS_trajectory_left_lock;
+        ROS_trajectory_left_state := state;
+        ROS_trajectory_left_id := id;
+        ROS_trajectory_left_size := size;
+        ROS_trajectory_left_index := 0;
+        ROS_trajectory_left_lock := FALSE;
+    ELSE
+        WaitTestAndSet ROS_trajectory_right_lock;
+        ROS_trajectory_right_state := state;
+        ROS_trajectory_right_id := id;
+        ROS_trajectory_right_size := size;
+        ROS_trajectory_right_index := 0;
+        ROS_trajectory_right_lock := FALSE;
+    ENDIF
+ENDPROC
+
+! Hands the downloaded trajectory to the motion task of the arm
+LOCAL PROC start_trajectory(num arm)
+    VAR num i;
+
+    IF (arm = ROS_LEFT_ARM) THEN
+        WaitTestAndSet ROS_trajectory_left_lock;
+        FOR i FROM 1 TO trajectory_size DO
+            ROS_trajectory_left{i} := trajectory{i};
+        ENDFOR
+        ROS_trajectory_left_size := trajectory_size;
+        ROS_trajectory_left_id := trajectory_id;
+        ROS_trajectory_left_index := 0;
+        ROS_trajectory_left_state := ROS_TRAJ_RUNNING;
+        ROS_new_trajectory_left := TRUE;
+        ROS_trajectory_left_lock := FALSE;
+    ELSE
+        WaitTestAndSet ROS_trajectory_right_lock;
+        FOR i FROM 1 TO trajectory_size DO
+            ROS_trajectory_right{i} := trajectory{i};
+        ENDFOR
+        ROS_trajectory_right_size := trajectory_size;
+        ROS_trajectory_right_id := trajectory_id;
+        ROS_trajectory_right_index := 0;
+        ROS_trajectory_right_state := ROS_TRAJ_RUNNING;
+        ROS_new_trajectory_right := TRUE;
+        ROS_trajectory_right_lock := FALSE;
+    ENDIF
+ENDPROC
+
+! A trajectory the motion task has not picked up yet is dropped here, a running one
+! is aborted by the motion task through its interrupt on the stop flag
+LOCAL PROC stop_trajectory(num arm)
+    IF (arm = ROS_LEFT_ARM) THEN
+        WaitTestAndSet ROS_trajectory_left_lock;
+        IF (ROS_new_trajectory_left) THEN
+            ROS_new_trajectory_left := FALSE;
+            ROS_trajectory_left_state := ROS_TRAJ_ABORTED;
+        ELSEIF (ROS_trajectory_left_state = ROS_TRAJ_RUNNING) THEN
+            ROS_trajectory_left_stop := TRUE;
+        ELSEIF (ROS_trajectory_left_state = ROS_TRAJ_LOADING) THEN
+            ROS_trajectory_left_state := ROS_TRAJ_ABORTED;
+        ENDIF
+        ROS_trajectory_left_lock := FALSE;
+    ELSE
+        WaitTestAndSet ROS_trajectory_right_lock;
+        IF (ROS_new_trajectory_right) THEN
+            ROS_new_trajectory_right := FALSE;
+            ROS_trajectory_right_state := ROS_TRAJ_ABORTED;
+        ELSEIF (ROS_trajectory_right_state = ROS_TRAJ_RUNNING) THEN
+            ROS_trajectory_right_stop := TRUE;
+        ELSEIF (ROS_trajectory_right_state = ROS_TRAJ_LOADING) THEN
+            ROS_trajectory_right_state := ROS_TRAJ_ABORTED;
+        ENDIF
+        ROS_trajectory_right_lock := FALSE;
+    ENDIF
+ENDPROC
+
+! Replies with arm, id, state, index, size and the current joints of the arm (radians)
+LOCAL PROC send_status(num arm, bool ok)
+    VAR ROS_msg message;
+    VAR jointtarget joints;
+
+    message.header.msg_type := ROS_MSG_TYPE_TRAJECTORY;
+    message.header.comm_type := ROS_COM_TYPE_SRV_REPLY;
+    message.header.reply_code := ROS_REPLY_TYPE_SUCCESS;
+    IF (NOT ok) message.header.reply_code := ROS_REPLY_TYPE_FAILURE;
+
+    PackRawBytes arm, message.data, 1, \IntX:=DINT;
+    IF (arm = ROS_LEFT_ARM) THEN
+        joints := CJointT(\TaskName:="T_ROB_L");
+        PackRawBytes ROS_trajectory_left_id, message.data, 5, \IntX:=DINT;
+        PackRawBytes ROS_trajectory_left_state, message.data, 9, \IntX:=DINT;
+        PackRawBytes ROS_trajectory_left_index, message.data, 13, \IntX:=DINT;
+        PackRawBytes ROS_trajectory_left_size, message.data, 17, \IntX:=DINT;
+    ELSE
+        joints := CJointT(\TaskName:="T_ROB_R");
+        PackRawBytes ROS_trajectory_right_id, message.data, 5, \IntX:=DINT;
+        PackRawBytes ROS_trajectory_right_state, message.data, 9, \IntX:=DINT;
+        PackRawBytes ROS_trajectory_right_index, message.data, 13, \IntX:=DINT;
+        PackRawBytes ROS_trajectory_right_size, message.data, 17, \IntX:=DINT;
+    ENDIF
+    ROS_pack_jointtarget joints, message.data, 21;
+
+    ROS_send_msg client_socket, message;
+
+ERROR
+    RAISE;  ! raise errors to calling code
+ENDPROC
+
+ENDMODULE
@@ -0,0 +1,70 @@
+#include <stddef.h>
+#include <errno.h>
+
+#include <yumi_hw/yumi_alloc_check.h>
+
+// The glibc allocator under its internal names, the wrappers below take the place of the
+// public ones for the whole process. Only the calls of armed threads are counted.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static __thread bool yumi_alloc_armed = false;
+static __thread unsigned long yumi_alloc_count = 0;
+
+void yumiAllocCheckArm(bool armed)
+{
+    yumi_alloc_armed = armed;
+}
+
+unsigned long yumiAllocCheckCount()
+{
+    return yumi_alloc_count;
+}
+
+extern "C" {
+
+void *malloc(size_t size)
+{
+    if(yumi_alloc_armed) yumi_alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if(yumi_alloc_armed) yumi_alloc_count++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if(yumi_alloc_armed) yumi_alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if(yumi_alloc_armed) yumi_alloc_count++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    if(yumi_alloc_armed) yumi_alloc_count++;
+    void *p = __libc_memalign(alignment, size);
+    if(p == NULL) return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+void free(void *ptr)
+{
+    if(yumi_alloc_armed && ptr != NULL) yumi_alloc_count++;
+    __libc_free(ptr);
+}
+
+}
@@ -0,0 +1 @@
+#include "yumi_hw/yumi_batch_sim.h"
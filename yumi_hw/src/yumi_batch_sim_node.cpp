@@ -0,0 +1,120 @@
+// SYS
+#include <cstdio>
+#include <cstdlib>
+
+// ROS headers
+#include <ros/ros.h>
+#include <urdf/model.h>
+
+#include "yumi_hw/yumi_batch_sim.h"
+
+/**
+  * Throughput of YumiBatchSim: steps robots YuMi models from /robot_description in lockstep,
+  * every robot moving to random targets within the joint limits, and reports the
+  * robot-steps per second.
+  */
+
+int main( int argc, char** argv )
+{
+  ros::init(argc, argv, "yumi_batch_sim");
+  ros::NodeHandle nh("~");
+
+  std::string name, urdf_string, joint_model, limits_namespace, base_link;
+  std::vector<std::string> tips;
+  int robots, threads, steps, grain, seed;
+  double control_period, target_period;
+  double time_constant, natural_frequency, damping_ratio;
+  nh.param("name", name, std::string("yumi"));
+  nh.param("robots", robots, 1024);
+  nh.param("threads", threads, 0);
+  nh.param("steps", steps, 10000);
+  nh.param("grain", grain, YUMI_BATCH_GRAIN);
+  nh.param("seed", seed, 1);
+  nh.param("control_period", control_period, 0.001);
+  // simulated time between new random targets of a robot
+  nh.param("target_period", target_period, 0.5);
+  nh.param("joint_model", joint_model, std::string("first_order"));
+  nh.param("time_constant", time_constant, 0.02);
+  nh.param("natural_frequency", natural_frequency, 30.0);
+  nh.param("damping_ratio", damping_ratio, 1.0);
+  nh.param("limits_namespace", limits_namespace, std::string("/robot_description_planning"));
+  nh.param("base_link", base_link, name + "_body");
+  if(!nh.getParam("tips", tips))
+  {
+    tips.push_back(name + "_link_7_l");
+    tips.push_back(name + "_link_7_r");
+  }
+
+  if(joint_model != "first_order" && joint_model != "second_order")
+  {
+    ROS_FATAL("Unknown joint model %s, use first_order or second_order", joint_model.c_str());
+    return -1;
+  }
+  urdf::Model model;
+  if(!ros::param::get("/robot_description", urdf_string) || !model.initString(urdf_string))
+  {
+    ROS_FATAL("No robot description on /robot_description");
+    return -1;
+  }
+
+  // the joints in the order of YumiHW
+  const char *arm_joints[] = {"1", "2", "3", "4", "5", "6", "7"};
+  const char *arms[] = {"l", "r"};
+  std::vector<std::string> joint_names;
+  for (int a = 0; a < 2; a++)
+  {
+    for (int j = 0; j < 7; j++)
+    {
+      joint_names.push_back(name + "_joint_" + arm_joints[j] + "_" + arms[a]);
+    }
+  }
+
+  YumiBatchSim sim;
+  if(!sim.setup(model, base_link, tips, joint_names, robots, threads))
+  {
+    ROS_FATAL("Could not set up the batch simulation");
+    return -1;
+  }
+  sim.setJointModel(joint_model == "first_order" ? YumiHWSim::FIRST_ORDER : YumiHWSim::SECOND_ORDER,
+    time_constant, natural_frequency, damping_ratio);
+  sim.loadLimits(ros::NodeHandle(limits_namespace));
+  sim.setGrain(grain);
+
+  // random targets within the joint limits, or within +-1 rad of joints without limits
+  std::vector<double> lower(joint_names.size()), upper(joint_names.size());
+  for (size_t j = 0; j < joint_names.size(); j++)
+  {
+    boost::shared_ptr<const urdf::Joint> joint = model.getJoint(joint_names[j]);
+    bool limited = joint && joint->limits && joint->type == urdf::Joint::REVOLUTE;
+    lower[j] = limited ? joint->limits->lower : -1.0;
+    upper[j] = limited ? joint->limits->upper : 1.0;
+  }
+  unsigned int state = seed;
+  int target_steps = std::max(1, (int)(target_period/control_period));
+
+  ROS_INFO("Stepping %d robots for %d steps on %d threads", robots, steps, sim.getThreads());
+  for (int s = 0; s < steps && ros::ok(); s++)
+  {
+    // a share of the robots gets new targets every step, spread so all get them once a target period
+    int first = (long long)robots*(s % target_steps)/target_steps;
+    int last = (long long)robots*(s % target_steps + 1)/target_steps;
+    for (size_t j = 0; j < joint_names.size(); j++)
+    {
+      double *command = sim.positionCommand(j);
+      for (int r = first; r < last; r++)
+      {
+        command[r] = lower[j] + (upper[j] - lower[j])*(rand_r(&state)/(double)RAND_MAX);
+      }
+    }
+    sim.step(control_period);
+  }
+
+  double rotation[9], position[3];
+  int tip = sim.getLinkIndex(tips.back());
+  sim.getLinkPose(0, tip, rotation, position);
+  ROS_INFO("%s of robot 0 at %.4f %.4f %.4f", tips.back().c_str(), position[0], position[1], position[2]);
+  ROS_INFO("%llu robot-steps in %.3f s: %.0f robot-steps/s, %.1f us per step, %lu blocks stolen",
+    sim.getRobotSteps(), sim.getStepTime(), sim.getThroughput(),
+    steps > 0 ? sim.getStepTime()/steps*1e6 : 0.0, sim.getStolenBlocks());
+  return 0;
+}
@@ -0,0 +1,121 @@
+// SYS
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "yumi_hw/yumi_flight_record.h"
+
+/**
+  * Exports a flight recorder dump (see YumiFlightRecorder) to CSV, one row per cycle:
+  *   yumi_flight_to_csv <dump.bin> [<out.csv>]
+  * Times are in seconds, relative to the first cycle of the dump.
+  */
+
+static const char *columns[] = {"position", "velocity", "effort", "position_command", "velocity_command"};
+
+static const float *jointValues(const YumiFlightRecord &r, int column)
+{
+  switch(column)
+  {
+    case 0: return r.position;
+    case 1: return r.velocity;
+    case 2: return r.effort;
+    case 3: return r.position_command;
+    default: return r.velocity_command;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  if(argc < 2 || argc > 3)
+  {
+    fprintf(stderr, "Usage: %s <dump.bin> [<out.csv>]\n", argv[0]);
+    return -1;
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) != 0)
+  {
+    fprintf(stderr, "Could not open %s: %s\n", argv[1], strerror(errno));
+    return -1;
+  }
+  if((size_t)st.st_size < sizeof(YumiFlightHeader))
+  {
+    fprintf(stderr, "%s is too short for a flight recorder dump\n", argv[1]);
+    return -1;
+  }
+  const char *map = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+  {
+    fprintf(stderr, "Could not map %s: %s\n", argv[1], strerror(errno));
+    return -1;
+  }
+
+  const YumiFlightHeader &header = *(const YumiFlightHeader *)map;
+  if(memcmp(header.magic, YUMI_FLIGHT_MAGIC, sizeof(YUMI_FLIGHT_MAGIC)) != 0 || header.version != YUMI_FLIGHT_VERSION ||
+    header.header_size != sizeof(YumiFlightHeader) || header.record_size != sizeof(YumiFlightRecord) ||
+    header.joints > YUMI_FLIGHT_JOINTS)
+  {
+    fprintf(stderr, "%s is not a flight recorder dump of version %d\n", argv[1], YUMI_FLIGHT_VERSION);
+    return -1;
+  }
+  // a dump cut short keeps its complete records
+  unsigned long records = (st.st_size - sizeof(YumiFlightHeader))/sizeof(YumiFlightRecord);
+  if(header.records < records) records = header.records;
+  const YumiFlightRecord *r = (const YumiFlightRecord *)(map + sizeof(YumiFlightHeader));
+
+  FILE *out = stdout;
+  if(argc == 3)
+  {
+    out = fopen(argv[2], "w");
+    if(out == NULL)
+    {
+      fprintf(stderr, "Could not write %s: %s\n", argv[2], strerror(errno));
+      return -1;
+    }
+  }
+
+  char name[YUMI_FLIGHT_NAME_LENGTH + 1];
+  fprintf(out, "cycle,time,stamp,period,read_time,update_time,write_time,strategy,reconnects");
+  for(int c = 0; c < YUMI_FLIGHT_CHANNELS; c++) fprintf(out, ",state_sequence_%d", c);
+  fprintf(out, ",limit,reconnect,stale");
+  for(int k = 0; k < 5; k++)
+  {
+    for(unsigned int j = 0; j < header.joints; j++)
+    {
+      strncpy(name, header.names[j], YUMI_FLIGHT_NAME_LENGTH);
+      name[YUMI_FLIGHT_NAME_LENGTH] = 0;
+      fprintf(out, ",%s_%s", name, columns[k]);
+    }
+  }
+  fprintf(out, "\n");
+
+  long long t0 = records > 0 ? r[0].time : 0;
+  for(unsigned long i = 0; i < records; i++)
+  {
+    fprintf(out, "%llu,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%d,%u",
+      (unsigned long long)r[i].cycle, (r[i].time - t0)*1e-9, r[i].stamp*1e-9, r[i].period*1e-9,
+      r[i].read_time*1e-9, r[i].update_time*1e-9, r[i].write_time*1e-9, r[i].strategy, r[i].reconnects);
+    for(int c = 0; c < YUMI_FLIGHT_CHANNELS; c++) fprintf(out, ",%u", r[i].state_sequence[c]);
+    fprintf(out, ",%d,%d,%d", (r[i].flags & YUMI_FLIGHT_LIMIT) != 0, (r[i].flags & YUMI_FLIGHT_RECONNECT) != 0,
+      (r[i].flags & YUMI_FLIGHT_STALE) != 0);
+    for(int k = 0; k < 5; k++)
+    {
+      const float *values = jointValues(r[i], k);
+      for(unsigned int j = 0; j < header.joints; j++) fprintf(out, ",%.7g", values[j]);
+    }
+    fprintf(out, "\n");
+  }
+
+  fprintf(stderr, "%lu cycles dumped for %s (%.3f s)\n", records, header.reason,
+    records > 1 ? (r[records - 1].time - t0)*1e-9 : 0.0);
+  if(out != stdout) fclose(out);
+  munmap((void *)map, st.st_size);
+  return 0;
+}
@@ -1,4 +1,7 @@
 #include<yumi_hw/yumi_hw.h>
+#include<yumi_hw/yumi_rapid_protocol.h>
+
+#include <algorithm>
 
 void YumiHW::create(std::string name, std::string urdf_string)
 {
@@ -26,17 +29,38 @@ void YumiHW::create(std::string name, std::string urdf_string)
     joint_names_.push_back( robot_namespace_ + std::string("_joint_5_r") );
     joint_names_.push_back( robot_namespace_ + std::string("_joint_6_r") );
     joint_names_.push_back( robot_namespace_ + std::string("_joint_7_r") );
+
+    // the names the gripper node publishes
+    if (n_grippers_ > 0)
+    {
+	joint_names_.push_back( std::string("gripper_l_joint") );
+	joint_names_.push_back( std::string("gripper_r_joint") );
+    }
     
     // VARIABLES
-    joint_position_.resize(n_joints_);
-    joint_position_prev_.resize(n_joints_);
-    joint_velocity_.resize(n_joints_);
-    joint_effort_.resize(n_joints_);
-    joint_position_command_.resize(n_joints_);
-    joint_velocity_command_.resize(n_joints_);
+    int n_all = n_joints_ + n_grippers_;
+    joint_position_.resize(n_all);
+    joint_position_prev_.resize(n_all);
+    joint_velocity_.resize(n_all);
+    joint_acceleration_.resize(n_all);
+    joint_effort_.resize(n_all);
+    joint_model_effort_.resize(n_all);
+    joint_external_effort_.resize(n_all);
+    if (effort_scale_.size() != (size_t)n_all)
+    {
+	effort_scale_.resize(n_all, 1.0);
+    }
+    joint_position_command_.resize(n_all);
+    joint_velocity_command_.resize(n_all);
 
-    joint_lower_limits_.resize(n_joints_);
-    joint_upper_limits_.resize(n_joints_);
+    joint_lower_limits_.resize(n_all);
+    joint_upper_limits_.resize(n_all);
+
+    if (!estimator_)
+    {
+	estimator_.reset(new YumiSmoothingEstimator(default_smoothing_));
+    }
+    estimator_->resize(n_all);
 
     // RESET VARIABLES
     reset();
@@ -62,15 +86,135 @@ void YumiHW::create(std::string name, std::string urdf_string)
     ROS_INFO("Succesfully created an abstract Yumi with interfaces to ROS control");
 }
 
+void YumiHW::setStateEstimator(YumiStateEstimator *estimator)
+{
+    estimator_.reset(estimator);
+    if (!joint_position_.empty())
+    {
+	estimator_->resize(joint_position_.size());
+    }
+}
+
+bool YumiHW::initDynamics(const std::string &base_link, const std::string &left_tip, const std::string &right_tip, bool inertial)
+{
+    dynamics_ready_ = false;
+    KDL::Tree tree;
+    if (!kdl_parser::treeFromUrdfModel(urdf_model_, tree))
+    {
+	ROS_ERROR("Could not build a dynamics model from the URDF");
+	return false;
+    }
+
+    const std::string tips[2] = {left_tip, right_tip};
+    for (int a = 0; a < 2; a++)
+    {
+	ArmDynamics &arm = arm_dynamics_[a];
+	if (!tree.getChain(base_link, tips[a], arm.chain))
+	{
+	    ROS_ERROR("No chain from %s to %s in the URDF", base_link.c_str(), tips[a].c_str());
+	    return false;
+	}
+
+	// the chain runs in kinematic order, the joint vectors in the order of the controller
+	arm.joints.clear();
+	for (unsigned int s = 0; s < arm.chain.getNrOfSegments(); s++)
+	{
+	    const KDL::Joint &joint = arm.chain.getSegment(s).getJoint();
+	    if (joint.getType() == KDL::Joint::None) continue;
+	    int index = std::find(joint_names_.begin(), joint_names_.begin() + n_joints_, joint.getName()) - joint_names_.begin();
+	    if (index >= n_joints_)
+	    {
+		ROS_ERROR("Joint %s of the chain to %s is not an arm joint", joint.getName().c_str(), tips[a].c_str());
+		return false;
+	    }
+	    arm.joints.push_back(index);
+	}
+
+	unsigned int n = arm.chain.getNrOfJoints();
+	arm.solver.reset(new KDL::ChainDynParam(arm.chain, gravity_));
+	arm.q.resize(n);
+	arm.qd.resize(n);
+	arm.qdd.resize(n);
+	arm.gravity.resize(n);
+	arm.coriolis.resize(n);
+	arm.mass.resize(n);
+    }
+
+    dynamics_inertial_ = inertial;
+    dynamics_ready_ = true;
+    return true;
+}
+
+void YumiHW::updateExternalEffort()
+{
+    if (!dynamics_ready_) return;
+
+    for (int a = 0; a < 2; a++)
+    {
+	ArmDynamics &arm = arm_dynamics_[a];
+	int n = arm.joints.size();
+	for (int i = 0; i < n; i++)
+	{
+	    arm.q(i) = joint_position_[arm.joints[i]];
+	    arm.qd(i) = joint_velocity_[arm.joints[i]];
+	    arm.qdd(i) = joint_acceleration_[arm.joints[i]];
+	}
+
+	arm.solver->JntToGravity(arm.q, arm.gravity);
+	if (dynamics_inertial_)
+	{
+	    arm.solver->JntToMass(arm.q, arm.mass);
+	    arm.solver->JntToCoriolis(arm.q, arm.qd, arm.coriolis);
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+	    double model = arm.gravity(i);
+	    if (dynamics_inertial_)
+	    {
+		// M(q) qdd by hand, an Eigen product would allocate a temporary
+		for (int k = 0; k < n; k++) model += arm.mass(i, k)*arm.qdd(k);
+		model += arm.coriolis(i);
+	    }
+	    int j = arm.joints[i];
+	    joint_model_effort_[j] = model;
+	    joint_external_effort_[j] = joint_effort_[j] - model;
+	}
+    }
+}
+
+void YumiHW::computeGravity(const std::vector<double> &position, std::vector<double> &effort)
+{
+    if (!dynamics_ready_) return;
+
+    for (int a = 0; a < 2; a++)
+    {
+	ArmDynamics &arm = arm_dynamics_[a];
+	int n = arm.joints.size();
+	for (int i = 0; i < n; i++)
+	{
+	    arm.q(i) = position[arm.joints[i]];
+	}
+	arm.solver->JntToGravity(arm.q, arm.gravity);
+	for (int i = 0; i < n; i++)
+	{
+	    effort[arm.joints[i]] = arm.gravity(i);
+	}
+    }
+}
+
 // reset values
 void YumiHW::reset()
 {
-    for (int j = 0; j < n_joints_; ++j)
+    for (int j = 0; j < n_joints_ + n_grippers_; ++j)
     {
 	joint_position_[j] = 0.0;
 	joint_position_prev_[j] = 0.0;
 	joint_velocity_[j] = 0.0;
+	joint_acceleration_[j] = 0.0;
 	joint_effort_[j] = 0.0;
+	joint_model_effort_[j] = 0.0;
+	joint_external_effort_[j] = 0.0;
 
 	joint_position_command_[j] = 0.0;
 	joint_velocity_command_[j] = 0.0;
@@ -158,6 +302,8 @@ void YumiHW::registerInterfaces(const urdf::Model *const urdf_model,
 		&joint_lower_limits_[j], &joint_upper_limits_[j]);
     }
 
+    registerGripperJoints(urdf_model);
+
     // Register interfaces
     registerInterface(&state_interface_);
     //registerInterface(&effort_interface_);
@@ -165,6 +311,39 @@ void YumiHW::registerInterfaces(const urdf::Model *const urdf_model,
     registerInterface(&velocity_interface_);
 }
 
+void YumiHW::registerGripperJoints(const urdf::Model *const urdf_model)
+{
+    for (int j = n_joints_; j < n_joints_ + n_grippers_; j++)
+    {
+	ROS_INFO("Loading gripper joint '%s' with a position interface", joint_names_[j].c_str());
+
+	state_interface_.registerHandle(hardware_interface::JointStateHandle(
+		    joint_names_[j], &joint_position_[j], &joint_velocity_[j], &joint_effort_[j]));
+
+	hardware_interface::JointHandle joint_handle_position;
+	joint_handle_position = hardware_interface::JointHandle(state_interface_.getHandle(joint_names_[j]),
+		&joint_position_command_[j]);
+	position_interface_.registerHandle(joint_handle_position);
+
+	// the stroke of the fingers, unless the URDF knows better
+	joint_limits_interface::JointLimits limits;
+	limits.has_position_limits = true;
+	limits.min_position = 0.0;
+	limits.max_position = YUMI_GRIPPER_MAX_OPENING;
+	if (urdf_model != NULL)
+	{
+	    const boost::shared_ptr<const urdf::Joint> urdf_joint = urdf_model->getJoint(joint_names_[j]);
+	    if (urdf_joint != NULL)
+	    {
+		joint_limits_interface::getJointLimits(urdf_joint, limits);
+	    }
+	}
+	joint_lower_limits_[j] = limits.min_position;
+	joint_upper_limits_[j] = limits.max_position;
+	pj_sat_interface_.registerHandle(joint_limits_interface::PositionJointSaturationHandle(joint_handle_position, limits));
+    }
+}
+
 // Register the limits of the joint specified by joint_name and\ joint_handle. The limits are
 // retrieved from the urdf_model.
 // Return the joint's type, lower position limit, upper position limit, and effort limit.
@@ -338,6 +517,25 @@ bool YumiHW::canSwitch(const std::list<hardware_interface::ControllerInfo> &star
 	    // Debug
 	    // std::cout << "This controller does not use any command interface, so it is only sensing, no problem" << std::endl;
 	}
+#if ROS_VERSION_MINIMUM(1,12,0)
+	// doSwitch() runs in the control loop and does not log, so its decisions are reported here
+	for(int i=0; i<it->claimed_resources.size(); i++) {
+	    const std::string &interface = it->claimed_resources[i].hardware_interface;
+	    if( interface.compare("hardware_interface::PositionJointInterface") == 0 )
+	    {
+		ROS_INFO("Request to switch to hardware_interface::PositionJointInterface (JOINT_POSITION)");
+	    }
+	    else if( interface.compare("hardware_interface::VelocityJointInterface") == 0 )
+	    {
+		ROS_INFO("Request to switch to hardware_interface::VelocityJointInterface (JOINT_VELOCITY)");
+	    }
+	    else
+	    {
+		ROS_INFO("Controller of type %s, requested interface of type %s. Impossible, sorry.\n",
+			it->type.c_str(), interface.c_str());
+	    }
+	}
+#endif
     }
 
     if( desired_strategies.size() > 1 )
@@ -349,6 +547,7 @@ bool YumiHW::canSwitch(const std::list<hardware_interface::ControllerInfo> &star
     return true;
 }
 
+// Runs in the control loop: nothing in here allocates or logs
 void YumiHW::doSwitch(const std::list<hardware_interface::ControllerInfo> &start_list, const std::list<hardware_interface::ControllerInfo> &stop_list)
 {
     ControlStrategy desired_strategy = JOINT_POSITION; // default
@@ -362,34 +561,25 @@ void YumiHW::doSwitch(const std::list<hardware_interface::ControllerInfo> &start
 	    //jade and karmic
 	    for(int i=0; i<it->claimed_resources.size(); i++) {
 
-		if( it->claimed_resources[i].hardware_interface.compare( std::string("hardware_interface::PositionJointInterface") ) == 0 )
+		if( it->claimed_resources[i].hardware_interface.compare("hardware_interface::PositionJointInterface") == 0 )
 		{
-		    ROS_INFO("Request to switch to hardware_interface::PositionJointInterface (JOINT_POSITION)");
 		    wantsPosition = true;
 		}
-		else if( it->claimed_resources[i].hardware_interface.compare( std::string("hardware_interface::VelocityJointInterface") ) == 0 )
+		else if( it->claimed_resources[i].hardware_interface.compare("hardware_interface::VelocityJointInterface") == 0 )
 		{
-		    ROS_INFO("Request to switch to hardware_interface::VelocityJointInterface (JOINT_VELOCITY)");
 		    wantsVelocity = true;
 		} 
-		else
-		{
-		    ROS_INFO("Controller of type %s, requested interface of type %s. Impossible, sorry.\n", 
-			    it->type.c_str(), it->claimed_resources[i].hardware_interface.c_str());
-		}
 	    }
 #else
 
 	    //indigo and below
-	    if( it->hardware_interface.compare( std::string("hardware_interface::PositionJointInterface") ) == 0 )
+	    if( it->hardware_interface.compare("hardware_interface::PositionJointInterface") == 0 )
 	    {
-		ROS_INFO("Request to switch to hardware_interface::PositionJointInterface (JOINT_POSITION)");
 		desired_strategy = JOINT_POSITION;
 		break;
 	    }
-	    else if( it->hardware_interface.compare( std::string("hardware_interface::VelocityJointInterface") ) == 0 )
+	    else if( it->hardware_interface.compare("hardware_interface::VelocityJointInterface") == 0 )
 	    {
-		ROS_INFO("Request to switch to hardware_interface::VelocityJointInterface (JOINT_VELOCITY)");
 		desired_strategy = JOINT_VELOCITY;
 		break;
 	    }
@@ -398,43 +588,24 @@ void YumiHW::doSwitch(const std::list<hardware_interface::ControllerInfo> &start
     if(wantsPosition) {		
 	desired_strategy = JOINT_POSITION;
     }
+    // with both position and velocity interfaces, velocity wins
     if(wantsVelocity) {
 	desired_strategy = JOINT_VELOCITY;
     }
 
-    if(wantsPosition && wantsVelocity) {
-	ROS_ERROR("Cannot have both position and velocity interface. Will assume Velocity. Beware!");
-    }
-
-    for (int j = 0; j < n_joints_; ++j)
+    for (int j = 0; j < n_joints_ + n_grippers_; ++j)
     {
-	///semantic Zero
+	///semantic Zero, the command handles point straight at these
 	joint_position_command_[j] = joint_position_[j];
 	joint_velocity_command_[j] = 0.0;
 	//joint_effort_command_[j] = 0.0;
-
-	///call setCommand once so that the JointLimitsInterface receive the correct value on their getCommand()!
-	try{  position_interface_.getHandle(joint_names_[j]).setCommand(joint_position_command_[j]);  }
-	catch(const hardware_interface::HardwareInterfaceException&){}
-	//try{  effort_interface_.getHandle(joint_names_[j]).setCommand(joint_effort_command_[j]);  }
-	//catch(const hardware_interface::HardwareInterfaceException&){}
-	try{  velocity_interface_.getHandle(joint_names_[j]).setCommand(joint_velocity_command_[j]);  }
-	catch(const hardware_interface::HardwareInterfaceException&){}
-
-	///reset joint_limit_interfaces
-	pj_sat_interface_.reset();
-	pj_limits_interface_.reset();
     }
 
-    if(desired_strategy == getControlStrategy())
-    {
-	std::cout << "The ControlStrategy didn't change, it is already: " << getControlStrategy() << std::endl;
-    }
-    else
-    {
-	setControlStrategy(desired_strategy);
-	std::cout << "The ControlStrategy changed to: " << getControlStrategy() << std::endl;
-    }
+    ///reset joint_limit_interfaces
+    pj_sat_interface_.reset();
+    pj_limits_interface_.reset();
+
+    setControlStrategy(desired_strategy);
 }
 
 void YumiHW::enforceLimits(ros::Duration period)
@@ -0,0 +1,306 @@
+// SYS
+#include <cstdio>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+// ROS headers
+#include <ros/ros.h>
+#include <controller_manager/controller_manager.h>
+#include <controller_manager_msgs/SwitchController.h>
+
+#include "yumi_hw/yumi_hw_rapid.h"
+#include "yumi_hw/yumi_mock_controller.h"
+#include "yumi_hw/yumi_realtime_loop.h"
+#include "yumi_hw/yumi_latency_stats.h"
+#include "yumi_hw/yumi_alloc_check.h"
+
+// the right arm channel of a run listens this far above the port of the run
+#define YUMI_BENCHMARK_RIGHT_PORT_OFFSET 1000
+
+/**
+  * Round-trip benchmark of the RAPID backend: drives YumiHWRapid and a controller manager
+  * against an in-process YumiMockController over loopback, for every combination of
+  * controller load and transport settings, and reports latency quantiles and cycle rates.
+  * The controllers are loaded from ~/manager, as the node loads them, and run in every cycle.
+  */
+
+struct BenchmarkRun
+{
+  double load;
+  double cycle_time;
+  double drop_rate;
+  bool tcp_no_delay;
+  bool per_arm_channels;
+};
+
+struct BenchmarkResult
+{
+  YumiLatencyHistogram ready, sent;
+  double exchange_rate, loop_rate;
+  unsigned long overruns, stale_commands, stale_states, skipped_states;
+  bool allocating;
+};
+
+// One read/update/write cycle with an extra busy wait on top of the controllers, standing in
+// for heavier ones
+class BenchmarkCycle
+{
+public:
+  BenchmarkCycle(YumiHW *robot, controller_manager::ControllerManager *manager, double load, YumiAllocCheck *alloc_check) :
+    robot_(robot), manager_(manager), load_ns_((long long)(load*1e9)), alloc_check_(alloc_check) {}
+
+  void update(const ros::Time &now, const ros::Duration &period)
+  {
+    alloc_check_->beginCycle();
+    robot_->read(now, period);
+    alloc_check_->endPhase(YumiAllocCheck::READ);
+    manager_->update(now, period);
+    if(load_ns_ > 0)
+    {
+      long long until = yumiMonotonicNs() + load_ns_;
+      while(yumiMonotonicNs() < until);
+    }
+    alloc_check_->endPhase(YumiAllocCheck::UPDATE);
+    robot_->write(now, period);
+    alloc_check_->endPhase(YumiAllocCheck::WRITE);
+  }
+
+private:
+  YumiHW *robot_;
+  controller_manager::ControllerManager *manager_;
+  long long load_ns_;
+  YumiAllocCheck *alloc_check_;
+};
+
+bool runBenchmark(const BenchmarkRun &run, int port, const std::string &urdf_string, const std::vector<std::string> &controllers,
+  double duration, double control_period, bool realtime, int cpu_affinity, int lookahead_points, int alloc_check_warmup,
+  BenchmarkResult &result)
+{
+  YumiMockControllerConfig config;
+  config.state_port = port;
+  config.right_state_port = run.per_arm_channels ? port + YUMI_BENCHMARK_RIGHT_PORT_OFFSET : -1;
+  config.gripper_state_port = -1;
+  config.gripper_command_port = -1;
+  config.cycle_time = run.cycle_time;
+  config.state_drop_rate = run.drop_rate;
+  config.command_drop_rate = run.drop_rate;
+  config.tcp_no_delay = run.tcp_no_delay;
+
+  YumiMockController mock;
+  if(!mock.init(config))
+  {
+    return false;
+  }
+  mock.start();
+
+  {
+    boost::scoped_ptr<YumiHWRapid> robot(new YumiHWRapid());
+    robot->create("yumi", urdf_string);
+    robot->setup("127.0.0.1", port, run.per_arm_channels ? port + YUMI_BENCHMARK_RIGHT_PORT_OFFSET : 0);
+    robot->setLookahead(lookahead_points, run.cycle_time);
+    // the warm-up is not measured, the histograms record from when they are resumed
+    result.ready.pause();
+    result.sent.pause();
+    robot->setLatencyHistograms(&result.ready, &result.sent);
+    if(!robot->init())
+    {
+      mock.stop();
+      return false;
+    }
+
+    boost::scoped_ptr<controller_manager::ControllerManager> manager(
+      new controller_manager::ControllerManager(robot.get(), ros::NodeHandle("~/manager")));
+    for(size_t i=0; i<controllers.size(); i++)
+    {
+      if(!manager->loadController(controllers[i]))
+      {
+        ROS_ERROR("Could not load the controller %s from ~/manager", controllers[i].c_str());
+        mock.stop();
+        return false;
+      }
+    }
+    YumiAllocCheck alloc_check;
+    alloc_check.setup(alloc_check_warmup);
+    BenchmarkCycle cycle(robot.get(), manager.get(), run.load, &alloc_check);
+
+    YumiRealtimeLoop loop;
+    loop.setup(boost::bind(&BenchmarkCycle::update, &cycle, _1, _2), control_period, realtime, 80, cpu_affinity);
+
+    // let the exchange settle before measuring, the switch is done by the running loop
+    if(!loop.start())
+    {
+      mock.stop();
+      return false;
+    }
+    if(!controllers.empty() &&
+      !manager->switchController(controllers, std::vector<std::string>(), controller_manager_msgs::SwitchController::Request::STRICT))
+    {
+      ROS_ERROR("Could not start the controllers");
+      loop.stop();
+      mock.stop();
+      return false;
+    }
+    usleep(500000);
+    unsigned long mock_start = mock.getCycles(), dropped_start = mock.getDroppedStates();
+    unsigned long loop_start = loop.getCycles(), overruns_start = loop.getOverruns();
+    result.ready.resume();
+    result.sent.resume();
+    unsigned long stale_cmd_start = robot->getStaleCommands(), stale_start = robot->getStaleStates(), skipped_start = robot->getSkippedStates();
+
+    usleep((useconds_t)(duration*1e6));
+    loop.stop();
+
+    // exchanges per channel, the mock counts the cycles and drops of all channels
+    result.exchange_rate = (mock.getCycles() - mock_start - (mock.getDroppedStates() - dropped_start))/duration/mock.getChannels();
+    result.loop_rate = (loop.getCycles() - loop_start)/duration;
+    result.overruns = loop.getOverruns() - overruns_start;
+    result.stale_commands = robot->getStaleCommands() - stale_cmd_start;
+    result.stale_states = robot->getStaleStates() - stale_start;
+    result.skipped_states = robot->getSkippedStates() - skipped_start;
+    result.allocating = alloc_check.failed();
+    if(result.allocating)
+    {
+      ROS_ERROR("Control cycle %lu after the warm-up made %lu heap allocator calls in %s()",
+        alloc_check.failedCycle(), alloc_check.failedCount(), alloc_check.failedPhase());
+    }
+  }
+  // the robot interface is gone and its socket closed, so the mock threads can finish
+  mock.stop();
+  return true;
+}
+
+int main( int argc, char** argv )
+{
+  ros::init(argc, argv, "yumi_hw_benchmark");
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+
+  ros::NodeHandle nh("~");
+
+  // the benchmark matrix
+  std::vector<double> loads, cycle_times, drop_rates;
+  std::vector<bool> no_delays, per_arm;
+  std::vector<std::string> controllers;
+  double duration, control_period;
+  bool realtime;
+  int port, cpu_affinity, lookahead_points, alloc_check_warmup;
+  std::string output;
+  bool allocating = false;
+
+  if(!nh.getParam("loads", loads))
+  {
+    loads.push_back(0.0);
+    loads.push_back(0.0002);
+    loads.push_back(0.001);
+  }
+  if(!nh.getParam("cycle_times", cycle_times))
+  {
+    cycle_times.push_back(0.004);
+    cycle_times.push_back(0.012);
+  }
+  if(!nh.getParam("drop_rates", drop_rates))
+  {
+    drop_rates.push_back(0.0);
+    drop_rates.push_back(0.01);
+  }
+  if(!nh.getParam("tcp_no_delay", no_delays))
+  {
+    no_delays.push_back(true);
+    no_delays.push_back(false);
+  }
+  if(!nh.getParam("per_arm_channels", per_arm))
+  {
+    per_arm.push_back(false);
+  }
+  // run in every cycle, their configuration is read from ~/manager/<controller>
+  if(!nh.getParam("controllers", controllers))
+  {
+    controllers.push_back("joint_state_controller");
+    controllers.push_back("joint_trajectory_pos_controller");
+  }
+  nh.param("duration", duration, 5.0);
+  nh.param("control_period", control_period, 0.002);
+  nh.param("realtime", realtime, false);
+  nh.param("cpu_affinity", cpu_affinity, -1);
+  nh.param("port", port, 15002);
+  nh.param("lookahead_points", lookahead_points, 0);
+  // > 0: the cycles of every run are checked for heap allocations after this many, and the
+  // benchmark fails if any allocates
+  nh.param("alloc_check_warmup", alloc_check_warmup, 0);
+  nh.param("output", output, std::string(""));
+
+  std::string urdf_string;
+  if(!nh.getParam("/robot_description", urdf_string))
+  {
+    ROS_WARN("No /robot_description, running without joint interfaces and controllers");
+    controllers.clear();
+  }
+
+  FILE *csv = NULL;
+  if(!output.empty())
+  {
+    csv = fopen(output.c_str(), "w");
+    if(csv == NULL)
+    {
+      ROS_ERROR("Could not open %s", output.c_str());
+      return -1;
+    }
+    fprintf(csv, "load,cycle_time,drop_rate,tcp_no_delay,per_arm,stage,p50,p99,p999,max,exchange_rate,loop_rate,overruns,stale_commands,stale_states,skipped_states\n");
+  }
+
+  printf("%8s %8s %6s %5s %4s | %-6s %9s %9s %9s %9s | %9s %9s %8s %8s %8s\n",
+    "load[us]", "cycle[ms]", "drop", "nodly", "arms", "stage", "p50[us]", "p99[us]", "p99.9[us]", "max[us]",
+    "exch[Hz]", "loop[Hz]", "overrun", "stale_c", "skipped");
+
+  for(size_t l=0; l<loads.size() && ros::ok(); l++)
+  for(size_t c=0; c<cycle_times.size() && ros::ok(); c++)
+  for(size_t d=0; d<drop_rates.size() && ros::ok(); d++)
+  for(size_t n=0; n<no_delays.size() && ros::ok(); n++)
+  for(size_t a=0; a<per_arm.size() && ros::ok(); a++)
+  {
+    BenchmarkRun run;
+    run.load = loads[l];
+    run.cycle_time = cycle_times[c];
+    run.drop_rate = drop_rates[d];
+    run.tcp_no_delay = no_delays[n];
+    run.per_arm_channels = per_arm[a];
+
+    BenchmarkResult result;
+    result.allocating = false;
+    if(!runBenchmark(run, port++, urdf_string, controllers, duration, control_period, realtime, cpu_affinity, lookahead_points, alloc_check_warmup, result))
+    {
+      ROS_ERROR("Benchmark run failed");
+      continue;
+    }
+    allocating = allocating || result.allocating;
+
+    const char *stages[2] = {"ready", "sent"};
+    const YumiLatencyHistogram *histograms[2] = {&result.ready, &result.sent};
+    for(int s=0; s<2; s++)
+    {
+      const YumiLatencyHistogram &h = *histograms[s];
+      printf("%8.0f %8.1f %6.3f %5d %4d | %-6s %9.1f %9.1f %9.1f %9.1f | %9.1f %9.1f %8lu %8lu %8lu\n",
+        run.load*1e6, run.cycle_time*1e3, run.drop_rate, (int)run.tcp_no_delay, run.per_arm_channels ? 2 : 1, stages[s],
+        h.quantile(0.5)*1e-3, h.quantile(0.99)*1e-3, h.quantile(0.999)*1e-3, h.max()*1e-3,
+        result.exchange_rate, result.loop_rate, result.overruns, result.stale_commands, result.skipped_states);
+      if(csv != NULL)
+      {
+        fprintf(csv, "%g,%g,%g,%d,%d,%s,%lld,%lld,%lld,%lld,%g,%g,%lu,%lu,%lu,%lu\n",
+          run.load, run.cycle_time, run.drop_rate, (int)run.tcp_no_delay, (int)run.per_arm_channels, stages[s],
+          h.quantile(0.5), h.quantile(0.99), h.quantile(0.999), h.max(),
+          result.exchange_rate, result.loop_rate, result.overruns, result.stale_commands,
+          result.stale_states, result.skipped_states);
+      }
+    }
+    fflush(stdout);
+  }
+
+  if(csv != NULL)
+  {
+    fclose(csv);
+  }
+  spinner.stop();
+  return allocating ? 1 : 0;
+}
@@ -0,0 +1,2 @@
+#include <yumi_hw/yumi_hw_egm.h>
+
@@ -109,8 +109,25 @@ public:
 
     // Load the YumiHWsim abstraction to interface the controllers with the gazebo model
     robot_hw_sim_.reset( new YumiHWGazebo() );
+    YumiStateEstimator *estimator = yumiStateEstimatorFromParams(model_nh_, 0.2);
+    if(estimator != NULL) robot_hw_sim_->setStateEstimator(estimator);
     robot_hw_sim_->create(robot_namespace_, urdf_string);
     robot_hw_sim_->setParentModel(parent_model_);
+
+    // Drive the joints with efforts, PID gains under pid_gains/<joint> plus the gravity of the arms
+    bool effort_control, gravity_compensation;
+    model_nh_.param("effort_control", effort_control, false);
+    model_nh_.param("gravity_compensation", gravity_compensation, true);
+    if(effort_control)
+    {
+      // the links are named after the model, the namespace may be /yumi
+      std::string base_link, left_tip, right_tip;
+      model_nh_.param("dynamics_base_link", base_link, parent_model_->GetName() + "_body");
+      model_nh_.param("dynamics_left_tip", left_tip, parent_model_->GetName() + "_link_7_l");
+      model_nh_.param("dynamics_right_tip", right_tip, parent_model_->GetName() + "_link_7_r");
+      robot_hw_sim_->setEffortControl(ros::NodeHandle(model_nh_, "pid_gains"), gravity_compensation,
+        base_link, left_tip, right_tip);
+    }
     if(!robot_hw_sim_->init())
     {
       ROS_FATAL_NAMED("yumi_hw","Could not initialize robot simulation interface");
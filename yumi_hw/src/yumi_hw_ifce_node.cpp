@@ -5,20 +5,129 @@
 #include <signal.h>
 #include <stdexcept>
 
+#include <boost/bind.hpp>
+
 // ROS headers
 #include <ros/ros.h>
 #include <controller_manager/controller_manager.h>
 
 // the lwr hw fri interface
 #include "yumi_hw/yumi_hw_rapid.h"
+#include "yumi_hw/yumi_hw_egm.h"
+#include "yumi_hw/yumi_realtime_loop.h"
+#include "yumi_hw/yumi_cycle_monitor.h"
+#include "yumi_hw/yumi_effort_publisher.h"
+#include "yumi_hw/yumi_trajectory_offload.h"
+#include "yumi_hw/yumi_alloc_check.h"
+#include "yumi_hw/yumi_flight_recorder.h"
 
-bool g_quit = false;
+volatile bool g_quit = false;
+YumiFlightRecorder *g_flight_recorder = NULL;
 
 void quitRequested(int sig)
 {
   g_quit = true;
 }
 
+// SIGUSR1 dumps the flight recorder on demand
+void dumpRequested(int sig)
+{
+  if(g_flight_recorder != NULL) g_flight_recorder->trigger(YumiFlightRecorder::REQUEST);
+}
+
+// a crash dumps the flight recorder before the default action ends the process
+void fatalSignal(int sig)
+{
+  if(g_flight_recorder != NULL) g_flight_recorder->dumpFromSignal(YumiFlightRecorder::SIGNAL);
+  raise(sig);
+}
+
+// One read/update/write cycle of the hardware interface and the controllers
+class ControlCycle
+{
+public:
+  ControlCycle(YumiHW *robot, controller_manager::ControllerManager *manager, YumiCycleMonitor *monitor, YumiAllocCheck *alloc_check) :
+    robot_(robot), manager_(manager), monitor_(monitor), alloc_check_(alloc_check), effort_publisher_(NULL), flight_recorder_(NULL),
+    session_recorder_(NULL), sample_stamps_(false) {}
+
+  // update the controllers at the time the controller sampled the state, instead of the loop time
+  void setSampleStamps(bool sample_stamps) { sample_stamps_ = sample_stamps; }
+
+  // estimate and publish the external effort after every read
+  void setEffortPublisher(YumiEffortPublisher *effort_publisher) { effort_publisher_ = effort_publisher; }
+
+  // keep every cycle in the flight recorder
+  void setFlightRecorder(YumiFlightRecorder *flight_recorder) { flight_recorder_ = flight_recorder; }
+
+  // record the stamps of the controllers to the session, the backend records the rest
+  void setSessionRecorder(YumiSessionRecorder *session_recorder) { session_recorder_ = session_recorder; }
+
+  void update(const ros::Time &now, const ros::Duration &period)
+  {
+    alloc_check_->beginCycle();
+    long long t0 = yumiMonotonicNs();
+
+    // read the state from the lwr
+    robot_->read(now, period);
+    robot_->updateExternalEffort();
+    long long t1 = yumiMonotonicNs();
+    alloc_check_->endPhase(YumiAllocCheck::READ);
+
+    // update the controllers, the time never goes back even if the clock estimate does
+    ros::Time stamp = now;
+    if(sample_stamps_)
+    {
+      stamp = robot_->getStateStamp(now);
+      if(stamp < last_stamp_) stamp = last_stamp_;
+      last_stamp_ = stamp;
+      if(session_recorder_ != NULL) session_recorder_->setStamp(stamp);
+    }
+    if(effort_publisher_ != NULL) effort_publisher_->publish(*robot_, stamp);
+    manager_->update(stamp, period);
+    long long t2 = yumiMonotonicNs();
+    alloc_check_->endPhase(YumiAllocCheck::UPDATE);
+
+    // write the command to the lwr
+    robot_->write(now, period);
+    long long t3 = yumiMonotonicNs();
+    alloc_check_->endPhase(YumiAllocCheck::WRITE);
+
+    monitor_->record(t1 - t0, t2 - t1, t3 - t2, period.toNSec(), now);
+    if(flight_recorder_ != NULL) flight_recorder_->record(*robot_, t0, stamp, period.toNSec(), t1 - t0, t2 - t1, t3 - t2);
+    alloc_check_->endPhase(YumiAllocCheck::STATS);
+  }
+
+private:
+  YumiHW *robot_;
+  controller_manager::ControllerManager *manager_;
+  YumiCycleMonitor *monitor_;
+  YumiAllocCheck *alloc_check_;
+  YumiEffortPublisher *effort_publisher_;
+  YumiFlightRecorder *flight_recorder_;
+  YumiSessionRecorder *session_recorder_;
+  bool sample_stamps_;
+  ros::Time last_stamp_;
+};
+
+// Restart the running controllers, so they start over from the measured state
+void restartControllers(controller_manager::ControllerManager &manager)
+{
+  std::vector<std::string> names, running;
+  manager.getControllerNames(names);
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    controller_interface::ControllerBase *controller = manager.getControllerByName(names[i]);
+    if(controller != NULL && controller->isRunning()) running.push_back(names[i]);
+  }
+  if(running.empty()) return;
+
+  ROS_INFO("Restarting %d controllers after a reconnection", (int)running.size());
+  if(!manager.switchController(running, running, controller_manager_msgs::SwitchController::Request::BEST_EFFORT))
+  {
+    ROS_ERROR("Could not restart the controllers after a reconnection");
+  }
+}
+
 // Get the URDF XML from the parameter server
 std::string getURDF(ros::NodeHandle &model_nh_, std::string param_name)
 {
@@ -69,19 +178,182 @@ int main( int argc, char** argv )
   ros::NodeHandle yumi_nh ("~");
 
   // get params or give default values
-  int port;
+  int port, right_port;
   std::string hintToRemoteHost;
   std::string name;
   //yumi_nh.param("port", port, 49939);
   yumi_nh.param("ip", hintToRemoteHost, std::string("192.168.125.1") );
   yumi_nh.param("name", name, std::string("yumi"));
+  // with a right_state_port the arms are served on separate connections and threads
+  // (ROS_stateServer_left/right.mod), state_port then serves the left arm only
+  yumi_nh.param("state_port", port, YUMI_STATE_PORT);
+  yumi_nh.param("right_state_port", right_port, 0);
+
+  // backend: "rapid" exchanges joint states and commands in lockstep over TCP with the RAPID
+  // state servers, "egm" streams them over UDP datagrams on egm_port every controller cycle
+  std::string backend;
+  int egm_port;
+  double egm_timeout;
+  yumi_nh.param("backend", backend, std::string("rapid"));
+  yumi_nh.param("egm_port", egm_port, YUMI_EGM_PORT);
+  yumi_nh.param("egm_timeout", egm_timeout, 0.1);
+  if(backend != "rapid" && backend != "egm")
+  {
+    ROS_FATAL_NAMED("yumi_hw","Unknown backend '%s', use rapid or egm", backend.c_str());
+    return -1;
+  }
+  bool egm = backend == "egm";
+
+  // realtime settings: memory locking, SCHED_FIFO priority and cpu pinning of the control thread
+  bool realtime;
+  int rt_priority, cpu_affinity;
+  double control_period;
+  yumi_nh.param("realtime", realtime, false);
+  yumi_nh.param("rt_priority", rt_priority, 80);
+  yumi_nh.param("cpu_affinity", cpu_affinity, -1);
+  yumi_nh.param("control_period", control_period, 0.004);
+
+  // loop statistics are published on ~cycle_stats every stats_period seconds, 0 disables them
+  double stats_period;
+  yumi_nh.param("stats_period", stats_period, 1.0);
+
+  // allocation check: after alloc_check_warmup cycles, the node fails as soon as a control
+  // cycle calls the heap allocator, 0 disables the check
+  int alloc_check_warmup;
+  yumi_nh.param("alloc_check_warmup", alloc_check_warmup, 0);
+
+  // lookahead streaming: in position mode every command carries lookahead_points future setpoints
+  // spaced lookahead_period apart, which the RAPID motion tasks blend through if a cycle is late
+  int lookahead_points;
+  double lookahead_period;
+  yumi_nh.param("lookahead_points", lookahead_points, 0);
+  yumi_nh.param("lookahead_period", lookahead_period, 0.02);
+  if(lookahead_points > YUMI_STREAM_MAX_POINTS)
+  {
+    ROS_WARN("At most %d lookahead points are supported", YUMI_STREAM_MAX_POINTS);
+  }
+
+  // trajectory offload: FollowJointTrajectory goals for left_arm/right_arm are downloaded to the
+  // controller and executed there, the listed streaming controllers are stopped meanwhile
+  bool trajectory_offload;
+  int trajectory_port;
+  std::vector<std::string> offload_controllers;
+  yumi_nh.param("trajectory_offload", trajectory_offload, false);
+  yumi_nh.param("trajectory_port", trajectory_port, YUMI_TRAJECTORY_PORT);
+  if(!yumi_nh.getParam("offload_controllers", offload_controllers))
+  {
+    offload_controllers.push_back("joint_trajectory_pos_controller");
+    offload_controllers.push_back("joint_trajectory_vel_controller");
+    offload_controllers.push_back("joint_trajectory_pos_grippers_controller");
+  }
+
+  // reconnection: a connection without joint states for state_timeout seconds is dropped and
+  // re-established with a backoff. The controller is then only sent the measured state until
+  // the running controllers were restarted from it, unless restart_controllers_on_reconnect is off
+  double state_timeout, reconnect_backoff_min, reconnect_backoff_max;
+  bool restart_controllers;
+  yumi_nh.param("state_timeout", state_timeout, 1.0);
+  yumi_nh.param("reconnect_backoff_min", reconnect_backoff_min, 0.1);
+  yumi_nh.param("reconnect_backoff_max", reconnect_backoff_max, 5.0);
+  yumi_nh.param("restart_controllers_on_reconnect", restart_controllers, true);
+
+  // grippers: gripper_l_joint and gripper_r_joint are served by the RAPID gripper servers and
+  // driven by the control loop like the arm joints. yumi_gripper_node must not run meanwhile,
+  // the servers take one client only
+  bool grippers;
+  int gripper_state_port, gripper_command_port;
+  double gripper_force, gripper_speed, gripper_deadband;
+  yumi_nh.param("grippers", grippers, false);
+  yumi_nh.param("gripper_state_port", gripper_state_port, DEFAULT_STATE_PORT);
+  yumi_nh.param("gripper_command_port", gripper_command_port, DEFAULT_COMMAND_PORT);
+  yumi_nh.param("gripper_force", gripper_force, 5.0);
+  yumi_nh.param("gripper_speed", gripper_speed, 0.02);
+  yumi_nh.param("gripper_deadband", gripper_deadband, 0.002);
+
+  // joint states and controllers are stamped with the time the controller sampled the state,
+  // from its clock mapped to the PC clock, instead of the time the loop read it
+  bool sample_time_stamps;
+  yumi_nh.param("sample_time_stamps", sample_time_stamps, true);
+
+  // effort: the motor torques of the controller times effort_scale (one per arm joint) are the
+  // joint efforts. With external_effort a dynamics model of the chains from dynamics_base_link
+  // to the tips estimates the effort of external forces, published on ~external_effort. Without
+  // external_effort_inertial the model is gravity only.
+  std::vector<double> effort_scale;
+  bool external_effort, external_effort_inertial;
+  int external_effort_decimation;
+  std::string dynamics_base_link, dynamics_left_tip, dynamics_right_tip;
+  yumi_nh.param("external_effort", external_effort, false);
+  yumi_nh.param("external_effort_inertial", external_effort_inertial, true);
+  yumi_nh.param("external_effort_decimation", external_effort_decimation, 1);
+  yumi_nh.param("dynamics_base_link", dynamics_base_link, name + "_body");
+  yumi_nh.param("dynamics_left_tip", dynamics_left_tip, name + "_link_7_l");
+  yumi_nh.param("dynamics_right_tip", dynamics_right_tip, name + "_link_7_r");
+
+  // flight recorder: the last flight_recorder_seconds of cycles are dumped to flight_recorder_path
+  // on a fault, a state channel silent for flight_recorder_stale_time, a joint more than
+  // flight_recorder_limit_margin beyond its limits, SIGUSR1 or a crash. 0 seconds turns it off.
+  double flight_recorder_seconds, flight_recorder_stale_time, flight_recorder_limit_margin;
+  int flight_recorder_max_dumps;
+  std::string flight_recorder_path;
+  yumi_nh.param("flight_recorder_seconds", flight_recorder_seconds, 10.0);
+  yumi_nh.param("flight_recorder_path", flight_recorder_path, std::string("/tmp"));
+  yumi_nh.param("flight_recorder_stale_time", flight_recorder_stale_time, 0.5);
+  yumi_nh.param("flight_recorder_limit_margin", flight_recorder_limit_margin, 0.01);
+  yumi_nh.param("flight_recorder_max_dumps", flight_recorder_max_dumps, 10);
+
+  // session recording: the joint states and commands of every cycle are recorded to session_record
+  // for replaying the controllers offline with yumi_hw_replay, the file grows by session_chunk_size MB
+  std::string session_record;
+  double session_chunk_size;
+  yumi_nh.param("session_record", session_record, std::string(""));
+  yumi_nh.param("session_chunk_size", session_chunk_size, 16.0);
 
   // get the general robot description, the lwr class will take care of parsing what's useful to itself
   std::string urdf_string = getURDF(yumi_nh, "/robot_description");
 
-  YumiHWRapid yumi_robot;
+  YumiHWRapid rapid_robot;
+  YumiHWEgm egm_robot;
+  YumiHW &yumi_robot = egm ? (YumiHW&)egm_robot : (YumiHW&)rapid_robot;
+  yumi_robot.setGrippers(grippers);
+
+  // joint velocities and accelerations: state_estimator is smoothing (velocity_smoothing),
+  // kalman (kalman_position_noise, kalman_jerk_noise) or polyfit (polyfit_samples, polyfit_order)
+  YumiStateEstimator *estimator = yumiStateEstimatorFromParams(yumi_nh, 0.04);
+  if(estimator == NULL)
+  {
+    return -1;
+  }
+  yumi_robot.setStateEstimator(estimator);
+  if(yumi_nh.getParam("effort_scale", effort_scale))
+  {
+    if(effort_scale.size() != N_YUMI_JOINTS)
+    {
+      ROS_FATAL("effort_scale needs %d values, got %lu", N_YUMI_JOINTS, effort_scale.size());
+      return -1;
+    }
+    yumi_robot.setEffortScale(effort_scale);
+  }
   yumi_robot.create(name, urdf_string);
-  yumi_robot.setup(hintToRemoteHost);
+  if(egm)
+  {
+    if(lookahead_points > 0 || trajectory_offload)
+    {
+      ROS_WARN("Lookahead streaming and trajectory offload are only available with the rapid backend");
+      trajectory_offload = false;
+    }
+    egm_robot.setup(egm_port, egm_timeout);
+    egm_robot.setResyncHold(restart_controllers);
+    egm_robot.setupGrippers(hintToRemoteHost, gripper_state_port, gripper_command_port, gripper_force, gripper_speed, gripper_deadband);
+  }
+  else
+  {
+    rapid_robot.setup(hintToRemoteHost, port, right_port);
+    rapid_robot.setLookahead(lookahead_points, lookahead_period);
+    rapid_robot.setReconnect(state_timeout, reconnect_backoff_min, reconnect_backoff_max);
+    rapid_robot.setResyncHold(restart_controllers);
+    rapid_robot.setupGrippers(gripper_state_port, gripper_command_port, gripper_force, gripper_speed, gripper_deadband);
+  }
   
   if(!yumi_robot.init())
   {
@@ -89,52 +361,158 @@ int main( int argc, char** argv )
     return -1;
   }
 
-  // timer variables
-  struct timespec ts = {0, 0};
-  ros::Time last(ts.tv_sec, ts.tv_nsec), now(ts.tv_sec, ts.tv_nsec);
-  ros::Duration period(1.0);
-
-  float sampling_time = yumi_robot.getSampleTime();
-  ROS_INFO("Sampling time on robot: %f", sampling_time);
+  if(!egm)
+  {
+    ROS_INFO("Sampling time on robot: %f", rapid_robot.getSampleTime());
+  }
 
   //the controller manager
   controller_manager::ControllerManager manager(&yumi_robot);
 
-  // run as fast as possible
+  YumiRealtimeLoop loop;
+  // reading the state never blocks, so the loop has to be paced by its own deadlines
+  if(control_period <= 0)
+  {
+    ROS_WARN("The control loop needs a positive control period, using 0.004s");
+    control_period = 0.004;
+  }
+
+  YumiCycleMonitor monitor;
+  if(stats_period > 0)
+  {
+    monitor.init(yumi_nh, stats_period, control_period, &loop);
+  }
+
+  // the control cycle: read the state, update the controllers, write the command
+  YumiAllocCheck alloc_check;
+  alloc_check.setup(alloc_check_warmup);
+  if(alloc_check.isEnabled())
+  {
+    ROS_INFO("Checking the control cycles for heap allocations after %d cycles", alloc_check_warmup);
+  }
+  ControlCycle cycle(&yumi_robot, &manager, &monitor, &alloc_check);
+  cycle.setSampleStamps(sample_time_stamps);
+
+  YumiEffortPublisher effort_publisher;
+  if(external_effort)
+  {
+    if(!yumi_robot.initDynamics(dynamics_base_link, dynamics_left_tip, dynamics_right_tip, external_effort_inertial))
+    {
+      ROS_FATAL_NAMED("yumi_hw","Could not set up the dynamics model for the external effort");
+      return -1;
+    }
+    effort_publisher.init(yumi_nh, yumi_robot, external_effort_decimation);
+    cycle.setEffortPublisher(&effort_publisher);
+  }
+
+  YumiFlightRecorder flight_recorder;
+  if(flight_recorder_seconds > 0)
+  {
+    flight_recorder.setup(flight_recorder_stale_time, flight_recorder_limit_margin, flight_recorder_max_dumps);
+    if(!flight_recorder.init(yumi_robot, flight_recorder_seconds, control_period, flight_recorder_path))
+    {
+      ROS_FATAL_NAMED("yumi_hw","Could not set up the flight recorder");
+      return -1;
+    }
+    cycle.setFlightRecorder(&flight_recorder);
+    g_flight_recorder = &flight_recorder;
+
+    struct sigaction fatal;
+    memset(&fatal, 0, sizeof(fatal));
+    fatal.sa_handler = fatalSignal;
+    fatal.sa_flags = SA_RESETHAND;
+    sigaction(SIGSEGV, &fatal, NULL);
+    sigaction(SIGBUS, &fatal, NULL);
+    sigaction(SIGFPE, &fatal, NULL);
+    sigaction(SIGABRT, &fatal, NULL);
+    signal(SIGUSR1, dumpRequested);
+    ROS_INFO("Flight recorder keeps the last %lu cycles, dumps go to %s",
+      flight_recorder.getCapacity(), flight_recorder_path.c_str());
+  }
+
+  YumiSessionRecorder session_recorder;
+  if(!session_record.empty())
+  {
+    if(egm)
+    {
+      ROS_WARN("Session recording is only available with the rapid backend");
+    }
+    else if(!session_recorder.open(session_record, yumi_robot, rapid_robot.getChannels(), control_period, (uint64_t)(session_chunk_size*1024*1024)))
+    {
+      ROS_FATAL_NAMED("yumi_hw","Could not record the session to %s", session_record.c_str());
+      return -1;
+    }
+    else
+    {
+      rapid_robot.setSessionRecorder(&session_recorder);
+      cycle.setSessionRecorder(&session_recorder);
+      ROS_INFO("Recording the session to %s", session_record.c_str());
+    }
+  }
+
+  loop.setup(boost::bind(&ControlCycle::update, &cycle, _1, _2), control_period, realtime, rt_priority, cpu_affinity);
+
+  if(realtime)
+  {
+    ROS_INFO("Running the control loop at %f s on a SCHED_FIFO thread, priority %d, cpu %d",
+      control_period, rt_priority, cpu_affinity);
+  }
+
+  if(!loop.start())
+  {
+    ROS_FATAL_NAMED("yumi_hw","Could not start the control loop");
+    return -1;
+  }
+
+  // the offload switches controllers, which needs the control loop to be running
+  YumiTrajectoryOffload offload;
+  if(trajectory_offload)
+  {
+    if(!offload.init(ros::NodeHandle(), hintToRemoteHost, trajectory_port, &rapid_robot, &manager, offload_controllers))
+    {
+      ROS_ERROR_NAMED("yumi_hw","Could not start the trajectory offload, only streaming is available");
+      offload.shutdown();
+    }
+  }
+
+  unsigned long reconnects = 0;
+  int exit_code = 0;
   while( !g_quit )
   {
-    // get the time / period
-    //if (!clock_gettime(CLOCK_MONOTONIC, &ts))
-    //{
-      now = ros::Time::now();	
-      //now.sec = ts.tv_sec;
-      //now.nsec = ts.tv_nsec;
-      period = now - last;
-      last = now;
-    //} 
-    //else
-    //{
-    //  ROS_FATAL("Failed to poll realtime clock!");
-    //  break;
-    //}
+    usleep(100000);
 
-    // read the state from the lwr
-    yumi_robot.read(now, period);
-    
-    // update the controllers
-    manager.update(now, period);
+    if(alloc_check.failed())
+    {
+      ROS_FATAL_NAMED("yumi_hw","Control cycle %lu after the warm-up made %lu heap allocator calls in %s()",
+        alloc_check.failedCycle(), alloc_check.failedCount(), alloc_check.failedPhase());
+      flight_recorder.trigger(YumiFlightRecorder::FAULT);
+      exit_code = -1;
+      break;
+    }
 
-    // write the command to the lwr
-    yumi_robot.write(now, period);
-    
-    //std::cout<<"Period is "<<period.toSec()<<std::endl;
-    //ros::Duration(sampling_time).sleep();
+    // the control loop has read the first state after a reconnection, resync the controllers to it
+    unsigned long handled = yumi_robot.getReconnects();
+    if(handled != reconnects)
+    {
+      if(restart_controllers) restartControllers(manager);
+      yumi_robot.releaseHold(handled);
+      reconnects = handled;
+    }
   }
+  offload.shutdown();
+  loop.stop();
+  // a pending dump is written before the recorder goes
+  g_flight_recorder = NULL;
+  flight_recorder.shutdown();
+  session_recorder.close();
+
+  ROS_INFO("Control loop ran %lu cycles with %lu overruns, max wakeup jitter %f s",
+    loop.getCycles(), loop.getOverruns(), loop.getMaxJitter());
 
   std::cerr<<"Stopping spinner..."<<std::endl;
   spinner.stop();
 
   std::cerr<<"Bye!"<<std::endl;
 
-  return 0;
+  return exit_code;
 }
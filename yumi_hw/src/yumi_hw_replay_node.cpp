@@ -0,0 +1,305 @@
+// SYS
+#include <cmath>
+#include <signal.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+// ROS headers
+#include <ros/ros.h>
+#include <controller_manager/controller_manager.h>
+#include <controller_manager_msgs/ListControllers.h>
+#include <hardware_interface/controller_info.h>
+
+#include "yumi_hw/yumi_hw_replay.h"
+#include "yumi_hw/yumi_session_recorder.h"
+#include "yumi_hw/yumi_latency_stats.h"
+
+/**
+  * Re-runs a controller stack against a session recorded by yumi_hw_ifce_node (session_record):
+  * the controllers get the recorded joint states with the recorded times, every cycle, and
+  * their commands are compared bit for bit with the ones recorded on the robot. The
+  * controllers are started where the recording switched them first, later recorded switches
+  * restart the running controllers (the reconnection restarts of the node).
+  *
+  * Inputs that reach the controllers over topics or actions are not part of the session.
+  */
+
+volatile bool g_quit = false;
+
+void quitRequested(int sig)
+{
+  g_quit = true;
+}
+
+// Replays the cycles of the session on a thread. The switches the cycles recorded are performed
+// by the loop itself at the end of the update of their cycle, where the controller manager
+// performed them on the robot, so they land in their cycle however loaded the machine is.
+class ReplayLoop
+{
+public:
+  ReplayLoop(YumiHWReplay *robot, controller_manager::ControllerManager *manager, double rate) :
+    robot_(robot), manager_(manager), rate_(rate), capture_(NULL), started_(false), failed_(false), done_(false) {}
+
+  // record the stamps of the controllers to the capture, the robot records the rest
+  void setCapture(YumiSessionRecorder *capture) { capture_ = capture; }
+
+  // the controllers the first recorded switch starts, as the manager hands them to the robot
+  void setControllers(const std::list<hardware_interface::ControllerInfo> &controllers) { controllers_ = controllers; }
+
+  void run()
+  {
+    long long start = yumiMonotonicNs();
+    long long first_time = 0;
+    bool first = true;
+    ros::Time last_stamp;
+
+    while(!g_quit && robot_->nextCycle())
+    {
+      ros::Time now = robot_->getCycleTime();
+      ros::Duration period = robot_->getCyclePeriod();
+      if(first)
+      {
+        first_time = now.toNSec();
+        first = false;
+      }
+      // rate 1 runs the cycles at the times they ran on the robot, 0 as fast as possible
+      if(rate_ > 0)
+      {
+        long long due = start + (long long)((now.toNSec() - first_time)/rate_);
+        long long wait = due - yumiMonotonicNs();
+        if(wait > 0) usleep(wait/1000);
+      }
+
+      robot_->read(now, period);
+
+      // stamped as the node stamped them, the time never goes back
+      ros::Time stamp = robot_->getStateStamp(now);
+      if(robot_->hasCycleStamp())
+      {
+        if(stamp < last_stamp) stamp = last_stamp;
+        last_stamp = stamp;
+        if(capture_ != NULL) capture_->setStamp(stamp);
+      }
+      manager_->update(stamp, period);
+
+      // the manager switches after the controllers updated, and so does the replay
+      if(robot_->hasCycleSwitch() && !switchControllers(stamp))
+      {
+        failed_ = true;
+        break;
+      }
+
+      robot_->write(now, period);
+    }
+    done_ = true;
+  }
+
+  // a recorded switch could not be replayed, the replay stopped at its cycle
+  bool hasFailed() const { return failed_; }
+  bool isDone() const { return done_; }
+
+private:
+  // the first switch starts the controllers, later ones restart them (the reconnection
+  // restarts of the node), in the order of ControllerManager::update
+  bool switchControllers(const ros::Time &time)
+  {
+    std::list<hardware_interface::ControllerInfo> stop;
+    if(started_) stop = controllers_;
+    robot_->doSwitch(controllers_, stop);
+
+    for (std::list<hardware_interface::ControllerInfo>::const_iterator it = stop.begin(); it != stop.end(); ++it)
+    {
+      controller_interface::ControllerBase *controller = manager_->getControllerByName(it->name);
+      if(controller == NULL || !controller->stopRequest(time))
+      {
+        ROS_ERROR("Could not stop the controller %s in cycle %lu", it->name.c_str(), robot_->getCycle());
+        return false;
+      }
+    }
+    for (std::list<hardware_interface::ControllerInfo>::const_iterator it = controllers_.begin(); it != controllers_.end(); ++it)
+    {
+      controller_interface::ControllerBase *controller = manager_->getControllerByName(it->name);
+      if(controller == NULL || !controller->startRequest(time))
+      {
+        ROS_ERROR("Could not start the controller %s in cycle %lu", it->name.c_str(), robot_->getCycle());
+        return false;
+      }
+    }
+    started_ = true;
+    return true;
+  }
+
+  YumiHWReplay *robot_;
+  controller_manager::ControllerManager *manager_;
+  double rate_;
+  YumiSessionRecorder *capture_;
+  std::list<hardware_interface::ControllerInfo> controllers_;
+  bool started_;
+  boost::atomic<bool> failed_;
+  boost::atomic<bool> done_;
+};
+
+// The loaded controllers with the interfaces they claim, from the manager's list_controllers
+bool controllerInfos(const std::vector<std::string> &names, std::list<hardware_interface::ControllerInfo> &infos)
+{
+  controller_manager_msgs::ListControllers list;
+  if(!ros::service::call("controller_manager/list_controllers", list))
+  {
+    ROS_ERROR("Could not list the controllers of the controller manager");
+    return false;
+  }
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    size_t k = 0;
+    while(k < list.response.controller.size() && list.response.controller[k].name != names[i]) k++;
+    if(k == list.response.controller.size())
+    {
+      ROS_ERROR("The controller manager does not list the controller %s", names[i].c_str());
+      return false;
+    }
+    const controller_manager_msgs::ControllerState &state = list.response.controller[k];
+    hardware_interface::ControllerInfo info;
+    info.name = state.name;
+    info.type = state.type;
+#if ROS_VERSION_MINIMUM(1,12,0)
+    for (size_t r = 0; r < state.claimed_resources.size(); r++)
+    {
+      hardware_interface::InterfaceResources resources;
+      resources.hardware_interface = state.claimed_resources[r].hardware_interface;
+      resources.resources.insert(state.claimed_resources[r].resources.begin(), state.claimed_resources[r].resources.end());
+      info.claimed_resources.push_back(resources);
+    }
+#else
+    info.hardware_interface = state.hardware_interface;
+    info.resources.insert(state.resources.begin(), state.resources.end());
+#endif
+    infos.push_back(info);
+  }
+  return true;
+}
+
+int main( int argc, char** argv )
+{
+  ros::init(argc, argv, "yumi_hw_replay", ros::init_options::NoSigintHandler);
+  ros::AsyncSpinner spinner(2);
+  spinner.start();
+
+  signal(SIGTERM, quitRequested);
+  signal(SIGINT, quitRequested);
+  signal(SIGHUP, quitRequested);
+
+  ros::NodeHandle nh("~");
+
+  // session to replay, optional session the replay is recorded to, and the speed of the replay
+  std::string session, capture_path, name, urdf_string;
+  double rate;
+  std::vector<std::string> controllers;
+  nh.param("session", session, std::string(""));
+  nh.param("capture", capture_path, std::string(""));
+  nh.param("rate", rate, 0.0);
+  nh.param("name", name, std::string("yumi"));
+  nh.getParam("controllers", controllers);
+  if(session.empty())
+  {
+    ROS_FATAL("Set ~session to the session file to replay");
+    return -1;
+  }
+  if(!ros::param::get("/robot_description", urdf_string))
+  {
+    ROS_FATAL("No robot description on /robot_description");
+    return -1;
+  }
+
+  YumiSessionReader probe;
+  if(!probe.open(session.c_str()))
+  {
+    ROS_FATAL("%s is not a session of version %d", session.c_str(), YUMI_SESSION_VERSION);
+    return -1;
+  }
+  YumiSessionHeader recorded = probe.header();
+  probe.close();
+
+  // the estimator has to be the one of the recording, state_estimator and its parameters as
+  // they were set for yumi_hw_ifce_node
+  YumiHWReplay robot;
+  robot.setGrippers(recorded.grippers > 0);
+  YumiStateEstimator *estimator = yumiStateEstimatorFromParams(nh, 0.04);
+  if(estimator == NULL)
+  {
+    return -1;
+  }
+  robot.setStateEstimator(estimator);
+  robot.create(name, urdf_string);
+  robot.setup(session);
+
+  YumiSessionRecorder capture;
+  if(!capture_path.empty())
+  {
+    if(!capture.open(capture_path, robot, recorded.channels, recorded.control_period*1e-9, recorded.chunk_size))
+    {
+      ROS_FATAL("Could not record the replay to %s", capture_path.c_str());
+      return -1;
+    }
+    capture.setBlocking(true);
+    robot.setCapture(&capture);
+  }
+
+  if(!robot.init())
+  {
+    ROS_FATAL("Could not set up the replay of %s", session.c_str());
+    return -1;
+  }
+  if(recorded.cycles == 0)
+  {
+    ROS_WARN("The recording of %s did not end cleanly, replaying the cycles it has", session.c_str());
+  }
+
+  controller_manager::ControllerManager manager(&robot);
+  for (size_t i = 0; i < controllers.size(); i++)
+  {
+    if(!manager.loadController(controllers[i]))
+    {
+      ROS_FATAL("Could not load the controller %s", controllers[i].c_str());
+      return -1;
+    }
+  }
+
+  // the replay switches the controllers itself, with the interfaces the manager would hand over
+  std::list<hardware_interface::ControllerInfo> infos;
+  if(!controllerInfos(controllers, infos))
+  {
+    return -1;
+  }
+  if(!robot.canSwitch(infos, std::list<hardware_interface::ControllerInfo>()))
+  {
+    ROS_FATAL("The controllers cannot run together on the robot");
+    return -1;
+  }
+
+  ReplayLoop loop(&robot, &manager, rate);
+  loop.setControllers(infos);
+  if(!capture_path.empty()) loop.setCapture(&capture);
+  boost::thread replay(boost::bind(&ReplayLoop::run, &loop));
+  ROS_INFO("Replaying %s at %s", session.c_str(), rate > 0 ? "a fixed rate" : "full speed");
+  replay.join();
+  capture.close();
+
+  ROS_INFO("Replayed %lu cycles, %lu were dropped in the recording", robot.getCycle(), robot.getDroppedCycles());
+  if(loop.hasFailed())
+  {
+    ROS_ERROR("The controller switch recorded in cycle %lu could not be replayed", robot.getCycle());
+    return 1;
+  }
+  if(robot.getMismatchedCycles() > 0)
+  {
+    ROS_ERROR("The commands of %lu cycles differ from the recording, from cycle %lu on, by up to %g",
+      robot.getMismatchedCycles(), robot.getFirstMismatch(), robot.getMaxMismatch());
+    return 1;
+  }
+  ROS_INFO("The commands of all cycles are the recorded ones");
+  spinner.stop();
+  return 0;
+}
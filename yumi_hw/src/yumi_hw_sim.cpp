@@ -0,0 +1 @@
+#include "yumi_hw/yumi_hw_sim.h"
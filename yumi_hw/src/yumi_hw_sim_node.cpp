@@ -0,0 +1,217 @@
+// SYS
+#include <cmath>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+// ROS headers
+#include <ros/ros.h>
+#include <rosgraph_msgs/Clock.h>
+#include <controller_manager/controller_manager.h>
+
+#include "yumi_hw/yumi_hw_sim.h"
+#include "yumi_hw/yumi_latency_stats.h"
+
+/**
+  * Runs the controllers against YumiHWSim, without Gazebo: the simulated time advances by
+  * control_period every cycle, paced at realtime_factor times real time, or as fast as the CPU
+  * allows with realtime_factor 0. The simulated time is published on /clock, nodes that
+  * talk to the controllers need /use_sim_time true unless the simulation runs in real time.
+  */
+
+volatile bool g_quit = false;
+
+void quitRequested(int sig)
+{
+  g_quit = true;
+}
+
+// Steps the simulation on a thread, the controllers are updated with the simulated time
+class SimLoop
+{
+public:
+  SimLoop(YumiHWSim *robot, controller_manager::ControllerManager *manager, ros::Publisher *clock,
+      double period, double realtime_factor, double clock_period, double duration) :
+    robot_(robot), manager_(manager), clock_(clock), period_(period), realtime_factor_(realtime_factor),
+    clock_period_(clock_period), duration_(duration), cycles_(0), late_(0), wall_ns_(0), done_(false) {}
+
+  void run(ros::Time start)
+  {
+    ros::Duration period(period_);
+    ros::Time now = start;
+    ros::Time next_clock = start;
+    long long period_ns = period.toNSec();
+    long long wall_start = yumiMonotonicNs();
+    // the wall time the simulated start is paced from, moved on when the loop falls behind
+    long long pace_start = wall_start;
+    long long paced = 0;
+    rosgraph_msgs::Clock clock;
+
+    while(!g_quit && (duration_ <= 0 || (now - start).toSec() < duration_))
+    {
+      if(realtime_factor_ > 0)
+      {
+        long long due = pace_start + (long long)(paced/realtime_factor_);
+        long long wall = yumiMonotonicNs();
+        if(wall > due + period_ns)
+        {
+          // behind by more than a cycle, the simulation slows down instead of catching up
+          pace_start += wall - due;
+          late_++;
+        }
+        else if(wall < due)
+        {
+          struct timespec ts;
+          ts.tv_sec = due/1000000000LL;
+          ts.tv_nsec = due%1000000000LL;
+          while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !g_quit);
+        }
+      }
+
+      if(clock_ != NULL && now >= next_clock)
+      {
+        clock.clock = now;
+        clock_->publish(clock);
+        next_clock = now + ros::Duration(clock_period_);
+      }
+
+      robot_->read(now, period);
+      manager_->update(now, period);
+      robot_->write(now, period);
+
+      now += period;
+      paced += period_ns;
+      cycles_++;
+      wall_ns_ = yumiMonotonicNs() - wall_start;
+    }
+    done_ = true;
+  }
+
+  unsigned long getCycles() const { return cycles_; }
+  // cycles the loop started later than a period behind the pace
+  unsigned long getLateCycles() const { return late_; }
+  double getWallTime() const { return wall_ns_*1e-9; }
+  bool isDone() const { return done_; }
+
+private:
+  YumiHWSim *robot_;
+  controller_manager::ControllerManager *manager_;
+  ros::Publisher *clock_;
+  double period_, realtime_factor_, clock_period_, duration_;
+  boost::atomic<unsigned long> cycles_, late_;
+  boost::atomic<long long> wall_ns_;
+  boost::atomic<bool> done_;
+};
+
+int main( int argc, char** argv )
+{
+  ros::init(argc, argv, "yumi_hw_sim", ros::init_options::NoSigintHandler);
+  ros::AsyncSpinner spinner(2);
+  spinner.start();
+
+  signal(SIGTERM, quitRequested);
+  signal(SIGINT, quitRequested);
+  signal(SIGHUP, quitRequested);
+
+  ros::NodeHandle nh("~");
+
+  std::string name, urdf_string, joint_model, limits_namespace;
+  double control_period, realtime_factor, clock_period, duration;
+  double time_constant, natural_frequency, damping_ratio;
+  bool grippers, publish_clock;
+  std::vector<double> initial_positions;
+  nh.param("name", name, std::string("yumi"));
+  nh.param("control_period", control_period, 0.001);
+  nh.param("realtime_factor", realtime_factor, 1.0);
+  nh.param("publish_clock", publish_clock, true);
+  nh.param("clock_period", clock_period, 0.001);
+  nh.param("duration", duration, 0.0);
+  nh.param("grippers", grippers, false);
+  // the joints: first_order follows the command with time_constant, second_order with
+  // natural_frequency and damping_ratio
+  nh.param("joint_model", joint_model, std::string("first_order"));
+  nh.param("time_constant", time_constant, 0.02);
+  nh.param("natural_frequency", natural_frequency, 30.0);
+  nh.param("damping_ratio", damping_ratio, 1.0);
+  // where joint_limits.yaml is loaded, joint_limits/<joint>/max_velocity etc.
+  nh.param("limits_namespace", limits_namespace, std::string("/robot_description_planning"));
+  nh.getParam("initial_positions", initial_positions);
+
+  if(control_period <= 0)
+  {
+    ROS_FATAL("The control period of the simulation has to be positive");
+    return -1;
+  }
+  if(joint_model != "first_order" && joint_model != "second_order")
+  {
+    ROS_FATAL("Unknown joint model %s, use first_order or second_order", joint_model.c_str());
+    return -1;
+  }
+  if(realtime_factor != 1.0 && !ros::Time::isSimTime())
+  {
+    ROS_WARN("The simulation runs at %g times real time without /use_sim_time, the controllers and their clients disagree on the time",
+      realtime_factor);
+  }
+  if(!ros::param::get("/robot_description", urdf_string))
+  {
+    ROS_FATAL("No robot description on /robot_description");
+    return -1;
+  }
+
+  YumiHWSim robot;
+  robot.setGrippers(grippers);
+  YumiStateEstimator *estimator = yumiStateEstimatorFromParams(nh, 0.2);
+  if(estimator == NULL)
+  {
+    return -1;
+  }
+  robot.setStateEstimator(estimator);
+  robot.create(name, urdf_string);
+  robot.setup(joint_model == "first_order" ? YumiHWSim::FIRST_ORDER : YumiHWSim::SECOND_ORDER,
+    time_constant, natural_frequency, damping_ratio);
+  robot.loadLimits(ros::NodeHandle(limits_namespace));
+  robot.setInitialPositions(initial_positions);
+  if(!robot.init())
+  {
+    ROS_FATAL("Could not set up the simulation");
+    return -1;
+  }
+
+  controller_manager::ControllerManager manager(&robot);
+
+  ros::Publisher clock;
+  if(publish_clock)
+  {
+    clock = ros::NodeHandle().advertise<rosgraph_msgs::Clock>("/clock", 10);
+  }
+
+  // the simulated time starts at the wall time, stamps stay readable next to the logs
+  ros::Time start;
+  start.fromNSec(ros::WallTime::now().toNSec());
+  SimLoop loop(&robot, &manager, publish_clock ? &clock : NULL, control_period, realtime_factor, clock_period, duration);
+  boost::thread sim(boost::bind(&SimLoop::run, &loop, start));
+  ROS_INFO("Simulating %s at %g Hz, %s", name.c_str(), 1.0/control_period,
+    realtime_factor > 0 ? "paced" : "as fast as possible");
+
+  while(!loop.isDone() && !g_quit)
+  {
+    usleep(100000);
+  }
+  g_quit = true;
+  sim.join();
+
+  double simulated = loop.getCycles()*control_period;
+  ROS_INFO("Simulated %.3f s in %.3f s (%.1f times real time)", simulated, loop.getWallTime(),
+    loop.getWallTime() > 0 ? simulated/loop.getWallTime() : 0.0);
+  if(loop.getLateCycles() > 0)
+  {
+    ROS_WARN("The simulation fell behind its pace %lu times", loop.getLateCycles());
+  }
+  spinner.stop();
+  return 0;
+}
@@ -0,0 +1,89 @@
+// SYS
+#include <signal.h>
+#include <unistd.h>
+
+// ROS headers
+#include <ros/ros.h>
+
+#include "yumi_hw/yumi_mock_controller.h"
+
+bool g_quit = false;
+
+void quitRequested(int sig)
+{
+  g_quit = true;
+}
+
+int main( int argc, char** argv )
+{
+  // initialize ROS
+  ros::init(argc, argv, "yumi_mock_controller", ros::init_options::NoSigintHandler);
+
+  // custom signal handlers
+  signal(SIGTERM, quitRequested);
+  signal(SIGINT, quitRequested);
+  signal(SIGHUP, quitRequested);
+
+  // create a node
+  ros::NodeHandle nh ("~");
+
+  // get params or give default values
+  YumiMockControllerConfig config;
+  int seed;
+  nh.param("state_port", config.state_port, config.state_port);
+  nh.param("right_state_port", config.right_state_port, config.right_state_port);
+  nh.param("gripper_state_port", config.gripper_state_port, config.gripper_state_port);
+  nh.param("gripper_command_port", config.gripper_command_port, config.gripper_command_port);
+  nh.param("tcp_no_delay", config.tcp_no_delay, config.tcp_no_delay);
+  nh.param("egm_port", config.egm_port, config.egm_port);
+  nh.param("egm_address", config.egm_address, config.egm_address);
+  nh.param("egm_timeout", config.egm_timeout, config.egm_timeout);
+  nh.param("cycle_time", config.cycle_time, config.cycle_time);
+  nh.param("response_latency", config.response_latency, config.response_latency);
+  nh.param("position_time_constant", config.position_time_constant, config.position_time_constant);
+  nh.param("velocity_time_constant", config.velocity_time_constant, config.velocity_time_constant);
+  nh.param("joint_inertia", config.joint_inertia, config.joint_inertia);
+  nh.param("state_drop_rate", config.state_drop_rate, config.state_drop_rate);
+  nh.param("command_drop_rate", config.command_drop_rate, config.command_drop_rate);
+  nh.param("clock_drift", config.clock_drift, config.clock_drift);
+  nh.param("gripper_cycle_time", config.gripper_cycle_time, config.gripper_cycle_time);
+  nh.param("gripper_speed", config.gripper_speed, config.gripper_speed);
+  nh.param("gripper_object_width", config.gripper_object_width, config.gripper_object_width);
+  nh.param("seed", seed, (int)config.seed);
+  config.seed = seed;
+
+  std::vector<double> initial_positions;
+  if(nh.getParam("initial_positions", initial_positions))
+  {
+    if(initial_positions.size() != N_YUMI_JOINTS)
+    {
+      ROS_FATAL("initial_positions needs %d values, got %lu", N_YUMI_JOINTS, initial_positions.size());
+      return -1;
+    }
+    for(int i=0; i<N_YUMI_JOINTS; i++)
+    {
+      config.initial_positions[i] = initial_positions[i];
+    }
+  }
+
+  YumiMockController controller;
+  if(!controller.init(config))
+  {
+    ROS_FATAL("Could not start the mock controller");
+    return -1;
+  }
+  controller.start();
+
+  while( !g_quit )
+  {
+    sleep(1);
+    ROS_DEBUG("Mock controller: %lu cycles, %lu states and %lu commands dropped",
+      controller.getCycles(), controller.getDroppedStates(), controller.getDroppedCommands());
+  }
+
+  controller.stop();
+  ROS_INFO("Mock controller ran %lu cycles, dropped %lu states and %lu commands",
+    controller.getCycles(), controller.getDroppedStates(), controller.getDroppedCommands());
+
+  return 0;
+}
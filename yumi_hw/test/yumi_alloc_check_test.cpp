@@ -0,0 +1,137 @@
+// SYS
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <gtest/gtest.h>
+
+// ROS headers
+#include <ros/ros.h>
+#include <controller_manager/controller_manager.h>
+#include <controller_manager_msgs/SwitchController.h>
+
+#include "yumi_hw/yumi_hw_rapid.h"
+#include "yumi_hw/yumi_mock_controller.h"
+#include "yumi_hw/yumi_realtime_loop.h"
+#include "yumi_hw/yumi_alloc_check.h"
+
+/**
+  * Runs YumiHWRapid and the controllers listed in ~controllers against an in-process
+  * YumiMockController, as yumi_hw_ifce_node runs them, and fails if a control cycle calls
+  * the heap allocator after the warm-up.
+  */
+
+// One read/update/write cycle of yumi_hw_ifce_node, with the phases checked
+class CheckedCycle
+{
+public:
+  CheckedCycle(YumiHW *robot, controller_manager::ControllerManager *manager, YumiAllocCheck *alloc_check) :
+    robot_(robot), manager_(manager), alloc_check_(alloc_check) {}
+
+  void update(const ros::Time &now, const ros::Duration &period)
+  {
+    alloc_check_->beginCycle();
+    robot_->read(now, period);
+    alloc_check_->endPhase(YumiAllocCheck::READ);
+    manager_->update(now, period);
+    alloc_check_->endPhase(YumiAllocCheck::UPDATE);
+    robot_->write(now, period);
+    alloc_check_->endPhase(YumiAllocCheck::WRITE);
+  }
+
+private:
+  YumiHW *robot_;
+  controller_manager::ControllerManager *manager_;
+  YumiAllocCheck *alloc_check_;
+};
+
+// an allocation the compiler can not leave out
+static void *(*volatile test_malloc)(size_t) = malloc;
+
+TEST(YumiAllocCheck, CountsAllocationsOfArmedCycles)
+{
+  YumiAllocCheck check;
+  check.setup(2);
+  check.beginCycle();
+  free(test_malloc(16));
+  check.endPhase(YumiAllocCheck::UPDATE);
+  EXPECT_FALSE(check.failed());
+
+  check.beginCycle();
+  check.endPhase(YumiAllocCheck::READ);
+  free(test_malloc(16));
+  check.endPhase(YumiAllocCheck::UPDATE);
+  yumiAllocCheckArm(false);
+
+  ASSERT_TRUE(check.failed());
+  EXPECT_EQ(1u, check.failedCycle());
+  EXPECT_STREQ("update", check.failedPhase());
+  EXPECT_EQ(2u, check.failedCount());
+}
+
+TEST(YumiAllocCheck, ControlCycleDoesNotAllocate)
+{
+  ros::NodeHandle nh("~");
+  std::string urdf_string;
+  std::vector<std::string> controllers;
+  int port, warmup;
+  double control_period, duration;
+  ASSERT_TRUE(nh.getParam("/robot_description", urdf_string));
+  nh.getParam("controllers", controllers);
+  nh.param("port", port, 16002);
+  nh.param("control_period", control_period, 0.002);
+  nh.param("warmup", warmup, 500);
+  nh.param("duration", duration, 3.0);
+
+  YumiMockControllerConfig config;
+  config.state_port = port;
+  config.gripper_state_port = -1;
+  config.gripper_command_port = -1;
+  config.cycle_time = control_period;
+  YumiMockController mock;
+  ASSERT_TRUE(mock.init(config));
+  mock.start();
+
+  YumiAllocCheck alloc_check;
+  alloc_check.setup(warmup);
+  {
+    YumiHWRapid robot;
+    robot.create("yumi", urdf_string);
+    robot.setup("127.0.0.1", port);
+    ASSERT_TRUE(robot.init());
+
+    controller_manager::ControllerManager manager(&robot, ros::NodeHandle("~/manager"));
+    for(size_t i=0; i<controllers.size(); i++)
+    {
+      ASSERT_TRUE(manager.loadController(controllers[i])) << controllers[i];
+    }
+
+    CheckedCycle cycle(&robot, &manager, &alloc_check);
+    YumiRealtimeLoop loop;
+    loop.setup(boost::bind(&CheckedCycle::update, &cycle, _1, _2), control_period);
+    ASSERT_TRUE(loop.start());
+    // the switch is done by the running loop, within the warm-up
+    EXPECT_TRUE(manager.switchController(controllers, std::vector<std::string>(),
+      controller_manager_msgs::SwitchController::Request::STRICT));
+    usleep((useconds_t)(duration*1e6));
+    loop.stop();
+  }
+  mock.stop();
+
+  EXPECT_GT(alloc_check.checkedCycles(), 0u);
+  EXPECT_FALSE(alloc_check.failed()) << "control cycle " << alloc_check.failedCycle() << " after the warm-up made "
+    << alloc_check.failedCount() << " heap allocator calls in " << alloc_check.failedPhase() << "()";
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "yumi_alloc_check_test");
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+  int result = RUN_ALL_TESTS();
+  spinner.stop();
+  return result;
+}
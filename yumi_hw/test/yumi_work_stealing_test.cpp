@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+#include <gtest/gtest.h>
+
+#include "yumi_hw/yumi_work_stealing.h"
+
+/**
+  * YumiWorkStealingPool has to run every item of every run exactly once, also when runs
+  * follow each other while workers are still stealing from the last one.
+  */
+
+class ItemCounter
+{
+public:
+  explicit ItemCounter(int items) : counts_(new boost::atomic<int>[items]), items_(items)
+  {
+    clear();
+  }
+
+  void count(int begin, int end)
+  {
+    for(int i=begin; i<end; i++) counts_[i]++;
+  }
+
+  // items not run exactly once, the counts start over
+  int wrong(int items)
+  {
+    int wrong = 0;
+    for(int i=0; i<items; i++)
+    {
+      if(counts_[i] != 1) wrong++;
+    }
+    clear();
+    return wrong;
+  }
+
+private:
+  void clear()
+  {
+    for(int i=0; i<items_; i++) counts_[i] = 0;
+  }
+
+  boost::scoped_array<boost::atomic<int> > counts_;
+  int items_;
+};
+
+// A run that lost blocks never returns, the watchdog fails the test instead of letting it hang
+class Watchdog
+{
+public:
+  explicit Watchdog(double timeout) : runs_(0), done_(false),
+    thread_(boost::bind(&Watchdog::watch, this, timeout)) {}
+
+  ~Watchdog()
+  {
+    done_ = true;
+    thread_.join();
+  }
+
+  void ran() { runs_++; }
+
+private:
+  void watch(double timeout)
+  {
+    unsigned long last = runs_;
+    boost::posix_time::time_duration period = boost::posix_time::milliseconds(100);
+    for(double quiet = 0.0; !done_; quiet += 0.1)
+    {
+      boost::this_thread::sleep(period);
+      if(runs_ != last)
+      {
+        last = runs_;
+        quiet = 0.0;
+      }
+      else if(quiet > timeout)
+      {
+        fprintf(stderr, "Run %lu did not finish within %g s, blocks were lost\n", last, timeout);
+        abort();
+      }
+    }
+  }
+
+  boost::atomic<unsigned long> runs_;
+  boost::atomic<bool> done_;
+  boost::thread thread_;
+};
+
+static void testBackToBack(int threads, int runs, int max_items, int grain)
+{
+  YumiWorkStealingPool pool;
+  pool.setup(threads);
+  ItemCounter counter(max_items);
+  YumiWorkStealingPool::Task task = boost::bind(&ItemCounter::count, &counter, _1, _2);
+  Watchdog watchdog(10.0);
+  unsigned int state = 1;
+  for(int r=0; r<runs; r++)
+  {
+    int items = 1 + rand_r(&state) % max_items;
+    pool.run(items, grain, task);
+    watchdog.ran();
+    ASSERT_EQ(0, counter.wrong(items)) << "run " << r << " of " << items << " items";
+  }
+}
+
+TEST(YumiWorkStealingPool, RunsEveryItemOnce)
+{
+  testBackToBack(4, 2000, 4096, 16);
+}
+
+TEST(YumiWorkStealingPool, RunsEveryItemOnceBackToBack)
+{
+  // single item blocks and short runs keep the workers stealing when the next run starts
+  testBackToBack(8, 50000, 64, 1);
+}
+
+TEST(YumiWorkStealingPool, RunsOnTheCallingThreadAlone)
+{
+  testBackToBack(1, 100, 1000, 7);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}